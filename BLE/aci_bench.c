@@ -0,0 +1,142 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+
+#include "aci_bench.h"
+#include "aci_cmds.h"
+#include "aci_evts.h"
+#include "hal_aci_tl.h"
+#include "lib_aci.h"
+
+/* Longest wait for an event, 250 ms in Timer 1 ticks */
+#define M_TIMEOUT_TICKS   ((uint16_t) (F_CPU / 1024 / 4))
+
+static void (*m_poll) (void);
+
+/* Wait for an event with opcode, dropping any other. False on timeout. */
+static bool m_event_wait (uint8_t opcode, hal_aci_data_t *p_event)
+{
+  const uint16_t start = TCNT1;
+
+  while ((uint16_t) (TCNT1 - start) < M_TIMEOUT_TICKS)
+  {
+    if (m_poll)
+    {
+      m_poll ();
+    }
+
+    if (hal_aci_tl_event_get (p_event) && p_event->buffer[1] == opcode)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/* Send a Test command and wait for the nRF8001 to start in mode */
+static bool m_test_mode (uint8_t test_mode, uint8_t device_mode)
+{
+  hal_aci_data_t msg = {.buffer = {2, ACI_CMD_TEST, test_mode}};
+
+  return hal_aci_tl_send (&msg) &&
+    m_event_wait (ACI_EVT_DEVICE_STARTED, &msg) &&
+    msg.buffer[2] == device_mode;
+}
+
+/* Send count echoes of len bytes at the current SPI clock */
+static void m_echoes (uint8_t len, uint8_t count, aci_bench_result_t *p_result)
+{
+  hal_aci_data_t cmd = {.buffer = {len + 1, ACI_CMD_ECHO}};
+  hal_aci_data_t evt;
+  const uint16_t start = TCNT1;
+  uint8_t i;
+  uint8_t j;
+
+  p_result->echoes = 0;
+
+  for (i = 0; i < count; i++)
+  {
+    /* Different data every time, a late echo does not pass for this one */
+    for (j = 0; j < len; j++)
+    {
+      cmd.buffer[2 + j] = i + j;
+    }
+
+    if (!hal_aci_tl_send (&cmd) || !m_event_wait (ACI_EVT_ECHO, &evt))
+    {
+      break;
+    }
+
+    if (evt.buffer[0] == len + 1 && !memcmp (&evt.buffer[2], &cmd.buffer[2], len))
+    {
+      p_result->echoes++;
+    }
+  }
+
+  p_result->ticks = TCNT1 - start;
+}
+
+uint8_t aci_bench_run (uint8_t len, uint8_t count,
+    aci_bench_result_t *p_results, void (*poll) (void))
+{
+  const uint8_t divider_saved = hal_aci_tl_spi_clock_get ();
+  hal_aci_data_t rsp;
+  uint8_t results = 0;
+  uint8_t divider;
+
+  m_poll = poll;
+
+  if (len > ACI_ECHO_DATA_MAX_LEN)
+  {
+    len = ACI_ECHO_DATA_MAX_LEN;
+  }
+
+  /* Test mode is entered from Standby, which a radio reset leads to */
+  if (!lib_aci_radio_reset () || !m_event_wait (ACI_EVT_CMD_RSP, &rsp) ||
+      !m_test_mode (ACI_TEST_MODE_DTM_ACI, ACI_DEVICE_TEST))
+  {
+    return 0;
+  }
+
+  for (divider = 2; divider; divider <<= 1)
+  {
+    if (F_CPU / divider > ACI_BENCH_SCK_MAX)
+    {
+      continue;
+    }
+
+    wdt_reset ();
+    hal_aci_tl_spi_clock_set (divider);
+    p_results[results].divider = divider;
+    m_echoes (len, count, &p_results[results]);
+    results++;
+  }
+
+  hal_aci_tl_spi_clock_set (divider_saved);
+  m_test_mode (ACI_TEST_MODE_EXIT, ACI_DEVICE_STANDBY);
+
+  return results;
+}
@@ -0,0 +1,66 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+/** @file
+ * @brief Benchmark of the ACI transport, with the echo of the nRF8001.
+ */
+
+#ifndef ACI_BENCH_H__
+#define ACI_BENCH_H__
+
+#include <stdint.h>
+
+#include "aci.h"
+
+/** Most SPI clocks measured, one per divider of hal_aci_tl_spi_clock_set() */
+#define ACI_BENCH_CLOCKS    7
+
+/** Fastest SCK the nRF8001 takes, in Hz */
+#define ACI_BENCH_SCK_MAX   3000000UL
+
+/** Measurement at one SPI clock */
+typedef struct {
+  uint8_t  divider;   /**< SCK is F_CPU / divider */
+  uint8_t  echoes;    /**< Echoes that came back intact */
+  uint16_t ticks;     /**< Time of all echoes, in Timer 1 ticks of 1024 CPU cycles */
+} _aci_packed_ aci_bench_result_t;
+
+/** @brief Measure the ACI transport at each SPI clock.
+ *  @details
+ *  Takes the nRF8001 from whatever it is doing into ACI Test mode, where it
+ *  answers Echo commands. At every SPI clock the nRF8001 takes, fastest
+ *  first, count Echo commands carrying len bytes are sent back to back
+ *  through hal_aci_tl_send() and hal_aci_tl_event_get(), each once the echo
+ *  of the previous one has come back. The nRF8001 is left in Standby, with
+ *  no link, and the SPI clock as it was.
+ *
+ *  Timer 1 must be running at F_CPU / 1024, as main() sets it.
+ *  @param len Bytes of data per echo, at most ACI_ECHO_DATA_MAX_LEN.
+ *  @param count Echoes per SPI clock.
+ *  @param p_results Room for ACI_BENCH_CLOCKS results.
+ *  @param poll Called while waiting for the nRF8001, or NULL.
+ *  @return The number of results, 0 if the nRF8001 did not enter Test mode.
+ */
+uint8_t aci_bench_run (uint8_t len, uint8_t count,
+    aci_bench_result_t *p_results, void (*poll) (void));
+
+#endif /* ACI_BENCH_H__ */
@@ -29,28 +29,29 @@
 #include "hal_aci_tl.h"
 #include "aci_queue.h"
 
-void aci_queue_init(aci_queue_t *aci_q)
+void aci_queue_init(aci_queue_t *aci_q, hal_aci_data_t *p_data, uint8_t mask)
 {
   uint8_t i;
 
+  aci_q->aci_data = p_data;
   aci_q->head = 0;
   aci_q->tail = 0;
 
-  for(i=0; i<ACI_QUEUE_SIZE; i++)
+  for(i=0; i<=mask; i++)
   {
     aci_q->aci_data[i].buffer[0] = 0x00;
     aci_q->aci_data[i].buffer[1] = 0x00;
   }
 }
 
-bool aci_queue_dequeue(aci_queue_t *aci_q, hal_aci_data_t *p_data)
+bool aci_queue_dequeue(aci_queue_t *aci_q, hal_aci_data_t *p_data, uint8_t mask)
 {
   if (aci_queue_is_empty(aci_q))
   {
     return false;
   }
 
-  const uint8_t index = aci_q->head & (ACI_QUEUE_SIZE - 1);
+  const uint8_t index = aci_q->head & mask;
 
   memcpy((uint8_t *)p_data,
       (uint8_t *)&(aci_q->aci_data[index]),
@@ -60,12 +61,12 @@ bool aci_queue_dequeue(aci_queue_t *aci_q, hal_aci_data_t *p_data)
   return true;
 }
 
-bool aci_queue_enqueue(aci_queue_t *aci_q, hal_aci_data_t *p_data)
+bool aci_queue_enqueue(aci_queue_t *aci_q, hal_aci_data_t *p_data, uint8_t mask)
 {
   const uint8_t length = p_data->buffer[0];
-  const uint8_t index = aci_q->tail & (ACI_QUEUE_SIZE - 1);
+  const uint8_t index = aci_q->tail & mask;
 
-  if (aci_queue_is_full(aci_q))
+  if (aci_queue_is_full(aci_q, mask))
   {
     return false;
   }
@@ -84,7 +85,8 @@ bool aci_queue_is_empty(aci_queue_t *aci_q)
   return (aci_q->head == aci_q->tail);
 }
 
-bool aci_queue_is_full(aci_queue_t *aci_q)
+bool aci_queue_is_full(aci_queue_t *aci_q, uint8_t mask)
 {
-  return (aci_q->tail == aci_q->head + ACI_QUEUE_SIZE);
+  /* The difference wraps with the 8-bit counters, the sum would not */
+  return ((uint8_t) (aci_q->tail - aci_q->head) > mask);
 }
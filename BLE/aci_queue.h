@@ -36,30 +36,73 @@
 #include "hal_aci_tl.h"
 
 /***********************************************************************    */
-/* The ACI_QUEUE_SIZE determines the memory usage of the system.            */
-/* Successfully tested to a ACI_QUEUE_SIZE of 4 (interrupt) and 4 (polling) */
+/* The queue sizes determine the memory usage of the system, each slot     */
+/* takes sizeof(hal_aci_data_t) bytes of RAM. They must be powers of two.  */
+/* Successfully tested to a queue size of 4 (interrupt) and 4 (polling).   */
+/* ACI_QUEUE_SIZE, if defined, sets both.                                  */
 /***********************************************************************    */
-#define ACI_QUEUE_SIZE  2
+#ifdef ACI_QUEUE_SIZE
+#ifndef ACI_TX_QUEUE_SIZE
+#define ACI_TX_QUEUE_SIZE  ACI_QUEUE_SIZE
+#endif
+#ifndef ACI_RX_QUEUE_SIZE
+#define ACI_RX_QUEUE_SIZE  ACI_QUEUE_SIZE
+#endif
+#endif
+
+/* Commands to the nRF8001 */
+#ifndef ACI_TX_QUEUE_SIZE
+#define ACI_TX_QUEUE_SIZE  2
+#endif
+
+/* Events from the nRF8001 */
+#ifndef ACI_RX_QUEUE_SIZE
+#define ACI_RX_QUEUE_SIZE  2
+#endif
+
+/* Indices are masked with size - 1, and head and tail are 8 bits wide */
+#define ACI_QUEUE_SIZE_VALID(n) ((n) > 0 && (n) <= 128 && ((n) & ((n) - 1)) == 0)
+
+#if !ACI_QUEUE_SIZE_VALID(ACI_TX_QUEUE_SIZE)
+#error ACI_TX_QUEUE_SIZE must be a power of two up to 128
+#endif
+#if !ACI_QUEUE_SIZE_VALID(ACI_RX_QUEUE_SIZE)
+#error ACI_RX_QUEUE_SIZE must be a power of two up to 128
+#endif
+
+/* The mask of each queue, passed as a constant to the functions below */
+#define ACI_TX_QUEUE_MASK  (ACI_TX_QUEUE_SIZE - 1)
+#define ACI_RX_QUEUE_MASK  (ACI_RX_QUEUE_SIZE - 1)
 
 /** Data type for queue of data packets to send/receive from radio.
  *
  *  A FIFO queue is maintained for packets. New packets are added (enqueued)
  *  at the tail and taken (dequeued) from the head. The head variable is the
  *  index of the next packet to dequeue while the tail variable is the index of
- *  where the next packet should be queued.
+ *  where the next packet should be queued. The slots are provided by the
+ *  owner of the queue, see aci_queue_init(). The queue does not keep its
+ *  size: the owner passes the mask, the number of slots less one, to every
+ *  call that needs it, as ACI_TX_QUEUE_MASK or ACI_RX_QUEUE_MASK.
  */
 
 typedef struct {
-	hal_aci_data_t           aci_data[ACI_QUEUE_SIZE];
+	hal_aci_data_t          *aci_data;
 	uint8_t                  head;
 	uint8_t                  tail;
 } aci_queue_t;
 
-void aci_queue_init(aci_queue_t *aci_q);
-bool aci_queue_dequeue(aci_queue_t *aci_q, hal_aci_data_t *p_data);
-bool aci_queue_enqueue(aci_queue_t *aci_q, hal_aci_data_t *p_data);
+/** @brief Initialize an empty queue.
+ *  @param aci_q The queue.
+ *  @param p_data Storage for the queue, mask + 1 slots.
+ *  @param mask Number of slots less one, the slots a power of two up to 128.
+ */
+void aci_queue_init(aci_queue_t *aci_q, hal_aci_data_t *p_data, uint8_t mask);
+bool aci_queue_dequeue(aci_queue_t *aci_q, hal_aci_data_t *p_data,
+    uint8_t mask);
+bool aci_queue_enqueue(aci_queue_t *aci_q, hal_aci_data_t *p_data,
+    uint8_t mask);
 bool aci_queue_is_empty(aci_queue_t *aci_q);
-bool aci_queue_is_full(aci_queue_t *aci_q);
+bool aci_queue_is_full(aci_queue_t *aci_q, uint8_t mask);
 
 #endif /* ACI_QUEUE_H__ */
 /** @} */
@@ -0,0 +1,311 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+@brief BLE link handling of the bootloader
+*/
+
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include <util/delay.h>
+
+#include "aci_bench.h"
+#include "ble.h"
+#include "bonding.h"
+#include "lib_aci.h"
+#include "aci_evts.h"
+#include "dfu.h"
+#include "hal_aci_tl.h"
+#include "../boot.h"
+#include "../history.h"
+#include "../watchdog.h"
+
+static aci_state_t  m_aci_state;
+static bool         m_enabled;
+static uint8_t      m_dfu_mode;
+static uint8_t      m_pipes[3];
+static uint16_t     m_conn_timeout;
+static uint16_t     m_conn_interval;
+
+static bool m_dfu_send (const uint8_t *p_data, uint8_t len);
+static void m_dfu_close (void);
+static void m_dfu_reset (void);
+
+static const dfu_transport_t m_dfu_transport = {
+  m_dfu_send, m_dfu_close, m_dfu_reset, NULL
+};
+
+/* Notify on the DFU Control Point */
+static bool m_dfu_send (const uint8_t *p_data, uint8_t len)
+{
+  bool status;
+
+  /* Put the notification message in the queue */
+  status = lib_aci_send_data(m_pipes[1], (uint8_t *) p_data, len);
+
+  /* Decrement our credit if we successfully transmitted */
+  if (status)
+  {
+    m_aci_state.data_credit_available--;
+  }
+
+  return status;
+}
+
+/* Disconnect, and wait until the nRF8001 reports it */
+static void m_dfu_close (void)
+{
+  hal_aci_evt_t aci_data;
+
+  lib_aci_disconnect(&m_aci_state, ACI_REASON_TERMINATE);
+
+  while (!lib_aci_event_get(&m_aci_state, &aci_data) ||
+         aci_data.evt.evt_opcode != ACI_EVT_DISCONNECTED);
+}
+
+/* Advertise for a connection. With BLE_STATUS_PIPE the status is put in
+ * the advertising data first, and ble_update() sends OpenAdvPipe and then
+ * Connect on the response to each command before it.
+ */
+static void m_advertise (void)
+{
+#ifdef BLE_STATUS_PIPE
+  ble_status_t status;
+
+  ble_status_get (&status);
+  if (lib_aci_set_local_data (BLE_STATUS_PIPE, (const uint8_t *) &status,
+        sizeof (status)))
+  {
+    return;
+  }
+#endif
+
+  lib_aci_connect (m_conn_timeout, m_conn_interval);
+}
+
+/* Reset the radio, ble_update() connects again once that is done */
+static void m_dfu_reset (void)
+{
+  while (!lib_aci_radio_reset());
+}
+
+void ble_init (bootloader_config_t *p_config)
+{
+  m_aci_state.aci_pins = p_config->aci_pins;
+
+  m_aci_state.data_credit_total = p_config->credit;
+  m_aci_state.data_credit_available = m_aci_state.data_credit_total;
+
+  m_conn_timeout = p_config->conn_timeout;
+  m_conn_interval = p_config->conn_interval;
+
+  m_pipes[0] = p_config->pipes[0];
+  m_pipes[1] = p_config->pipes[1];
+  m_pipes[2] = p_config->pipes[2];
+
+  lib_aci_init (&m_aci_state);
+
+  dfu_init (&m_dfu_transport);
+
+  m_enabled = true;
+}
+
+bool ble_spi_ready (void)
+{
+  return m_enabled && hal_aci_tl_transfer_ready ();
+}
+
+void ble_spi_service (void)
+{
+  hal_aci_tl_transfer ();
+}
+
+bool ble_event_ready (void)
+{
+  return m_enabled && hal_aci_tl_event_available ();
+}
+
+#ifdef ACI_BENCH
+uint8_t ble_spi_bench (uint8_t len, uint8_t count,
+    aci_bench_result_t *p_results, void (*poll) (void))
+{
+  if (!m_enabled || m_dfu_mode)
+  {
+    return 0;
+  }
+
+  return aci_bench_run (len, count, p_results, poll);
+}
+#endif
+
+/* Get and process an event from the BLE link. If we detect an event
+ * indicating that we are about to receive a new firmware image on BLE we set
+ * "m_dfu_mode" to a true value.
+ */
+bool ble_update (void)
+{
+  hal_aci_evt_t aci_data;
+  aci_evt_t *aci_evt;
+  uint8_t pipe;
+  uint8_t eeprom_status = 0xFF;
+
+  const uint8_t *bond_status_addr     = (uint8_t *) (0);
+
+  /* Attempt to grab an event from the BLE message queue. Events that only
+   * update the ACI state leave nothing to do here.
+   */
+  if (!lib_aci_event_get(&m_aci_state, &aci_data)) {
+    return m_dfu_mode;
+  }
+
+  aci_evt = &(aci_data.evt);
+
+  /* Any event shows the link is alive, however slow the central is */
+  if (m_dfu_mode) {
+    wdt_reset();
+  }
+
+  switch(aci_evt->evt_opcode) {
+    case ACI_EVT_DEVICE_STARTED:
+      m_aci_state.data_credit_total =
+        aci_evt->params.device_started.credit_available;
+      if (aci_evt->params.device_started.device_mode == ACI_DEVICE_STANDBY) {
+        if (aci_evt->params.device_started.hw_error) {
+            /* Magic number used to make sure the HW error event
+             * is handled correctly. */
+            _delay_ms (20);
+        }
+        else
+        {
+          /* Check to see if we should read bond data from EEPROM */
+          eeprom_read_block ((void *) &eeprom_status, bond_status_addr, 1);
+
+          if (eeprom_status != 0xFF)
+          {
+            watchdog_phase_set (WATCHDOG_PHASE_BOND);
+            bond_data_restore (&m_aci_state, eeprom_status);
+            watchdog_phase_set (WATCHDOG_PHASE_IDLE);
+          }
+
+          m_advertise ();
+        }
+      }
+      break; /* ACI_EVT_DEVICE_STARTED */
+
+    case ACI_EVT_CMD_RSP:
+      if ((aci_evt->params.cmd_rsp.cmd_opcode == ACI_CMD_RADIO_RESET) &&
+          (aci_evt->params.cmd_rsp.cmd_status == ACI_STATUS_SUCCESS))
+      {
+        m_advertise ();
+      }
+#ifdef BLE_STATUS_PIPE
+      /* A pipe the setup has no broadcast for is refused, and the device
+       * advertises without the status
+       */
+      else if ((aci_evt->params.cmd_rsp.cmd_opcode == ACI_CMD_SET_LOCAL_DATA) &&
+          (aci_evt->params.cmd_rsp.cmd_status == ACI_STATUS_SUCCESS))
+      {
+        lib_aci_open_adv_pipe (BLE_STATUS_PIPE);
+      }
+      else if ((aci_evt->params.cmd_rsp.cmd_opcode == ACI_CMD_SET_LOCAL_DATA) ||
+          (aci_evt->params.cmd_rsp.cmd_opcode == ACI_CMD_OPEN_ADV_PIPE))
+      {
+        lib_aci_connect (m_conn_timeout, m_conn_interval);
+      }
+#endif
+      break; /* ACI_EVT_CMD_RSP */
+
+    case ACI_EVT_CONNECTED:
+      wdt_reset();
+      /* We should have checked that this is true before we jumped into
+       * the bootloader. Hopefully we did.
+       */
+      m_aci_state.data_credit_available = m_aci_state.data_credit_total;
+      break; /* ACI_EVT_CONNECTED */
+
+    case ACI_EVT_DISCONNECTED:
+      m_advertise ();
+      break; /* ACI_EVT_DISCONNECTED */
+
+    case ACI_EVT_PIPE_ERROR:
+      wdt_reset();
+      /* If we received a pipe error, some message got borked.
+       * All we can do is update our credit to reflect it
+       */
+      if (aci_evt->params.pipe_error.error_code !=
+          ACI_STATUS_ERROR_PEER_ATT_ERROR) {
+        m_aci_state.data_credit_available++;
+      }
+      break; /* ACI_EVT_PIPE_ERROR */
+
+    case ACI_EVT_DATA_RECEIVED:
+      wdt_reset();
+      /* If data received is on either of the DFU pipes, we enter DFU mode.
+       * We then update the DFU state machine to run the transfer.
+       */
+      pipe = aci_evt->params.data_received.rx_data.pipe_number;
+      if (pipe == m_pipes[0] || pipe == m_pipes[2]) {
+        if (!m_dfu_mode) {
+          const uint8_t byte_idx = m_pipes[1] / 8;
+          const uint8_t byte_mask = (1 << (m_pipes[1] % 8));
+
+          m_dfu_mode = 1;
+          watchdog_phase_set (WATCHDOG_PHASE_DFU);
+
+          /* There are two paths into the bootloader. We either got here
+           * because there is no application, or we jumped from application.
+           * In the latter case, as we haven't received an event from the
+           * nRF8001 with the pipe statuses, we have to assume that the
+           * Control Point TX pipe is open. At this point, that is safe.
+           */
+          m_aci_state.pipes_open_bitmap[byte_idx] |= byte_mask;
+          m_aci_state.pipes_closed_bitmap[byte_idx] &= ~byte_mask;
+        }
+
+        dfu_update(pipe == m_pipes[0] ? DFU_CHANNEL_PACKET : DFU_CHANNEL_CONTROL,
+            aci_evt->params.data_received.rx_data.aci_data, aci_evt->len - 2);
+      }
+      break; /* ACI_EVT_DATA_RECEIVED */
+
+    default:
+      break;
+  }
+
+  return m_dfu_mode;
+}
+
+#ifdef BLE_STATUS_PIPE
+void ble_status_get (ble_status_t *p_status)
+{
+  history_record_t record = {0};
+
+#ifdef HISTORY
+  history_read (&record);
+#endif
+
+  p_status->status_version = BLE_STATUS_VERSION;
+  p_status->version = boot_flash_read (FLASHEND - 1) |
+    (boot_flash_read (FLASHEND) << 8);
+  p_status->app_valid = jump_app_valid ();
+  p_status->result = record.result;
+  p_status->image_size = record.image_size;
+}
+#endif
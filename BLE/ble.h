@@ -0,0 +1,98 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief BLE link handling of the bootloader.
+ */
+
+#ifndef BLE_H__
+#define BLE_H__
+
+#include <stdbool.h>
+
+#include "aci_bench.h"
+#include "bootloader_config.h"
+
+/** Layout version of ble_status_t */
+#define BLE_STATUS_VERSION 1
+
+/** Status of the bootloader, in the advertising data while it waits for a
+ *  connection. Built with BLE_STATUS_PIPE set to a broadcast pipe of the
+ *  nRF8001 setup, the value of the pipe is kept at this record, and the
+ *  pipe is opened for advertising before every Connect. A scanner can then
+ *  tell the units in the bootloader, and how their last DFU ended, without
+ *  connecting.
+ */
+typedef struct {
+  uint8_t  status_version;  /**< BLE_STATUS_VERSION */
+  uint16_t version;         /**< Optiboot version, major in the high byte */
+  uint8_t  app_valid;       /**< The application may be started */
+  uint8_t  result;          /**< HISTORY_RESULT_* of the last DFU */
+  uint32_t image_size;      /**< Image size of the last DFU */
+} _aci_packed_ ble_status_t;
+
+ACI_ASSERT_SIZE(ble_status_t, 9);
+
+/** @brief Set up the ACI transport and the DFU state machine.
+ *  @param p_config Valid configuration read from EEPROM.
+ */
+void ble_init(bootloader_config_t *p_config);
+
+/** @brief Check whether the nRF8001 is ready for an SPI transfer.
+ *  @return True if RDYN is low and the event can be stored. Always false
+ *  before ble_init().
+ */
+bool ble_spi_ready(void);
+
+/** @brief Run the SPI transfer the nRF8001 is ready for. */
+void ble_spi_service(void);
+
+/** @brief Check whether a received event waits for ble_update().
+ *  @return Always false before ble_init().
+ */
+bool ble_event_ready(void);
+
+/** @brief Get and process one event from the BLE link.
+ *  @details
+ *  Brings the nRF8001 up, keeps it advertising and hands data received on
+ *  the DFU pipes to the DFU state machine. The flash work of the DFU is
+ *  left to dfu_background(), to be run when there is no event.
+ *  @return True once a DFU transfer has started on BLE. From then on the
+ *  BLE link is used for the lifetime of the program.
+ */
+bool ble_update(void);
+
+/** @brief Get the status the bootloader advertises, with BLE_STATUS_PIPE.
+ *  @param p_status Where to put the status.
+ */
+void ble_status_get(ble_status_t *p_status);
+
+/** @brief Benchmark the SPI transport to the nRF8001, see aci_bench_run().
+ *  @details
+ *  For a DFU on another transport: the BLE link is dropped for the
+ *  benchmark and not brought up again. Built with ACI_BENCH only.
+ *  @return The number of results, 0 before ble_init(), once a DFU has
+ *  started on BLE, or if the benchmark failed.
+ */
+uint8_t ble_spi_bench(uint8_t len, uint8_t count,
+    aci_bench_result_t *p_results, void (*poll)(void));
+
+#endif /* BLE_H__ */
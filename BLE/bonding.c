@@ -1,6 +1,7 @@
 #include "bonding.h"
 
 #include <avr/eeprom.h>
+#include <avr/wdt.h>
 #include <util/delay.h>
 
 /*
@@ -25,11 +26,11 @@ aci_status_code_t bond_data_restore(aci_state_t *aci_stat, uint8_t eeprom_status
   /* Read from the EEPROM */
   while(1)
   {
-    len = eeprom_read_byte ((uint8_t *) eeprom_read_addr);
+    len = eeprom_read_byte ((uint8_t *) (uintptr_t) eeprom_read_addr);
     eeprom_read_addr++;
     aci_cmd.buffer[0] = len;
 
-    eeprom_read_block ((void *) &aci_cmd.buffer[1], (uint8_t *) eeprom_read_addr, len);
+    eeprom_read_block ((void *) &aci_cmd.buffer[1], (uint8_t *) (uintptr_t) eeprom_read_addr, len);
     eeprom_read_addr += len;
 
     /* Send the ACI Write Dynamic Data */
@@ -47,6 +48,9 @@ aci_status_code_t bond_data_restore(aci_state_t *aci_stat, uint8_t eeprom_status
 
         if (aci_evt->evt_opcode == ACI_EVT_CMD_RSP)
         {
+          /* Each message gets the full timeout of the bond phase */
+          wdt_reset();
+
           /* ACI Evt Command Response */
           if (aci_evt->params.cmd_rsp.cmd_status == ACI_STATUS_TRANSACTION_COMPLETE)
           {
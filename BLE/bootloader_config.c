@@ -0,0 +1,50 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+@brief Reading and validation of the bootloader configuration
+*/
+
+#include <stddef.h>
+#include <avr/eeprom.h>
+
+#include "../jump.h"
+
+#include "bootloader_config.h"
+#include "crc16.h"
+
+#define CONFIG_CRC_START  offsetof(bootloader_config_t, version)
+#define CONFIG_CRC_END    offsetof(bootloader_config_t, crc)
+
+bool bootloader_config_read(bootloader_config_t *p_config)
+{
+  eeprom_read_block((void *) p_config,
+      (const void *) (uintptr_t) (E2END - BOOTLOADER_EEPROM_SIZE),
+      sizeof(bootloader_config_t));
+
+  if (p_config->version != BOOTLOADER_CONFIG_VERSION)
+  {
+    return false;
+  }
+
+  return p_config->crc == crc16_compute((uint8_t *) p_config + CONFIG_CRC_START,
+      CONFIG_CRC_END - CONFIG_CRC_START, NULL);
+}
@@ -0,0 +1,68 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief Bootloader configuration stored in EEPROM.
+ */
+
+#ifndef BOOTLOADER_CONFIG_H__
+#define BOOTLOADER_CONFIG_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aci.h"
+#include "hal_aci_tl.h"
+
+/** Layout version of bootloader_config_t. Version 1 was the unchecked
+ *  layout, with a "valid nRF8001 data" flag of 1 in place of the version.
+ */
+#define BOOTLOADER_CONFIG_VERSION 2
+
+/** Configuration block at the top of EEPROM (E2END - BOOTLOADER_EEPROM_SIZE).
+ *
+ *  The CRC covers version through conn_interval. unused was the application
+ *  valid flag, which now rotates over the cells below the block (see
+ *  jump.h), and is left out of it.
+ */
+typedef struct {
+  uint8_t    unused;
+  uint8_t    version;
+  aci_pins_t aci_pins;
+  uint8_t    credit;
+  uint8_t    pipes[3];
+  uint16_t   conn_timeout;
+  uint16_t   conn_interval;
+  uint16_t   crc;
+} _aci_packed_ bootloader_config_t;
+
+ACI_ASSERT_SIZE(bootloader_config_t, 24);
+
+/** @brief Read the configuration block from EEPROM.
+ *  @details
+ *  The block is read with a single EEPROM block read, and checked for the
+ *  current layout version and a matching CRC.
+ *  @param p_config Where to put the configuration.
+ *  @return True if the configuration is valid, false if it must not be used.
+ */
+bool bootloader_config_read(bootloader_config_t *p_config);
+
+#endif /* BOOTLOADER_CONFIG_H__ */
@@ -0,0 +1,43 @@
+/* Copyright (c) 2014, Nordic Semiconductor ASA
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/** @file
+ * @brief CRC-16-CCITT, as used by the Nordic DFU protocol.
+ */
+
+#ifndef CRC16_H__
+#define CRC16_H__
+
+#include <stdint.h>
+
+/** @brief Compute the CRC-16-CCITT of a block of data.
+ *  @details
+ *  The polynomial is 0x1021, and the computation starts at 0xFFFF. Data
+ *  that arrives in pieces is handled by passing the CRC of the previous
+ *  pieces in p_crc.
+ *  @param p_data Data to compute the CRC of.
+ *  @param size Number of bytes in p_data.
+ *  @param p_crc CRC to continue from, or NULL to start a new computation.
+ *  @return The updated CRC.
+ */
+uint16_t crc16_compute(const uint8_t *p_data, uint16_t size, const uint16_t *p_crc);
+
+#endif /* CRC16_H__ */
@@ -23,102 +23,296 @@
   @brief Implementation of the DFU procedure.
  */
 
+#include <stddef.h>
 #include <string.h>
+#include <avr/eeprom.h>
 #include <avr/io.h>
 #include <util/delay.h>
 
 #include "../boot.h"
+#include "../bootcopy.h"
+#include "../history.h"
+#include "../stack.h"
 #include "../jump.h"
+#include "../watchdog.h"
 
-#include "lib_aci.h"
+#include "crc16.h"
 #include "dfu.h"
 
 /*****************************************************************************
 * Local definitions
 *****************************************************************************/
 
-static void dfu_data_pkt_handle (aci_evt_t *aci_evt);
-static void dfu_init_pkt_handle (void);
-static void dfu_image_size_set (aci_evt_t *aci_evt);
+/* Written pages waiting to be read back, a power of two. When it is full,
+ * the oldest page is read back before the next one is written.
+ */
+#ifndef DFU_VERIFY_QUEUE_SIZE
+#define DFU_VERIFY_QUEUE_SIZE 4
+#endif
+
+/* A written page, and the CRC of what was loaded into it */
+typedef struct
+{
+  flash_addr_t address;
+  uint16_t     size;
+  uint16_t     crc;
+} dfu_verify_t;
+
+static void dfu_data_pkt_handle (const uint8_t *p_data, uint8_t len);
+static void dfu_init_pkt_handle (const uint8_t *p_data, uint8_t len);
+static void dfu_image_size_set (const uint8_t *p_data);
 static void dfu_image_validate (void);
+#ifdef HISTORY
+static void dfu_history_report (void);
+#endif
+#ifdef STACK_REPORT
+static void dfu_memory_report (void);
+#endif
 static void dfu_reset (void);
 
-static bool m_send (uint8_t *buff, uint8_t buff_len);
-static void m_write_page (uint16_t page, uint8_t *buff);
+static bool m_send (const uint8_t *buff, uint8_t buff_len);
+static void m_spm_wait (void);
+static void m_page_load (uint8_t data);
+static void m_page_commit (void);
+static void m_verify_page (void);
+static flash_addr_t m_image_room (void);
+static void m_image_start (void);
+static bool m_image_crc_check (void);
 
 /*****************************************************************************
 * Static Globals
 *****************************************************************************/
 
-static aci_state_t *m_aci_state;
+static const dfu_transport_t *m_transport;
 static uint8_t      m_dfu_state = ST_ANY;
 static uint32_t     m_image_size;
+static uint8_t      m_image_type;
+static uint16_t     m_init_crc;
+static bool         m_init_crc_set;
 static uint16_t     m_pkt_notif_target;
 static uint16_t     m_pkt_notif_target_cnt;
 static uint32_t     m_num_of_firmware_bytes_rcvd;
-static uint16_t     m_page_address;
-static uint8_t      m_page_buff[SPM_PAGESIZE];
-static uint8_t      m_page_buff_index;
-static uint8_t      m_pipe_array[3];
+static flash_addr_t m_page_address;
+static flash_addr_t m_erase_address;
+static flash_addr_t m_erase_end;
+static uint16_t     m_page_offset;
+static uint8_t      m_page_odd_byte;
+static uint16_t     m_page_crc;
+static dfu_verify_t m_verify_queue[DFU_VERIFY_QUEUE_SIZE];
+static uint8_t      m_verify_head;
+static uint8_t      m_verify_count;
+static bool         m_verify_failed;
 
 /*****************************************************************************
 * Static Functions
 *****************************************************************************/
 
-/* Transmit buffer_len number of bytes from buffer to the BLE controller */
-static bool m_send (uint8_t *buff, uint8_t buff_len)
+/* Transmit buffer_len number of bytes from buffer to the peer */
+static bool m_send (const uint8_t *buff, uint8_t buff_len)
 {
-  bool status;
+  return m_transport->send (buff, buff_len);
+}
 
-  /* Put the notification message in the queue */
-  status = lib_aci_send_data(m_pipe_array[1], buff, buff_len);
+/* Wait for the SPM unit, servicing the link meanwhile if it needs that.
+ * SPM instructions are ignored while the EEPROM is written, and the
+ * history returns with its last byte still being written, so that is
+ * waited for as well.
+ */
+static void m_spm_wait (void)
+{
+  while (boot_spm_busy () || !eeprom_is_ready ())
+  {
+    if (m_transport->poll)
+    {
+      m_transport->poll ();
+    }
+  }
+}
 
-  /* Decrement our credit if we successfully transmitted */
-  if (status)
+/* Load one byte of the image into the SPM temporary page buffer.
+ * The buffer is loaded a word at a time, so the low byte of a word is held
+ * back until its high byte arrives, possibly in the next packet. The page is
+ * committed to flash as soon as the buffer is full. The link is polled after
+ * every word, so a serial line does not overrun while a packet is loaded.
+ */
+static void m_page_load (uint8_t data)
+{
+  m_page_crc = crc16_compute (&data, 1, &m_page_crc);
+
+  if (m_page_offset & 1)
+  {
+    boot_page_fill (m_page_address + m_page_offset - 1,
+        m_page_odd_byte | (data << 8));
+
+    if (m_transport->poll)
+    {
+      m_transport->poll ();
+    }
+  }
+  else
   {
-    m_aci_state->data_credit_available--;
+    m_page_odd_byte = data;
   }
 
-  return status;
+  if (++m_page_offset == SPM_PAGESIZE)
+  {
+    m_page_commit ();
+  }
 }
 
-/* Write the contents of buf to the given flash page */
-static void m_write_page (uint16_t page_num, uint8_t *buff)
+/* Program the current flash page from the temporary page buffer, erasing
+ * it first unless dfu_background() already has. The temporary buffer is
+ * not affected by a page erase. On parts with more than 64 KB of flash,
+ * boot_page_erase/write load RAMPZ from bits 16-23 of the address, so the
+ * page lands above the 64 KB boundary instead of wrapping. The page is
+ * queued to be read back later, with the CRC of the bytes loaded into it.
+ */
+static void m_page_commit (void)
 {
-  uint16_t size = SPM_PAGESIZE / 2;
-  uint16_t addr = page_num;
+  dfu_verify_t *p_verify;
+
+  /* Flush a held back low byte, the high byte stays erased */
+  if (m_page_offset & 1)
+  {
+    boot_page_fill (m_page_address + m_page_offset - 1,
+        0xFF00 | m_page_odd_byte);
+  }
+
+  if (m_page_address >= m_erase_address)
+  {
+    boot_page_erase (m_page_address);
+    m_spm_wait ();
+    m_erase_address = m_page_address + SPM_PAGESIZE;
+  }
 
-  /* If the page is still erasing, we need to wait for it to complete */
-  boot_spm_busy_wait ();
+  /* Store buffer in flash page, then wait while the memory is written. The
+   * buffer is not touched again until the write has completed.
+   */
+  boot_page_write (m_page_address);
+  m_spm_wait ();
+
+  /* Make the RWW section readable for the read back. Enabling it aborts a
+   * load of the page buffer, so this is the time to do it, with the buffer
+   * just cleared by the write. It stays readable until the next erase,
+   * which dfu_background() starts only once every queued page is read.
+   */
+#if defined(RWWSRE)
+  boot_rww_enable ();
+#endif
 
-  /* Fill the page buffer */
-  do
+  if (m_verify_count == DFU_VERIFY_QUEUE_SIZE)
   {
-    /* Set up little-endian word. */
-    uint16_t a;
-    a = *buff++;
-    a += (*buff++) << 8;
-    __boot_page_fill_short (addr, a);
-    addr += 2;
-  } while (--size);
-
-  /* Store buffer in flash page, then wait while the memory is written */
-  __boot_page_write_short (page_num);
-  boot_spm_busy_wait();
+    m_verify_page ();
+  }
+
+  p_verify = &m_verify_queue[(m_verify_head + m_verify_count++) &
+    (DFU_VERIFY_QUEUE_SIZE - 1)];
+  p_verify->address = m_page_address;
+  p_verify->size = m_page_offset;
+  p_verify->crc = m_page_crc;
+
+  m_page_address += SPM_PAGESIZE;
+  m_page_offset = 0;
+  m_page_crc = 0xFFFF;
 }
 
-/* Receive a firmware packet, and write it to flash. Also sends receipt
- * notifications if needed
+/* Read back the oldest written page, and compare its CRC with the one
+ * recorded when it was loaded. The RWW section must be readable.
+ */
+static void m_verify_page (void)
+{
+  const dfu_verify_t *p_verify = &m_verify_queue[m_verify_head];
+  uint16_t crc = 0xFFFF;
+  uint16_t i;
+  uint8_t data;
+
+  for (i = 0; i < p_verify->size; i++)
+  {
+    data = boot_flash_read (p_verify->address + i);
+    crc = crc16_compute (&data, 1, &crc);
+  }
+
+  if (crc != p_verify->crc)
+  {
+    m_verify_failed = true;
+  }
+
+  m_verify_head = (m_verify_head + 1) & (DFU_VERIFY_QUEUE_SIZE - 1);
+  m_verify_count--;
+}
+
+/* Bytes of flash the image of the type given by 'Start DFU' may take: up to
+ * the boot section for an application, the whole boot section for a
+ * bootloader, which is staged from the start of flash
+ */
+static flash_addr_t m_image_room (void)
+{
+#ifdef SELF_UPDATE
+  if (m_image_type == DFU_IMAGE_BOOTLOADER)
+  {
+    return FLASHEND + 1UL - BOOT_SECTION_START;
+  }
+#endif
+  return BOOT_SECTION_START;
+}
+
+/* Give up the current application for the image. The pages the image will
+ * take can be erased from now on, so jumping to the application is
+ * disabled until the new image has been verified, and the attempt is
+ * recorded.
  */
-static void dfu_data_pkt_handle (aci_evt_t *aci_evt)
+static void m_image_start (void)
 {
-  const aci_evt_params_data_received_t *data_received =
-    (aci_evt_params_data_received_t *) &(aci_evt->params);
-  const uint8_t bytes_received = aci_evt->len-2;
+  jump_app_key_clear ();
+  history_dfu_start (m_image_size);
+
+  m_erase_address = 0;
+  m_erase_end = (m_image_size + SPM_PAGESIZE - 1) &
+    ~(flash_addr_t) (SPM_PAGESIZE - 1);
+}
+
+/* True if the image written to flash has the CRC of the init packet */
+static bool m_image_crc_check (void)
+{
+  uint16_t crc = 0xFFFF;
+  uint32_t i;
+  uint8_t data;
+
+  if (!m_init_crc_set)
+  {
+    return false;
+  }
+
+  for (i = 0; i < m_image_size; i++)
+  {
+    data = boot_flash_read (i);
+    crc = crc16_compute (&data, 1, &crc);
+  }
 
+  return crc == m_init_crc;
+}
+
+/* Receive a firmware packet, and write it to flash. Also sends receipt
+ * notifications if needed. A packet reaching past the image size is
+ * refused whole, before any of it is loaded: flash beyond the image, up to
+ * the bootloader, was not erased for it.
+ */
+static void dfu_data_pkt_handle (const uint8_t *p_data, uint8_t len)
+{
   static const uint8_t receive_app_success[] = {OP_CODE_RESPONSE,
      BLE_DFU_RECEIVE_APP_PROCEDURE,
      BLE_DFU_RESP_VAL_SUCCESS};
+  static const uint8_t receive_app_size[] = {OP_CODE_RESPONSE,
+     BLE_DFU_RECEIVE_APP_PROCEDURE,
+     BLE_DFU_RESP_VAL_DATA_SIZE};
+
+  if (m_num_of_firmware_bytes_rcvd + len > m_image_size)
+  {
+    history_dfu_end (HISTORY_RESULT_SIZE);
+    m_send (receive_app_size, 3);
+    m_dfu_state = ST_FW_INVALID;
+    return;
+  }
 
   /* If package notification is enabled, decrement the counter and issue a
    * notification if required
@@ -142,131 +336,279 @@ static void dfu_data_pkt_handle (aci_evt_t *aci_evt)
     }
   }
 
-  /* Write received data to page buffer.
-   * If the buffer is empty, we've received the first data in a new page,
-   * which should be erased while the buffer fills. When the buffer is full,
-   * we write it to flash.
+  /* Write received data straight into the SPM page buffer, which is
+   * committed to flash whenever it fills up. The buffer can not be loaded
+   * while a background erase is running.
    */
   uint8_t i;
-  for (i = 0; i < bytes_received; i++)
+  m_spm_wait ();
+  for (i = 0; i < len; i++)
   {
-    if (m_page_buff_index == 0)
-    {
-      __boot_page_erase_short (m_page_address);
-    }
-
-    m_page_buff[m_page_buff_index++] = data_received->rx_data.aci_data[i];
-
-    if (m_page_buff_index == SPM_PAGESIZE)
-    {
-      m_page_buff_index = 0;
-      m_write_page (m_page_address, m_page_buff);
-      m_page_address += SPM_PAGESIZE;
-    }
+    m_page_load (p_data[i]);
   }
 
   /* Check if we've received the entire firmware image */
-  m_num_of_firmware_bytes_rcvd += bytes_received;
+  m_num_of_firmware_bytes_rcvd += len;
   if (m_image_size == m_num_of_firmware_bytes_rcvd)
   {
-    /* Write final page to flash */
-    m_write_page (m_page_address++, m_page_buff);
+    /* Write final page to flash, unless the image ended on a page boundary
+     * and m_page_load() has already written it.
+     */
+    if (m_page_offset)
+    {
+      m_page_commit ();
+    }
 
     /* Send firmware received notification */
-    m_send ((uint8_t *) receive_app_success, 3);
+    m_send (receive_app_success, 3);
   }
 }
 
 /* Activate the received firmware image */
-static void dfu_image_activate (aci_evt_t *aci_evt)
+static void dfu_image_activate (void)
 {
-  hal_aci_evt_t aci_data;
+#ifdef SELF_UPDATE
+  /* The staged bootloader is copied over this one, which starts next. The
+   * application it displaced stays invalid.
+   */
+  if (m_image_type == DFU_IMAGE_BOOTLOADER)
+  {
+    watchdog_phase_set (WATCHDOG_PHASE_ACTIVATE);
+    m_transport->close ();
+    bootcopy_start (m_image_size);
+  }
+#endif
 
   jump_app_key_set ();
-  lib_aci_disconnect(m_aci_state, ACI_REASON_TERMINATE);
-
-  while(1) {
-    if (lib_aci_event_get(m_aci_state, &aci_data) &&
-       (aci_evt->evt_opcode == ACI_EVT_DISCONNECTED)) {
-      /* Set watchdog to shortest interval and spin until reset */
-      WDTCSR = _BV(WDCE) | _BV(WDE);
-      WDTCSR = _BV(WDE);
-      while(1);
-    }
-  }
+  watchdog_phase_set (WATCHDOG_PHASE_ACTIVATE);
+  m_transport->close ();
+
+  /* The link is down, start the application directly rather than through
+   * a watchdog reset and jump_check()
+   */
+  jump_app_start ();
 }
 
-/* Receive and store the firmware image size */
-static void dfu_image_size_set (aci_evt_t *aci_evt)
+/* Receive and store the firmware image size, from the field of the image
+ * type given by 'Start DFU'. Only an application, or with SELF_UPDATE a
+ * bootloader, that fits its room in flash is taken; otherwise the DFU does
+ * not start. Nothing is erased yet.
+ */
+static void dfu_image_size_set (const uint8_t *p_data)
 {
   static const uint8_t dfu_start_success[] = {OP_CODE_RESPONSE,
     BLE_DFU_START_PROCEDURE, BLE_DFU_RESP_VAL_SUCCESS};
+  static const uint8_t dfu_start_not_supported[] = {OP_CODE_RESPONSE,
+    BLE_DFU_START_PROCEDURE, BLE_DFU_RESP_VAL_NOT_SUPPORTED};
+  static const uint8_t dfu_start_size[] = {OP_CODE_RESPONSE,
+    BLE_DFU_START_PROCEDURE, BLE_DFU_RESP_VAL_DATA_SIZE};
+  uint8_t field;
 
-  const uint8_t pipe = m_pipe_array[1];
-  const uint8_t byte_idx = pipe / 8;
-  const uint8_t byte_mask = (1 << (pipe % 8));
-
-  /* There are two paths into the bootloader. We either got here because
-   * there is no application, or we jumped from application.
-   * In the latter case, as we haven't received an event from the nRF8001
-   * with the pipe statuses, we have to assume that the Control Point
-   * TX pipe is open. At this point, that is safe.
-   */
-  m_aci_state->pipes_open_bitmap[byte_idx] |= byte_mask;
-  m_aci_state->pipes_closed_bitmap[byte_idx] &= ~byte_mask;
+  switch (m_image_type)
+  {
+    case DFU_IMAGE_APPLICATION:
+      field = 8;
+      break;
+#ifdef SELF_UPDATE
+    case DFU_IMAGE_BOOTLOADER:
+      field = 4;
+      break;
+#endif
+    default:
+      m_send (dfu_start_not_supported, 3);
+      return;
+  }
 
   m_image_size =
-    (uint32_t)aci_evt->params.data_received.rx_data.aci_data[11] << 24 |
-    (uint32_t)aci_evt->params.data_received.rx_data.aci_data[10] << 16 |
-    (uint32_t)aci_evt->params.data_received.rx_data.aci_data[9]  << 8  |
-    (uint32_t)aci_evt->params.data_received.rx_data.aci_data[8];
+    (uint32_t)p_data[field + 3] << 24 |
+    (uint32_t)p_data[field + 2] << 16 |
+    (uint32_t)p_data[field + 1] << 8  |
+    (uint32_t)p_data[field];
+
+  if (m_image_size == 0 || m_image_size > m_image_room ())
+  {
+    m_send (dfu_start_size, 3);
+    return;
+  }
+  m_init_crc_set = false;
 
   /* Write response */
-  m_send ((uint8_t *) dfu_start_success, 3);
+  m_send (dfu_start_success, 3);
 
   m_dfu_state = ST_RDY;
 }
 
-/* Validate the received firmware image, and transmit the result */
+/* Validate the received firmware image, and transmit the result. Pages
+ * not read back yet are read back first, and an image that did not read
+ * back as it was written, or that is short of its size, fails. The result
+ * goes into the history.
+ */
 static void dfu_image_validate (void)
 {
   static const uint8_t validate_success[] = {OP_CODE_RESPONSE,
     BLE_DFU_VALIDATE_PROCEDURE,
     BLE_DFU_RESP_VAL_SUCCESS};
+  static const uint8_t validate_failure[] = {OP_CODE_RESPONSE,
+    BLE_DFU_VALIDATE_PROCEDURE,
+    BLE_DFU_RESP_VAL_OPER_FAILED};
+  static const uint8_t validate_size[] = {OP_CODE_RESPONSE,
+    BLE_DFU_VALIDATE_PROCEDURE,
+    BLE_DFU_RESP_VAL_DATA_SIZE};
+  static const uint8_t validate_crc[] = {OP_CODE_RESPONSE,
+    BLE_DFU_VALIDATE_PROCEDURE,
+    BLE_DFU_RESP_VAL_CRC_ERROR};
 
-  /* Completed successfully */
-  if (m_num_of_firmware_bytes_rcvd == m_image_size)
+  m_spm_wait ();
+  while (m_verify_count)
   {
-    m_send((uint8_t *) validate_success, 3);
+    m_verify_page ();
   }
 
+  if (m_verify_failed)
+  {
+    history_dfu_end (HISTORY_RESULT_VERIFY);
+    m_send (validate_failure, 3);
+    m_dfu_state = ST_FW_INVALID;
+    return;
+  }
+
+  if (m_num_of_firmware_bytes_rcvd != m_image_size)
+  {
+    history_dfu_end (HISTORY_RESULT_SIZE);
+    m_send (validate_size, 3);
+    m_dfu_state = ST_FW_INVALID;
+    return;
+  }
+
+  /* The image, as it reads back from flash, must have the CRC the init
+   * packet gave for it. A bootloader image always needs one; an
+   * application from an older tool that sends no init packet goes
+   * unchecked.
+   */
+  if ((m_init_crc_set || m_image_type == DFU_IMAGE_BOOTLOADER) &&
+      !m_image_crc_check ())
+  {
+    history_dfu_end (HISTORY_RESULT_CRC);
+    m_send (validate_crc, 3);
+    m_dfu_state = ST_FW_INVALID;
+    return;
+  }
+
+  /* Completed successfully */
+  history_dfu_end (HISTORY_RESULT_SUCCESS);
+  m_send (validate_success, 3);
+
   m_dfu_state = ST_FW_VALID;
 }
 
-/* Receive and process an init packet */
-static void dfu_init_pkt_handle (void)
+#ifdef HISTORY
+/* Report the application valid flag, then the newest history record but
+ * its sequence number and CRC, after a response to the history request
+ */
+static void dfu_history_report (void)
+{
+  uint8_t report[4 + offsetof (history_record_t, crc) -
+    offsetof (history_record_t, result)] = {OP_CODE_RESPONSE,
+    BLE_DFU_HISTORY_PROCEDURE, BLE_DFU_RESP_VAL_SUCCESS};
+  history_record_t record;
+
+  history_read (&record);
+  report[3] = jump_app_valid ();
+  memcpy (&report[4], &record.result, sizeof (report) - 4);
+  m_send (report, sizeof (report));
+}
+#endif
+
+#ifdef STACK_REPORT
+/* Report the RAM taken by the statics, the deepest the stack has been, and
+ * the margin left below it, in bytes, after a response to the memory
+ * request
+ */
+static void dfu_memory_report (void)
+{
+  const uint16_t size = stack_size ();
+  const uint16_t unused = stack_unused ();
+  const uint16_t ram[3] = {RAMEND + 1 - RAMSTART - size, size - unused,
+    unused};
+  uint8_t report[3 + sizeof (ram)] = {OP_CODE_RESPONSE,
+    BLE_DFU_MEMORY_PROCEDURE, BLE_DFU_RESP_VAL_SUCCESS};
+
+  memcpy (&report[3], ram, sizeof (ram));
+  m_send (report, sizeof (report));
+}
+#endif
+
+/* Receive and process an init packet, see dfu_init_packet_t. An image
+ * whose header does not match this part, or that does not fit its room in
+ * flash, is refused here, with the application still intact, and the DFU
+ * goes back to idle.
+ */
+static void dfu_init_pkt_handle (const uint8_t *p_data, uint8_t len)
 {
   static const uint8_t init_procedure_success[] = {OP_CODE_RESPONSE,
      BLE_DFU_INIT_PROCEDURE,
      BLE_DFU_RESP_VAL_SUCCESS};
+  static const uint8_t init_procedure_not_supported[] = {OP_CODE_RESPONSE,
+     BLE_DFU_INIT_PROCEDURE,
+     BLE_DFU_RESP_VAL_NOT_SUPPORTED};
+  static const uint8_t init_procedure_size[] = {OP_CODE_RESPONSE,
+     BLE_DFU_INIT_PROCEDURE,
+     BLE_DFU_RESP_VAL_DATA_SIZE};
+  dfu_init_packet_t init;
+
+  if (len >= sizeof (init))
+  {
+    memcpy (&init, p_data, sizeof (init));
+
+    if (init.version != DFU_INIT_VERSION ||
+        init.signature[0] != SIGNATURE_0 ||
+        init.signature[1] != SIGNATURE_1 ||
+        init.signature[2] != SIGNATURE_2)
+    {
+      m_send (init_procedure_not_supported, 3);
+      m_dfu_state = ST_IDLE;
+      return;
+    }
+
+    if (init.max_address >= m_image_room () ||
+        m_image_size > init.max_address + 1)
+    {
+      m_send (init_procedure_size, 3);
+      m_dfu_state = ST_IDLE;
+      return;
+    }
+  }
+
+  if (len >= 2)
+  {
+    m_init_crc = (uint16_t)p_data[1] << 8 | p_data[0];
+    m_init_crc_set = true;
+  }
 
   /* Send init received notification */
-  m_send ((uint8_t *) init_procedure_success, 3);
+  m_send (init_procedure_success, 3);
 }
 
 /* Update the interval between receipt notifications */
-static void dfu_notification_set (aci_evt_t *aci_evt)
+static void dfu_notification_set (const uint8_t *p_data)
 {
   m_pkt_notif_target =
-    (uint16_t)aci_evt->params.data_received.rx_data.aci_data[2] << 8 |
-    (uint16_t)aci_evt->params.data_received.rx_data.aci_data[1];
+    (uint16_t)p_data[2] << 8 |
+    (uint16_t)p_data[1];
   m_pkt_notif_target_cnt = m_pkt_notif_target;
 }
 
-/* Disconnect from the nRF8001 and do a reset */
+/* Drop the link and start over. A transfer under way is recorded as
+ * aborted; one that has not given up the application yet is not recorded.
+ */
 static void dfu_reset (void)
 {
-  while (!lib_aci_radio_reset());
+  if (m_dfu_state == ST_RX_DATA_PKT)
+  {
+    history_dfu_end (HISTORY_RESULT_ABORTED);
+  }
+
+  m_transport->reset ();
 
   m_dfu_state = ST_IDLE;
 }
@@ -276,29 +618,60 @@ static void dfu_reset (void)
 *****************************************************************************/
 
 /* Initialize the state machine */
-void dfu_init (uint8_t *p_pipes)
+void dfu_init (const dfu_transport_t *p_transport)
 {
   m_dfu_state = ST_IDLE;
-  memcpy(m_pipe_array, p_pipes, 3);
+  m_image_type = DFU_IMAGE_APPLICATION;
+  m_transport = p_transport;
+  history_init (p_transport->poll);
+}
+
+bool dfu_background_ready (void)
+{
+  return (m_verify_count || m_erase_address < m_erase_end) &&
+    !boot_spm_busy () && eeprom_is_ready ();
 }
 
-/* Update the state machine according to the event in aci_evt */
-void dfu_update (aci_state_t *aci_state, aci_evt_t *aci_evt)
+/* Read back a written page, or else erase the next page of the image
+ * ahead of the data, if the SPM unit and the EEPROM are idle. Called
+ * between events.
+ */
+void dfu_background (void)
+{
+  if (!dfu_background_ready ())
+  {
+    return;
+  }
+
+  if (m_verify_count)
+  {
+    m_verify_page ();
+    return;
+  }
+
+  boot_page_erase (m_erase_address);
+  m_erase_address += SPM_PAGESIZE;
+}
+
+void dfu_housekeeping (void)
 {
-  const aci_rx_data_t *rx_data = &(aci_evt->params.data_received.rx_data);
-  uint8_t event = EV_ANY;
-  uint8_t pipe;
+  history_clock ();
+}
+
+/* Update the state machine according to a packet written on channel */
+void dfu_update (uint8_t channel, const uint8_t *p_data, uint8_t len)
+{
+  uint8_t event;
 
-  m_aci_state = aci_state;
-  pipe = rx_data->pipe_number;
+  history_clock ();
 
   /* Incoming data packet */
-  if (pipe == m_pipe_array[0]) {
+  if (channel == DFU_CHANNEL_PACKET) {
     event = DFU_PACKET_RX;
   }
   /* Incoming control point */
-  else if (pipe == m_pipe_array[2]) {
-    event = rx_data->aci_data[0];
+  else {
+    event = p_data[0];
   }
 
   /* Update the state machine based on the incoming event and current state */
@@ -308,28 +681,40 @@ void dfu_update (aci_state_t *aci_state, aci_evt_t *aci_evt)
       switch (m_dfu_state)
       {
         case ST_IDLE:
-          dfu_image_size_set(aci_evt);
+          dfu_image_size_set(p_data);
           break;
         case ST_RX_INIT_PKT:
-          dfu_init_pkt_handle();
+          dfu_init_pkt_handle(p_data, len);
           break;
         case ST_RX_DATA_PKT:
-          dfu_data_pkt_handle(aci_evt);
+          dfu_data_pkt_handle(p_data, len);
           break;
       }
       break;
+    case OP_CODE_START_DFU:
+      /* Without a type, as from older tools, the image is an application */
+      if (m_dfu_state == ST_IDLE)
+        m_image_type = (len > 1) ? p_data[1] : DFU_IMAGE_APPLICATION;
+      break;
     case OP_CODE_RECEIVE_INIT:
       if (m_dfu_state == ST_RDY)
         m_dfu_state = ST_RX_INIT_PKT;
       break;
     case OP_CODE_RECEIVE_FW:
       if (m_dfu_state == ST_RDY || m_dfu_state == ST_RX_INIT_PKT)
-        /* Once we reach this point, the currently loaded application
-         * will be trashed, and we should disable jumping to application
-         * until we have verified the incoming firmware.
-         */
-        jump_app_key_clear ();
+      {
+        m_image_start ();
+
+        /* The image is always written from the start of flash */
+        m_page_address = 0;
+        m_page_offset = 0;
+        m_page_crc = 0xFFFF;
+        m_verify_count = 0;
+        m_verify_failed = false;
+        m_num_of_firmware_bytes_rcvd = 0;
+
         m_dfu_state = ST_RX_DATA_PKT;
+      }
       break;
     case OP_CODE_VALIDATE:
       if (m_dfu_state == ST_RX_DATA_PKT)
@@ -337,13 +722,23 @@ void dfu_update (aci_state_t *aci_state, aci_evt_t *aci_evt)
       break;
     case OP_CODE_ACTIVATE_N_RESET:
       if (m_dfu_state == ST_FW_VALID)
-        dfu_image_activate(aci_evt);
+        dfu_image_activate();
       break;
     case OP_CODE_SYS_RESET:
       dfu_reset();
       break;
     case OP_CODE_PKT_RCPT_NOTIF_REQ:
-      dfu_notification_set (aci_evt);
+      dfu_notification_set (p_data);
+      break;
+#ifdef HISTORY
+    case OP_CODE_HISTORY_REQ:
+      dfu_history_report ();
+      break;
+#endif
+#ifdef STACK_REPORT
+    case OP_CODE_MEMORY_REQ:
+      dfu_memory_report ();
       break;
+#endif
   }
 }
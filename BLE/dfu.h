@@ -22,6 +22,9 @@
 #ifndef DFU_H_
 #define DFU_H_
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #define ST_IDLE             1
 #define ST_RDY              2
 #define ST_RX_INIT_PKT      3
@@ -43,6 +46,35 @@
 #define OP_CODE_PKT_RCPT_NOTIF_REQ    8   /* 'Request packet rcpt notification.*/
 #define OP_CODE_RESPONSE              16  /* 'Response.*/
 #define OP_CODE_PKT_RCPT_NOTIF        17   /* 'Packets Receipt Notification'.*/
+#define OP_CODE_HISTORY_REQ           32  /* 'Report DFU history', not part of
+                                             the Nordic DFU */
+#define OP_CODE_MEMORY_REQ            33  /* 'Report RAM use', not part of the
+                                             Nordic DFU */
+#define OP_CODE_SPI_BENCH_REQ         34  /* 'Benchmark SPI', UART only, see
+                                             uart_dfu.h */
+
+/* Image types of 'Start DFU'. A bootloader image is only taken by a build
+ * with SELF_UPDATE, see bootcopy.h.
+ */
+#define DFU_IMAGE_SOFTDEVICE          1
+#define DFU_IMAGE_BOOTLOADER          2
+#define DFU_IMAGE_APPLICATION         4
+
+/* The init packet. Its first two bytes are the CRC-16-CCITT of the image,
+ * which is all older tools send. The header after them lets the image be
+ * refused before the application is given up for it: it names the part the
+ * image was built for and the highest address it takes, counted from the
+ * start of the image.
+ */
+#define DFU_INIT_VERSION              1
+
+typedef struct __attribute__ ((packed))
+{
+  uint16_t crc;           /* CRC-16-CCITT of the image */
+  uint8_t  version;       /* DFU_INIT_VERSION */
+  uint8_t  signature[3];  /* SIGNATURE_0..2 of the part */
+  uint32_t max_address;   /* Highest address of the image */
+} dfu_init_packet_t;
 
 /**@brief   DFU Procedure type.
  *
@@ -53,6 +85,9 @@
 #define BLE_DFU_RECEIVE_APP_PROCEDURE   3
 #define BLE_DFU_VALIDATE_PROCEDURE      4
 #define BLE_DFU_PKT_RCPT_REQ_PROCEDURE  8
+#define BLE_DFU_HISTORY_PROCEDURE       32
+#define BLE_DFU_MEMORY_PROCEDURE        33
+#define BLE_DFU_SPI_BENCH_PROCEDURE     34
 
 /**@brief   DFU Response value type.
  */
@@ -63,7 +98,50 @@
 #define BLE_DFU_RESP_VAL_CRC_ERROR       5
 #define BLE_DFU_RESP_VAL_OPER_FAILED     6
 
-void dfu_init (uint8_t *ppipes);
-void dfu_update (aci_state_t *aci_state, aci_evt_t *aci_evt);
+/* Where a packet handed to dfu_update() was written: the DFU Packet, which
+ * carries the image size, the init packet and the image, or the DFU Control
+ * Point
+ */
+#define DFU_CHANNEL_PACKET    0
+#define DFU_CHANNEL_CONTROL   1
+
+/* The link a DFU runs over: BLE in ble.c, or the serial line in uart_dfu.c */
+typedef struct
+{
+  /* Send a response or receipt notification to the peer. Returns false if
+   * the link could not take it.
+   */
+  bool (*send) (const uint8_t *p_data, uint8_t len);
+
+  /* Close the link ahead of Activate & Reset. The reset follows at once. */
+  void (*close) (void);
+
+  /* 'Reset System' */
+  void (*reset) (void);
+
+  /* Called while waiting for the SPM unit and between the words of a data
+   * packet, for a link that has to be serviced by polling. May be NULL.
+   */
+  void (*poll) (void);
+} dfu_transport_t;
+
+void dfu_init (const dfu_transport_t *p_transport);
+void dfu_update (uint8_t channel, const uint8_t *p_data, uint8_t len);
+
+/* Read back the pages written so far against the CRC recorded for them,
+ * and erase the flash for the image ahead of the data, one page per call
+ * while the SPM unit is idle. Call when there is no event to process.
+ */
+void dfu_background (void);
+
+/* True if dfu_background() has a page to read back or erase, and the SPM
+ * unit and the EEPROM are idle
+ */
+bool dfu_background_ready (void);
+
+/* Work of no urgency, for when nothing else is ready: keeps the clock of
+ * the DFU history running
+ */
+void dfu_housekeeping (void);
 
 #endif /* DFU_H_ */
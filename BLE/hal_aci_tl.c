@@ -35,9 +35,16 @@ static inline uint8_t m_spi_readwrite (const uint8_t aci_byte);
 static inline void m_aci_spi_transfer (hal_aci_data_t * data_to_send,
     hal_aci_data_t * received_data);
 
+static hal_aci_data_t aci_tx_data[ACI_TX_QUEUE_SIZE];
+static hal_aci_data_t aci_rx_data[ACI_RX_QUEUE_SIZE];
 static aci_queue_t  aci_tx_q;
 static aci_queue_t  aci_rx_q;
 static aci_pins_t   *pins;
+static uint8_t      spi_divider;
+
+#ifdef HAL_ACI_TL_STATS
+hal_aci_tl_stats_t  hal_aci_tl_stats;
+#endif
 
 static inline void m_aci_event_check(void)
 {
@@ -45,8 +52,11 @@ static inline void m_aci_event_check(void)
   hal_aci_data_t received_data;
 
   /* No room to store incoming messages */
-  if (aci_queue_is_full(&aci_rx_q))
+  if (aci_queue_is_full(&aci_rx_q, ACI_RX_QUEUE_MASK))
   {
+#ifdef HAL_ACI_TL_STATS
+    hal_aci_tl_stats.rx_queue_full++;
+#endif
     return;
   }
 
@@ -64,7 +74,7 @@ static inline void m_aci_event_check(void)
   }
 
   /* Receive from queue */
-  if (!aci_queue_dequeue(&aci_tx_q, &data_to_send))
+  if (!aci_queue_dequeue(&aci_tx_q, &data_to_send, ACI_TX_QUEUE_MASK))
   {
     /* queue was empty, nothing to send */
     data_to_send.status_byte = 0;
@@ -77,7 +87,8 @@ static inline void m_aci_event_check(void)
   /* If there are messages to transmit, and we can store the reply,
    * we request a new transfer
   */
-  if (!aci_queue_is_full(&aci_rx_q) && !aci_queue_is_empty(&aci_tx_q))
+  if (!aci_queue_is_full(&aci_rx_q, ACI_RX_QUEUE_MASK) &&
+      !aci_queue_is_empty(&aci_tx_q))
   {
     m_aci_reqn_enable();
   }
@@ -85,7 +96,7 @@ static inline void m_aci_event_check(void)
   /* Check if we received data */
   if (received_data.buffer[0] > 0)
   {
-    aci_queue_enqueue(&aci_rx_q, &received_data);
+    aci_queue_enqueue(&aci_rx_q, &received_data, ACI_RX_QUEUE_MASK);
   }
 
   return;
@@ -159,7 +170,7 @@ static inline void m_spi_init (void)
    * we might accidentally be put in slave mode if a signal arrives on the
    * pin. We set it as output to avoid this possibility.
    */
-  DDRB |= (1 << PB2);
+  *pin_to_mode (PIN_SPI_SS) |= pin_to_bit_mask (PIN_SPI_SS);
 
   /* Set MISO as input */
   *miso_mode &= ~pin_to_bit_mask(pins->miso_pin);
@@ -173,8 +184,9 @@ static inline void m_spi_init (void)
   *rdyn_mode &= ~pin_to_bit_mask(pins->rdyn_pin);
   *rdyn_out |= pin_to_bit_mask(pins->rdyn_pin);
 
-  /* Configure SPI registers */
-  SPCR |= _BV(SPE) | _BV(DORD) | _BV(MSTR) | _BV(SPI2X) | _BV(SPR0);
+  /* Configure SPI registers, SCK at F_CPU / 16. SPI2X is in SPSR. */
+  SPCR |= _BV(SPE) | _BV(DORD) | _BV(MSTR) | _BV(SPR0);
+  spi_divider = 16;
 }
 
 static inline uint8_t m_spi_readwrite(const uint8_t aci_byte)
@@ -190,8 +202,8 @@ void hal_aci_tl_init(aci_pins_t *aci_pins)
   volatile uint8_t *reset_mode = pin_to_mode (aci_pins->reset_pin);
 
   /* Initialize the ACI Command queue. */
-  aci_queue_init(&aci_tx_q);
-  aci_queue_init(&aci_rx_q);
+  aci_queue_init(&aci_tx_q, aci_tx_data, ACI_TX_QUEUE_MASK);
+  aci_queue_init(&aci_rx_q, aci_rx_data, ACI_RX_QUEUE_MASK);
 
   /* Set local pin struct pointer */
   pins = aci_pins;
@@ -213,10 +225,10 @@ bool hal_aci_tl_send(hal_aci_data_t *p_aci_cmd)
     return false;
   }
 
-  ret_val = aci_queue_enqueue(&aci_tx_q, p_aci_cmd);
+  ret_val = aci_queue_enqueue(&aci_tx_q, p_aci_cmd, ACI_TX_QUEUE_MASK);
   if (ret_val)
   {
-    if(!aci_queue_is_full(&aci_rx_q))
+    if(!aci_queue_is_full(&aci_rx_q, ACI_RX_QUEUE_MASK))
     {
       /* Lower the REQN only when successfully enqueued */
       m_aci_reqn_enable();
@@ -228,19 +240,13 @@ bool hal_aci_tl_send(hal_aci_data_t *p_aci_cmd)
 
 bool hal_aci_tl_event_get(hal_aci_data_t *p_aci_data)
 {
-  bool was_full;
-
-  if (!aci_queue_is_full(&aci_rx_q))
-  {
-    m_aci_event_check();
-  }
+  m_aci_event_check();
 
-  was_full = aci_queue_is_full(&aci_rx_q);
-
-  if (aci_queue_dequeue(&aci_rx_q, p_aci_data))
+  if (aci_queue_dequeue(&aci_rx_q, p_aci_data, ACI_RX_QUEUE_MASK))
   {
     /* Attempt to pull REQN LOW since we've made room for new messages */
-    if (!aci_queue_is_full(&aci_rx_q) && !aci_queue_is_empty(&aci_tx_q))
+    if (!aci_queue_is_full(&aci_rx_q, ACI_RX_QUEUE_MASK) &&
+        !aci_queue_is_empty(&aci_tx_q))
     {
       m_aci_reqn_enable();
     }
@@ -251,6 +257,52 @@ bool hal_aci_tl_event_get(hal_aci_data_t *p_aci_data)
   return false;
 }
 
+bool hal_aci_tl_transfer_ready (void)
+{
+  return hal_aci_tl_rdyn() && !aci_queue_is_full(&aci_rx_q, ACI_RX_QUEUE_MASK);
+}
+
+void hal_aci_tl_transfer (void)
+{
+  m_aci_event_check();
+}
+
+bool hal_aci_tl_event_available (void)
+{
+  return !aci_queue_is_empty(&aci_rx_q);
+}
+
+bool hal_aci_tl_spi_clock_set (uint8_t divider)
+{
+  uint8_t rate = 0;
+
+  /* Dividers 2 to 128 are 2 << rate */
+  while (rate < 6 && (2 << rate) < divider)
+  {
+    rate++;
+  }
+  if ((2 << rate) != divider)
+  {
+    return false;
+  }
+
+  /* SPR1:0 divide by 4 << 2 * SPR, 128 for 3, and SPI2X halves that. The
+   * SPI is off while the rate changes.
+   */
+  SPCR &= ~(_BV(SPE) | _BV(SPR1) | _BV(SPR0));
+  SPCR |= rate >> 1;
+  SPSR = ((rate & 1) || rate == 6) ? 0 : _BV(SPI2X);
+  SPCR |= _BV(SPE);
+  spi_divider = divider;
+
+  return true;
+}
+
+uint8_t hal_aci_tl_spi_clock_get (void)
+{
+  return spi_divider;
+}
+
 /* Returns true if the rdyn line is low */
 bool hal_aci_tl_rdyn (void)
 {
@@ -65,6 +65,15 @@ typedef struct {
 
 ACI_ASSERT_SIZE(hal_aci_data_t, HAL_ACI_MAX_LENGTH + 2);
 
+#ifdef HAL_ACI_TL_STATS
+/** Transport layer counters, built in for the host simulator only */
+typedef struct {
+  uint32_t rx_queue_full; /**< Event checks skipped, no room in the RX queue */
+} hal_aci_tl_stats_t;
+
+extern hal_aci_tl_stats_t hal_aci_tl_stats;
+#endif
+
 /** Datatype for ACI pins and interface (polling/interrupt)*/
 typedef struct aci_pins_t
 {
@@ -114,6 +123,39 @@ bool hal_aci_tl_send(hal_aci_data_t *aci_buffer);
  */
 bool hal_aci_tl_event_get(hal_aci_data_t *p_aci_data);
 
+/** @brief Check for an SPI transfer to run
+ *  @details
+ *  True if the nRF8001 has lowered RDYN for a transfer, and the event
+ *  queue has room for what it brings.
+ */
+bool hal_aci_tl_transfer_ready (void);
+
+/** @brief Run the SPI transfer the nRF8001 is ready for, if any
+ *  @details
+ *  Sends the next queued command, and queues the event received. This is
+ *  done by hal_aci_tl_event_get() as well.
+ */
+void hal_aci_tl_transfer (void);
+
+/** @brief Check for a received event
+ *  @details
+ *  True if hal_aci_tl_event_get() has an event to return without a
+ *  transfer.
+ */
+bool hal_aci_tl_event_available (void);
+
+/** @brief Set the SPI clock
+ *  @details
+ *  SCK runs at F_CPU / divider, for a divider of 2, 4, 8, 16, 32, 64 or
+ *  128. hal_aci_tl_init() sets 16. Not to be called during a transfer.
+ *  @param divider Division of the CPU clock.
+ *  @return False, with the clock unchanged, for any other divider.
+ */
+bool hal_aci_tl_spi_clock_set (uint8_t divider);
+
+/** @brief Get the divider of the SPI clock, see hal_aci_tl_spi_clock_set() */
+uint8_t hal_aci_tl_spi_clock_get (void);
+
 /** @brief Get the state of the nRF8001 RDYN line
  *  @details
  *  True if rdyn is low, or false.
@@ -137,6 +137,44 @@ bool lib_aci_disconnect(aci_state_t *aci_stat, aci_disconnect_reason_t reason)
   return ret_val;
 }
 
+bool lib_aci_set_local_data(uint8_t pipe, const uint8_t *p_value, uint8_t size)
+{
+  static hal_aci_data_t set_local_data_msg = {
+    .buffer = {MSG_SET_LOCAL_DATA_BASE_LEN, ACI_CMD_SET_LOCAL_DATA}
+  };
+
+  uint8_t* const buffer = &(set_local_data_msg.buffer[0]);
+
+  *(buffer + OFFSET_ACI_CMD_T_LEN) = MSG_SET_LOCAL_DATA_BASE_LEN + size;
+
+  *(buffer + OFFSET_ACI_CMD_T_SET_LOCAL_DATA +
+      OFFSET_ACI_CMD_PARAMS_SET_LOCAL_DATA_T_TX_DATA +
+      OFFSET_ACI_TX_DATA_T_PIPE_NUMBER) =
+    pipe;
+
+  memcpy((buffer + OFFSET_ACI_CMD_T_SET_LOCAL_DATA +
+        OFFSET_ACI_CMD_PARAMS_SET_LOCAL_DATA_T_TX_DATA +
+        OFFSET_ACI_TX_DATA_T_ACI_DATA), p_value, size);
+
+  return hal_aci_tl_send(&set_local_data_msg);
+}
+
+bool lib_aci_open_adv_pipe(uint8_t pipe)
+{
+  static hal_aci_data_t open_adv_pipe_msg = {
+    .buffer = {MSG_OPEN_ADV_PIPES_LEN, ACI_CMD_OPEN_ADV_PIPE}
+  };
+
+  uint8_t* const pipes = &(open_adv_pipe_msg.buffer[0]) +
+    OFFSET_ACI_CMD_T_OPEN_ADV_PIPE +
+    OFFSET_ACI_CMD_PARAMS_OPEN_ADV_PIPE_T_PIPES;
+
+  memset(pipes, 0, PIPES_ARRAY_SIZE);
+  pipes[pipe / 8] = (1 << (pipe % 8));
+
+  return hal_aci_tl_send(&open_adv_pipe_msg);
+}
+
 bool lib_aci_send_data(uint8_t pipe, uint8_t *p_value, uint8_t size)
 {
   static hal_aci_data_t send_data_msg = {
@@ -161,20 +199,16 @@ bool lib_aci_send_data(uint8_t pipe, uint8_t *p_value, uint8_t size)
 
 bool lib_aci_event_get(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data)
 {
-  bool status = false;
-
-  status = hal_aci_tl_event_get((hal_aci_data_t *)p_aci_evt_data);
+  aci_evt_t * aci_evt = &p_aci_evt_data->evt;
 
   /**
   Update the state of the ACI with the
-  ACI Events -> Pipe Status, Disconnected, Connected, Bond Status, Pipe Error
+  ACI Events -> Pipe Status, Disconnected, Timing, Data Credit
+  Events that only carry state are consumed here, and the next event is
+  taken in their place, so the caller only sees events it acts on.
   */
-  if (status)
+  while (hal_aci_tl_event_get((hal_aci_data_t *)p_aci_evt_data))
   {
-    aci_evt_t * aci_evt;
-
-    aci_evt = &p_aci_evt_data->evt;
-
     switch(aci_evt->evt_opcode)
     {
         case ACI_EVT_PIPE_STATUS:
@@ -186,7 +220,7 @@ bool lib_aci_event_get(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data)
                     aci_evt->params.pipe_status.pipes_closed_bitmap,
                     PIPES_ARRAY_SIZE);
             }
-            break;
+            continue;
 
         case ACI_EVT_DISCONNECTED:
             {
@@ -206,7 +240,17 @@ bool lib_aci_event_get(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data)
                 aci_stat->connection_interval = aci_evt->params.timing.conn_rf_interval;
                 aci_stat->slave_latency       = aci_evt->params.timing.conn_slave_rf_latency;
                 aci_stat->supervision_timeout = aci_evt->params.timing.conn_rf_timeout;
-            break;
+            continue;
+
+        case ACI_EVT_DATA_CREDIT:
+                /* Credits of several events add up here */
+                aci_stat->data_credit_available += aci_evt->params.data_credit.credit;
+            continue;
+
+        case ACI_EVT_ECHO:
+        case ACI_EVT_DATA_ACK:
+            /* Not used by the bootloader */
+            continue;
 
         default:
             /* Need default case to avoid compiler warnings about missing enum
@@ -214,6 +258,9 @@ bool lib_aci_event_get(aci_state_t *aci_stat, hal_aci_evt_t *p_aci_evt_data)
              */
             break;
     }
+
+    return true;
   }
-  return status;
+
+  return false;
 }
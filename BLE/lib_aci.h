@@ -177,6 +177,24 @@ bool lib_aci_connect(uint16_t run_timeout, uint16_t adv_interval);
  */
 bool lib_aci_disconnect(aci_state_t *aci_stat, aci_disconnect_reason_t reason);
 
+/** @brief Sets the value of a local pipe, such as a broadcast pipe.
+ *  @details This function sends a @c SetLocalData command to the radio.
+ *  @param pipe Pipe number of the local value.
+ *  @param p_value Pointer to the value.
+ *  @param size Size of the value.
+ *  @return True if the transaction is successfully initiated.
+ */
+bool lib_aci_set_local_data(uint8_t pipe, const uint8_t *p_value, uint8_t size);
+
+/** @brief Puts the value of a broadcast pipe in the advertising data.
+ *  @details This function sends an @c OpenAdvPipe command to the radio,
+ *  with pipe as the only open advertising pipe. The data goes out with the
+ *  next @c Connect or @c Broadcast.
+ *  @param pipe Pipe number of the broadcast pipe.
+ *  @return True if the transaction is successfully initiated.
+ */
+bool lib_aci_open_adv_pipe(uint8_t pipe);
+
 /* @} */
 
 /** @name ACI commands available in Connected mode */
@@ -203,7 +221,8 @@ bool lib_aci_send_data(uint8_t pipe, uint8_t *value, uint8_t size);
 /** @brief Gets an ACI event from the ACI Event Queue
  *  @details This function gets an ACI event from the ACI event queue.  The
  *    queue is updated by the SPI driver for the ACI running in the interrupt
- *    context
+ *    context. Pipe Status, Timing, Data Credit, Echo and Data Ack events
+ *    only update aci_stat, and are not returned.
  *  @param aci_stat pointer to the state of the ACI.
  *  @param p_aci_data pointer to the ACI Event. The ACI Event received will be
  *    copied into this pointer.
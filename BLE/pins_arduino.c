@@ -26,82 +26,141 @@
 
 #include "pins_arduino.h"
 
+/* Ports, by their index in m_port_to_mode */
+#define M_PA  1
+#define M_PB  2
+#define M_PC  3
+#define M_PD  4
+#define M_PE  5
+#define M_PF  6
+#define M_PG  7
+#define M_PH  8
+#define M_PJ  9
+#define M_PK  10
+#define M_PL  11
+
+/* The pin tables are read from flash. They go with the code rather than in
+ * .progmem, which the linker puts at the start of .text, where the
+ * bootloader, linked without start files, begins to run.
+ */
+#ifdef __AVR__
+#define M_PROGMEM  __attribute__ ((section (".text.pins_arduino")))
+#else
+#define M_PROGMEM  PROGMEM
+#endif
+
+/* A bootloader above 64 KB reads its flash with ELPM */
+#if (FLASHEND > 0xFFFF)
+#define M_PGM_READ(table, n) \
+  pgm_read_byte_far (pgm_get_far_address (table) + (n))
+#else
+#define M_PGM_READ(table, n)  pgm_read_byte (&(table)[n])
+#endif
+
+#if defined(PINS_ARDUINO_MEGA)
+
+static const uint8_t m_pin_to_port[NUM_DIGITAL_PINS] M_PROGMEM = {
+  M_PE, M_PE, M_PE, M_PE, M_PG, M_PE, M_PH, M_PH,   /* 0 - 7 */
+  M_PH, M_PH, M_PB, M_PB, M_PB, M_PB, M_PJ, M_PJ,   /* 8 - 15 */
+  M_PH, M_PH, M_PD, M_PD, M_PD, M_PD, M_PA, M_PA,   /* 16 - 23 */
+  M_PA, M_PA, M_PA, M_PA, M_PA, M_PA, M_PC, M_PC,   /* 24 - 31 */
+  M_PC, M_PC, M_PC, M_PC, M_PC, M_PC, M_PD, M_PG,   /* 32 - 39 */
+  M_PG, M_PG, M_PL, M_PL, M_PL, M_PL, M_PL, M_PL,   /* 40 - 47 */
+  M_PL, M_PL, M_PB, M_PB, M_PB, M_PB, M_PF, M_PF,   /* 48 - 55 */
+  M_PF, M_PF, M_PF, M_PF, M_PF, M_PF, M_PK, M_PK,   /* 56 - 63 */
+  M_PK, M_PK, M_PK, M_PK, M_PK, M_PK,               /* 64 - 69 */
+};
+
+static const uint8_t m_pin_to_bit_mask[NUM_DIGITAL_PINS] M_PROGMEM = {
+  _BV(0), _BV(1), _BV(4), _BV(5), _BV(5), _BV(3), _BV(3), _BV(4),
+  _BV(5), _BV(6), _BV(4), _BV(5), _BV(6), _BV(7), _BV(1), _BV(0),
+  _BV(1), _BV(0), _BV(3), _BV(2), _BV(1), _BV(0), _BV(0), _BV(1),
+  _BV(2), _BV(3), _BV(4), _BV(5), _BV(6), _BV(7), _BV(7), _BV(6),
+  _BV(5), _BV(4), _BV(3), _BV(2), _BV(1), _BV(0), _BV(7), _BV(2),
+  _BV(1), _BV(0), _BV(7), _BV(6), _BV(5), _BV(4), _BV(3), _BV(2),
+  _BV(1), _BV(0), _BV(3), _BV(2), _BV(1), _BV(0), _BV(0), _BV(1),
+  _BV(2), _BV(3), _BV(4), _BV(5), _BV(6), _BV(7), _BV(0), _BV(1),
+  _BV(2), _BV(3), _BV(4), _BV(5), _BV(6), _BV(7),
+};
+
+static volatile uint8_t * const m_port_to_mode[] = {
+  [M_PA] = &DDRA, [M_PB] = &DDRB, [M_PC] = &DDRC, [M_PD] = &DDRD,
+  [M_PE] = &DDRE, [M_PF] = &DDRF, [M_PG] = &DDRG, [M_PH] = &DDRH,
+  [M_PJ] = &DDRJ, [M_PK] = &DDRK, [M_PL] = &DDRL,
+};
+
+#elif defined(PINS_ARDUINO_SANGUINO)
+
+static const uint8_t m_pin_to_port[NUM_DIGITAL_PINS] M_PROGMEM = {
+  M_PB, M_PB, M_PB, M_PB, M_PB, M_PB, M_PB, M_PB,   /* 0 - 7 */
+  M_PD, M_PD, M_PD, M_PD, M_PD, M_PD, M_PD, M_PD,   /* 8 - 15 */
+  M_PC, M_PC, M_PC, M_PC, M_PC, M_PC, M_PC, M_PC,   /* 16 - 23 */
+  M_PA, M_PA, M_PA, M_PA, M_PA, M_PA, M_PA, M_PA,   /* 24 - 31 */
+};
+
+/* Port A runs backwards, analog input 0 is pin 31 */
+static const uint8_t m_pin_to_bit_mask[NUM_DIGITAL_PINS] M_PROGMEM = {
+  _BV(0), _BV(1), _BV(2), _BV(3), _BV(4), _BV(5), _BV(6), _BV(7),
+  _BV(0), _BV(1), _BV(2), _BV(3), _BV(4), _BV(5), _BV(6), _BV(7),
+  _BV(0), _BV(1), _BV(2), _BV(3), _BV(4), _BV(5), _BV(6), _BV(7),
+  _BV(7), _BV(6), _BV(5), _BV(4), _BV(3), _BV(2), _BV(1), _BV(0),
+};
+
+static volatile uint8_t * const m_port_to_mode[] = {
+  [M_PA] = &DDRA, [M_PB] = &DDRB, [M_PC] = &DDRC, [M_PD] = &DDRD,
+};
+
+#else
+
+static const uint8_t m_pin_to_port[NUM_DIGITAL_PINS] M_PROGMEM = {
+  M_PD, M_PD, M_PD, M_PD, M_PD, M_PD, M_PD, M_PD,   /* 0 - 7 */
+  M_PB, M_PB, M_PB, M_PB, M_PB, M_PB,               /* 8 - 13 */
+  M_PC, M_PC, M_PC, M_PC, M_PC, M_PC,               /* 14 - 19 */
+};
+
+static const uint8_t m_pin_to_bit_mask[NUM_DIGITAL_PINS] M_PROGMEM = {
+  _BV(0), _BV(1), _BV(2), _BV(3), _BV(4), _BV(5), _BV(6), _BV(7),
+  _BV(0), _BV(1), _BV(2), _BV(3), _BV(4), _BV(5),
+  _BV(0), _BV(1), _BV(2), _BV(3), _BV(4), _BV(5),
+};
+
+static volatile uint8_t * const m_port_to_mode[] = {
+  [M_PB] = &DDRB, [M_PC] = &DDRC, [M_PD] = &DDRD,
+};
+
+#endif
+
 volatile uint8_t *pin_to_mode (uint8_t n)
 {
-  if (n >= 0 && n < 8)
-  {
-    return &DDRD;
-  }
-  else if (n >= 8 && n < 14)
-  {
-    return &DDRB;
-  }
-  else if (n >= 14 && n <= 19)
-  {
-    return &DDRC;
-  }
-  else
+  if (n >= NUM_DIGITAL_PINS)
   {
     return NOT_A_PIN;
   }
+
+  return m_port_to_mode[M_PGM_READ (m_pin_to_port, n)];
 }
 
+/* PINx, DDRx and PORTx of a port follow each other */
 volatile uint8_t *pin_to_output (uint8_t n)
 {
-  if (n >= 0 && n < 8)
-  {
-    return &PORTD;
-  }
-  else if (n >= 8 && n < 14)
-  {
-    return &PORTB;
-  }
-  else if (n >= 14 && n <= 19)
-  {
-    return &PORTC;
-  }
-  else
-  {
-    return NOT_A_PIN;
-  }
+  volatile uint8_t *mode = pin_to_mode (n);
+
+  return mode ? mode + 1 : NOT_A_PIN;
 }
 
 volatile uint8_t *pin_to_input (uint8_t n)
 {
-  if (n >= 0 && n < 8)
-  {
-    return &PIND;
-  }
-  else if (n >= 8 && n < 14)
-  {
-    return &PINB;
-  }
-  else if (n >= 14 && n <= 19)
-  {
-    return &PINC;
-  }
-  else
-  {
-    return NOT_A_PIN;
-  }
+  volatile uint8_t *mode = pin_to_mode (n);
+
+  return mode ? mode - 1 : NOT_A_PIN;
 }
 
 uint8_t pin_to_bit_mask (uint8_t n)
 {
-  if (n >= 0 && n < 8)
-  {
-    return _BV(n);
-  }
-  else if (n >= 8 && n < 14)
-  {
-    return _BV(n - 8);
-  }
-  else if (n >= 14 && n <= 19)
-  {
-    return _BV(n - 14);
-  }
-  else
+  if (n >= NUM_DIGITAL_PINS)
   {
     return NOT_A_PIN;
   }
+
+  return M_PGM_READ (m_pin_to_bit_mask, n);
 }
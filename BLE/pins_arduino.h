@@ -19,11 +19,45 @@
  * SOFTWARE.
  */
 
+/** @file
+  @brief Arduino digital pin numbers of the supported boards.
+   The layout follows the part: the Arduino standard variant (Uno and
+   earlier) for the ATmega8/88/168/328, the Arduino Mega for the
+   ATmega1280/2560, and the Sanguino for the ATmega644/1284.
+ */
+
 #ifndef Pins_Arduino_h
 #define Pins_Arduino_h
 
 #include <avr/pgmspace.h>
 
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__)
+#define PINS_ARDUINO_MEGA
+#define NUM_DIGITAL_PINS  70
+#define PIN_SPI_SS        53
+#define PIN_SPI_MOSI      51
+#define PIN_SPI_MISO      50
+#define PIN_SPI_SCK       52
+#elif defined(__AVR_ATmega644__) || defined(__AVR_ATmega644P__) || \
+      defined(__AVR_ATmega1284__) || defined(__AVR_ATmega1284P__)
+#define PINS_ARDUINO_SANGUINO
+#define NUM_DIGITAL_PINS  32
+#define PIN_SPI_SS        4
+#define PIN_SPI_MOSI      5
+#define PIN_SPI_MISO      6
+#define PIN_SPI_SCK       7
+#else
+#define PINS_ARDUINO_STANDARD
+#define NUM_DIGITAL_PINS  20
+#define PIN_SPI_SS        10
+#define PIN_SPI_MOSI      11
+#define PIN_SPI_MISO      12
+#define PIN_SPI_SCK       13
+#endif
+
+/* Registers and bit of pin n, or NOT_A_PIN for a pin the board does not
+ * have
+ */
 volatile uint8_t *pin_to_mode (uint8_t n);
 volatile uint8_t *pin_to_output (uint8_t n);
 volatile uint8_t *pin_to_input (uint8_t n);
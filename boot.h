@@ -114,6 +114,7 @@
 
 #include <avr/eeprom.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
 #include <inttypes.h>
 #include <limits.h>
 
@@ -785,6 +786,25 @@
 
 #endif
 
+/* Flash byte addresses need 17 bits on parts with more than 64 KB of flash.
+   Only those parts pay for a 32-bit address; everything else keeps the
+   16-bit registers the _short macros expect. */
+
+#if (FLASHEND > USHRT_MAX)
+typedef uint32_t flash_addr_t;
+#else
+typedef uint16_t flash_addr_t;
+#endif
+
+/* Read a flash byte at a flash_addr_t. The RWW section reads back only
+   after boot_rww_enable() has followed the last erase or write. */
+
+#if (FLASHEND > USHRT_MAX)
+#define boot_flash_read(address)      pgm_read_byte_far(address)
+#else
+#define boot_flash_read(address)      pgm_read_byte(address)
+#endif
+
 /** \ingroup avr_boot
 
     Same as boot_page_fill() except it waits for eeprom and spm operations to
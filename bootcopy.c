@@ -0,0 +1,173 @@
+#include "bootcopy.h"
+
+#ifdef SELF_UPDATE
+
+#include <stddef.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+
+#include "boot.h"
+
+#if (BOOTCOPY_START <= BOOT_SECTION_START)
+#error The boot section has no room for .bootcopy
+#endif
+
+/* Everything bootcopy_run() uses is inlined into it, so the copy never
+ * leaves .bootcopy for code it may be overwriting
+ */
+#define M_INLINE static inline __attribute__ ((always_inline))
+
+#define M_STATE(field) \
+  (BOOTCOPY_STATE_ADDR + offsetof (bootcopy_state_t, field))
+
+/* Pages of the boot section */
+#define M_PAGES_MAX \
+  ((FLASHEND + 1UL - BOOT_SECTION_START) / SPM_PAGESIZE)
+
+/* The pages of .bootcopy, which are not copied */
+#define M_BOOTCOPY_PAGE \
+  ((BOOTCOPY_START - BOOT_SECTION_START) / SPM_PAGESIZE)
+#define M_BOOTCOPY_PAGE_END \
+  (M_BOOTCOPY_PAGE + BOOTCOPY_SIZE / SPM_PAGESIZE)
+
+/* The jump to bootcopy_run() that stands in for the first page: JMP on
+ * parts with more than 8 KB of flash, RJMP, which wraps around, otherwise
+ */
+#if (FLASHEND > 0x1FFF)
+#define M_JUMP_WORD_0 \
+  (0x940C | (((BOOTCOPY_START / 2) >> 13) & 0x01F0) | \
+   (((BOOTCOPY_START / 2) >> 16) & 1))
+#define M_JUMP_WORD_1  ((uint16_t) (BOOTCOPY_START / 2))
+#else
+#define M_JUMP_WORD_0 \
+  (0xC000 | (((BOOTCOPY_START - BOOT_SECTION_START) / 2 - 1) & 0x0FFF))
+#define M_JUMP_WORD_1  0xFFFF
+#endif
+
+M_INLINE uint8_t m_eeprom_read (uint16_t address)
+{
+  while (EECR & _BV(EEPE));
+  EEAR = address;
+  EECR |= _BV(EERE);
+  return EEDR;
+}
+
+/* Write a byte and wait for it: the SPM unit ignores every instruction,
+ * page buffer fills included, while the EEPROM is written
+ */
+M_INLINE void m_eeprom_write (uint16_t address, uint8_t data)
+{
+  while (EECR & _BV(EEPE));
+  EEAR = address;
+  EEDR = data;
+  EECR |= _BV(EEMPE);
+  EECR |= _BV(EEPE);
+  while (EECR & _BV(EEPE));
+}
+
+/* Erase and program a page of the boot section from the temporary page
+ * buffer
+ */
+M_INLINE void m_page_program (flash_addr_t page)
+{
+  boot_page_erase (page);
+  boot_spm_busy_wait ();
+  boot_page_write (page);
+  boot_spm_busy_wait ();
+  wdt_reset ();
+}
+
+/* Copy page of the boot section from the staged image */
+M_INLINE void m_page_copy (uint8_t page)
+{
+  const flash_addr_t from = (flash_addr_t) page * SPM_PAGESIZE;
+  uint16_t i;
+
+  for (i = 0; i < SPM_PAGESIZE; i += 2)
+  {
+    boot_page_fill (BOOT_SECTION_START + from + i,
+        boot_flash_read (from + i) | (boot_flash_read (from + i + 1) << 8));
+  }
+  m_page_program (BOOT_SECTION_START + from);
+}
+
+void bootcopy_start (uint32_t size)
+{
+  uint32_t pages = (size + SPM_PAGESIZE - 1) / SPM_PAGESIZE;
+
+  if (pages > M_PAGES_MAX)
+  {
+    pages = M_PAGES_MAX;
+  }
+
+  /* The magic goes last: a reset before it leaves no copy pending */
+  eeprom_write_byte ((uint8_t *) M_STATE (pages), (uint8_t) pages);
+  eeprom_write_byte ((uint8_t *) M_STATE (next), 0);
+  eeprom_write_byte ((uint8_t *) M_STATE (magic), BOOTCOPY_MAGIC);
+  eeprom_busy_wait ();
+
+  bootcopy_run ();
+}
+
+bool bootcopy_pending (void)
+{
+  return eeprom_read_byte ((const uint8_t *) M_STATE (magic)) ==
+    BOOTCOPY_MAGIC;
+}
+
+void bootcopy_run (void)
+{
+  uint8_t pages;
+  uint8_t next;
+
+#ifdef __AVR__
+  /* Entered from the reset vector too, with nothing set up */
+  asm volatile ("clr __zero_reg__");
+  SP = RAMEND;
+#endif
+
+  /* A page takes under 10 ms, give the copy 2 s per page */
+  wdt_reset ();
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = _BV(WDE) | _BV(WDP2) | _BV(WDP1) | _BV(WDP0);
+
+  pages = m_eeprom_read (M_STATE (pages));
+  next = m_eeprom_read (M_STATE (next));
+
+  /* Copying again is harmless, the staged image stays as it is */
+  if (pages > M_PAGES_MAX)
+  {
+    pages = M_PAGES_MAX;
+  }
+  if (next > pages)
+  {
+    next = 0;
+  }
+
+  if (next == 0)
+  {
+    boot_page_fill (BOOT_SECTION_START, M_JUMP_WORD_0);
+    boot_page_fill (BOOT_SECTION_START + 2, M_JUMP_WORD_1);
+    m_page_program (BOOT_SECTION_START);
+    m_eeprom_write (M_STATE (next), ++next);
+  }
+
+  while (next < pages)
+  {
+    if (next < M_BOOTCOPY_PAGE || next >= M_BOOTCOPY_PAGE_END)
+    {
+      m_page_copy (next);
+    }
+    m_eeprom_write (M_STATE (next), ++next);
+  }
+
+  m_page_copy (0);
+  m_eeprom_write (M_STATE (magic), 0xFF);
+
+  /* Start the new bootloader with a watchdog reset */
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = _BV(WDE);
+  for (;;);
+}
+
+#endif /* SELF_UPDATE */
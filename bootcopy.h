@@ -0,0 +1,80 @@
+/* Self-update of the bootloader, from a copy the DFU staged in application
+ * flash.
+ *
+ * The copy runs from BOOTCOPY_SIZE bytes below the last BOOTCOPY_SIZE of the
+ * boot section, the .bootcopy section, which is never written: everything
+ * it needs is inlined into bootcopy_run(). It programs the rest of the boot
+ * section page by page, the last pages with the version word included, and
+ * keeps its progress in EEPROM, so a reset at any point picks the copy up
+ * again:
+ *
+ *   1. The first page, where the reset vector lands, is replaced by a jump
+ *      to bootcopy_run(). Until then the running bootloader is whole, and
+ *      jump_check() resumes the copy.
+ *   2. The other pages but those of .bootcopy are copied, each followed by
+ *      the page count.
+ *   3. The first page is copied last, and the state cleared.
+ *
+ * Only a reset while the first page itself is erased and written, twice
+ * a few milliseconds, leaves no way back. The new bootloader must keep
+ * the same .bootcopy: whatever its image holds there is not copied.
+ *
+ * Only built with SELF_UPDATE, see the Makefile.
+ */
+
+#ifndef BOOTCOPY_H_
+#define BOOTCOPY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <avr/io.h>
+
+#include "jump.h"
+
+/* First byte of the boot section. The Makefile passes the start of .text of
+ * the target, otherwise the smallest boot section of 256 words is assumed.
+ */
+#ifndef BOOT_SECTION_START
+#define BOOT_SECTION_START (FLASHEND + 1UL - 512)
+#endif
+
+/* Bytes of the copy routine, a whole number of pages on every part */
+#define BOOTCOPY_SIZE  256
+
+/* First byte of .bootcopy, where the Makefile places it: below as many
+ * bytes again at the end of the boot section, which hold the version word
+ */
+#define BOOTCOPY_START (FLASHEND + 1UL - 2 * BOOTCOPY_SIZE)
+
+/* The state of a copy, in the bootloader EEPROM area after the watchdog
+ * log. Erased EEPROM reads as no copy pending.
+ */
+#define BOOTCOPY_STATE_ADDR  (E2END - BOOTLOADER_EEPROM_SIZE + 27)
+#define BOOTCOPY_MAGIC       0xB5
+
+typedef struct
+{
+  uint8_t magic;  /* BOOTCOPY_MAGIC while a copy is pending */
+  uint8_t pages;  /* pages to copy, from the start of the boot section */
+  uint8_t next;   /* 0 before the jump is in place, then the next page,
+                     pages once only the first one is left */
+} bootcopy_state_t;
+
+/* Record a copy of the size bytes staged at the start of flash into the
+ * boot section, then run it. The reset that follows starts the new
+ * bootloader.
+ */
+void bootcopy_start (uint32_t size) __attribute__ ((noreturn));
+
+/* True if a copy was started and has not finished */
+bool bootcopy_pending (void);
+
+/* Carry out or resume the pending copy, then reset */
+#ifdef __AVR__
+void bootcopy_run (void)
+  __attribute__ ((used, OS_main, noreturn, section (".bootcopy")));
+#else
+void bootcopy_run (void) __attribute__ ((noreturn));
+#endif
+
+#endif /* BOOTCOPY_H_ */
@@ -0,0 +1,164 @@
+#include "history.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <avr/eeprom.h>
+#include <avr/io.h>
+
+#include "BLE/crc16.h"
+
+#if (HISTORY_SLOTS & (HISTORY_SLOTS - 1))
+#error HISTORY_SLOTS must be a power of two
+#endif
+
+#define M_SLOT_ADDR(slot) \
+  ((void *) (HISTORY_ADDR + (slot) * sizeof (history_record_t)))
+
+/* Timer 1 counts F_CPU / 1024, history_clock() extends it to 32 bits */
+static uint32_t m_ticks;
+static uint16_t m_tcnt;
+
+static void (*m_poll) (void);
+
+static void m_eeprom_wait (void)
+{
+  while (!eeprom_is_ready ())
+  {
+    if (m_poll)
+    {
+      m_poll ();
+    }
+  }
+}
+
+static uint16_t m_crc (const history_record_t *p_record)
+{
+  return crc16_compute ((const uint8_t *) p_record,
+      offsetof (history_record_t, crc), NULL);
+}
+
+/* Read a slot, returns true if it holds a record */
+static bool m_read (uint8_t slot, history_record_t *p_record)
+{
+  m_eeprom_wait ();
+  eeprom_read_block (p_record, M_SLOT_ADDR (slot), sizeof (*p_record));
+
+  return m_crc (p_record) == p_record->crc;
+}
+
+/* Read the newest record, and return its slot. Without a record, return
+ * HISTORY_SLOTS and the defaults, with a seq that the first record written
+ * follows.
+ */
+static uint8_t m_load (history_record_t *p_record)
+{
+  history_record_t next;
+  bool valid = m_read (0, p_record);
+  bool next_valid;
+  uint8_t slot;
+
+  for (slot = 0; slot < HISTORY_SLOTS; slot++)
+  {
+    next_valid = m_read ((slot + 1) & (HISTORY_SLOTS - 1), &next);
+
+    if (valid && !(next_valid && next.seq == (uint8_t) (p_record->seq + 1)))
+    {
+      return slot;
+    }
+
+    *p_record = next;
+    valid = next_valid;
+  }
+
+  memset (p_record, 0, sizeof (*p_record));
+  p_record->seq = 0xFF;
+
+  return HISTORY_SLOTS;
+}
+
+/* Write a record into the slot after the newest, at slot, a byte at a
+ * time so the link is polled in between
+ */
+static void m_store (history_record_t *p_record, uint8_t slot)
+{
+  const uint8_t *p_src = (const uint8_t *) p_record;
+  uint8_t *p_dst;
+  uint8_t i;
+
+  slot = (slot == HISTORY_SLOTS) ? 0 : (slot + 1) & (HISTORY_SLOTS - 1);
+  p_dst = M_SLOT_ADDR (slot);
+
+  p_record->seq++;
+  p_record->crc = m_crc (p_record);
+  for (i = 0; i < sizeof (*p_record); i++)
+  {
+    m_eeprom_wait ();
+    eeprom_update_byte (p_dst + i, p_src[i]);
+  }
+}
+
+void history_init (void (*poll) (void))
+{
+  m_poll = poll;
+}
+
+bool history_read (history_record_t *p_record)
+{
+  return m_load (p_record) != HISTORY_SLOTS;
+}
+
+void history_dfu_start (uint32_t image_size)
+{
+  history_record_t record;
+  const uint8_t slot = m_load (&record);
+
+  record.result = HISTORY_RESULT_STARTED;
+  record.attempts++;
+  record.image_size = image_size;
+  record.duration_ms = 0;
+  record.bytes_per_s = 0;
+  m_store (&record, slot);
+
+  TCCR1B = _BV(CS12) | _BV(CS10);
+  m_ticks = 0;
+  m_tcnt = TCNT1;
+}
+
+void history_dfu_end (uint8_t result)
+{
+  history_record_t record;
+  const uint8_t slot = m_load (&record);
+  uint32_t bytes_per_s = 0xFFFF;
+
+  if (record.result != HISTORY_RESULT_STARTED)
+  {
+    return;
+  }
+
+  history_clock ();
+
+  /* 1024 * 1000 / F_CPU ms per tick, without overflowing for 35 minutes
+   * at 16 MHz
+   */
+  record.duration_ms = m_ticks * 128 / (F_CPU / 8000);
+  if (record.duration_ms)
+  {
+    bytes_per_s = record.image_size * 1000 / record.duration_ms;
+  }
+  record.bytes_per_s = (bytes_per_s < 0xFFFF) ? bytes_per_s : 0xFFFF;
+
+  record.result = result;
+  if (result == HISTORY_RESULT_SUCCESS)
+  {
+    record.successes++;
+  }
+  m_store (&record, slot);
+}
+
+void history_clock (void)
+{
+  const uint16_t now = TCNT1;
+
+  m_ticks += (uint16_t) (now - m_tcnt);
+  m_tcnt = now;
+}
@@ -0,0 +1,84 @@
+/* DFU history, kept in EEPROM below the bootloader configuration and the
+ * cells of the application valid flag (jump.h).
+ *
+ * Every change is written as a new record into the next of HISTORY_SLOTS
+ * slots, so the cells wear HISTORY_SLOTS times slower than a fixed place
+ * would. A record carries a sequence number and a CRC; the newest is the
+ * one with a valid CRC whose successor in the next slot is missing. A
+ * record torn by a reset while it was written fails its CRC, and the one
+ * before it stays the newest.
+ *
+ * Built with HISTORY=1 only. Without it, the DFU calls below compile to
+ * nothing, and the EEPROM below the valid flag cells is left to the
+ * application.
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "jump.h"
+
+/* Slots in the ring, a power of two */
+#ifndef HISTORY_SLOTS
+#define HISTORY_SLOTS  8
+#endif
+
+/* How the last DFU attempt ended */
+#define HISTORY_RESULT_NONE     0  /* no attempt yet */
+#define HISTORY_RESULT_STARTED  1  /* never ended: the link was lost, or the
+                                      bootloader reset */
+#define HISTORY_RESULT_SUCCESS  2
+#define HISTORY_RESULT_VERIFY   3  /* flash did not read back as written */
+#define HISTORY_RESULT_SIZE     4  /* validated short of the image size, or
+                                      data sent past it */
+#define HISTORY_RESULT_ABORTED  5  /* 'Reset System' during the transfer */
+#define HISTORY_RESULT_CRC      6  /* the image failed the CRC of its init
+                                      packet */
+
+typedef struct
+{
+  uint8_t  seq;
+  uint8_t  result;        /* HISTORY_RESULT_* of the last attempt */
+  uint16_t attempts;      /* DFUs started */
+  uint16_t successes;     /* DFUs validated */
+  uint32_t image_size;    /* of the last attempt */
+  uint32_t duration_ms;   /* from Receive Firmware Image, when the
+                             application is given up, to Validate */
+  uint16_t bytes_per_s;   /* image_size over duration_ms, at most 0xFFFF */
+  uint16_t crc;           /* CRC-16-CCITT of the fields above */
+} __attribute__ ((packed)) history_record_t;
+
+#define HISTORY_ADDR \
+  (JUMP_APP_VALID_ADDR - HISTORY_SLOTS * sizeof (history_record_t))
+
+#ifdef HISTORY
+/* Call poll, if not NULL, whenever the EEPROM is busy with a record. A
+ * record takes some 60 ms to write, longer than a serial line can be left
+ * alone.
+ */
+void history_init (void (*poll) (void));
+
+/* Read the newest record. Without one, everything is zero and false is
+ * returned.
+ */
+bool history_read (history_record_t *p_record);
+
+/* A DFU of image_size bytes starts: count it and start the clock */
+void history_dfu_start (uint32_t image_size);
+
+/* The DFU started last ended with result, a HISTORY_RESULT_* */
+void history_dfu_end (uint8_t result);
+
+/* Advance the clock of the DFU. Call at least every 4 s at 16 MHz. */
+void history_clock (void);
+#else
+#define history_init(poll)
+#define history_dfu_start(image_size)
+#define history_dfu_end(result)
+#define history_clock()
+#endif
+
+#endif /* HISTORY_H_ */
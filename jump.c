@@ -3,19 +3,40 @@
 #include <avr/wdt.h>
 #include <avr/eeprom.h>
 
+#include "bootcopy.h"
+#include "uart_defs.h"
+
 uint16_t boot_key __attribute__((section (".noinit")));
-const uint8_t *valid_app_addr = (uint8_t *) (E2END - BOOTLOADER_EEPROM_SIZE);
+
+/* A cell of the application valid flag, a constant so that jump_check()
+ * needs neither .data nor .bss
+ */
+#define M_VALID_APP_ADDR(cell) \
+  ((uint8_t *) (uintptr_t) (JUMP_APP_VALID_ADDR + (cell)))
+
+static uint8_t m_app_valid_cell (void);
+static void m_app_valid_set (uint8_t app_valid);
 
 void jump_check (void)
 {
-  uint8_t valid_app = 0;
+#ifdef __AVR__
+  /* Naked, ahead of the startup code: the C code called from here needs
+   * __zero_reg__, which keeps its value across a watchdog reset
+   */
+  asm volatile ("clr __zero_reg__");
+#endif
 
-  /* Check to see if we should read BLE data from EEPROM */
-  valid_app = eeprom_read_byte (valid_app_addr);
+#ifdef SELF_UPDATE
+  /* A copy of a new bootloader that a reset cut short is finished first */
+  if (bootcopy_pending ())
+  {
+    bootcopy_run ();
+  }
+#endif
 
   if ((MCUSR & (1 << WDRF)) &&
       (boot_key == BOOTLOADER_KEY) &&
-      valid_app == 1)
+      jump_app_valid () == 1)
   {
     /* Clear watchdog reset flag and the boot key */
     MCUSR &= ~(1 << WDRF);
@@ -30,6 +51,59 @@ void jump_check (void)
   }
 }
 
+void jump_app_start (void)
+{
+  /* WDE can not be cleared while WDRF is set */
+  wdt_reset ();
+  MCUSR &= ~(1 << WDRF);
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = 0;
+  boot_key = 0;
+
+  SPCR = 0;
+  SPSR = 0;
+
+  UART_SRB = 0;
+  UART_SRA = 0;
+  UART_SRC = _BV(UCSZ00) | _BV(UCSZ01);
+  UART_SRL = 0;
+
+  TCCR1B = 0;
+  TCNT1 = 0;
+
+  /* Every pin back to an input without pull-up, the LED, the UART and the
+   * nRF8001 lines alike
+   */
+#ifdef DDRA
+  DDRA = 0;
+  PORTA = 0;
+#endif
+  DDRB = 0;
+  PORTB = 0;
+  DDRC = 0;
+  PORTC = 0;
+  DDRD = 0;
+  PORTD = 0;
+#ifdef DDRE
+  DDRE = 0;
+  PORTE = 0;
+  DDRF = 0;
+  PORTF = 0;
+  DDRG = 0;
+  PORTG = 0;
+  DDRH = 0;
+  PORTH = 0;
+  DDRJ = 0;
+  PORTJ = 0;
+  DDRK = 0;
+  PORTK = 0;
+  DDRL = 0;
+  PORTL = 0;
+#endif
+
+  ((void (*)(void)) 0x0000)();
+}
+
 void jump_boot_key_clear (void)
 {
   boot_key = 0;
@@ -40,12 +114,59 @@ void jump_boot_key_set (void)
   boot_key = BOOTLOADER_KEY;
 }
 
+/* The last cell written in the lap of the first one */
+static uint8_t m_app_valid_cell (void)
+{
+  const uint8_t lap = eeprom_read_byte (M_VALID_APP_ADDR (0)) &
+    JUMP_APP_VALID_LAP;
+  uint8_t cell = 1;
+
+  while (cell < JUMP_APP_VALID_CELLS &&
+         (eeprom_read_byte (M_VALID_APP_ADDR (cell)) &
+          JUMP_APP_VALID_LAP) == lap)
+  {
+    cell++;
+  }
+
+  return cell - 1;
+}
+
+/* A reset while the next cell is written leaves it erased, which reads as
+ * the flag before the change, or as not valid if the cell starts a lap of
+ * erased cells, never as a valid flag that was not set
+ */
+static void m_app_valid_set (uint8_t app_valid)
+{
+  uint8_t cell = m_app_valid_cell ();
+  uint8_t lap = eeprom_read_byte (M_VALID_APP_ADDR (0)) & JUMP_APP_VALID_LAP;
+
+  if (eeprom_read_byte (M_VALID_APP_ADDR (cell)) == (lap | app_valid))
+  {
+    return;
+  }
+
+  if (++cell == JUMP_APP_VALID_CELLS)
+  {
+    cell = 0;
+    lap ^= JUMP_APP_VALID_LAP;
+  }
+  eeprom_update_byte (M_VALID_APP_ADDR (cell), lap | app_valid);
+}
+
+uint8_t jump_app_valid (void)
+{
+  const uint8_t value =
+    eeprom_read_byte (M_VALID_APP_ADDR (m_app_valid_cell ()));
+
+  return value == 0xFF ? value : value & ~JUMP_APP_VALID_LAP;
+}
+
 void jump_app_key_clear (void)
 {
-  eeprom_write_byte ((uint8_t *)valid_app_addr, 0);
+  m_app_valid_set (0);
 }
 
 void jump_app_key_set (void)
 {
-  eeprom_write_byte ((uint8_t *)valid_app_addr, 1);
+  m_app_valid_set (1);
 }
@@ -4,6 +4,19 @@
 #define BOOTLOADER_KEY 0xDC42
 #define BOOTLOADER_EEPROM_SIZE 32
 
+/* The application valid flag, rotated over JUMP_APP_VALID_CELLS cells of
+ * EEPROM right below bootloader_config_t, so that no cell is rewritten on
+ * every update. Each change goes to the cell after the current one, with
+ * the flag in bits 0-6 and a lap in bit 7: the cells written in the current
+ * lap share bit 7 of the first cell, and the current cell is the last of
+ * them. A change that wraps around to the first cell flips the lap, and
+ * erased cells read as the end of a lap with the flag at 0x7F, not valid.
+ */
+#define JUMP_APP_VALID_CELLS 8
+#define JUMP_APP_VALID_ADDR \
+  (E2END - BOOTLOADER_EEPROM_SIZE - JUMP_APP_VALID_CELLS)
+#define JUMP_APP_VALID_LAP   0x80
+
 /* application_jump_check is placed in the .init3 section, which means it runs
  * before ordinary C code on reset.
  * We verify that the reset cause was a watchdog reset, and that boot_key
@@ -11,12 +24,23 @@
  */
 void jump_check (void) __attribute__ ((used, naked, section (".init3")));
 
+/* Start the application without a reset: the watchdog, SPI, UART, timer 1
+ * and I/O ports are left as a reset leaves them first. Call with the
+ * transports closed.
+ */
+void jump_app_start (void);
+
 /* Clear the boot_key variable */
 void jump_boot_key_clear (void);
 
 /* Set the boot_key variable */
 void jump_boot_key_set (void);
 
+/* The application valid flag: 1 for a valid application, 0 once a DFU has
+ * started, and 0xFF while the cells are erased
+ */
+uint8_t jump_app_valid (void);
+
 /* Clear the application valid flag */
 void jump_app_key_clear (void);
 
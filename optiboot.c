@@ -217,11 +217,12 @@ asm("  .section .version\n"
  */
 #include "boot.h"
 #include "jump.h"
+#include "sched.h"
+#include "watchdog.h"
 
 /* Bluetooth files */
-#include "BLE/bonding.h"
-#include "BLE/lib_aci.h"
-#include "BLE/aci_evts.h"
+#include "BLE/bootloader_config.h"
+#include "BLE/ble.h"
 #include "BLE/dfu.h"
 
 /* We don't use <avr/wdt.h> as those routines have interrupt overhead we don't
@@ -230,6 +231,8 @@ asm("  .section .version\n"
 
 #include "pin_defs.h"
 #include "stk500.h"
+#include "uart_defs.h"
+#include "uart_dfu.h"
 
 #ifndef LED_START_FLASHES
 #define LED_START_FLASHES 0
@@ -252,10 +255,6 @@ asm("  .section .version\n"
 #endif
 #endif
 
-#ifndef UART
-#define UART 0
-#endif
-
 #define BAUD_SETTING (( (F_CPU + BAUD_RATE * 4L) / ((BAUD_RATE * 8L))) - 1 )
 #define BAUD_ACTUAL (F_CPU/(8 * ((BAUD_SETTING)+1)))
 #define BAUD_ERROR (( 100*(BAUD_RATE - BAUD_ACTUAL) ) / BAUD_RATE)
@@ -294,6 +293,14 @@ asm("  .section .version\n"
 #endif /* baud rate fastn check */
 #endif
 
+/* STK_PROG_MULTI receives a page while the previous one is written, which
+ * needs the hardware UART, and does not patch the vectors of a virtual boot
+ * partition. It is built with MULTI_PAGE=1 only, as is STK_READ_MULTI.
+ */
+#if defined(MULTI_PAGE) && (defined(SOFT_UART) || defined(VIRTUAL_BOOT_PARTITION))
+#error MULTI_PAGE needs the hardware UART, and no virtual boot partition
+#endif
+
 /* Watchdog settings */
 #define WATCHDOG_OFF    (0)
 #define WATCHDOG_16MS   (_BV(WDE))
@@ -316,11 +323,19 @@ asm("  .section .version\n"
  */
 int main(void) __attribute__ ((OS_main)) __attribute__ ((section (".init9")));
 static void uart_update (void);
-static void ble_update (uint8_t *pipes);
+static void ble_task (void);
+static bool uart_task_ready (void);
+static void uart_task (void);
 static void putch(uint8_t ch);
 static uint8_t getch(void);
 static void getNch(uint8_t count);
+static uint16_t getAddress(void);
 static void verifySpace();
+static void checkSpace(uint8_t ch);
+#ifdef MULTI_PAGE
+static void multiPoll(void);
+static void multiWait(void);
+#endif
 static void flash_led(uint8_t count);
 static inline void watchdogReset();
 static void watchdogConfig(uint8_t x);
@@ -328,12 +343,6 @@ static void watchdogConfig(uint8_t x);
 static void uartDelay() __attribute__ ((naked));
 #endif
 
-/* BLE stuff */
-static struct aci_state_t aci_state;
-static uint8_t dfu_mode;
-uint16_t conn_timeout;
-uint16_t conn_interval;
-
 /*
  * NRWW memory
  * Addresses below NRWW (Non-Read-While-Write) can be programmed while
@@ -378,71 +387,46 @@ uint16_t conn_interval;
 /* C zero initialises all global variables. However, that requires */
 /* These definitions are NOT zero initialised, but that doesn't matter */
 /* This allows us to drop the zero init code, saving us memory */
-#define buff    ((uint8_t*)(RAMSTART))
 #ifdef VIRTUAL_BOOT_PARTITION
 #define rstVect (*(uint16_t*)(RAMSTART+SPM_PAGESIZE*2+4))
 #define wdtVect (*(uint16_t*)(RAMSTART+SPM_PAGESIZE*2+6))
 #endif
 
-/*
- * Handle devices with up to 4 uarts (eg m1280.)  Rather inelegantly.
- * Note that mega8/m32 still needs special handling, because ubrr is handled
- * differently.
+/* A page as it arrives on the UART: STK_PROG_PAGE receives it while an RWW
+ * page is erased, STK_PROG_MULTI while the previous one is written. It can
+ * no longer sit at RAMSTART, which .data and .bss of the BLE code take.
  */
-#if UART == 0
-# define UART_SRA UCSR0A
-# define UART_SRB UCSR0B
-# define UART_SRC UCSR0C
-# define UART_SRL UBRR0L
-# define UART_UDR UDR0
-#elif UART == 1
-#if !defined(UDR1)
-#error UART == 1, but no UART1 on device
-#endif
-# define UART_SRA UCSR1A
-# define UART_SRB UCSR1B
-# define UART_SRC UCSR1C
-# define UART_SRL UBRR1L
-# define UART_UDR UDR1
-#elif UART == 2
-#if !defined(UDR2)
-#error UART == 2, but no UART2 on device
-#endif
-# define UART_SRA UCSR2A
-# define UART_SRB UCSR2B
-# define UART_SRC UCSR2C
-# define UART_SRL UBRR2L
-# define UART_UDR UDR2
-#elif UART == 3
-#if !defined(UDR1)
-#error UART == 3, but no UART3 on device
-#endif
-# define UART_SRA UCSR3A
-# define UART_SRB UCSR3B
-# define UART_SRC UCSR3C
-# define UART_SRL UBRR3L
-# define UART_UDR UDR3
+static uint8_t  buff[SPM_PAGESIZE];
+#ifdef MULTI_PAGE
+static uint16_t multiCount;
 #endif
 
+/* Set once a DFU has started on BLE, UART is ignored from then on */
+static uint8_t ble_dfu_mode;
+
+/* The main loop, highest priority first: the SPI transfers the nRF8001
+ * asks for with RDYN, the events they bring, which carry the DFU packets,
+ * the flash work of the DFU once the SPM unit is done, the UART, and
+ * housekeeping in the gaps. The BLE tasks are never ready without a valid
+ * BLE configuration.
+ */
+static const sched_task_t main_tasks[] = {
+  {ble_spi_ready, ble_spi_service},
+  {ble_event_ready, ble_task},
+  {dfu_background_ready, dfu_background},
+  {uart_task_ready, uart_task},
+  {NULL, dfu_housekeeping},
+};
+
 /* In main we set up the hardware, read BLE information from EEPROM if it is
- * available, and then continuously poll on both the UART and the BLE link
- * for a hex file transfer. When valid activity is detected on either link,
- * we proceed with a transfer on that link
+ * available, and then run the tasks above, which poll both the UART and the
+ * BLE link for a hex file transfer. When valid activity is detected on
+ * either link, we proceed with a transfer on that link
  */
 int main (void)
 {
   uint8_t valid_ble;
-  uint8_t ch;
-  uint8_t pipes[3];
-
-  const uint16_t eeprom_base_addr   = E2END - BOOTLOADER_EEPROM_SIZE;
-
-  const uint8_t *valid_ble_addr     = (uint8_t *) (eeprom_base_addr + 1);
-  const uint8_t *pins_addr          = (uint8_t *) (eeprom_base_addr + 2);
-  const uint8_t *credit_addr        = (uint8_t *) (eeprom_base_addr + 14);
-  const uint8_t *pipes_addr         = (uint8_t *) (eeprom_base_addr + 15);
-  const uint8_t *conn_timeout_addr  = (uint8_t *) (eeprom_base_addr + 18);
-  const uint8_t *conn_interval_addr = (uint8_t *) (eeprom_base_addr + 20);
+  bootloader_config_t config;
 
   /* After the zero init loop, this is the first code to run.
    *
@@ -454,7 +438,9 @@ int main (void)
    * If not, uncomment the following instructions:
    * cli();
    */
+#ifdef __AVR__
   asm volatile ("clr __zero_reg__");
+#endif
 #if defined(__AVR_ATmega8__) || defined (__AVR_ATmega32__)
   SP=RAMEND;  /* This is done by hardware reset */
 #endif
@@ -477,12 +463,11 @@ int main (void)
 #endif
 #endif
 
-  /* Set up watchdog to trigger after 4s if possible, otherwise after 2s. */
-#ifndef __AVR_ATmega8__
-  watchdogConfig(WATCHDOG_4S);
-#else
-  watchdogConfig(WATCHDOG_2S);
-#endif
+  /* Log a reset that cost a transfer, then set up the watchdog to trigger
+   * after 4s if possible, otherwise after 2s.
+   */
+  watchdog_log_reset ();
+  watchdog_phase_set (WATCHDOG_PHASE_IDLE);
 
 #if (LED_START_FLASHES > 0) || defined(LED_DATA_FLASH)
   /* Set LED pin as output */
@@ -499,162 +484,68 @@ int main (void)
   flash_led(LED_START_FLASHES * 2);
 #endif
 
-  /* Check to see if we should read BLE data from EEPROM */
-  valid_ble = eeprom_read_byte (valid_ble_addr);
+  /* Read the BLE configuration from EEPROM. If it is missing or corrupt, the
+   * pins can not be trusted, so BLE is left alone and only UART is used.
+   */
+  valid_ble = bootloader_config_read (&config);
 
   if (valid_ble == 1)
   {
-    /* Read pin data */
-    eeprom_read_block ((void *) &aci_state.aci_pins, pins_addr,
-        sizeof(aci_pins_t));
-
-    /* Read credit data */
-    aci_state.data_credit_total = eeprom_read_byte (credit_addr);
-    aci_state.data_credit_available = aci_state.data_credit_total;
-
-    /* Read pipe data */
-    eeprom_read_block ((void *) &pipes, pipes_addr, 3);
-
-    /* Read connection timeout */
-    eeprom_read_block ((void *) &conn_timeout, conn_timeout_addr, 2);
-
-    /* Read connection advertise interval */
-    eeprom_read_block ((void *) &conn_interval, conn_interval_addr, 2);
-
-    lib_aci_init (&aci_state);
-
-    dfu_init (pipes);
+    ble_init (&config);
   }
 
   jump_boot_key_set ();
 
-  for (;;) {
-    /* We grab the value in the UDR register without looping, as we need to do
-     * a non-blocking read in the event that UART is disabled. This is okay
-     * since we validate the data we pull before acting on it. */
-    ch = UART_UDR;
-
-    /* Try to get an ACI event from the BLE device. If the event indicates the
-     * start of a BLE transfer, we proceed to use BLE for the lifetime of the
-     * program.
-     * If not we, check if the character received on UART is a sync event. If
-     * this is the case, we use UART for the lifetime of the program.
-    */
-    if (valid_ble == 1) {
-      do {
-        ble_update (pipes);
-      } while (dfu_mode);
-    }
-
-    if (ch == STK_GET_SYNC) {
-      verifySpace ();
-      uart_update ();
-    }
-  }
+  sched_run (main_tasks, sizeof (main_tasks) / sizeof (main_tasks[0]));
 }
 
-/* Get and process events from the BLE link. If we detect an event indicating
- * that we are about to receive a new firmware image on BLE we set "ble_mode"
- * to a true value.
+/* Handle an ACI event. If it starts a BLE transfer, we use BLE for the
+ * lifetime of the program.
  */
-static void ble_update (uint8_t *pipes)
+static void ble_task (void)
 {
-  hal_aci_evt_t aci_data;
-  aci_evt_t *aci_evt;
-  uint8_t pipe;
-  uint8_t eeprom_status = 0xFF;
-
-  const uint8_t *bond_status_addr     = (uint8_t *) (0);
+  ble_dfu_mode = ble_update ();
+}
 
-  /* Attempt to grab an event from the BLE message queue */
-  if (!lib_aci_event_get(&aci_state, &aci_data)) {
-    return;
+/* A character is arriving on the UART */
+static bool uart_task_ready (void)
+{
+  if (ble_dfu_mode) {
+    return false;
   }
+#ifdef SOFT_UART
+  /* The start bit */
+  return !(UART_PIN & _BV(UART_RX_BIT));
+#else
+  return UART_SRA & _BV(RXC0);
+#endif
+}
 
-  aci_evt = &(aci_data.evt);
-
-  switch(aci_evt->evt_opcode) {
-    case ACI_EVT_DEVICE_STARTED:
-      aci_state.data_credit_total =
-        aci_evt->params.device_started.credit_available;
-      if (aci_evt->params.device_started.device_mode == ACI_DEVICE_STANDBY) {
-        if (aci_evt->params.device_started.hw_error) {
-            /* Magic number used to make sure the HW error event
-             * is handled correctly. */
-            _delay_ms (20);
-        }
-        else
-        {
-          /* Check to see if we should read bond data from EEPROM */
-          eeprom_read_block ((void *) &eeprom_status, bond_status_addr, 1);
-
-          if (eeprom_status != 0xFF)
-          {
-            bond_data_restore (&aci_state, eeprom_status);
-          }
-
-          lib_aci_connect (conn_timeout, conn_interval);
-        }
-      }
-      break; /* ACI_EVT_DEVICE_STARTED */
-
-    case ACI_EVT_CMD_RSP:
-      if ((aci_evt->params.cmd_rsp.cmd_opcode == ACI_CMD_RADIO_RESET) &&
-          (aci_evt->params.cmd_rsp.cmd_status == ACI_STATUS_SUCCESS))
-      {
-        lib_aci_connect (conn_timeout, conn_interval);
-      }
-      break; /* ACI_EVT_CMD_RSP */
-
-    case ACI_EVT_CONNECTED:
-      watchdogReset();
-      /* We should have checked that this is true before we jumped into
-       * the bootloader. Hopefully we did.
-       */
-      aci_state.data_credit_available = aci_state.data_credit_total;
-      break; /* ACI_EVT_CONNECTED */
-
-    case ACI_EVT_DISCONNECTED:
-      lib_aci_connect (conn_timeout, conn_interval);
-      break; /* ACI_EVT_DISCONNECTED */
-
-    case ACI_EVT_DATA_CREDIT:
-      watchdogReset();
-      aci_state.data_credit_available = aci_state.data_credit_available +
-                                        aci_evt->params.data_credit.credit;
-      break; /* ACI_EVT_DATA_CREDIT */
-
-    case ACI_EVT_PIPE_ERROR:
-      watchdogReset();
-      /* If we received a pipe error, some message got borked.
-       * All we can do is update our credit to reflect it
-       */
-      if (aci_evt->params.pipe_error.error_code !=
-          ACI_STATUS_ERROR_PEER_ATT_ERROR) {
-        aci_state.data_credit_available++;
-      }
-      break; /* ACI_EVT_PIPE_ERROR */
-
-    case ACI_EVT_DATA_RECEIVED:
-      watchdogReset();
-      /* If data received is on either of the DFU pipes, we enter DFU mode.
-       * We then update the DFU state machine to run the transfer.
-       */
-      pipe = aci_evt->params.data_received.rx_data.pipe_number;
-      if (pipe == pipes[0] || pipe == pipes[2]) {
-        if (!dfu_mode) {
-          dfu_mode = 1;
-        }
+/* If the character received on UART is a sync event, we use UART for the
+ * lifetime of the program. Anything else is dropped.
+ */
+static void uart_task (void)
+{
+  uint8_t ch;
 
-        dfu_update(&aci_state, aci_evt);
-      }
-      break; /* ACI_EVT_DATA_RECEIVED */
+#ifdef SOFT_UART
+  ch = getch ();
+#else
+  /* Read without getch(), so that noise does not reset the watchdog */
+  ch = UART_UDR;
+#endif
 
-    default:
-      break;
+  if (ch == STK_GET_SYNC) {
+    verifySpace ();
+    uart_update ();
   }
 
-  return;
+#ifdef UART_DFU
+  /* The same DFU as over BLE, in frames, see uart_dfu.h */
+  if (uart_dfu_hello (ch)) {
+    uart_dfu_run ();
+  }
+#endif
 }
 
 /* If main() detects a firmware transfer on UART, this function is run in a
@@ -683,6 +574,13 @@ static void uart_update (void)
 	putch(OPTIBOOT_MINVER);
       } else if (which == 0x81) {
 	  putch(OPTIBOOT_MAJVER);
+#ifdef MULTI_PAGE
+      } else if (which == Parm_STK_MULTI_PAGE) {
+	/*
+	 * Announce STK_PROG_MULTI and STK_READ_MULTI, with the page size
+	 */
+	putch(SPM_PAGESIZE / 2);
+#endif
       } else {
 	/*
 	 * GET PARAMETER returns a generic 0x03 reply for
@@ -701,15 +599,7 @@ static void uart_update (void)
     }
     else if(ch == STK_LOAD_ADDRESS) {
       // LOAD ADDRESS
-      uint16_t newAddress;
-      newAddress = getch();
-      newAddress = (newAddress & 0xff) | (getch() << 8);
-#ifdef RAMPZ
-      // Transfer top bit to RAMPZ
-      RAMPZ = (newAddress & 0x8000) ? 1 : 0;
-#endif
-      newAddress += newAddress; // Convert from word address to byte address
-      address = newAddress;
+      address = getAddress();
       verifySpace();
     }
     else if(ch == STK_UNIVERSAL) {
@@ -732,8 +622,9 @@ static void uart_update (void)
 
       // While that is going on, read in page contents
       bufPtr = buff;
+      ch = length;
       do *bufPtr++ = getch();
-      while (--length);
+      while (--ch);
 
       // If we are in NRWW section, page erase has to be delayed until now.
       // Todo: Take RAMPZ into account (not doing so just means that we will
@@ -767,17 +658,22 @@ static void uart_update (void)
       }
 #endif
 
-      // Copy buffer into programming buffer
+      // Copy the bytes received into the programming buffer, the high byte
+      // of an odd last word stays erased
       bufPtr = buff;
       addrPtr = (uint16_t)(void*)address;
-      ch = SPM_PAGESIZE / 2;
       do {
         uint16_t a;
         a = *bufPtr++;
-        a |= (*bufPtr++) << 8;
+        if (--length) {
+          a |= (*bufPtr++) << 8;
+          --length;
+        } else {
+          a |= 0xff00;
+        }
         __boot_page_fill_short((uint16_t)(void*)addrPtr,a);
         addrPtr += 2;
-      } while (--ch);
+      } while (length);
 
       // Write from programming buffer
       __boot_page_write_short((uint16_t)(void*)address);
@@ -789,12 +685,90 @@ static void uart_update (void)
 #endif
 
     }
+#ifdef MULTI_PAGE
+    /* Write count pages from a word address, see stk500.h. Each page is
+     * collected in RAM and loaded into the programming buffer at once, and
+     * the next one is received while it is erased and written. Every page
+     * written is answered with STK_OK, and the host sends no more than one
+     * page ahead of those, so the buffer is free for it at any baud rate.
+     */
+    else if(ch == STK_PROG_MULTI) {
+      uint8_t count;
+      uint16_t i;
+
+      address = getAddress();
+      count = getch();
+      if (!count) {
+        // Treated like a bad command
+        watchdogConfig(WATCHDOG_16MS);
+        while (1);
+      }
+      multiCount = 0;
+      do {
+        while (multiCount < SPM_PAGESIZE) {
+          buff[multiCount++] = getch();
+        }
+
+        // Bytes of the next page may be stored from the start of the
+        // buffer right away, the words are loaded far faster than they
+        // arrive
+        multiCount = 0;
+        for (i = 0; i < SPM_PAGESIZE; i += 2) {
+          __boot_page_fill_short((uint16_t)(void*)(address + i),
+              buff[i] | (buff[i + 1] << 8));
+          multiPoll();
+        }
+
+        __boot_page_erase_short((uint16_t)(void*)address);
+        multiWait();
+        __boot_page_write_short((uint16_t)(void*)address);
+        multiWait();
+        putch(STK_OK);
+
+        address += SPM_PAGESIZE;
+#ifdef RAMPZ
+        if (!address) {
+          RAMPZ++;
+        }
+#endif
+      } while (--count);
+
+#if defined(RWWSRE)
+      // Reenable read access to flash
+      boot_rww_enable();
+#endif
+
+      // The command terminator may have come in with the last page
+      checkSpace(multiCount ? buff[0] : getch());
+    }
+#endif
     /* Read memory block mode, length is big endian.  */
-    else if(ch == STK_READ_PAGE) {
-      // READ PAGE - we only read flash
-      getch();			/* getlen() */
-      length = getch();
-      getch();
+    else if(ch == STK_READ_PAGE
+#ifdef MULTI_PAGE
+            || ch == STK_READ_MULTI
+#endif
+           ) {
+      uint16_t count;
+
+#ifdef MULTI_PAGE
+      if (ch == STK_READ_MULTI) {
+        // READ MULTI - count pages from a word address, see stk500.h
+        address = getAddress();
+        count = (uint16_t)getch() * SPM_PAGESIZE;
+        if (!count) {
+          // Treated like a bad command
+          watchdogConfig(WATCHDOG_16MS);
+          while (1);
+        }
+      }
+      else
+#endif
+      {
+        // READ PAGE - we only read flash
+        count = getch() << 8;	/* getlen() */
+        count |= getch();
+        getch();
+      }
 
       verifySpace();
       do {
@@ -806,6 +780,9 @@ static void uart_update (void)
         else if (address == 9) ch=wdtVect >> 8;
         else ch = pgm_read_byte_near(address);
         address++;
+#elif !defined(__AVR__)
+        // The host simulator reads its model of the flash
+        ch = boot_flash_read(address++);
 #elif defined(RAMPZ)
         // Since RAMPZ should already be set, we need to use EPLM directly.
         // Also, we can use the autoincrement version of lpm to update "address"
@@ -818,7 +795,7 @@ static void uart_update (void)
         __asm__ ("lpm %0,Z+\n" : "=r" (ch), "=z" (address): "1" (address));
 #endif
         putch(ch);
-      } while (--length);
+      } while (--count);
     }
 
     /* Get device signature bytes  */
@@ -966,9 +943,28 @@ static void getNch(uint8_t count)
   verifySpace();
 }
 
+/* Read a word address, and return it as a byte address */
+static uint16_t getAddress(void)
+{
+  uint16_t newAddress;
+  newAddress = getch();
+  newAddress = (newAddress & 0xff) | (getch() << 8);
+#ifdef RAMPZ
+  // Transfer top bit to RAMPZ
+  RAMPZ = (newAddress & 0x8000) ? 1 : 0;
+#endif
+  newAddress += newAddress; // Convert from word address to byte address
+  return newAddress;
+}
+
 static void verifySpace()
 {
-  if (getch() != CRC_EOP) {
+  checkSpace(getch());
+}
+
+static void checkSpace(uint8_t ch)
+{
+  if (ch != CRC_EOP) {
     /* Shorten WD timeout and busy-loop until reset */
     watchdogConfig(WATCHDOG_16MS);
     while (1);
@@ -976,6 +972,31 @@ static void verifySpace()
   putch(STK_INSYNC);
 }
 
+#ifdef MULTI_PAGE
+/* Store a byte of the next page, if one has arrived. A byte that finds the
+ * buffer full was sent ahead of the STK_OK of the page before, and is
+ * treated like a bad command.
+ */
+static void multiPoll(void)
+{
+  if (UART_SRA & _BV(RXC0)) {
+    if (multiCount == SPM_PAGESIZE) {
+      watchdogConfig(WATCHDOG_16MS);
+      while (1);
+    }
+    buff[multiCount++] = UART_UDR;
+  }
+}
+
+/* Wait for the SPM unit, receiving meanwhile */
+static void multiWait(void)
+{
+  while (boot_spm_busy()) {
+    multiPoll();
+  }
+}
+#endif
+
 #if LED_START_FLASHES > 0
 static void flash_led(uint8_t count)
 {
@@ -996,9 +1017,11 @@ static void flash_led(uint8_t count)
 /* Watchdog functions. These are only safe with interrupts turned off. */
 static void watchdogReset()
 {
+#ifdef __AVR__
   __asm__ __volatile__ (
     "wdr\n"
   );
+#endif
 }
 
 static void watchdogConfig(uint8_t x)
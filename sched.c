@@ -0,0 +1,47 @@
+#include "sched.h"
+
+#include <string.h>
+#include <avr/io.h>
+
+#ifdef SCHED_STATS
+sched_stats_t sched_stats[SCHED_TASKS_MAX];
+#endif
+
+uint8_t sched_step (const sched_task_t *p_tasks, uint8_t count)
+{
+#ifdef SCHED_STATS
+  uint16_t start;
+#endif
+  uint8_t i;
+
+  for (i = 0; i < count; i++)
+  {
+    if (!p_tasks[i].ready || p_tasks[i].ready ())
+    {
+#ifdef SCHED_STATS
+      start = TCNT1;
+      p_tasks[i].run ();
+      sched_stats[i].ticks += (uint16_t) (TCNT1 - start);
+      sched_stats[i].runs++;
+#else
+      p_tasks[i].run ();
+#endif
+      break;
+    }
+  }
+
+  return i;
+}
+
+void sched_run (const sched_task_t *p_tasks, uint8_t count)
+{
+  TCCR1B = _BV(CS12) | _BV(CS10);
+#ifdef SCHED_STATS
+  memset (sched_stats, 0, sizeof (sched_stats));
+#endif
+
+  for (;;)
+  {
+    sched_step (p_tasks, count);
+  }
+}
@@ -0,0 +1,53 @@
+/* Run-to-completion scheduler of the bootloader's main loop.
+ *
+ * Tasks are listed highest priority first. Every turn runs the first task
+ * whose ready() holds, to completion, and starts over from the top, so a
+ * task only runs while every task above it has nothing to do. ready()
+ * polls the status the task waits for, such as RDYN, SPMEN or RXC; no
+ * interrupts are used. A task without ready() is always ready, and belongs
+ * last, where it fills the gaps.
+ */
+
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Tasks a table may hold */
+#ifndef SCHED_TASKS_MAX
+#define SCHED_TASKS_MAX  5
+#endif
+
+typedef struct
+{
+  bool (*ready) (void);
+  void (*run) (void);
+} sched_task_t;
+
+#ifdef SCHED_STATS
+/* Per task of the running table. Time is in ticks of timer 1, 1024 CPU
+ * cycles each; a run shorter than a tick counts one when it spans a tick
+ * boundary, so the sum over many runs still measures the time spent.
+ */
+typedef struct
+{
+  uint32_t runs;
+  uint32_t ticks;
+} sched_stats_t;
+
+extern sched_stats_t sched_stats[SCHED_TASKS_MAX];
+#endif
+
+/* Run the first ready task of count. Returns its index, or count if none
+ * was ready.
+ */
+uint8_t sched_step (const sched_task_t *p_tasks, uint8_t count);
+
+/* Start timer 1 and clear the statistics, if kept, then run the tasks for
+ * good
+ */
+void sched_run (const sched_task_t *p_tasks, uint8_t count)
+  __attribute__ ((noreturn));
+
+#endif /* SCHED_H_ */
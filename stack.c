@@ -0,0 +1,41 @@
+#include "stack.h"
+
+#include <string.h>
+
+void stack_paint (void)
+{
+#ifdef __AVR__
+  /* No stack and no __zero_reg__ yet, so only the registers named here */
+  asm volatile (
+    "  ldi r30, lo8(_end)\n"
+    "  ldi r31, hi8(_end)\n"
+    "  ldi r24, %0\n"
+    "  ldi r25, hi8(%1)\n"
+    "1:\n"
+    "  st Z+, r24\n"
+    "  cpi r30, lo8(%1)\n"
+    "  cpc r31, r25\n"
+    "  brlo 1b\n"
+    "  breq 1b\n"
+    :: "M" (STACK_PAINT), "i" (RAMEND));
+#else
+  memset (STACK_START, STACK_PAINT, stack_size ());
+#endif
+}
+
+uint16_t stack_size (void)
+{
+  return STACK_END + 1 - STACK_START;
+}
+
+uint16_t stack_unused (void)
+{
+  const uint8_t *p = STACK_START;
+
+  while (p <= STACK_END && *p == STACK_PAINT)
+  {
+    p++;
+  }
+
+  return p - STACK_START;
+}
@@ -0,0 +1,47 @@
+/* Stack painting, to find out how deep the stack has ever grown.
+ *
+ * The RAM between the end of the statics (.data, .bss and .noinit) and
+ * RAMEND holds nothing but the stack. stack_paint() fills it with
+ * STACK_PAINT before anything runs; the stack overwrites the paint as it
+ * grows down, and the paint left at the bottom is the margin that was never
+ * used. A stack byte that happens to hold STACK_PAINT makes the margin look
+ * at most that much larger.
+ *
+ * Built with STACK_REPORT=1 only, for the memory request of the DFU.
+ */
+
+#ifndef STACK_H_
+#define STACK_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#define STACK_PAINT  0xC5
+
+/* The stack area, first and last byte. The host build points it elsewhere
+ * (see tests/host/host_avr.h).
+ */
+#ifndef STACK_START
+extern uint8_t _end;
+#define STACK_START  (&_end)
+#define STACK_END    ((uint8_t *) RAMEND)
+#endif
+
+#ifdef __AVR__
+/* Runs from .init1, first thing after reset and before anything is on the
+ * stack. Never called.
+ */
+void stack_paint (void) __attribute__ ((used, naked, section (".init1")));
+#else
+void stack_paint (void);
+#endif
+
+/* Bytes between the statics and RAMEND */
+uint16_t stack_size (void);
+
+/* Bytes at the bottom of the stack area still painted: the margin that was
+ * left at the deepest the stack has been since reset
+ */
+uint16_t stack_unused (void);
+
+#endif /* STACK_H_ */
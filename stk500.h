@@ -37,3 +37,24 @@
 #define STK_READ_OSCCAL     0x76  /* 'v' */
 #define STK_READ_FUSE_EXT   0x77  /* 'w' */
 #define STK_READ_OSCCAL_EXT 0x78  /* 'x' */
+
+/* Optiboot extensions, not known to AVRDUDE.
+ *
+ * STK_PROG_MULTI addr_lo addr_hi count page[count] CRC_EOP
+ *   Write count flash pages of SPM_PAGESIZE bytes from the word address
+ *   addr. Each page is answered with STK_OK once it is written, and
+ *   CRC_EOP with STK_INSYNC STK_OK. The host sends a page, or CRC_EOP,
+ *   only while at most one page is unanswered.
+ * STK_READ_MULTI addr_lo addr_hi count CRC_EOP
+ *   Read count flash pages from the word address addr, answered with
+ *   STK_INSYNC page[count] STK_OK.
+ *
+ * count is 1 to 255, 0 is treated like a bad command.
+ *
+ * STK_GET_PARAMETER Parm_STK_MULTI_PAGE returns SPM_PAGESIZE / 2 if both are
+ * supported, in a bootloader built with MULTI_PAGE=1. Bootloaders without
+ * them return 0x03, as for any parameter they do not know.
+ */
+#define STK_PROG_MULTI      0x7A  /* 'z' */
+#define STK_READ_MULTI      0x7B  /* '{' */
+#define Parm_STK_MULTI_PAGE 0xA0
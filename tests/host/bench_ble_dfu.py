@@ -0,0 +1,153 @@
+#!/usr/bin/env python3
+"""DFU throughput benchmark on the host simulator.
+
+Runs tools/ble_dfu.py against ble_sim for every combination of packet
+receipt notification interval (PRN), connection interval, ACI queue sizes
+and nRF8001 data credits, and writes one CSV row per run. The ACI queue
+sizes are fixed at compile time, so each pair of TX and RX queue sizes is
+a separate ble_sim build, given as --sim TX,RX=PATH. The client keeps up to two PRN intervals of
+packets in flight, or relies on link flow control alone for a PRN of 0.
+
+Columns:
+    prn, interval_us, tx_queue_size, rx_queue_size, credits
+                      the parameters
+    bytes_per_s       image bytes over the time from Receive firmware image
+                      to its response, as seen by the client
+    events            connection events over the same time
+    spm_stall_pct     share of the whole run spent waiting on SPM
+    rx_queue_full     event checks skipped by hal_aci_tl.c for a full RX
+                      queue
+    latency_avg       average cycles from the write of a packet to its
+                      transfer to the AVR
+    result            ok, or why the DFU failed, in which case the
+                      measurements are left empty
+
+    make -C tests/host bench
+"""
+
+import argparse
+import concurrent.futures
+import csv
+import itertools
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', 'tools'))
+
+import ble_dfu  # noqa: E402
+
+APPLICATION = os.path.join(HERE, '..', 'test_application.hex')
+
+COLUMNS = ['prn', 'interval_us', 'tx_queue_size', 'rx_queue_size', 'credits',
+           'bytes_per_s', 'events', 'spm_stall_pct', 'rx_queue_full', 'latency_avg', 'result']
+
+REPORT = {
+    'spm_stall_pct': r'SPM stall cycles \(([0-9.]+)%\)',
+    'rx_queue_full': r'(\d+) event checks with the RX queue full',
+    'latency_avg': r'packet latency \d+/(\d+)/\d+ cycles',
+}
+
+
+def bench(sim, eeprom, image, prn, interval_us, credits):
+    """One DFU, returns the CSV fields it measured"""
+    with tempfile.TemporaryDirectory() as tmp:
+        sock = os.path.join(tmp, 'sock')
+        proc = subprocess.Popen([sim, '--socket', sock, '--eeprom', eeprom,
+                                 '--interval-us', str(interval_us),
+                                 '--credits', str(credits)],
+                                stdout=subprocess.PIPE, universal_newlines=True)
+        try:
+            for _ in range(500):
+                if os.path.exists(sock):
+                    break
+                time.sleep(0.01)
+            link = ble_dfu.SimLink(sock)
+            try:
+                events, time_us = ble_dfu.DfuClient(link, prn, 2 * prn).run(image)
+            except (ble_dfu.DfuError, ble_dfu.Disconnected) as e:
+                return {'result': str(e) or type(e).__name__}
+            finally:
+                link.close()
+            report, _ = proc.communicate(timeout=600)
+        finally:
+            if proc.poll() is None:
+                proc.kill()
+                proc.wait()
+    if proc.returncode != 0:
+        return {'result': 'simulator exit status %d' % proc.returncode}
+
+    fields = {'bytes_per_s': round(len(image) * 1e6 / time_us), 'events': events,
+              'result': 'ok'}
+    for name, pattern in REPORT.items():
+        match = re.search(pattern, report)
+        if not match:
+            raise ble_dfu.DfuError('%s: no %s in report' % (sim, name))
+        fields[name] = match.group(1)
+    return fields
+
+
+def numbers(text):
+    return [int(n) for n in text.split(',')]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--eeprom', required=True,
+                        help='EEPROM image with the bootloader configuration')
+    parser.add_argument('--sim', action='append', required=True,
+                        metavar='TX,RX=PATH',
+                        help='ble_sim built with ACI_TX_QUEUE_SIZE=TX and '
+                             'ACI_RX_QUEUE_SIZE=RX, repeatable')
+    parser.add_argument('--prn', type=numbers, default=[0, 1, 5, 10, 20],
+                        help='PRN values (%(default)s)')
+    parser.add_argument('--interval-us', type=numbers, default=[7500, 15000, 30000],
+                        help='connection intervals (%(default)s)')
+    parser.add_argument('--credits', type=numbers, default=[1, 2, 4],
+                        help='nRF8001 data credits (%(default)s)')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count() or 1,
+                        help='runs in parallel (%(default)s)')
+    parser.add_argument('-o', '--output', help='CSV file, standard output if not given')
+    args = parser.parse_args()
+
+    sims = []
+    for spec in args.sim:
+        sizes, _, path = spec.partition('=')
+        sizes = sizes.split(',')
+        if len(sizes) != 2 or not all(n.isdigit() for n in sizes) or not path:
+            parser.error('--sim takes TX,RX=PATH, not %s' % spec)
+        sims.append((int(sizes[0]), int(sizes[1]), path))
+
+    image = ble_dfu.read_hex(APPLICATION)
+    runs = [(prn, interval_us, tx_size, rx_size, credits, path)
+            for (tx_size, rx_size, path), prn, interval_us, credits
+            in itertools.product(sims, args.prn, args.interval_us, args.credits)]
+
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        results = pool.map(lambda run: bench(run[5], args.eeprom, image,
+                                             run[0], run[1], run[4]), runs)
+        out = open(args.output, 'w', newline='') if args.output else sys.stdout
+        try:
+            writer = csv.DictWriter(out, COLUMNS)
+            writer.writeheader()
+            for (prn, interval_us, tx_size, rx_size, credits, _), fields \
+                    in zip(runs, results):
+                fields.update(prn=prn, interval_us=interval_us,
+                              tx_queue_size=tx_size, rx_queue_size=rx_size,
+                              credits=credits)
+                writer.writerow(fields)
+        finally:
+            if out is not sys.stdout:
+                out.close()
+
+    if args.output:
+        print('bench_ble_dfu: %d runs written to %s' % (len(runs), args.output))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""Image preparation benchmark of the DFU tools.
+
+Times the steps between an Intel HEX file and the packets that go out,
+for each of the test HEX files, as CSV. The CRC-16 and packetizing are
+timed both the way tools/ble_dfu.py used to do them, a CRC bit-twiddled
+per byte and a list of every packet, and the way it does now, through
+CRC16_TABLE and a generator of views into the image. The packet file of
+tools/dfu_pack.py is timed from writing to sending its last packet, which
+leaves opening it as all the preparation a DFU has to do.
+
+Columns:
+    hex               the HEX file
+    image_bytes       size of the flat image
+    read_hex_ms       parsing the HEX file
+    crc_bitwise_ms    CRC-16 as crc16_compute() in BLE/crc16.c, in Python
+    crc_table_ms      CRC-16 through CRC16_TABLE
+    packets_list_ms   all packets of 20 bytes copied into a list
+    packets_view_ms   the same packets from ble_dfu.packets()
+    pack_ms           writing the packet file
+    replay_ms         opening the packet file and taking all its packets
+
+Every figure is the best of --repeat runs.
+
+    make -C tests/host bench-prep
+"""
+
+import argparse
+import csv
+import os
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', 'tools'))
+
+import ble_dfu  # noqa: E402
+
+HEX_FILES = [os.path.join(HERE, '..', name)
+             for name in ('test_application.hex', 'dfu_application.hex')]
+
+COLUMNS = ['hex', 'image_bytes', 'read_hex_ms', 'crc_bitwise_ms',
+           'crc_table_ms', 'packets_list_ms', 'packets_view_ms', 'pack_ms',
+           'replay_ms']
+
+
+def crc16_bitwise(data, crc=0xFFFF):
+    """crc16_compute() of tools/ble_dfu.py before CRC16_TABLE"""
+    for byte in data:
+        crc = ((crc >> 8) | (crc << 8)) & 0xFFFF
+        crc ^= byte
+        crc ^= (crc & 0xFF) >> 4
+        crc ^= (crc << 12) & 0xFFFF
+        crc ^= ((crc & 0xFF) << 5) & 0xFFFF
+    return crc
+
+
+def best_ms(repeat, step):
+    """Fastest of repeat runs of step(), in milliseconds, and its result"""
+    best = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = step()
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return '%.3f' % (best * 1000), result
+
+
+def replay(path):
+    """Open a packet file and take every packet of it"""
+    with ble_dfu.PacketFile(path) as packet_file:
+        count = 0
+        for _ in ble_dfu.packets(packet_file.image, ble_dfu.DFU_PACKET_SIZE):
+            count += 1
+        return count
+
+
+def bench(path, repeat, tmp):
+    fields = {'hex': os.path.basename(path)}
+    fields['read_hex_ms'], image = best_ms(repeat, lambda: ble_dfu.read_hex(path))
+    fields['image_bytes'] = len(image)
+
+    fields['crc_bitwise_ms'], crc_bitwise = best_ms(
+        repeat, lambda: crc16_bitwise(image))
+    fields['crc_table_ms'], crc_table = best_ms(
+        repeat, lambda: ble_dfu.crc16_compute(image))
+    if crc_bitwise != crc_table:
+        raise ble_dfu.DfuError('%s: CRC 0x%04x through the table, 0x%04x bitwise' %
+                               (path, crc_table, crc_bitwise))
+
+    size = ble_dfu.DFU_PACKET_SIZE
+    fields['packets_list_ms'], _ = best_ms(
+        repeat, lambda: len([image[i:i + size]
+                             for i in range(0, len(image), size)]))
+    fields['packets_view_ms'], _ = best_ms(
+        repeat, lambda: sum(1 for _ in ble_dfu.packets(image, size)))
+
+    packet_path = os.path.join(tmp, fields['hex'] + '.dfu')
+    fields['pack_ms'], _ = best_ms(
+        repeat, lambda: ble_dfu.write_packet_file(
+            packet_path, image, ble_dfu.DFU_IMAGE_APPLICATION,
+            ble_dfu.init_packet(image)))
+    fields['replay_ms'], _ = best_ms(repeat, lambda: replay(packet_path))
+    return fields
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('hex', nargs='*', default=HEX_FILES,
+                        help='HEX files (the test applications)')
+    parser.add_argument('--repeat', type=int, default=5,
+                        help='runs of every step (%(default)s)')
+    parser.add_argument('-o', '--output', help='CSV file, standard output if not given')
+    args = parser.parse_args()
+
+    if args.repeat < 1:
+        parser.error('--repeat must be at least 1')
+
+    try:
+        with tempfile.TemporaryDirectory() as tmp:
+            rows = [bench(path, args.repeat, tmp) for path in args.hex]
+    except (ble_dfu.DfuError, OSError) as e:
+        print('bench_image_prep: %s' % (e,), file=sys.stderr)
+        return 1
+
+    out = open(args.output, 'w', newline='') if args.output else sys.stdout
+    try:
+        writer = csv.DictWriter(out, COLUMNS)
+        writer.writeheader()
+        writer.writerows(rows)
+    finally:
+        if out is not sys.stdout:
+            out.close()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""STK500 upload benchmark on the host simulator.
+
+Uploads and verifies tests/test_application.hex with tools/stk500_upload.py
+on stk500_sim for every combination of adapter latency and flow, one page
+per command as AVRDUDE does or the multi-page extension with a number of
+pages per command, and writes one CSV row per run.
+
+Columns:
+    latency_us        turnaround of the serial adapter, see uart_sim.c
+    flow              classic, or multi with pages pages per command
+    pages             pages per multi-page command, empty for classic
+    seconds           simulated time from reset to the application
+    bytes_per_s       image bytes over that time
+    cycles_per_page   cycles from one page write to the next
+    turnarounds       times the client's bytes found the bootloader idle
+    result            ok, or why the upload failed, in which case the
+                      measurements are left empty
+
+    make -C tests/host bench-stk500
+"""
+
+import argparse
+import concurrent.futures
+import csv
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', 'tools'))
+
+import ble_dfu  # noqa: E402
+import stk500_upload  # noqa: E402
+
+APPLICATION = os.path.join(HERE, '..', 'test_application.hex')
+
+COLUMNS = ['latency_us', 'flow', 'pages', 'seconds', 'bytes_per_s',
+           'cycles_per_page', 'turnarounds', 'result']
+
+
+def bench(sim, baud, image, latency_us, pages):
+    """One upload, returns the CSV fields it measured"""
+    mode = 'multi' if pages else 'classic'
+    with tempfile.TemporaryDirectory() as tmp:
+        tty = os.path.join(tmp, 'tty')
+        proc = subprocess.Popen([sim, '--link', tty, '--baud', str(baud),
+                                 '--latency-us', str(latency_us)],
+                                stdout=subprocess.PIPE, universal_newlines=True)
+        try:
+            for _ in range(500):
+                if os.path.exists(tty):
+                    break
+                time.sleep(0.01)
+            stk = stk500_upload.Stk500(tty, baud)
+            try:
+                stk500_upload.upload(stk, image, mode, pages or 1, True)
+            except (ble_dfu.DfuError, OSError) as e:
+                return {'result': str(e) or type(e).__name__}
+            finally:
+                stk.close()
+            report, _ = proc.communicate(timeout=600)
+        finally:
+            if proc.poll() is None:
+                proc.kill()
+                proc.wait()
+    if proc.returncode != 0:
+        return {'result': 'simulator exit status %d' % proc.returncode}
+
+    seconds = re.search(r'([0-9.]+) s simulated', report)
+    turnarounds = re.search(r'(\d+) turnarounds', report)
+    cycles_per_page = re.search(r'(\d+) cycles per page', report)
+    if not seconds or not turnarounds or not cycles_per_page:
+        raise ble_dfu.DfuError('%s: unexpected report %r' % (sim, report))
+    seconds = float(seconds.group(1))
+    return {'seconds': '%.3f' % seconds,
+            'bytes_per_s': round(len(image) / seconds),
+            'cycles_per_page': cycles_per_page.group(1),
+            'turnarounds': turnarounds.group(1), 'result': 'ok'}
+
+
+def numbers(text):
+    return [int(n) for n in text.split(',')]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--sim', required=True, help='stk500_sim')
+    parser.add_argument('--baud', type=int, default=115200,
+                        help='line rate (%(default)s)')
+    parser.add_argument('--latency-us', type=numbers, default=[0, 1000, 4000, 16000],
+                        help='adapter latencies (%(default)s)')
+    parser.add_argument('--pages', type=numbers, default=[1, 4, 16, 255],
+                        help='pages per multi-page command (%(default)s)')
+    parser.add_argument('--jobs', type=int, default=os.cpu_count() or 1,
+                        help='runs in parallel (%(default)s)')
+    parser.add_argument('-o', '--output', help='CSV file, standard output if not given')
+    args = parser.parse_args()
+
+    image = ble_dfu.read_hex(APPLICATION)
+    runs = [(latency_us, pages) for latency_us in args.latency_us
+            for pages in [0] + args.pages]
+
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        results = pool.map(lambda run: bench(args.sim, args.baud, image,
+                                             run[0], run[1]), runs)
+        out = open(args.output, 'w', newline='') if args.output else sys.stdout
+        try:
+            writer = csv.DictWriter(out, COLUMNS)
+            writer.writeheader()
+            for (latency_us, pages), fields in zip(runs, results):
+                fields.update(latency_us=latency_us,
+                              flow='multi' if pages else 'classic',
+                              pages=pages or '')
+                writer.writerow(fields)
+        finally:
+            if out is not sys.stdout:
+                out.close()
+
+    if args.output:
+        print('bench_stk500: %d runs written to %s' % (len(runs), args.output))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
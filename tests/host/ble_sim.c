@@ -0,0 +1,377 @@
+/* Host simulator of the bootloader's BLE DFU path.
+ *
+ * The BLE sources of the bootloader (ble.c, dfu.c, lib_aci.c, hal_aci_tl.c
+ * and what they use) run unmodified against the AVR stand-ins of host_avr.c,
+ * with the nRF8001 model of nrf8001_model.c attached to SPSR and the RDYN
+ * pin. The configuration, pins included, is read from an EEPROM image the
+ * same way main() does.
+ *
+ * A DFU client, normally tools/ble_dfu.py, plays the central through
+ * sim_link.c, in lockstep with the simulated clock.
+ *
+ * Time is the cycle count of the simulated AVR. SPI transfers are charged
+ * at the configured SPI clock and SPM operations at their data sheet
+ * duration. Other CPU time is approximated per poll of RDYN, which is what
+ * the bootloader does while idle. The BLE tasks of main() are run the way
+ * its scheduler runs them, see sched.h.
+ *
+ * The run ends when the Disconnected event following the bootloader's own
+ * Disconnect command (Activate & Reset) has been transferred to it. The
+ * flash image can then be written out for comparison.
+ */
+
+#include <getopt.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "host_avr.h"
+#include "nrf8001_model.h"
+#include "sim_link.h"
+
+#include "aci_queue.h"
+#include "ble.h"
+#include "bootloader_config.h"
+#include "hal_aci_tl.h"
+#include "pins_arduino.h"
+#include "dfu.h"
+#include "../../history.h"
+#include "../../jump.h"
+#include "../../sched.h"
+#include "../../stack.h"
+
+/* Round trip of the main loop when there is nothing to do */
+#define SIM_POLL_CYCLES       40
+
+/* SPDR write, SPIF poll and SPDR read around every SPI byte */
+#define SIM_SPI_BYTE_CYCLES   8
+
+typedef struct
+{
+  const char *socket_path;
+  const char *eeprom_path;
+  const char *flash_path;
+  sim_link_config_t link;
+  nrf8001_config_t nrf8001;
+} sim_options_t;
+
+static bool     m_avr_run (uint64_t cycles);
+static uint64_t m_avr_cycles (void);
+
+static void m_ble_task (void);
+
+/* The tasks of main() but the UART, see optiboot.c */
+static const sched_task_t m_tasks[] = {
+  {ble_spi_ready, ble_spi_service},
+  {ble_event_ready, m_ble_task},
+  {dfu_background_ready, dfu_background},
+  {NULL, dfu_housekeeping},
+};
+static const char * const m_task_names[] = {
+  "spi", "event", "spm", "housekeeping"
+};
+
+#define M_TASK_COUNT (sizeof (m_tasks) / sizeof (m_tasks[0]))
+
+static sim_options_t      m_options = {
+  .link = {
+    .interval_us = 7500,
+    .packets_per_event = 4,
+    .time_limit_s = 600,
+    .cycles_per_us = F_CPU / 1000000UL,
+    .avr_run = m_avr_run,
+    .avr_cycles = m_avr_cycles,
+  },
+  .nrf8001 = {.credits = 2, .rx_buffers = 4, .clock = m_avr_cycles},
+};
+static bootloader_config_t m_config;
+static uint32_t           m_rdyn_polls;
+static jmp_buf            m_reset;
+
+static volatile uint8_t  *m_rdyn_in;
+static uint8_t            m_rdyn_mask;
+static volatile uint8_t  *m_reqn_out;
+static uint8_t            m_reqn_mask;
+
+/* AVR side */
+
+static uint64_t m_avr_cycles (void)
+{
+  return host_cycles;
+}
+
+/* SCK period in CPU cycles, from SPR1:0 in SPCR and SPI2X in SPSR */
+static uint32_t m_spi_clock_cycles (void)
+{
+  static const uint8_t dividers[4] = {4, 16, 64, 128};
+  const uint32_t divider = dividers[host_SPCR & (_BV(SPR1) | _BV(SPR0))];
+
+  return (host_SPSR & _BV(SPI2X)) ? divider / 2 : divider;
+}
+
+/* A read of SPSR completes the byte written to SPDR */
+static void m_spi_status (void)
+{
+  host_SPDR = nrf8001_spi_exchange (host_SPDR);
+  host_SPSR |= _BV(SPIF);
+  host_cycles += 8 * m_spi_clock_cycles () + SIM_SPI_BYTE_CYCLES;
+
+  if (nrf8001_local_disconnect_done ())
+  {
+    longjmp (m_reset, 1);
+  }
+}
+
+static void m_pin_input (volatile uint8_t *pin)
+{
+  bool reqn_low;
+
+  if (pin != m_rdyn_in)
+  {
+    return;
+  }
+
+  reqn_low = !(*m_reqn_out & m_reqn_mask);
+
+  m_rdyn_polls++;
+  host_cycles += SIM_POLL_CYCLES;
+
+  if (nrf8001_rdyn_low (reqn_low))
+  {
+    *pin &= ~m_rdyn_mask;
+  }
+  else
+  {
+    *pin |= m_rdyn_mask;
+  }
+}
+
+/* RDYN is read through the pointer pin_to_input() returns, which the flash
+ * tables of pins_arduino.c look up without reading PINx. The read is made
+ * here, see RDYN_LDFLAGS in the Makefile.
+ */
+volatile uint8_t *__real_pin_to_input (uint8_t n);
+
+volatile uint8_t *__wrap_pin_to_input (uint8_t n)
+{
+  volatile uint8_t *pin = __real_pin_to_input (n);
+
+  return pin ? host_pin_input (pin) : pin;
+}
+
+static void m_ble_task (void)
+{
+  ble_update ();
+}
+
+/* Run the bootloader until the clock reaches cycles. Returns false if it
+ * reset instead.
+ */
+static bool m_avr_run (uint64_t cycles)
+{
+  if (setjmp (m_reset))
+  {
+    return false;
+  }
+
+  while (host_cycles < cycles)
+  {
+    sched_step (m_tasks, M_TASK_COUNT);
+  }
+
+  return true;
+}
+
+/* Setup and report */
+
+static void m_load (const char *path, uint8_t *p_dst, size_t size)
+{
+  FILE *f = fopen (path, "rb");
+
+  if (!f || fread (p_dst, 1, size, f) != size)
+  {
+    perror (path);
+    exit (1);
+  }
+  fclose (f);
+}
+
+static void m_store (const char *path, const uint8_t *p_src, size_t size)
+{
+  FILE *f = fopen (path, "wb");
+
+  if (!f || fwrite (p_src, 1, size, f) != size)
+  {
+    perror (path);
+    exit (1);
+  }
+  fclose (f);
+}
+
+static void m_report (void)
+{
+  const double seconds = (double) host_cycles / F_CPU;
+  history_record_t history;
+  uint8_t i;
+
+  history_read (&history);
+
+  printf ("ble_sim: %.6f s simulated, %llu cycles, %lu connection events\n",
+      seconds, (unsigned long long) host_cycles,
+      (unsigned long) sim_link_stats.connection_events);
+  printf ("ble_sim: %lu packets, %lu bytes, %.0f bytes/s\n",
+      (unsigned long) sim_link_stats.packets,
+      (unsigned long) sim_link_stats.packet_bytes,
+      sim_link_stats.packet_bytes / seconds);
+  printf ("ble_sim: %lu notifications, %lu pipe errors, "
+      "%lu SPI transfers, %lu SPI bytes, %lu RDYN polls\n",
+      (unsigned long) nrf8001_stats.data_sent,
+      (unsigned long) nrf8001_stats.pipe_errors,
+      (unsigned long) nrf8001_stats.spi_transfers,
+      (unsigned long) nrf8001_stats.spi_bytes,
+      (unsigned long) m_rdyn_polls);
+  printf ("ble_sim: packet latency %llu/%llu/%llu cycles min/avg/max\n",
+      (unsigned long long) nrf8001_stats.rx_latency_min,
+      (unsigned long long) (nrf8001_stats.data_delivered ?
+        nrf8001_stats.rx_latency_total / nrf8001_stats.data_delivered : 0),
+      (unsigned long long) nrf8001_stats.rx_latency_max);
+  printf ("ble_sim: ACI queues TX %u RX %u, "
+      "%lu event checks with the RX queue full\n",
+      ACI_TX_QUEUE_SIZE, ACI_RX_QUEUE_SIZE,
+      (unsigned long) hal_aci_tl_stats.rx_queue_full);
+  printf ("ble_sim: %lu page writes, %llu SPM stall cycles (%.1f%%), "
+      "%lu SPM errors, valid_app %u\n",
+      (unsigned long) host_spm_stats.writes,
+      (unsigned long long) host_spm_stats.stall_cycles,
+      100.0 * host_spm_stats.stall_cycles / host_cycles,
+      (unsigned long) host_spm_stats.errors, jump_app_valid ());
+  for (i = 0; i < M_TASK_COUNT; i++)
+  {
+    printf ("ble_sim: task %s, %lu runs, %lu cycles\n", m_task_names[i],
+        (unsigned long) sched_stats[i].runs,
+        (unsigned long) sched_stats[i].ticks * 1024);
+  }
+  printf ("ble_sim: history %u attempts, %u successes, result %u, "
+      "%lu bytes in %lu ms\n",
+      history.attempts, history.successes, history.result,
+      (unsigned long) history.image_size, (unsigned long) history.duration_ms);
+}
+
+static void m_usage (const char *name)
+{
+  fprintf (stderr,
+      "usage: %s --socket PATH --eeprom FILE [options]\n"
+      "  --socket PATH          UNIX socket to accept the client on\n"
+      "  --eeprom FILE          EEPROM image with the bootloader configuration\n"
+      "  --flash-out FILE       write the flash image here when done\n"
+      "  --interval-us N        connection interval (%lu)\n"
+      "  --packets-per-event N  writes per connection event (%u)\n"
+      "  --credits N            nRF8001 data credits (%u)\n"
+      "  --rx-buffers N         nRF8001 receive buffers (%u)\n"
+      "  --time-limit N         simulated seconds before giving up (%lu)\n",
+      name, (unsigned long) m_options.link.interval_us,
+      m_options.link.packets_per_event, m_options.nrf8001.credits,
+      m_options.nrf8001.rx_buffers, (unsigned long) m_options.link.time_limit_s);
+  exit (2);
+}
+
+static unsigned long m_number (const char *text, unsigned long max)
+{
+  char *end;
+  const unsigned long value = strtoul (text, &end, 0);
+
+  if (*text == '\0' || *end != '\0' || value == 0 || value > max)
+  {
+    fprintf (stderr, "ble_sim: bad value %s\n", text);
+    exit (2);
+  }
+
+  return value;
+}
+
+static void m_parse (int argc, char **argv)
+{
+  static const struct option options[] = {
+    {"socket",            required_argument, NULL, 's'},
+    {"eeprom",            required_argument, NULL, 'e'},
+    {"flash-out",         required_argument, NULL, 'f'},
+    {"interval-us",       required_argument, NULL, 'i'},
+    {"packets-per-event", required_argument, NULL, 'p'},
+    {"credits",           required_argument, NULL, 'c'},
+    {"rx-buffers",        required_argument, NULL, 'r'},
+    {"time-limit",        required_argument, NULL, 't'},
+    {"help",              no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0},
+  };
+  int opt;
+
+  while ((opt = getopt_long (argc, argv, "", options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 's': m_options.socket_path = optarg; break;
+      case 'e': m_options.eeprom_path = optarg; break;
+      case 'f': m_options.flash_path = optarg; break;
+      case 'i': m_options.link.interval_us = m_number (optarg, 4000000); break;
+      case 'p': m_options.link.packets_per_event = m_number (optarg, 255); break;
+      case 'c': m_options.nrf8001.credits = m_number (optarg, 255); break;
+      case 'r': m_options.nrf8001.rx_buffers = m_number (optarg, 255); break;
+      case 't': m_options.link.time_limit_s = m_number (optarg, 100000); break;
+      default: m_usage (argv[0]);
+    }
+  }
+
+  if (!m_options.socket_path || !m_options.eeprom_path || optind != argc)
+  {
+    m_usage (argv[0]);
+  }
+}
+
+int main (int argc, char **argv)
+{
+  m_parse (argc, argv);
+
+  host_avr_reset ();
+  stack_paint ();
+  m_load (m_options.eeprom_path, host_eeprom, sizeof (host_eeprom));
+
+  if (!bootloader_config_read (&m_config))
+  {
+    sim_link_fail ("no valid bootloader configuration in EEPROM");
+  }
+
+  /* Resolve the pins before the hooks are attached, pin_to_input() reads
+   * through them
+   */
+  m_rdyn_in = pin_to_input (m_config.aci_pins.rdyn_pin);
+  m_rdyn_mask = pin_to_bit_mask (m_config.aci_pins.rdyn_pin);
+  m_reqn_out = pin_to_output (m_config.aci_pins.reqn_pin);
+  m_reqn_mask = pin_to_bit_mask (m_config.aci_pins.reqn_pin);
+  if (!m_rdyn_in || !m_reqn_out)
+  {
+    sim_link_fail ("REQN or RDYN is not a supported pin");
+  }
+
+  nrf8001_init (&m_options.nrf8001);
+  host_io_hooks.spi_status = m_spi_status;
+  host_io_hooks.pin_input = m_pin_input;
+
+  sim_link_accept (m_options.socket_path);
+
+  ble_init (&m_config);
+  m_options.link.pipes = m_config.pipes;
+  sim_link_session (&m_options.link);
+
+  if (m_options.flash_path)
+  {
+    m_store (m_options.flash_path, host_flash, sizeof (host_flash));
+  }
+
+  m_report ();
+  sim_link_close ();
+
+  return 0;
+}
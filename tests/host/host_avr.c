@@ -0,0 +1,486 @@
+/* Simulated AVR core for the host tests, see host_avr.h */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "host_avr.h"
+
+#define HOST_DEFINE_PORT(x)  volatile uint8_t host_port_##x[3]
+
+volatile uint8_t host_SPMCSR;
+volatile uint8_t host_WDTCSR;
+volatile uint8_t host_MCUSR;
+volatile uint8_t host_SPCR;
+volatile uint8_t host_SPSR;
+volatile uint8_t host_SPDR;
+volatile uint8_t host_UCSR0A;
+volatile uint8_t host_UCSR0B;
+volatile uint8_t host_UCSR0C;
+volatile uint8_t host_UBRR0L;
+volatile uint8_t host_UDR0;
+volatile uint8_t host_TCCR1B;
+volatile uint16_t host_TCNT1;
+volatile uint16_t host_EEAR;
+static volatile uint8_t m_EECR;
+static volatile uint8_t m_EEDR;
+#ifdef HOST_HAS_RAMPZ
+volatile uint8_t host_RAMPZ;
+#endif
+
+HOST_DEFINE_PORT(B);
+HOST_DEFINE_PORT(C);
+HOST_DEFINE_PORT(D);
+#ifdef HOST_HAS_PORTA
+HOST_DEFINE_PORT(A);
+#endif
+#ifdef HOST_HAS_PORTE_TO_L
+HOST_DEFINE_PORT(E);
+HOST_DEFINE_PORT(F);
+HOST_DEFINE_PORT(G);
+HOST_DEFINE_PORT(H);
+HOST_DEFINE_PORT(J);
+HOST_DEFINE_PORT(K);
+HOST_DEFINE_PORT(L);
+#endif
+
+host_io_hooks_t  host_io_hooks;
+uint8_t          host_flash[FLASHEND + 1UL];
+host_flash_weak_t host_flash_weak;
+uint8_t          host_eeprom[E2END + 1];
+uint8_t          host_ram[RAMEND + 1];
+uint64_t         host_cycles;
+host_spm_stats_t host_spm_stats;
+
+/* Temporary page buffer of the SPM unit */
+static uint16_t  m_spm_buffer[SPM_PAGESIZE / 2];
+static uint8_t   m_spm_loaded[SPM_PAGESIZE / 2];
+static uint64_t  m_spm_busy_until;
+
+/* End of the EEPROM write under way */
+static uint64_t  m_eeprom_busy_until;
+
+/* Set by an erase or write of the RWW section, until it is enabled again */
+static uint8_t   m_rww_locked;
+
+static void m_spm_error (const char *what, uint32_t address)
+{
+  fprintf (stderr, "spm: %s at 0x%05lx\n", what, (unsigned long) address);
+  host_spm_stats.errors++;
+}
+
+static void m_eeprom_access (void);
+
+/* An SPM instruction is ignored while a previous operation is in progress.
+ * An EEPROM write started through EECR has started by then.
+ */
+static int m_spm_start (const char *what, uint32_t address)
+{
+  m_eeprom_access ();
+
+  if (host_cycles < m_spm_busy_until)
+  {
+    m_spm_error (what, address);
+    return 0;
+  }
+
+  if (host_cycles < m_eeprom_busy_until)
+  {
+    m_spm_error ("spm during eeprom write", address);
+    return 0;
+  }
+
+  if (address > FLASHEND)
+  {
+    m_spm_error ("address out of range", address);
+    return 0;
+  }
+
+  return 1;
+}
+
+static void m_spm_buffer_clear (void)
+{
+  memset (m_spm_buffer, 0xFF, sizeof (m_spm_buffer));
+  memset (m_spm_loaded, 0, sizeof (m_spm_loaded));
+}
+
+void host_avr_reset (void)
+{
+  memset (host_flash, 0xFF, sizeof (host_flash));
+  memset (host_eeprom, 0xFF, sizeof (host_eeprom));
+  memset (&host_spm_stats, 0, sizeof (host_spm_stats));
+  memset (&host_flash_weak, 0, sizeof (host_flash_weak));
+  memset (&host_io_hooks, 0, sizeof (host_io_hooks));
+  host_cycles = 0;
+
+  host_avr_power_cycle ();
+}
+
+void host_avr_power_cycle (void)
+{
+  memset (host_ram, 0, sizeof (host_ram));
+  m_spm_buffer_clear ();
+  m_spm_busy_until = 0;
+  m_eeprom_busy_until = 0;
+  m_rww_locked = 0;
+
+  host_SPMCSR = 0;
+  host_SPCR = 0;
+  host_SPSR = 0;
+  host_SPDR = 0;
+  host_TCCR1B = 0;
+  host_EEAR = 0;
+  m_EECR = 0;
+  m_EEDR = 0;
+#ifdef HOST_HAS_RAMPZ
+  host_RAMPZ = 0;
+#endif
+}
+
+void host_spm_erase (uint32_t address)
+{
+  const uint32_t page = address & ~(uint32_t)(SPM_PAGESIZE - 1);
+
+  if (!m_spm_start ("page erase while busy", address))
+  {
+    return;
+  }
+
+  memset (&host_flash[page], 0xFF, SPM_PAGESIZE);
+  m_spm_busy_until = host_cycles + HOST_SPM_BUSY_CYCLES;
+  m_rww_locked |= page < HOST_NRWW_START;
+  host_spm_stats.erases++;
+
+  if (host_io_hooks.spm)
+  {
+    host_io_hooks.spm (page);
+  }
+}
+
+void host_spm_fill (uint32_t address, uint16_t data)
+{
+  const uint16_t word = (address & (SPM_PAGESIZE - 1)) / 2;
+
+  if (!m_spm_start ("page fill while busy", address))
+  {
+    return;
+  }
+
+  /* Each word of the temporary buffer can only be loaded once */
+  if (m_spm_loaded[word])
+  {
+    m_spm_error ("page buffer word loaded twice", address);
+    return;
+  }
+
+  m_spm_buffer[word] = data;
+  m_spm_loaded[word] = 1;
+  host_spm_stats.fills++;
+}
+
+void host_spm_write (uint32_t address)
+{
+  const uint32_t page = address & ~(uint32_t)(SPM_PAGESIZE - 1);
+  uint16_t i;
+
+  if (!m_spm_start ("page write while busy", address))
+  {
+    return;
+  }
+
+  /* Programming can only clear bits, an unerased page gets the AND */
+  for (i = 0; i < SPM_PAGESIZE / 2; i++)
+  {
+    host_flash[page + 2 * i]     &= (uint8_t) m_spm_buffer[i];
+    host_flash[page + 2 * i + 1] &= (uint8_t) (m_spm_buffer[i] >> 8);
+  }
+
+  if ((host_flash_weak.address & ~(uint32_t)(SPM_PAGESIZE - 1)) == page)
+  {
+    host_flash[host_flash_weak.address] |= host_flash_weak.bits;
+  }
+
+  /* The temporary buffer is cleared by a page write */
+  m_spm_buffer_clear ();
+  m_spm_busy_until = host_cycles + HOST_SPM_BUSY_CYCLES;
+  m_rww_locked |= page < HOST_NRWW_START;
+  host_spm_stats.writes++;
+
+  if (host_io_hooks.spm)
+  {
+    host_io_hooks.spm (page);
+  }
+}
+
+/* Enabling the RWW section aborts a load of the page buffer, and the words
+ * loaded so far are lost
+ */
+void host_spm_rww_enable (void)
+{
+  if (!m_spm_start ("rww enable while busy", 0))
+  {
+    return;
+  }
+
+  if (memchr (m_spm_loaded, 1, sizeof (m_spm_loaded)))
+  {
+    m_spm_error ("rww enable while the page buffer is loaded", 0);
+    m_spm_buffer_clear ();
+  }
+
+  m_rww_locked = 0;
+}
+
+uint8_t host_flash_read (uint32_t address)
+{
+  if ((host_cycles < m_spm_busy_until || m_rww_locked) &&
+      address < HOST_NRWW_START)
+  {
+    m_spm_error ("read of the locked RWW section", address);
+  }
+
+  host_spm_stats.reads++;
+  return host_flash[address];
+}
+
+uint8_t host_spm_busy (void)
+{
+  if (host_cycles < m_spm_busy_until)
+  {
+    host_cycles += HOST_SPM_POLL_CYCLES;
+    host_spm_stats.stall_cycles += HOST_SPM_POLL_CYCLES;
+    return _BV(SPMEN);
+  }
+
+  return 0;
+}
+
+uint8_t host_spm_pending (void)
+{
+  return host_cycles < m_spm_busy_until;
+}
+
+uint8_t host_eeprom_pending (void)
+{
+  return host_cycles < m_eeprom_busy_until;
+}
+
+void host_delay_us (double us)
+{
+  host_cycles += (uint64_t) (us * (F_CPU / 1000000.0));
+}
+
+/* I/O hooks */
+
+volatile uint8_t *host_spi_status (void)
+{
+  /* No transfer with the SPI off, when SPI2X may be written */
+  if (host_io_hooks.spi_status && (host_SPCR & _BV(SPE)))
+  {
+    host_io_hooks.spi_status ();
+  }
+
+  return &host_SPSR;
+}
+
+volatile uint8_t *host_uart_status (void)
+{
+  if (host_io_hooks.uart_status)
+  {
+    host_io_hooks.uart_status ();
+  }
+
+  return &host_UCSR0A;
+}
+
+volatile uint8_t *host_uart_data (void)
+{
+  if (host_io_hooks.uart_data)
+  {
+    return host_io_hooks.uart_data ();
+  }
+
+  return &host_UDR0;
+}
+
+volatile uint8_t *host_pin_input (volatile uint8_t *pin)
+{
+  if (host_io_hooks.pin_input)
+  {
+    host_io_hooks.pin_input (pin);
+  }
+
+  return pin;
+}
+
+volatile uint16_t *host_timer1_count (void)
+{
+  host_TCNT1 = (uint16_t) (host_cycles >> 10);
+
+  return &host_TCNT1;
+}
+
+/* EEPROM */
+
+/* Carry out what the last write to EECR started. A write needs EEMPE
+ * set ahead of EEPE, as on the part, and EEPE without it is dropped. While
+ * a write runs, EEPE reads as set and each access costs a poll.
+ */
+static void m_eeprom_access (void)
+{
+  const uint16_t address = host_EEAR & E2END;
+  const uint8_t control = m_EECR;
+
+  if (host_cycles < m_eeprom_busy_until)
+  {
+    host_cycles += HOST_SPM_POLL_CYCLES;
+    m_EECR = (control & ~_BV(EEMPE)) | _BV(EEPE);
+    return;
+  }
+
+  if (control & _BV(EERE))
+  {
+    m_EEDR = host_eeprom[address];
+    m_EECR &= ~_BV(EERE);
+  }
+
+  if (control & _BV(EEPE))
+  {
+    m_EECR &= ~(_BV(EEMPE) | _BV(EEPE));
+
+    if (control & _BV(EEMPE))
+    {
+      host_eeprom[address] = m_EEDR;
+      m_eeprom_busy_until = host_cycles + HOST_EEPROM_BUSY_CYCLES;
+      m_EECR |= _BV(EEPE);
+
+      if (host_io_hooks.eeprom_write)
+      {
+        host_io_hooks.eeprom_write (address);
+      }
+    }
+  }
+}
+
+volatile uint8_t *host_eeprom_control (void)
+{
+  m_eeprom_access ();
+
+  return &m_EECR;
+}
+
+volatile uint8_t *host_eeprom_data (void)
+{
+  m_eeprom_access ();
+
+  return &m_EEDR;
+}
+
+static uint16_t m_eeprom_index (const void *addr)
+{
+  return (uint16_t) ((uintptr_t) addr & E2END);
+}
+
+/* Wait for a write under way, as the avr-libc functions do */
+static void m_eeprom_wait (void)
+{
+  if (host_cycles < m_eeprom_busy_until)
+  {
+    host_cycles = m_eeprom_busy_until;
+  }
+}
+
+/* Start a write of one byte */
+static void m_eeprom_write (uint16_t i, uint8_t value)
+{
+  m_eeprom_wait ();
+  host_eeprom[i & E2END] = value;
+  m_eeprom_busy_until = host_cycles + HOST_EEPROM_BUSY_CYCLES;
+}
+
+uint8_t host_eeprom_ready (void)
+{
+  if (host_cycles < m_eeprom_busy_until)
+  {
+    host_cycles += HOST_SPM_POLL_CYCLES;
+    return 0;
+  }
+
+  return 1;
+}
+
+uint8_t eeprom_read_byte (const uint8_t *addr)
+{
+  m_eeprom_wait ();
+  return host_eeprom[m_eeprom_index (addr)];
+}
+
+uint16_t eeprom_read_word (const uint16_t *addr)
+{
+  const uint16_t i = m_eeprom_index (addr);
+
+  m_eeprom_wait ();
+  return host_eeprom[i] | (host_eeprom[(i + 1) & E2END] << 8);
+}
+
+void eeprom_read_block (void *dst, const void *src, size_t n)
+{
+  uint8_t *d = dst;
+  uint16_t i = m_eeprom_index (src);
+
+  m_eeprom_wait ();
+  while (n--)
+  {
+    *d++ = host_eeprom[i];
+    i = (i + 1) & E2END;
+  }
+}
+
+void eeprom_write_byte (uint8_t *addr, uint8_t value)
+{
+  m_eeprom_write (m_eeprom_index (addr), value);
+}
+
+void eeprom_write_word (uint16_t *addr, uint16_t value)
+{
+  const uint16_t i = m_eeprom_index (addr);
+
+  m_eeprom_write (i, (uint8_t) value);
+  m_eeprom_write (i + 1, (uint8_t) (value >> 8));
+}
+
+void eeprom_write_block (const void *src, void *dst, size_t n)
+{
+  const uint8_t *s = src;
+  uint16_t i = m_eeprom_index (dst);
+
+  while (n--)
+  {
+    m_eeprom_write (i++, *s++);
+  }
+}
+
+void eeprom_update_byte (uint8_t *addr, uint8_t value)
+{
+  const uint16_t i = m_eeprom_index (addr);
+
+  m_eeprom_wait ();
+  if (host_eeprom[i] != value)
+  {
+    m_eeprom_write (i, value);
+  }
+}
+
+void eeprom_update_block (const void *src, void *dst, size_t n)
+{
+  const uint8_t *s = src;
+  uint8_t *d = dst;
+
+  while (n--)
+  {
+    eeprom_update_byte (d++, *s++);
+  }
+}
@@ -0,0 +1,119 @@
+/* Simulated AVR core for the host tests.
+ *
+ * Flash, EEPROM and the SPM unit of the part selected at compile time,
+ * plus a cycle counter that the SPM unit and the delay routines advance.
+ * The SPM model is deliberately strict: an SPM instruction issued while a
+ * previous erase or write or an EEPROM write is still running, or a second
+ * fill of the same temporary buffer word, is counted as an error instead of
+ * being silently accepted. The tests check that counter.
+ */
+
+#ifndef HOST_AVR_H_
+#define HOST_AVR_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+/* Page erase and page write take 3.7-4.5 ms, we use the upper bound */
+#define HOST_SPM_BUSY_CYCLES  ((uint64_t) F_CPU * 45 / 10000)
+
+/* Cost of one iteration of a boot_spm_busy() poll loop */
+#define HOST_SPM_POLL_CYCLES  4
+
+/* An EEPROM write takes 3.4 ms. The SPM unit ignores every instruction
+ * while one runs, which is counted as an SPM error.
+ */
+#define HOST_EEPROM_BUSY_CYCLES  ((uint64_t) F_CPU * 34 / 10000)
+
+typedef struct
+{
+  uint32_t erases;
+  uint32_t writes;
+  uint32_t fills;
+  uint32_t errors;
+  uint64_t stall_cycles;
+  uint32_t reads;         /* flash bytes read by host_flash_read() */
+} host_spm_stats_t;
+
+/* Peripheral model attached to the I/O registers. spi_status is called on
+ * every access to SPSR while SPE is set in SPCR, and can complete a transfer
+ * by exchanging SPDR and setting SPIF. uart_status is called on every access to UCSR0A, and can
+ * update RXC0, UDRE0 and TXC0. uart_data is called on every access to UDR0
+ * and returns the register to use. The bootloader reads UDR0 only after
+ * seeing RXC0 and writes it only after seeing UDRE0, so a model that never
+ * reports both at once can tell a read from a write. pin_input is
+ * called whenever a PINx register is accessed, including when only its
+ * address is taken. spm is called after every page erase and write, and
+ * eeprom_write after every EEPROM write started through EECR; a test can
+ * cut the power there by leaving with longjmp(). Any of them may be left
+ * NULL.
+ */
+typedef struct
+{
+  void (*spi_status) (void);
+  void (*uart_status) (void);
+  volatile uint8_t *(*uart_data) (void);
+  void (*pin_input) (volatile uint8_t *pin);
+  void (*spm) (uint32_t address);
+  void (*eeprom_write) (uint16_t address);
+} host_io_hooks_t;
+
+/* A weak cell: bits of one flash byte that stay erased when its page is
+ * written. No bits by default.
+ */
+typedef struct
+{
+  uint32_t address;
+  uint8_t  bits;
+} host_flash_weak_t;
+
+extern host_io_hooks_t  host_io_hooks;
+extern uint8_t          host_flash[FLASHEND + 1UL];
+extern host_flash_weak_t host_flash_weak;
+extern uint8_t          host_eeprom[E2END + 1];
+extern uint64_t         host_cycles;
+extern host_spm_stats_t host_spm_stats;
+
+/* SRAM, for the stack painting of stack.c alone: the bootloader's own
+ * variables and stack are the host's. The statics are taken to end
+ * HOST_RAM_STATIC bytes in.
+ */
+#define HOST_RAM_STATIC  0x300
+
+extern uint8_t          host_ram[RAMEND + 1];
+
+#define STACK_START  (&host_ram[RAMSTART + HOST_RAM_STATIC])
+#define STACK_END    (&host_ram[RAMEND])
+
+/* Erase flash and EEPROM, clear RAM, registers, counters, the clock and the
+ * I/O hooks
+ */
+void host_avr_reset (void);
+
+/* Power the part down and up again: flash and EEPROM keep what was written,
+ * an erase or write under way is cut short, and RAM, registers and the
+ * temporary page buffer are cleared
+ */
+void host_avr_power_cycle (void);
+
+void    host_spm_erase (uint32_t address);
+void    host_spm_fill (uint32_t address, uint16_t data);
+void    host_spm_write (uint32_t address);
+void    host_spm_rww_enable (void);
+uint8_t host_spm_busy (void);
+
+/* Read flash the way boot_flash_read() does. Reading the RWW section while
+ * an erase or write runs, or before boot_rww_enable() has followed one of
+ * the RWW section, is counted as an SPM error.
+ */
+uint8_t host_flash_read (uint32_t address);
+
+/* True while an erase or write runs, without the cost of a busy poll */
+uint8_t host_spm_pending (void);
+
+/* True while an EEPROM write runs, without the cost of a busy poll */
+uint8_t host_eeprom_pending (void);
+
+void host_delay_us (double us);
+
+#endif /* HOST_AVR_H_ */
@@ -0,0 +1,64 @@
+/* Host replacement for boot.h.
+ *
+ * Force-included ahead of every translation unit in the host build. It
+ * claims boot.h's include guard, so the inline assembly in boot.h is never
+ * seen, and maps the SPM macros onto the SPM model in host_avr.c.
+ *
+ * The _short variants only load the Z register, so on parts with RAMPZ the
+ * page they hit depends on whatever RAMPZ already holds, exactly as on the
+ * hardware. The _extended variants load RAMPZ from bits 16-23 first.
+ */
+
+#ifndef _AVR_BOOT_H_
+#define _AVR_BOOT_H_    1
+
+#include <limits.h>
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/eeprom.h>
+
+#include "host_avr.h"
+
+#ifdef RAMPZ
+#define HOST_SPM_Z(address)           (((uint32_t) RAMPZ << 16) | (uint16_t)(address))
+#define HOST_SPM_RAMPZ_LOAD(address)  (RAMPZ = (uint8_t)((uint32_t)(address) >> 16))
+#else
+#define HOST_SPM_Z(address)           ((uint16_t)(address))
+#define HOST_SPM_RAMPZ_LOAD(address)  ((void) 0)
+#endif
+
+#define boot_spm_busy()               host_spm_busy()
+#define boot_spm_busy_wait()          do{}while(boot_spm_busy())
+#define boot_rww_busy()               0
+
+#define __boot_page_fill_short(address, data) \
+  host_spm_fill (HOST_SPM_Z(address), (uint16_t)(data))
+#define __boot_page_erase_short(address) \
+  host_spm_erase (HOST_SPM_Z(address))
+#define __boot_page_write_short(address) \
+  host_spm_write (HOST_SPM_Z(address))
+#define __boot_rww_enable_short() \
+  host_spm_rww_enable ()
+
+#define __boot_page_fill_extended_short(address, data) \
+  (HOST_SPM_RAMPZ_LOAD(address), __boot_page_fill_short(address, data))
+#define __boot_page_erase_extended_short(address) \
+  (HOST_SPM_RAMPZ_LOAD(address), __boot_page_erase_short(address))
+#define __boot_page_write_extended_short(address) \
+  (HOST_SPM_RAMPZ_LOAD(address), __boot_page_write_short(address))
+
+#if (FLASHEND > USHRT_MAX)
+#define boot_page_fill(address, data) __boot_page_fill_extended_short(address, data)
+#define boot_page_erase(address)      __boot_page_erase_extended_short(address)
+#define boot_page_write(address)      __boot_page_write_extended_short(address)
+typedef uint32_t flash_addr_t;
+#else
+#define boot_page_fill(address, data) __boot_page_fill_short(address, data)
+#define boot_page_erase(address)      __boot_page_erase_short(address)
+#define boot_page_write(address)      __boot_page_write_short(address)
+typedef uint16_t flash_addr_t;
+#endif
+#define boot_rww_enable()             __boot_rww_enable_short()
+#define boot_flash_read(address)      host_flash_read (address)
+
+#endif /* _AVR_BOOT_H_ */
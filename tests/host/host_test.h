@@ -0,0 +1,35 @@
+/* Minimal test runner for the host tests.
+ *
+ * Each test_*.c file is one executable. Tests are plain functions run with
+ * RUN_TEST(), failed CHECK()s are reported and counted, and the exit status
+ * of the program is the result of the file.
+ */
+
+#ifndef HOST_TEST_H_
+#define HOST_TEST_H_
+
+#include <stdio.h>
+
+extern int host_test_failures;
+
+#define CHECK(cond)                                                   \
+  do {                                                                \
+    if (!(cond))                                                      \
+    {                                                                 \
+      fprintf (stderr, "%s:%d: CHECK failed: %s\n",                   \
+          __FILE__, __LINE__, #cond);                                 \
+      host_test_failures++;                                           \
+    }                                                                 \
+  } while (0)
+
+#define RUN_TEST(fn)                                                  \
+  do {                                                                \
+    const int failures_before = host_test_failures;                   \
+    fn ();                                                            \
+    printf ("%-48s %s\n", #fn,                                        \
+        host_test_failures == failures_before ? "ok" : "FAILED");     \
+  } while (0)
+
+#define HOST_TEST_RESULT() (host_test_failures ? 1 : 0)
+
+#endif /* HOST_TEST_H_ */
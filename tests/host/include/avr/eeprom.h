@@ -0,0 +1,27 @@
+/* Host stand-in for <avr/eeprom.h>, backed by host_eeprom[] in host_avr.c */
+
+#ifndef HOST_AVR_EEPROM_H_
+#define HOST_AVR_EEPROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint8_t  eeprom_read_byte (const uint8_t *addr);
+uint16_t eeprom_read_word (const uint16_t *addr);
+void     eeprom_read_block (void *dst, const void *src, size_t n);
+void     eeprom_write_byte (uint8_t *addr, uint8_t value);
+void     eeprom_write_word (uint16_t *addr, uint16_t value);
+void     eeprom_write_block (const void *src, void *dst, size_t n);
+void     eeprom_update_byte (uint8_t *addr, uint8_t value);
+void     eeprom_update_block (const void *src, void *dst, size_t n);
+
+/* Writes take time as on the part, see host_avr.h. Like avr-libc, every
+ * function waits for a write under way before it starts, and the update
+ * functions only write bytes that differ.
+ */
+uint8_t  host_eeprom_ready (void);
+
+#define eeprom_is_ready()   host_eeprom_ready ()
+#define eeprom_busy_wait()  do {} while (!eeprom_is_ready ())
+
+#endif /* HOST_AVR_EEPROM_H_ */
@@ -0,0 +1,267 @@
+/* Host stand-in for <avr/io.h>.
+ *
+ * The bootloader sources are compiled unmodified on the build machine for
+ * the tests in tests/host. Every I/O register becomes a plain global
+ * (defined in host_avr.c) and the memory geometry follows the part selected
+ * with -D__AVR_<part>__, the same macro avr-gcc defines for -mmcu.
+ */
+
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+/* Memory geometry and signature of the simulated part. HOST_NRWW_START is
+ * the first byte of the No-Read-While-Write section, the largest boot
+ * section of the part.
+ */
+#if defined(__AVR_ATmega1284P__)
+#  define FLASHEND      0x1FFFFUL
+#  define SPM_PAGESIZE  256
+#  define E2END         0xFFF
+#  define RAMSTART      (0x100)
+#  define RAMEND        0x40FF
+#  define HOST_NRWW_START 0x1E000UL
+#  define SIGNATURE_0   0x1E
+#  define SIGNATURE_1   0x97
+#  define SIGNATURE_2   0x05
+#  define HOST_HAS_RAMPZ
+#  define HOST_HAS_PORTA
+#elif defined(__AVR_ATmega1280__)
+#  define FLASHEND      0x1FFFFUL
+#  define SPM_PAGESIZE  256
+#  define E2END         0xFFF
+#  define RAMSTART      (0x200)
+#  define RAMEND        0x21FF
+#  define HOST_NRWW_START 0x1E000UL
+#  define SIGNATURE_0   0x1E
+#  define SIGNATURE_1   0x97
+#  define SIGNATURE_2   0x03
+#  define HOST_HAS_RAMPZ
+#  define HOST_HAS_PORTA
+#  define HOST_HAS_PORTE_TO_L
+#elif defined(__AVR_ATmega644P__)
+#  define FLASHEND      0xFFFF
+#  define SPM_PAGESIZE  256
+#  define E2END         0x7FF
+#  define RAMSTART      (0x100)
+#  define RAMEND        0x10FF
+#  define HOST_NRWW_START 0xE000
+#  define SIGNATURE_0   0x1E
+#  define SIGNATURE_1   0x96
+#  define SIGNATURE_2   0x0A
+#  define HOST_HAS_PORTA
+#elif defined(__AVR_ATmega168__)
+#  define FLASHEND      0x3FFF
+#  define SPM_PAGESIZE  128
+#  define E2END         0x1FF
+#  define RAMSTART      (0x100)
+#  define RAMEND        0x4FF
+#  define HOST_NRWW_START 0x3800
+#  define SIGNATURE_0   0x1E
+#  define SIGNATURE_1   0x94
+#  define SIGNATURE_2   0x06
+#elif defined(__AVR_ATmega328P__)
+#  define FLASHEND      0x7FFF
+#  define SPM_PAGESIZE  128
+#  define E2END         0x3FF
+#  define RAMSTART      (0x100)
+#  define RAMEND        0x8FF
+#  define HOST_NRWW_START 0x7000
+#  define SIGNATURE_0   0x1E
+#  define SIGNATURE_1   0x95
+#  define SIGNATURE_2   0x0F
+#else
+#  error "Unsupported part for host build, add it to tests/host/include/avr/io.h"
+#endif
+
+/* I/O registers */
+extern volatile uint8_t host_SPMCSR;
+extern volatile uint8_t host_WDTCSR;
+extern volatile uint8_t host_MCUSR;
+extern volatile uint8_t host_SPCR;
+extern volatile uint8_t host_SPSR;
+extern volatile uint8_t host_SPDR;
+extern volatile uint8_t host_UCSR0A;
+extern volatile uint8_t host_UCSR0B;
+extern volatile uint8_t host_UCSR0C;
+extern volatile uint8_t host_UBRR0L;
+extern volatile uint8_t host_UDR0;
+extern volatile uint8_t host_TCCR1B;
+extern volatile uint16_t host_TCNT1;
+extern volatile uint16_t host_EEAR;
+
+/* SPSR, UCSR0A, UDR0 and the PINx registers are accessed through these, so
+ * a peripheral model can update them first, see host_io_hooks in host_avr.h
+ */
+volatile uint8_t *host_spi_status (void);
+volatile uint8_t *host_uart_status (void);
+volatile uint8_t *host_uart_data (void);
+volatile uint8_t *host_pin_input (volatile uint8_t *pin);
+
+/* Timer 1 counts host_cycles at F_CPU / 1024, whatever TCCR1B says. What is
+ * written to TCNT1 is lost at the next read.
+ */
+volatile uint16_t *host_timer1_count (void);
+
+/* EECR and EEDR carry out the EEPROM read or write that the last write to
+ * EECR started, before they are accessed. A write takes time, see
+ * host_avr.h, and EEPE reads as set until it has completed.
+ */
+volatile uint8_t *host_eeprom_control (void);
+volatile uint8_t *host_eeprom_data (void);
+
+#define SPMCSR  host_SPMCSR
+#define WDTCSR  host_WDTCSR
+#define MCUSR   host_MCUSR
+#define SPCR    host_SPCR
+#define SPSR    (*host_spi_status ())
+#define SPDR    host_SPDR
+#define UCSR0A  (*host_uart_status ())
+#define UCSR0B  host_UCSR0B
+#define UCSR0C  host_UCSR0C
+#define UBRR0L  host_UBRR0L
+#define UDR0    (*host_uart_data ())
+#define TCCR1B  host_TCCR1B
+#define TCNT1   (*host_timer1_count ())
+#define EEAR    host_EEAR
+#define EECR    (*host_eeprom_control ())
+#define EEDR    (*host_eeprom_data ())
+
+#ifdef HOST_HAS_RAMPZ
+extern volatile uint8_t host_RAMPZ;
+#define RAMPZ   host_RAMPZ
+#endif
+
+/* PINx, DDRx and PORTx of a port, one after the other as on the AVR */
+#define HOST_DECLARE_PORT(x)  extern volatile uint8_t host_port_##x[3]
+
+HOST_DECLARE_PORT(B);
+HOST_DECLARE_PORT(C);
+HOST_DECLARE_PORT(D);
+#define DDRB  host_port_B[1]
+#define PORTB host_port_B[2]
+#define PINB  (*host_pin_input (&host_port_B[0]))
+#define DDRC  host_port_C[1]
+#define PORTC host_port_C[2]
+#define PINC  (*host_pin_input (&host_port_C[0]))
+#define DDRD  host_port_D[1]
+#define PORTD host_port_D[2]
+#define PIND  (*host_pin_input (&host_port_D[0]))
+
+#ifdef HOST_HAS_PORTA
+HOST_DECLARE_PORT(A);
+#define DDRA  host_port_A[1]
+#define PORTA host_port_A[2]
+#define PINA  (*host_pin_input (&host_port_A[0]))
+#endif
+
+#ifdef HOST_HAS_PORTE_TO_L
+HOST_DECLARE_PORT(E);
+HOST_DECLARE_PORT(F);
+HOST_DECLARE_PORT(G);
+HOST_DECLARE_PORT(H);
+HOST_DECLARE_PORT(J);
+HOST_DECLARE_PORT(K);
+HOST_DECLARE_PORT(L);
+#define DDRE  host_port_E[1]
+#define PORTE host_port_E[2]
+#define PINE  (*host_pin_input (&host_port_E[0]))
+#define DDRF  host_port_F[1]
+#define PORTF host_port_F[2]
+#define PINF  (*host_pin_input (&host_port_F[0]))
+#define DDRG  host_port_G[1]
+#define PORTG host_port_G[2]
+#define PING  (*host_pin_input (&host_port_G[0]))
+#define DDRH  host_port_H[1]
+#define PORTH host_port_H[2]
+#define PINH  (*host_pin_input (&host_port_H[0]))
+#define DDRJ  host_port_J[1]
+#define PORTJ host_port_J[2]
+#define PINJ  (*host_pin_input (&host_port_J[0]))
+#define DDRK  host_port_K[1]
+#define PORTK host_port_K[2]
+#define PINK  (*host_pin_input (&host_port_K[0]))
+#define DDRL  host_port_L[1]
+#define PORTL host_port_L[2]
+#define PINL  (*host_pin_input (&host_port_L[0]))
+#endif
+
+/* SPMCSR */
+#define SPMEN   0
+#define PGERS   1
+#define PGWRT   2
+#define BLBSET  3
+#define RWWSRE  4
+#define SIGRD   5
+#define RWWSB   6
+#define SPMIE   7
+
+/* WDTCSR */
+#define WDP0    0
+#define WDP1    1
+#define WDP2    2
+#define WDE     3
+#define WDCE    4
+#define WDP3    5
+#define WDIE    6
+#define WDIF    7
+
+/* MCUSR */
+#define PORF    0
+#define EXTRF   1
+#define BORF    2
+#define WDRF    3
+
+/* SPCR */
+#define SPR0    0
+#define SPR1    1
+#define CPHA    2
+#define CPOL    3
+#define MSTR    4
+#define DORD    5
+#define SPE     6
+#define SPIE    7
+
+/* SPSR */
+#define SPI2X   0
+#define WCOL    6
+#define SPIF    7
+
+/* TCCR1B */
+#define CS10    0
+#define CS11    1
+#define CS12    2
+
+/* EECR */
+#define EERE    0
+#define EEPE    1
+#define EEMPE   2
+#define EERIE   3
+
+/* UCSR0A/B/C */
+#define U2X0    1
+#define UPE0    2
+#define DOR0    3
+#define FE0     4
+#define UDRE0   5
+#define TXC0    6
+#define RXC0    7
+#define TXEN0   3
+#define RXEN0   4
+#define UCSZ00  1
+#define UCSZ01  2
+
+/* Port bits */
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+
+#endif /* HOST_AVR_IO_H_ */
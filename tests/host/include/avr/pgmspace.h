@@ -0,0 +1,23 @@
+/* Host stand-in for <avr/pgmspace.h>. Program memory is ordinary memory. */
+
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+#include <avr/io.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(addr)       (*(const uint8_t *)(addr))
+#define pgm_read_byte_near(addr)  pgm_read_byte(addr)
+#define pgm_read_word(addr)       (*(const uint16_t *)(addr))
+#define pgm_read_word_near(addr)  pgm_read_word(addr)
+#define pgm_read_ptr(addr)        (*(void * const *)(addr))
+
+/* Far addresses are host addresses */
+typedef uintptr_t uint_farptr_t;
+
+#define pgm_get_far_address(var)  ((uint_farptr_t) &(var))
+#define pgm_read_byte_far(addr)   (*(const uint8_t *) (uint_farptr_t) (addr))
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
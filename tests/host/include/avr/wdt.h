@@ -0,0 +1,10 @@
+/* Host stand-in for <avr/wdt.h> */
+
+#ifndef HOST_AVR_WDT_H_
+#define HOST_AVR_WDT_H_
+
+#include <avr/io.h>
+
+#define wdt_reset() do {} while (0)
+
+#endif /* HOST_AVR_WDT_H_ */
@@ -0,0 +1,11 @@
+/* Host stand-in for <util/delay.h>. Delays advance the simulated clock. */
+
+#ifndef HOST_UTIL_DELAY_H_
+#define HOST_UTIL_DELAY_H_
+
+#include "host_avr.h"
+
+#define _delay_us(us) host_delay_us (us)
+#define _delay_ms(ms) host_delay_us ((ms) * 1000.0)
+
+#endif /* HOST_UTIL_DELAY_H_ */
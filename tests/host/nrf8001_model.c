@@ -0,0 +1,551 @@
+/* Behavioural model of the nRF8001, see nrf8001_model.h */
+
+#include <string.h>
+
+#include "aci.h"
+#include "aci_cmds.h"
+#include "aci_evts.h"
+#include "lib_aci.h"
+
+#include "nrf8001_model.h"
+
+#define NRF8001_EVENT_QUEUE_SIZE  16
+#define NRF8001_TX_QUEUE_SIZE     8
+#define NRF8001_DEBUG_BYTE        0x01
+
+/* Status of the Disconnected event, remote user terminated connection */
+#define BTLE_REMOTE_USER_TERMINATED  0x13
+
+typedef struct
+{
+  uint8_t len;
+  uint8_t data[HAL_ACI_MAX_LENGTH];   /* Opcode and parameters */
+  bool    rx_data;                    /* Takes a receive buffer */
+  bool    local_disconnect;
+  uint64_t queued_at;
+} nrf8001_msg_t;
+
+nrf8001_stats_t nrf8001_stats;
+
+static nrf8001_config_t m_config;
+static nrf8001_link_t   m_link;
+static uint8_t          m_credits;
+static uint8_t          m_credits_used;
+static uint8_t          m_pipes_open[PIPES_ARRAY_SIZE];
+static bool             m_local_disconnect_done;
+
+/* Broadcast pipe value, and whether OpenAdvPipe put it in the advertising */
+static uint8_t          m_broadcast[ACI_PIPE_TX_DATA_MAX_LEN];
+static uint8_t          m_broadcast_len;
+static bool             m_broadcast_adv;
+
+static nrf8001_msg_t    m_events[NRF8001_EVENT_QUEUE_SIZE];
+static uint8_t          m_event_head;
+static uint8_t          m_event_count;
+static uint8_t          m_rx_data_count;
+
+static nrf8001_msg_t    m_tx[NRF8001_TX_QUEUE_SIZE];
+static uint8_t          m_tx_head;
+static uint8_t          m_tx_count;
+
+/* SPI transfer in progress */
+static uint8_t          m_spi_index;
+static uint8_t          m_spi_total;
+static uint8_t          m_cmd[HAL_ACI_MAX_LENGTH + 1];
+static uint8_t          m_cmd_len;
+static nrf8001_msg_t   *m_out;
+
+static nrf8001_msg_t *m_event_put (uint8_t len)
+{
+  nrf8001_msg_t *p_msg;
+
+  if (m_event_count == NRF8001_EVENT_QUEUE_SIZE)
+  {
+    return NULL;
+  }
+
+  p_msg = &m_events[(m_event_head + m_event_count++) % NRF8001_EVENT_QUEUE_SIZE];
+  memset (p_msg, 0, sizeof (*p_msg));
+  p_msg->len = len;
+  nrf8001_stats.events++;
+
+  return p_msg;
+}
+
+static void m_event_pop (void)
+{
+  if (m_events[m_event_head].rx_data)
+  {
+    m_rx_data_count--;
+  }
+
+  m_event_head = (m_event_head + 1) % NRF8001_EVENT_QUEUE_SIZE;
+  m_event_count--;
+}
+
+static void m_cmd_rsp (uint8_t opcode, uint8_t status)
+{
+  nrf8001_msg_t *p_msg = m_event_put (3);
+
+  if (p_msg)
+  {
+    p_msg->data[0] = ACI_EVT_CMD_RSP;
+    p_msg->data[1] = opcode;
+    p_msg->data[2] = status;
+  }
+}
+
+static void m_pipe_error (uint8_t pipe, uint8_t error_code)
+{
+  nrf8001_msg_t *p_msg = m_event_put (3);
+
+  nrf8001_stats.pipe_errors++;
+
+  if (p_msg)
+  {
+    p_msg->data[0] = ACI_EVT_PIPE_ERROR;
+    p_msg->data[1] = pipe;
+    p_msg->data[2] = error_code;
+  }
+}
+
+static bool m_pipe_is_open (uint8_t pipe)
+{
+  return pipe < ACI_DEVICE_MAX_PIPES &&
+         (m_pipes_open[pipe / 8] & (1 << (pipe % 8)));
+}
+
+static void m_link_drop (void)
+{
+  m_link = NRF8001_STANDBY;
+  memset (m_pipes_open, 0, sizeof (m_pipes_open));
+  m_credits = m_config.credits;
+  m_credits_used = 0;
+  m_tx_count = 0;
+}
+
+static void m_device_started (uint8_t mode)
+{
+  nrf8001_msg_t *p_msg = m_event_put (4);
+
+  if (p_msg)
+  {
+    p_msg->data[0] = ACI_EVT_DEVICE_STARTED;
+    p_msg->data[1] = mode;
+    p_msg->data[2] = 0;
+    p_msg->data[3] = m_config.credits;
+  }
+}
+
+static void m_send_data (const uint8_t *p_params, uint8_t len)
+{
+  const uint8_t pipe = p_params[0];
+  nrf8001_msg_t *p_msg;
+
+  if (m_link != NRF8001_CONNECTED || !m_pipe_is_open (pipe))
+  {
+    m_pipe_error (pipe, ACI_STATUS_ERROR_PIPE_STATE_INVALID);
+    return;
+  }
+
+  if (m_credits == 0 || m_tx_count == NRF8001_TX_QUEUE_SIZE)
+  {
+    m_pipe_error (pipe, ACI_STATUS_ERROR_CREDIT_NOT_AVAILABLE);
+    return;
+  }
+
+  m_credits--;
+  p_msg = &m_tx[(m_tx_head + m_tx_count++) % NRF8001_TX_QUEUE_SIZE];
+  p_msg->len = len;
+  memcpy (p_msg->data, p_params, len);
+}
+
+/* Carry out a command from the AVR, m_cmd holds opcode and parameters */
+static void m_command (void)
+{
+  const uint8_t opcode = m_cmd[0];
+  nrf8001_msg_t *p_msg;
+
+  nrf8001_stats.commands++;
+
+  switch (opcode)
+  {
+    case ACI_CMD_CONNECT:
+      if (m_link != NRF8001_STANDBY)
+      {
+        m_cmd_rsp (opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+        break;
+      }
+      m_link = NRF8001_ADVERTISING;
+      m_cmd_rsp (opcode, ACI_STATUS_SUCCESS);
+      break;
+
+    case ACI_CMD_RADIO_RESET:
+      m_link_drop ();
+      m_cmd_rsp (opcode, ACI_STATUS_SUCCESS);
+      break;
+
+    case ACI_CMD_DISCONNECT:
+      if (m_link != NRF8001_CONNECTED)
+      {
+        m_cmd_rsp (opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+        break;
+      }
+      m_cmd_rsp (opcode, ACI_STATUS_SUCCESS);
+      m_link_drop ();
+      p_msg = m_event_put (3);
+      if (p_msg)
+      {
+        p_msg->data[0] = ACI_EVT_DISCONNECTED;
+        p_msg->data[1] = ACI_STATUS_SUCCESS;
+        p_msg->data[2] = BTLE_REMOTE_USER_TERMINATED;
+        p_msg->local_disconnect = true;
+      }
+      break;
+
+    case ACI_CMD_SEND_DATA:
+      if (m_cmd_len < 2)
+      {
+        m_cmd_rsp (opcode, ACI_STATUS_ERROR_INVALID_LENGTH);
+        break;
+      }
+      m_send_data (&m_cmd[1], m_cmd_len - 1);
+      break;
+
+    case ACI_CMD_SET_LOCAL_DATA:
+      if (m_cmd_len < 2 || m_cmd_len - 2 > sizeof (m_broadcast))
+      {
+        m_cmd_rsp (opcode, ACI_STATUS_ERROR_INVALID_LENGTH);
+        break;
+      }
+      if (!m_config.broadcast_pipe || m_cmd[1] != m_config.broadcast_pipe)
+      {
+        m_cmd_rsp (opcode, ACI_STATUS_ERROR_PIPE_INVALID);
+        break;
+      }
+      m_broadcast_len = m_cmd_len - 2;
+      memcpy (m_broadcast, &m_cmd[2], m_broadcast_len);
+      m_cmd_rsp (opcode, ACI_STATUS_SUCCESS);
+      break;
+
+    case ACI_CMD_OPEN_ADV_PIPE:
+      if (m_cmd_len != 1 + PIPES_ARRAY_SIZE)
+      {
+        m_cmd_rsp (opcode, ACI_STATUS_ERROR_INVALID_LENGTH);
+        break;
+      }
+      m_broadcast_adv = m_config.broadcast_pipe &&
+        (m_cmd[1 + m_config.broadcast_pipe / 8] &
+         (1 << (m_config.broadcast_pipe % 8)));
+      m_cmd_rsp (opcode, ACI_STATUS_SUCCESS);
+      break;
+
+    case ACI_CMD_WRITE_DYNAMIC_DATA:
+      m_cmd_rsp (opcode, ACI_STATUS_TRANSACTION_COMPLETE);
+      break;
+
+    case ACI_CMD_TEST:
+      if (m_cmd_len == 2 && m_link == NRF8001_STANDBY &&
+          m_cmd[1] == ACI_TEST_MODE_DTM_ACI)
+      {
+        m_link = NRF8001_TEST;
+        m_device_started (ACI_DEVICE_TEST);
+      }
+      else if (m_cmd_len == 2 && m_link == NRF8001_TEST &&
+          m_cmd[1] == ACI_TEST_MODE_EXIT)
+      {
+        m_link_drop ();
+        m_device_started (ACI_DEVICE_STANDBY);
+      }
+      else
+      {
+        m_cmd_rsp (opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+      }
+      break;
+
+    case ACI_CMD_ECHO:
+      if (m_link != NRF8001_TEST)
+      {
+        m_cmd_rsp (opcode, ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+        break;
+      }
+      p_msg = m_event_put (m_cmd_len);
+      if (p_msg)
+      {
+        p_msg->data[0] = ACI_EVT_ECHO;
+        memcpy (&p_msg->data[1], &m_cmd[1], m_cmd_len - 1);
+      }
+      break;
+
+    default:
+      m_cmd_rsp (opcode, ACI_STATUS_ERROR_CMD_UNKNOWN);
+      break;
+  }
+}
+
+static uint64_t m_clock (void)
+{
+  return m_config.clock ? m_config.clock () : 0;
+}
+
+static void m_rx_delivered (const nrf8001_msg_t *p_msg)
+{
+  const uint64_t latency = m_clock () - p_msg->queued_at;
+
+  if (nrf8001_stats.data_delivered++ == 0 ||
+      latency < nrf8001_stats.rx_latency_min)
+  {
+    nrf8001_stats.rx_latency_min = latency;
+  }
+  if (latency > nrf8001_stats.rx_latency_max)
+  {
+    nrf8001_stats.rx_latency_max = latency;
+  }
+  nrf8001_stats.rx_latency_total += latency;
+}
+
+static void m_spi_end (void)
+{
+  nrf8001_stats.spi_transfers++;
+
+  if (m_out)
+  {
+    if (m_out->rx_data)
+    {
+      m_rx_delivered (m_out);
+    }
+
+    if (m_out->local_disconnect)
+    {
+      m_local_disconnect_done = true;
+    }
+
+    m_event_pop ();
+    m_out = NULL;
+  }
+
+  if (m_cmd_len)
+  {
+    m_command ();
+  }
+
+  m_spi_index = 0;
+}
+
+void nrf8001_init (const nrf8001_config_t *p_config)
+{
+  m_config = *p_config;
+  memset (&nrf8001_stats, 0, sizeof (nrf8001_stats));
+  m_event_head = 0;
+  m_event_count = 0;
+  m_rx_data_count = 0;
+  m_tx_head = 0;
+  m_spi_index = 0;
+  m_out = NULL;
+  m_local_disconnect_done = false;
+  m_broadcast_len = 0;
+  m_broadcast_adv = false;
+  m_link_drop ();
+  m_device_started (ACI_DEVICE_STANDBY);
+}
+
+bool nrf8001_rdyn_low (bool reqn_low)
+{
+  return reqn_low || m_event_count > 0;
+}
+
+uint8_t nrf8001_spi_exchange (uint8_t mosi)
+{
+  uint8_t miso;
+
+  nrf8001_stats.spi_bytes++;
+
+  if (m_spi_index == 0)
+  {
+    /* Length from the AVR, debug byte back. The event to send is latched
+     * here, events queued during the transfer wait for the next one.
+     */
+    m_out = m_event_count ? &m_events[m_event_head] : NULL;
+    m_cmd_len = mosi;
+    miso = NRF8001_DEBUG_BYTE;
+  }
+  else if (m_spi_index == 1)
+  {
+    const uint8_t out_len = m_out ? m_out->len : 0;
+    uint8_t max_bytes;
+
+    /* Command opcode from the AVR, event length back */
+    m_cmd[0] = mosi;
+    miso = out_len;
+
+    if (m_cmd_len == 0)
+    {
+      max_bytes = out_len;
+    }
+    else
+    {
+      max_bytes = (out_len > m_cmd_len - 1) ? out_len : m_cmd_len - 1;
+    }
+
+    if (max_bytes > HAL_ACI_MAX_LENGTH)
+    {
+      max_bytes = HAL_ACI_MAX_LENGTH;
+    }
+
+    m_spi_total = 2 + max_bytes;
+  }
+  else
+  {
+    const uint8_t i = m_spi_index - 2;
+
+    if (i + 1 < sizeof (m_cmd))
+    {
+      m_cmd[i + 1] = mosi;
+    }
+
+    miso = (m_out && i < m_out->len) ? m_out->data[i] : 0;
+  }
+
+  if (++m_spi_index == m_spi_total && m_spi_index > 1)
+  {
+    m_spi_end ();
+  }
+
+  return miso;
+}
+
+bool nrf8001_local_disconnect_done (void)
+{
+  return m_local_disconnect_done;
+}
+
+nrf8001_link_t nrf8001_link (void)
+{
+  return m_link;
+}
+
+uint8_t nrf8001_adv_data (uint8_t *p_data)
+{
+  if (m_link != NRF8001_ADVERTISING || !m_broadcast_adv)
+  {
+    return 0;
+  }
+
+  memcpy (p_data, m_broadcast, m_broadcast_len);
+  return m_broadcast_len;
+}
+
+bool nrf8001_connect (const uint8_t *p_pipes, uint8_t count)
+{
+  nrf8001_msg_t *p_msg;
+  uint8_t i;
+
+  if (m_link != NRF8001_ADVERTISING)
+  {
+    return false;
+  }
+
+  m_link = NRF8001_CONNECTED;
+  for (i = 0; i < count; i++)
+  {
+    m_pipes_open[p_pipes[i] / 8] |= 1 << (p_pipes[i] % 8);
+  }
+
+  /* Connected: address type, address, interval, latency, timeout, clock
+   * accuracy. The timing is informational, the simulator runs the events.
+   */
+  p_msg = m_event_put (15);
+  if (p_msg)
+  {
+    p_msg->data[0] = ACI_EVT_CONNECTED;
+    p_msg->data[1] = ACI_BD_ADDR_TYPE_PUBLIC;
+    p_msg->data[8] = 6;
+    p_msg->data[12] = 100;
+  }
+
+  p_msg = m_event_put (1 + 2 * PIPES_ARRAY_SIZE);
+  if (p_msg)
+  {
+    p_msg->data[0] = ACI_EVT_PIPE_STATUS;
+    memcpy (&p_msg->data[1], m_pipes_open, PIPES_ARRAY_SIZE);
+  }
+
+  return true;
+}
+
+uint8_t nrf8001_rx_free (void)
+{
+  const uint8_t queue_free = NRF8001_EVENT_QUEUE_SIZE - m_event_count;
+  uint8_t free;
+
+  if (m_link != NRF8001_CONNECTED || m_rx_data_count >= m_config.rx_buffers)
+  {
+    return 0;
+  }
+
+  free = m_config.rx_buffers - m_rx_data_count;
+
+  return free < queue_free ? free : queue_free;
+}
+
+bool nrf8001_write (uint8_t pipe, const uint8_t *p_data, uint8_t len)
+{
+  nrf8001_msg_t *p_msg;
+
+  if (nrf8001_rx_free () == 0 || !m_pipe_is_open (pipe) ||
+      len > HAL_ACI_MAX_LENGTH - 2)
+  {
+    return false;
+  }
+
+  p_msg = m_event_put (2 + len);
+  p_msg->data[0] = ACI_EVT_DATA_RECEIVED;
+  p_msg->data[1] = pipe;
+  memcpy (&p_msg->data[2], p_data, len);
+  p_msg->rx_data = true;
+  p_msg->queued_at = m_clock ();
+  m_rx_data_count++;
+  nrf8001_stats.data_received++;
+
+  return true;
+}
+
+uint8_t nrf8001_notification_get (uint8_t *p_pipe, uint8_t *p_data)
+{
+  const nrf8001_msg_t *p_msg;
+
+  if (m_tx_count == 0)
+  {
+    return 0;
+  }
+
+  p_msg = &m_tx[m_tx_head];
+  m_tx_head = (m_tx_head + 1) % NRF8001_TX_QUEUE_SIZE;
+  m_tx_count--;
+  m_credits_used++;
+  nrf8001_stats.data_sent++;
+
+  *p_pipe = p_msg->data[0];
+  memcpy (p_data, &p_msg->data[1], p_msg->len - 1);
+
+  return p_msg->len - 1;
+}
+
+void nrf8001_connection_event_end (void)
+{
+  nrf8001_msg_t *p_msg;
+
+  if (m_credits_used == 0)
+  {
+    return;
+  }
+
+  p_msg = m_event_put (2);
+  if (p_msg)
+  {
+    p_msg->data[0] = ACI_EVT_DATA_CREDIT;
+    p_msg->data[1] = m_credits_used;
+    m_credits += m_credits_used;
+    m_credits_used = 0;
+  }
+}
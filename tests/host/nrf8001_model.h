@@ -0,0 +1,115 @@
+/* Behavioural model of the nRF8001 for the host simulator.
+ *
+ * The model sits on the ACI side of the chip: it takes the bytes the AVR
+ * clocks out on SPI, answers with queued events, and drives RDYN. On the
+ * air side it is driven by the simulator in whole connection events: the
+ * central connects, writes to pipes and collects notifications.
+ *
+ * Only what the bootloader uses is modelled: DeviceStarted, Connect,
+ * RadioReset, Disconnect, SendData with data credits, WriteDynamicData,
+ * SetLocalData and OpenAdvPipe on a single broadcast pipe, and Test,
+ * entering and leaving ACI Test mode from Standby, in which Echo is
+ * answered. Other commands get a command response with
+ * ERROR_CMD_UNKNOWN.
+ *
+ * Received data is held in a small number of buffers. While they are all
+ * taken by events the AVR has not fetched, the link layer stops accepting
+ * packets, which is how the nRF8001 flow controls the central.
+ */
+
+#ifndef NRF8001_MODEL_H_
+#define NRF8001_MODEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hal_aci_tl.h"
+
+typedef struct
+{
+  uint8_t credits;      /* Data credits announced in DeviceStarted */
+  uint8_t rx_buffers;   /* Received packets held before flow control */
+  uint8_t broadcast_pipe; /* Broadcast pipe of the setup, 0 for none */
+
+  /* CPU cycles of the AVR, for the receive latency statistics */
+  uint64_t (*clock) (void);
+} nrf8001_config_t;
+
+typedef enum
+{
+  NRF8001_STANDBY,
+  NRF8001_ADVERTISING,
+  NRF8001_CONNECTED,
+  NRF8001_TEST,         /* ACI Test mode, no link */
+} nrf8001_link_t;
+
+typedef struct
+{
+  uint32_t spi_transfers;
+  uint32_t spi_bytes;
+  uint32_t commands;
+  uint32_t events;
+  uint32_t data_received;   /* Packets written by the central */
+  uint32_t data_delivered;  /* Of those, transferred to the AVR */
+  uint32_t data_sent;       /* Notifications sent to the central */
+  uint32_t pipe_errors;
+
+  /* Cycles from the write of a packet to its transfer to the AVR */
+  uint64_t rx_latency_min;
+  uint64_t rx_latency_max;
+  uint64_t rx_latency_total;
+} nrf8001_stats_t;
+
+extern nrf8001_stats_t nrf8001_stats;
+
+/* Power up, with a DeviceStarted event pending */
+void nrf8001_init (const nrf8001_config_t *p_config);
+
+/* ACI side */
+
+/* Level of RDYN given the level of REQN. RDYN is low while an event is
+ * pending or the AVR requests a transfer.
+ */
+bool nrf8001_rdyn_low (bool reqn_low);
+
+/* Exchange one SPI byte. The model counts the bytes of a transfer itself,
+ * from the two length bytes, the same way hal_aci_tl.c does.
+ */
+uint8_t nrf8001_spi_exchange (uint8_t mosi);
+
+/* True once the Disconnected event following a Disconnect command from the
+ * AVR has been transferred. The bootloader resets after that.
+ */
+bool nrf8001_local_disconnect_done (void);
+
+/* Air side */
+
+nrf8001_link_t nrf8001_link (void);
+
+/* The value of the broadcast pipe in the advertising data. Returns its
+ * length, 0 while not advertising or with the pipe not opened for it.
+ */
+uint8_t nrf8001_adv_data (uint8_t *p_data);
+
+/* Connect to an advertising device, with the given pipes open */
+bool nrf8001_connect (const uint8_t *p_pipes, uint8_t count);
+
+/* Free receive buffers, the number of packets the central can write in the
+ * coming connection event
+ */
+uint8_t nrf8001_rx_free (void);
+
+/* A packet written by the central on pipe */
+bool nrf8001_write (uint8_t pipe, const uint8_t *p_data, uint8_t len);
+
+/* Take the next notification sent in this connection event. Returns its
+ * length, or 0 if there are no more.
+ */
+uint8_t nrf8001_notification_get (uint8_t *p_pipe, uint8_t *p_data);
+
+/* Close the connection event, returning the credits of the notifications
+ * sent in it to the AVR
+ */
+void nrf8001_connection_event_end (void);
+
+#endif /* NRF8001_MODEL_H_ */
@@ -0,0 +1,233 @@
+/* Central side of the simulated BLE link, see sim_link.h */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nrf8001_model.h"
+#include "sim_link.h"
+
+/* Give up if the bootloader never advertises */
+#define SIM_LINK_ADVERTISING_US  1000000UL
+
+sim_link_stats_t sim_link_stats;
+
+static const sim_link_config_t *m_config;
+static int m_client = -1;
+
+void sim_link_fail (const char *what)
+{
+  fprintf (stderr, "sim_link: %s\n", what);
+  exit (1);
+}
+
+static void m_send (const void *buf, size_t len)
+{
+  const uint8_t *p = buf;
+
+  while (len)
+  {
+    const ssize_t n = send (m_client, p, len, 0);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      sim_link_fail ("client went away");
+    }
+
+    p += n;
+    len -= n;
+  }
+}
+
+static void m_recv (void *buf, size_t len)
+{
+  uint8_t *p = buf;
+
+  while (len)
+  {
+    const ssize_t n = recv (m_client, p, len, 0);
+
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      sim_link_fail ("client went away");
+    }
+
+    p += n;
+    len -= n;
+  }
+}
+
+static void m_msg_send (uint8_t type, const uint8_t *p_data, uint8_t len)
+{
+  const uint8_t header[2] = {type, len};
+
+  m_send (header, 2);
+  m_send (p_data, len);
+}
+
+static uint8_t m_msg_recv (uint8_t *p_data, uint8_t *p_len)
+{
+  uint8_t header[2];
+
+  m_recv (header, 2);
+  m_recv (p_data, header[1]);
+  *p_len = header[1];
+
+  return header[0];
+}
+
+static uint32_t m_time_us (void)
+{
+  return (uint32_t) (m_config->avr_cycles () / m_config->cycles_per_us);
+}
+
+static void m_msg_send_time (uint8_t type, uint8_t extra, uint8_t extra_len)
+{
+  const uint32_t t = m_time_us ();
+  const uint8_t msg[5] = {t, t >> 8, t >> 16, t >> 24, extra};
+
+  m_msg_send (type, msg, 4 + extra_len);
+}
+
+/* One connection event: notifications to the client, writes from it */
+static void m_connection_event (void)
+{
+  uint8_t data[255];
+  uint8_t budget = nrf8001_rx_free ();
+  uint8_t pipe;
+  uint8_t len;
+  uint8_t type;
+
+  sim_link_stats.connection_events++;
+
+  while ((len = nrf8001_notification_get (&pipe, data)) > 0)
+  {
+    m_msg_send ('N', data, len);
+  }
+  nrf8001_connection_event_end ();
+
+  if (budget > m_config->packets_per_event)
+  {
+    budget = m_config->packets_per_event;
+  }
+  m_msg_send_time ('E', budget, 1);
+
+  while ((type = m_msg_recv (data, &len)) != 'S')
+  {
+    if (type == 'Q')
+    {
+      sim_link_fail ("aborted by client");
+    }
+
+    if ((type != 'P' && type != 'C') || budget-- == 0)
+    {
+      sim_link_fail ("protocol error");
+    }
+
+    pipe = m_config->pipes[type == 'P' ? 0 : 2];
+    if (!nrf8001_write (pipe, data, len))
+    {
+      sim_link_fail ("write rejected");
+    }
+
+    if (type == 'P')
+    {
+      sim_link_stats.packets++;
+      sim_link_stats.packet_bytes += len;
+    }
+  }
+}
+
+void sim_link_accept (const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (path) >= sizeof (addr.sun_path))
+  {
+    sim_link_fail ("socket path too long");
+  }
+  strcpy (addr.sun_path, path);
+
+  unlink (path);
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 ||
+      bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+      listen (fd, 1) < 0)
+  {
+    perror (path);
+    exit (1);
+  }
+
+  m_client = accept (fd, NULL, NULL);
+  if (m_client < 0)
+  {
+    perror ("accept");
+    exit (1);
+  }
+
+  close (fd);
+  unlink (path);
+}
+
+void sim_link_session (const sim_link_config_t *p_config)
+{
+  const uint64_t interval = (uint64_t) p_config->interval_us * p_config->cycles_per_us;
+  const uint64_t limit = (uint64_t) p_config->time_limit_s * 1000000UL * p_config->cycles_per_us;
+  uint64_t next_event;
+  uint8_t data[255];
+  uint8_t len;
+
+  m_config = p_config;
+  memset (&sim_link_stats, 0, sizeof (sim_link_stats));
+
+  if (m_msg_recv (data, &len) != 'O')
+  {
+    sim_link_fail ("protocol error");
+  }
+
+  while (nrf8001_link () != NRF8001_ADVERTISING)
+  {
+    if (!p_config->avr_run (p_config->avr_cycles () + 1) ||
+        m_time_us () > SIM_LINK_ADVERTISING_US)
+    {
+      sim_link_fail ("bootloader does not advertise");
+    }
+  }
+
+  nrf8001_connect (p_config->pipes, 3);
+  next_event = p_config->avr_cycles () + interval;
+
+  while (p_config->avr_run (next_event))
+  {
+    if (p_config->avr_cycles () > limit)
+    {
+      sim_link_fail ("time limit reached");
+    }
+
+    m_connection_event ();
+    next_event += interval;
+  }
+
+  m_msg_send_time ('D', 0, 0);
+}
+
+void sim_link_close (void)
+{
+  close (m_client);
+  m_client = -1;
+}
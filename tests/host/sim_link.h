@@ -0,0 +1,69 @@
+/* Central side of the simulated BLE link.
+ *
+ * Serves one DFU client, normally tools/ble_dfu.py, over a UNIX socket in
+ * lockstep with the clock of a simulated AVR, one connection event at a
+ * time. The AVR is whatever runs the bootloader with the nRF8001 model of
+ * nrf8001_model.c attached: the host build in ble_sim.c, or simavr in
+ * tests/simavr. Every message is a type byte, a length byte and the
+ * payload:
+ *
+ *   client -> simulator
+ *     'O'                  connect, first message of a session
+ *     'P' data             write without response to the DFU packet
+ *     'C' data             write to the DFU control point
+ *     'S'                  end of the writes for this connection event
+ *     'Q'                  abort
+ *
+ *   simulator -> client
+ *     'N' data             notification on the control point
+ *     'E' time_us budget   connection event; time in microseconds since
+ *                          reset (u32 LE) and the number of writes the link
+ *                          accepts in this event
+ *     'D' time_us          the bootloader disconnected
+ *
+ * Notifications of a connection event come ahead of its 'E'. The client
+ * answers every 'E' with its writes, at most budget of them, then 'S'.
+ */
+
+#ifndef SIM_LINK_H_
+#define SIM_LINK_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct
+{
+  const uint8_t *pipes;             /* DFU packet, control point TX and RX */
+  uint32_t       interval_us;
+  uint8_t        packets_per_event;
+  uint32_t       time_limit_s;
+  uint32_t       cycles_per_us;
+
+  /* Run the AVR until its clock reaches cycles. Returns false once it has
+   * reset, which ends the session.
+   */
+  bool     (*avr_run) (uint64_t cycles);
+  uint64_t (*avr_cycles) (void);
+} sim_link_config_t;
+
+typedef struct
+{
+  uint32_t connection_events;
+  uint32_t packets;
+  uint32_t packet_bytes;
+} sim_link_stats_t;
+
+extern sim_link_stats_t sim_link_stats;
+
+/* Wait for the client on a UNIX socket at path */
+void sim_link_accept (const char *path);
+
+/* Run a session, from the client's connect to the bootloader's reset */
+void sim_link_session (const sim_link_config_t *p_config);
+
+void sim_link_close (void);
+
+/* Report an error and exit */
+void sim_link_fail (const char *what);
+
+#endif /* SIM_LINK_H_ */
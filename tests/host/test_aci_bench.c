@@ -0,0 +1,275 @@
+/* Host tests for the SPI benchmark of BLE/aci_bench.c, and the SPI clock
+ * setting of hal_aci_tl.c it uses.
+ *
+ * The nRF8001 model of nrf8001_model.c is attached to SPSR and RDYN the way
+ * ble_sim.c attaches it, with SPI bytes charged at the SPI clock of SPCR
+ * and SPSR. The model answers without delay, so the time of an echo is
+ * that of the transfers and the polls of RDYN alone.
+ */
+
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+#include "nrf8001_model.h"
+
+#include "aci_bench.h"
+#include "aci_cmds.h"
+#include "aci_evts.h"
+#include "hal_aci_tl.h"
+#include "lib_aci.h"
+#include "pins_arduino.h"
+
+/* Polls of RDYN, and the work around every SPI byte, as in ble_sim.c */
+#define M_POLL_CYCLES      40
+#define M_SPI_BYTE_CYCLES  8
+
+int host_test_failures;
+
+static aci_pins_t         m_pins = {
+  .reqn_pin = 9,
+  .rdyn_pin = 8,
+  .mosi_pin = 11,
+  .miso_pin = 12,
+  .sck_pin = 13,
+  .reset_pin = 4,
+  .active_pin = UNUSED,
+  .optional_chip_sel_pin = UNUSED,
+};
+static const nrf8001_config_t m_nrf8001 = {.credits = 2, .rx_buffers = 4};
+
+static volatile uint8_t  *m_rdyn_in;
+static volatile uint8_t  *m_reqn_out;
+static uint32_t           m_polls;
+
+/* Helpers */
+
+/* SCK period in CPU cycles, from SPR1:0 in SPCR and SPI2X in SPSR */
+static uint32_t m_spi_clock_cycles (void)
+{
+  static const uint8_t dividers[4] = {4, 16, 64, 128};
+  const uint32_t divider = dividers[host_SPCR & (_BV(SPR1) | _BV(SPR0))];
+
+  return (host_SPSR & _BV(SPI2X)) ? divider / 2 : divider;
+}
+
+static void m_spi_status (void)
+{
+  host_SPDR = nrf8001_spi_exchange (host_SPDR);
+  host_SPSR |= _BV(SPIF);
+  host_cycles += 8 * m_spi_clock_cycles () + M_SPI_BYTE_CYCLES;
+}
+
+static void m_pin_input (volatile uint8_t *pin)
+{
+  const uint8_t rdyn_mask = pin_to_bit_mask (m_pins.rdyn_pin);
+
+  if (pin != m_rdyn_in)
+  {
+    return;
+  }
+
+  host_cycles += M_POLL_CYCLES;
+
+  if (nrf8001_rdyn_low (!(*m_reqn_out & pin_to_bit_mask (m_pins.reqn_pin))))
+  {
+    *pin &= ~rdyn_mask;
+  }
+  else
+  {
+    *pin |= rdyn_mask;
+  }
+}
+
+/* RDYN is read through the pointer pin_to_input() returns, which the flash
+ * tables of pins_arduino.c look up without reading PINx. The read is made
+ * here, see RDYN_LDFLAGS in the Makefile.
+ */
+volatile uint8_t *__real_pin_to_input (uint8_t n);
+
+volatile uint8_t *__wrap_pin_to_input (uint8_t n)
+{
+  volatile uint8_t *pin = __real_pin_to_input (n);
+
+  return pin ? host_pin_input (pin) : pin;
+}
+
+static void m_poll (void)
+{
+  m_polls++;
+}
+
+/* A powered up nRF8001 with its DeviceStarted event pending, and the
+ * transport as ble_init() leaves it
+ */
+static void m_setup (void)
+{
+  host_avr_reset ();
+  m_rdyn_in = pin_to_input (m_pins.rdyn_pin);
+  m_reqn_out = pin_to_output (m_pins.reqn_pin);
+  m_polls = 0;
+
+  nrf8001_init (&m_nrf8001);
+  host_io_hooks.spi_status = m_spi_status;
+  host_io_hooks.pin_input = m_pin_input;
+
+  hal_aci_tl_init (&m_pins);
+}
+
+/* Dividers the benchmark should use at F_CPU, fastest first */
+static uint8_t m_dividers_expected (uint8_t *p_dividers)
+{
+  uint8_t count = 0;
+  uint16_t divider;
+
+  for (divider = 2; divider <= 128; divider <<= 1)
+  {
+    if (F_CPU / divider <= ACI_BENCH_SCK_MAX)
+    {
+      p_dividers[count++] = (uint8_t) divider;
+    }
+  }
+
+  return count;
+}
+
+/* Tests */
+
+/* Every divider gives SPR1:0 and SPI2X for that SCK, and leaves the SPI on */
+static void test_spi_clock_set (void)
+{
+  uint16_t divider;
+
+  m_setup ();
+  CHECK (hal_aci_tl_spi_clock_get () == 16);
+  CHECK (m_spi_clock_cycles () == 16);
+
+  for (divider = 2; divider <= 128; divider <<= 1)
+  {
+    CHECK (hal_aci_tl_spi_clock_set ((uint8_t) divider));
+    CHECK (hal_aci_tl_spi_clock_get () == divider);
+    CHECK (m_spi_clock_cycles () == divider);
+    CHECK (host_SPCR & _BV(SPE));
+    CHECK (host_SPCR & _BV(MSTR));
+    CHECK (host_SPCR & _BV(DORD));
+  }
+}
+
+static void test_spi_clock_set_invalid (void)
+{
+  static const uint8_t invalid[] = {0, 1, 3, 12, 129, 255};
+  uint8_t i;
+
+  m_setup ();
+  for (i = 0; i < sizeof (invalid); i++)
+  {
+    CHECK (!hal_aci_tl_spi_clock_set (invalid[i]));
+  }
+  CHECK (hal_aci_tl_spi_clock_get () == 16);
+  CHECK (m_spi_clock_cycles () == 16);
+}
+
+/* Every echo comes back at every clock the nRF8001 takes, and a faster
+ * clock takes less time
+ */
+static void test_echoes (void)
+{
+  aci_bench_result_t results[ACI_BENCH_CLOCKS];
+  uint8_t dividers[ACI_BENCH_CLOCKS];
+  const uint8_t expected = m_dividers_expected (dividers);
+  uint8_t count;
+  uint8_t i;
+
+  m_setup ();
+  count = aci_bench_run (ACI_ECHO_DATA_MAX_LEN, 8, results, m_poll);
+
+  CHECK (count == expected);
+  for (i = 0; i < count && i < expected; i++)
+  {
+    CHECK (results[i].divider == dividers[i]);
+    CHECK (results[i].echoes == 8);
+    CHECK (results[i].ticks > 0);
+    if (i > 0)
+    {
+      CHECK (results[i].ticks > results[i - 1].ticks);
+    }
+  }
+  CHECK (m_polls > 0);
+}
+
+/* The nRF8001 ends in Standby without a link, and the SPI clock is as it
+ * was
+ */
+static void test_state_restored (void)
+{
+  aci_bench_result_t results[ACI_BENCH_CLOCKS];
+  hal_aci_data_t event;
+
+  m_setup ();
+  CHECK (hal_aci_tl_spi_clock_set (64));
+  CHECK (aci_bench_run (4, 2, results, NULL) > 0);
+
+  CHECK (nrf8001_link () == NRF8001_STANDBY);
+  CHECK (hal_aci_tl_spi_clock_get () == 64);
+  CHECK (m_spi_clock_cycles () == 64);
+  CHECK (!hal_aci_tl_event_get (&event));
+
+  /* Echo is refused outside Test mode */
+  memset (&event, 0, sizeof (event));
+  event.buffer[0] = 2;
+  event.buffer[1] = ACI_CMD_ECHO;
+  CHECK (hal_aci_tl_send (&event));
+  while (!hal_aci_tl_event_get (&event));
+  CHECK (event.buffer[1] == ACI_EVT_CMD_RSP);
+  CHECK (event.buffer[3] == ACI_STATUS_ERROR_DEVICE_STATE_INVALID);
+}
+
+/* More data than an echo carries is cut to ACI_ECHO_DATA_MAX_LEN */
+static void test_len_clamped (void)
+{
+  aci_bench_result_t results[ACI_BENCH_CLOCKS];
+  uint8_t count;
+  uint8_t i;
+
+  m_setup ();
+  count = aci_bench_run (255, 3, results, NULL);
+  CHECK (count > 0);
+  for (i = 0; i < count; i++)
+  {
+    CHECK (results[i].echoes == 3);
+  }
+}
+
+/* A connection is given up for Test mode */
+static void test_from_advertising (void)
+{
+  static const uint8_t pipes[] = {1, 2, 3};
+  aci_bench_result_t results[ACI_BENCH_CLOCKS];
+  hal_aci_data_t msg;
+
+  m_setup ();
+  CHECK (lib_aci_connect (0, 0x20));
+  while (nrf8001_link () != NRF8001_ADVERTISING)
+  {
+    hal_aci_tl_event_get (&msg);
+  }
+  CHECK (nrf8001_connect (pipes, sizeof (pipes)));
+
+  CHECK (aci_bench_run (8, 4, results, NULL) > 0);
+  CHECK (results[0].echoes == 4);
+  CHECK (nrf8001_link () == NRF8001_STANDBY);
+}
+
+int main (void)
+{
+  RUN_TEST (test_spi_clock_set);
+  RUN_TEST (test_spi_clock_set_invalid);
+  RUN_TEST (test_echoes);
+  RUN_TEST (test_state_restored);
+  RUN_TEST (test_len_clamped);
+  RUN_TEST (test_from_advertising);
+
+  return HOST_TEST_RESULT ();
+}
@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+"""End to end BLE DFU against a bootloader simulator.
+
+tools/ble_dfu.py transfers tests/test_application.hex to the simulator,
+which runs the bootloader with the nRF8001 model, and the flash image the
+simulator leaves behind is compared with the HEX file. The simulator is
+ble_sim, the bootloader's BLE sources built for the host, or ble_simavr in
+tests/simavr, the AVR build on simavr. Options after the simulator are
+passed on to it.
+
+    test_ble_dfu.py <eeprom.bin> <simulator> [simulator options]
+"""
+
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', 'tools'))
+
+import ble_dfu  # noqa: E402
+
+APPLICATION = os.path.join(HERE, '..', 'test_application.hex')
+# RAM of the ATmega328P the simulators run
+SIM_RAM_SIZE = 2048
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print('%s: CHECK failed: %s' % (__file__, what), file=sys.stderr)
+        failures += 1
+
+
+def dfu(sim, eeprom, image, prn, window, mcu, init=None):
+    """Run one DFU, returns the flash image and the simulator report"""
+    with tempfile.TemporaryDirectory() as tmp:
+        sock = os.path.join(tmp, 'sock')
+        flash = os.path.join(tmp, 'flash.bin')
+        proc = subprocess.Popen(sim + ['--socket', sock, '--eeprom', eeprom,
+                                       '--flash-out', flash],
+                                stdout=subprocess.PIPE, universal_newlines=True)
+        try:
+            for _ in range(500):
+                if os.path.exists(sock):
+                    break
+                time.sleep(0.01)
+            link = ble_dfu.SimLink(sock)
+            try:
+                client = ble_dfu.DfuClient(link, prn, window)
+                history = client.history()
+                check(history.attempts == 0 and history.result == 'none',
+                      'no update in the history yet')
+                memory = client.memory()
+                check(memory.static + memory.stack_peak + memory.stack_free ==
+                      SIM_RAM_SIZE, 'RAM use adds up to the RAM of the part')
+                client.run(image, mcu=mcu, init=init)
+            finally:
+                link.close()
+            report, _ = proc.communicate(timeout=60)
+        finally:
+            if proc.poll() is None:
+                proc.kill()
+                proc.wait()
+        check(proc.returncode == 0, 'simulator exit status %d' % proc.returncode)
+        with open(flash, 'rb') as f:
+            return f.read(), report
+
+
+def run_test(name, sim, eeprom, prn, window, mcu=None, packet_file=False):
+    failures_before = failures
+    image = ble_dfu.read_hex(APPLICATION)
+    if packet_file:
+        # Sent from the mapped file of tools/dfu_pack.py
+        with tempfile.TemporaryDirectory() as tmp:
+            path = os.path.join(tmp, 'app.dfu')
+            ble_dfu.write_packet_file(path, image, ble_dfu.DFU_IMAGE_APPLICATION,
+                                      ble_dfu.init_packet(image, mcu))
+            with ble_dfu.open_image(path) as packed:
+                flash, report = dfu(sim, eeprom, packed.image, prn, window,
+                                    None, packed.init)
+    else:
+        flash, report = dfu(sim, eeprom, image, prn, window, mcu)
+
+    check(flash[:len(image)] == image, 'image written to flash')
+    check(flash[len(image):] == b'\xff' * (len(flash) - len(image)),
+          'rest of flash erased')
+    # Only the host simulator checks the use of the SPM unit
+    if 'SPM errors' in report:
+        check(re.search(r'\b0 SPM errors', report), 'no SPM errors')
+    check(re.search(r'valid_app 1\b', report), 'application marked valid')
+    check(re.search(r'history 1 attempts, 1 successes, result 2, %d bytes' %
+                    len(image), report), 'update recorded in the history')
+    print('%-48s %s' % (name, 'ok' if failures == failures_before else 'FAILED'))
+
+
+def test_bootloader_image():
+    """A bootloader HEX file is sent from its boot section to the version
+    word
+    """
+    failures_before = failures
+    boot = bytes(range(256)) * 15 + b'\xff' * 254 + b'\x02\x08'
+    image = ble_dfu.bootloader_image(b'\xff' * 0x7000 + boot)
+    check(image == boot, 'boot section sent')
+    check(ble_dfu.start_packet(image, ble_dfu.DFU_IMAGE_BOOTLOADER) ==
+          bytes(4) + len(image).to_bytes(4, 'little') + bytes(4),
+          'size in the bootloader field')
+    print('%-48s %s' % ('test_bootloader_image',
+                        'ok' if failures == failures_before else 'FAILED'))
+
+
+def test_init_packet():
+    """The init packet header follows the CRC, as dfu_init_packet_t"""
+    failures_before = failures
+    image = bytes(range(100))
+    crc = ble_dfu.init_packet(image)
+    check(crc == struct.pack('<H', ble_dfu.crc16_compute(image)),
+          'CRC alone without a part')
+    check(ble_dfu.init_packet(image, 'atmega328p') ==
+          crc + bytes([1, 0x1e, 0x95, 0x0f, 99, 0, 0, 0]),
+          'version, signature and highest address after the CRC')
+    print('%-48s %s' % ('test_init_packet',
+                        'ok' if failures == failures_before else 'FAILED'))
+
+
+def test_crc16_table():
+    """The CRC through the table is the CRC-16-CCITT of BLE/crc16.c"""
+    failures_before = failures
+    check(ble_dfu.crc16_compute(b'123456789') == 0x29B1, 'check value')
+    check(ble_dfu.crc16_compute(b'') == 0xFFFF, 'start value')
+    check(ble_dfu.crc16_compute(b'6789', ble_dfu.crc16_compute(b'12345')) ==
+          0x29B1, 'continued from a given CRC')
+    print('%-48s %s' % ('test_crc16_table',
+                        'ok' if failures == failures_before else 'FAILED'))
+
+
+def test_packet_file():
+    """A packet file gives back the image, type and init packet stored,
+    and a cut short one is refused
+    """
+    failures_before = failures
+    image = bytes(range(256)) * 3 + b'\x01'
+    init = ble_dfu.init_packet(image, 'atmega1284p')
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'boot.dfu')
+        ble_dfu.write_packet_file(path, image, ble_dfu.DFU_IMAGE_BOOTLOADER, init)
+        check(ble_dfu.is_packet_file(path), 'packet file recognized')
+        with ble_dfu.open_image(path) as packed:
+            check(bytes(packed.image) == image, 'image')
+            check(packed.image_type == ble_dfu.DFU_IMAGE_BOOTLOADER, 'image type')
+            check(packed.init == init, 'init packet')
+            sizes = [len(p) for p in ble_dfu.packets(packed.image, 20)]
+            check(sizes == [20] * 38 + [9], 'packets of 20 bytes and the rest')
+
+        with open(path, 'r+b') as f:
+            f.truncate(ble_dfu.PACKET_FILE_HEADER_SIZE + len(image) - 1)
+        try:
+            ble_dfu.PacketFile(path).close()
+            check(False, 'truncated packet file refused')
+        except ble_dfu.DfuError:
+            pass
+    print('%-48s %s' % ('test_packet_file',
+                        'ok' if failures == failures_before else 'FAILED'))
+
+
+def main():
+    eeprom, sim = sys.argv[1], sys.argv[2:]
+
+    test_bootloader_image()
+    test_init_packet()
+    test_crc16_table()
+    test_packet_file()
+    run_test('test_pipelined_window', sim, eeprom, prn=10, window=20,
+             mcu='atmega328p')
+    run_test('test_stop_and_wait', sim, eeprom, prn=1, window=1)
+    run_test('test_packet_file_replayed', sim, eeprom, prn=10, window=20,
+             mcu='atmega328p', packet_file=True)
+    run_test('test_link_flow_control_only', sim, eeprom, prn=0, window=0)
+
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,181 @@
+/* Host tests for the bootloader status in the advertising data, see
+ * ble_status_t in BLE/ble.h.
+ *
+ * BLE/ble.c is built with BLE_STATUS_PIPE and run against the nRF8001
+ * model of nrf8001_model.c, attached to SPSR and RDYN the way ble_sim.c
+ * attaches it. The status is read back from the advertising data of the
+ * model.
+ */
+
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+#include "nrf8001_model.h"
+
+#include "ble.h"
+#include "pins_arduino.h"
+#include "../../history.h"
+
+/* Rounds of the main loop to reach advertising, with room to spare */
+#define M_ROUNDS  64
+
+int host_test_failures;
+
+static bootloader_config_t m_config = {
+  .version = BOOTLOADER_CONFIG_VERSION,
+  .aci_pins = {
+    .reqn_pin = 9,
+    .rdyn_pin = 8,
+    .mosi_pin = 11,
+    .miso_pin = 12,
+    .sck_pin = 13,
+    .reset_pin = 4,
+    .active_pin = UNUSED,
+    .optional_chip_sel_pin = UNUSED,
+  },
+  .credit = 2,
+  .pipes = {8, 9, 10},
+  .conn_timeout = 180,
+  .conn_interval = 0x50,
+};
+
+static volatile uint8_t  *m_rdyn_in;
+static volatile uint8_t  *m_reqn_out;
+
+/* Helpers */
+
+static void m_spi_status (void)
+{
+  host_SPDR = nrf8001_spi_exchange (host_SPDR);
+  host_SPSR |= _BV(SPIF);
+}
+
+static void m_pin_input (volatile uint8_t *pin)
+{
+  const uint8_t rdyn_mask = pin_to_bit_mask (m_config.aci_pins.rdyn_pin);
+
+  if (pin != m_rdyn_in)
+  {
+    return;
+  }
+
+  if (nrf8001_rdyn_low (!(*m_reqn_out &
+          pin_to_bit_mask (m_config.aci_pins.reqn_pin))))
+  {
+    *pin &= ~rdyn_mask;
+  }
+  else
+  {
+    *pin |= rdyn_mask;
+  }
+}
+
+/* See ble_sim.c */
+volatile uint8_t *__real_pin_to_input (uint8_t n);
+
+volatile uint8_t *__wrap_pin_to_input (uint8_t n)
+{
+  volatile uint8_t *pin = __real_pin_to_input (n);
+
+  return pin ? host_pin_input (pin) : pin;
+}
+
+/* A bootloader of version 5.0 with an nRF8001 whose setup has a broadcast
+ * pipe at broadcast_pipe, 0 for none
+ */
+static void m_setup (uint8_t broadcast_pipe)
+{
+  const nrf8001_config_t nrf8001 = {
+    .credits = 2,
+    .rx_buffers = 4,
+    .broadcast_pipe = broadcast_pipe,
+  };
+
+  host_avr_reset ();
+  host_flash[FLASHEND - 1] = 0;
+  host_flash[FLASHEND] = 5;
+  m_rdyn_in = pin_to_input (m_config.aci_pins.rdyn_pin);
+  m_reqn_out = pin_to_output (m_config.aci_pins.reqn_pin);
+
+  nrf8001_init (&nrf8001);
+  host_io_hooks.spi_status = m_spi_status;
+  host_io_hooks.pin_input = m_pin_input;
+}
+
+/* Run the main loop until the nRF8001 advertises */
+static bool m_advertise (void)
+{
+  uint8_t i;
+
+  ble_init (&m_config);
+  for (i = 0; i < M_ROUNDS && nrf8001_link () != NRF8001_ADVERTISING; i++)
+  {
+    while (ble_spi_ready ())
+    {
+      ble_spi_service ();
+    }
+    ble_update ();
+  }
+
+  return nrf8001_link () == NRF8001_ADVERTISING;
+}
+
+/* Tests */
+
+static void test_status_advertised (void)
+{
+  ble_status_t status;
+  uint8_t data[20];
+
+  m_setup (BLE_STATUS_PIPE);
+  jump_app_key_set ();
+
+  CHECK (m_advertise ());
+  CHECK (nrf8001_adv_data (data) == sizeof (status));
+  memcpy (&status, data, sizeof (status));
+  CHECK (status.status_version == BLE_STATUS_VERSION);
+  CHECK (status.version == 0x0500);
+  CHECK (status.app_valid == 1);
+  CHECK (status.result == HISTORY_RESULT_NONE);
+  CHECK (status.image_size == 0);
+}
+
+/* A transfer cut short shows as started, with no application to run */
+static void test_interrupted_dfu_advertised (void)
+{
+  ble_status_t status;
+  uint8_t data[20];
+
+  m_setup (BLE_STATUS_PIPE);
+  jump_app_key_clear ();
+  history_dfu_start (12345);
+
+  CHECK (m_advertise ());
+  CHECK (nrf8001_adv_data (data) == sizeof (status));
+  memcpy (&status, data, sizeof (status));
+  CHECK (status.app_valid == 0);
+  CHECK (status.result == HISTORY_RESULT_STARTED);
+  CHECK (status.image_size == 12345);
+}
+
+/* Without the broadcast pipe, the device advertises all the same */
+static void test_no_broadcast_pipe (void)
+{
+  uint8_t data[20];
+
+  m_setup (0);
+  CHECK (m_advertise ());
+  CHECK (nrf8001_adv_data (data) == 0);
+}
+
+int main (void)
+{
+  RUN_TEST (test_status_advertised);
+  RUN_TEST (test_interrupted_dfu_advertised);
+  RUN_TEST (test_no_broadcast_pipe);
+
+  return HOST_TEST_RESULT ();
+}
@@ -0,0 +1,300 @@
+/* Host tests for the self-update copy of bootcopy.c.
+ *
+ * A new bootloader is staged at the start of flash, and bootcopy_start()
+ * copies it over the boot section, which holds an old one. The copy is
+ * left through the EEPROM write that clears its state. The power is cut
+ * by leaving through the SPM and EEPROM hooks instead, and the copy then
+ * resumed with bootcopy_run(), as jump_check() or the jump on the first
+ * page would after the reset.
+ */
+
+#include <setjmp.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+
+#include "../../bootcopy.h"
+
+#define M_MAGIC_ADDR \
+  (BOOTCOPY_STATE_ADDR + offsetof (bootcopy_state_t, magic))
+
+/* Bytes of the boot section, and the part of them in .bootcopy */
+#define M_COPY_SIZE  (FLASHEND + 1UL - BOOT_SECTION_START)
+#define M_BOOTCOPY   (BOOTCOPY_START - BOOT_SECTION_START)
+
+/* How a copy was left */
+#define M_CUT   1
+#define M_DONE  2
+
+int host_test_failures;
+
+static uint8_t  m_image[M_COPY_SIZE];
+static uint8_t  m_old[M_COPY_SIZE];
+static jmp_buf  m_power;
+static uint32_t m_events;
+static uint32_t m_cut_at;
+
+/* Helpers */
+
+static int m_page_is_erased (uint32_t page)
+{
+  uint32_t i;
+
+  for (i = 0; i < SPM_PAGESIZE; i++)
+  {
+    if (host_flash[page + i] != 0xFF)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Count a point where the power can fail, and fail it at m_cut_at */
+static void m_event (void)
+{
+  if (++m_events == m_cut_at)
+  {
+    longjmp (m_power, M_CUT);
+  }
+}
+
+/* The first page erased is the window no copy recovers from, it is not
+ * cut
+ */
+static void m_spm (uint32_t address)
+{
+  if (address == BOOT_SECTION_START && m_page_is_erased (address))
+  {
+    return;
+  }
+
+  m_event ();
+}
+
+static void m_eeprom_write (uint16_t address)
+{
+  if (address == M_MAGIC_ADDR && host_eeprom[address] == 0xFF)
+  {
+    longjmp (m_power, M_DONE);
+  }
+
+  m_event ();
+}
+
+/* An old bootloader in the boot section, and size bytes of a new one
+ * staged at the start of flash, the last page padded as the DFU leaves it
+ */
+static void m_setup (uint32_t size)
+{
+  uint32_t i;
+
+  host_avr_reset ();
+  host_io_hooks.spm = m_spm;
+  host_io_hooks.eeprom_write = m_eeprom_write;
+
+  for (i = 0; i < sizeof (m_old); i++)
+  {
+    m_old[i] = (uint8_t) (i * 7 + 3);
+  }
+  memcpy (&host_flash[BOOT_SECTION_START], m_old, sizeof (m_old));
+
+  srand (size);
+  memset (m_image, 0xFF, sizeof (m_image));
+  for (i = 0; i < size && i < sizeof (m_image); i++)
+  {
+    m_image[i] = (uint8_t) rand ();
+  }
+  memcpy (host_flash, m_image, sizeof (m_image));
+}
+
+/* Copy size bytes, cutting the power at event cut_at, 0 for never, and
+ * resuming after it. Returns the number of events.
+ */
+static uint32_t m_copy (uint32_t size, uint32_t cut_at)
+{
+  volatile int cuts = 0;
+
+  m_events = 0;
+  m_cut_at = cut_at;
+
+  switch (setjmp (m_power))
+  {
+    case 0:
+      bootcopy_start (size);
+      break;
+    case M_CUT:
+      cuts++;
+      host_avr_power_cycle ();
+      CHECK (bootcopy_pending ());
+      bootcopy_run ();
+      break;
+  }
+
+  CHECK (cuts == (cut_at && cut_at <= m_events));
+  CHECK (!bootcopy_pending ());
+  return m_events;
+}
+
+/* The pages of size bytes but those of .bootcopy hold the new bootloader,
+ * the rest of the boot section the old one, and the staged copy is intact
+ */
+static int m_copied (uint32_t size)
+{
+  const uint32_t copied =
+    (size + SPM_PAGESIZE - 1) & ~(uint32_t) (SPM_PAGESIZE - 1);
+  uint32_t i;
+
+  for (i = 0; i < sizeof (m_old); i++)
+  {
+    const int new = i < copied &&
+      (i < M_BOOTCOPY || i >= M_BOOTCOPY + BOOTCOPY_SIZE);
+
+    if (host_flash[BOOT_SECTION_START + i] != (new ? m_image[i] : m_old[i]))
+    {
+      return 0;
+    }
+  }
+
+  return memcmp (host_flash, m_image, sizeof (m_image)) == 0 &&
+    host_spm_stats.errors == 0;
+}
+
+/* Tests */
+
+/* The state follows the watchdog log, within the bootloader area */
+static void test_state_in_bootloader_area (void)
+{
+  CHECK (BOOTCOPY_STATE_ADDR + sizeof (bootcopy_state_t) <= E2END + 1);
+  CHECK (M_BOOTCOPY % SPM_PAGESIZE == 0);
+  CHECK (BOOTCOPY_SIZE % SPM_PAGESIZE == 0);
+}
+
+static void test_copy (void)
+{
+  const uint32_t size = 5 * SPM_PAGESIZE + 17;
+
+  m_setup (size);
+  m_copy (size, 0);
+  CHECK (m_copied (size));
+}
+
+/* A whole boot section is copied but for .bootcopy, up to the version
+ * word at the end of flash
+ */
+static void test_bootcopy_not_written (void)
+{
+  const uint32_t size = M_COPY_SIZE;
+
+  m_setup (size);
+  m_copy (size, 0);
+  CHECK (m_copied (size));
+  CHECK (host_flash[FLASHEND - 1] == m_image[size - 2]);
+  CHECK (host_flash[FLASHEND] == m_image[size - 1]);
+}
+
+/* Once the first page is a jump to bootcopy_run(), the reset vector
+ * resumes the copy
+ */
+static void test_first_page_jumps_to_copy (void)
+{
+  const uint32_t size = 3 * SPM_PAGESIZE;
+  volatile int cut = 0;
+  uint16_t word[2];
+  uint32_t target;
+  uint32_t i;
+
+  m_setup (size);
+  m_cut_at = 1;
+  m_events = 0;
+  if (setjmp (m_power) == 0)
+  {
+    bootcopy_start (size);
+  }
+  else
+  {
+    cut = 1;
+  }
+  CHECK (cut);
+  CHECK (bootcopy_pending ());
+
+  memcpy (word, &host_flash[BOOT_SECTION_START], sizeof (word));
+#if (FLASHEND > 0x1FFF)
+  CHECK ((word[0] & 0xFE0E) == 0x940C);
+  target = ((uint32_t) (word[0] & 0x01F0) << 13 |
+      (uint32_t) (word[0] & 1) << 16 | word[1]) * 2;
+#else
+  CHECK ((word[0] & 0xF000) == 0xC000);
+  target = BOOT_SECTION_START + 2 + (word[0] & 0x0FFF) * 2;
+#endif
+  CHECK (target == BOOTCOPY_START);
+  for (i = sizeof (word); i < SPM_PAGESIZE; i++)
+  {
+    CHECK (host_flash[BOOT_SECTION_START + i] == 0xFF);
+  }
+}
+
+/* Cut at every erase and write of flash and EEPROM in turn, the copy ends
+ * the same
+ */
+static void test_power_cut_anywhere (void)
+{
+  const uint32_t size = M_COPY_SIZE - SPM_PAGESIZE + 1;
+  uint32_t events;
+  uint32_t cut;
+
+  m_setup (size);
+  events = m_copy (size, 0);
+  CHECK (events >= 3 * ((size - BOOTCOPY_SIZE) / SPM_PAGESIZE));
+
+  for (cut = 1; cut <= events; cut++)
+  {
+    m_setup (size);
+    m_copy (size, cut);
+    if (!m_copied (size))
+    {
+      fprintf (stderr, "power cut at event %lu\n", (unsigned long) cut);
+      CHECK (0);
+      break;
+    }
+  }
+}
+
+/* A state left by an older copy with more pages is not run past the
+ * boot section
+ */
+static void test_state_out_of_range (void)
+{
+  const uint32_t size = 2 * SPM_PAGESIZE;
+
+  m_setup (size);
+  host_eeprom[BOOTCOPY_STATE_ADDR + offsetof (bootcopy_state_t, magic)] =
+    BOOTCOPY_MAGIC;
+  host_eeprom[BOOTCOPY_STATE_ADDR + offsetof (bootcopy_state_t, pages)] = 2;
+  host_eeprom[BOOTCOPY_STATE_ADDR + offsetof (bootcopy_state_t, next)] = 200;
+
+  m_events = 0;
+  m_cut_at = 0;
+  if (setjmp (m_power) == 0)
+  {
+    bootcopy_run ();
+  }
+  CHECK (!bootcopy_pending ());
+  CHECK (m_copied (size));
+}
+
+int main (void)
+{
+  RUN_TEST (test_state_in_bootloader_area);
+  RUN_TEST (test_copy);
+  RUN_TEST (test_bootcopy_not_written);
+  RUN_TEST (test_first_page_jumps_to_copy);
+  RUN_TEST (test_power_cut_anywhere);
+  RUN_TEST (test_state_out_of_range);
+
+  return HOST_TEST_RESULT ();
+}
@@ -0,0 +1,250 @@
+/* Host tests for the EEPROM configuration block in BLE/bootloader_config.c,
+ * and the cells of the application valid flag below it in jump.c.
+ *
+ * The EEPROM images are generated by tools/bootloader_config.py for the
+ * part the test is built for, so the tool and the bootloader are checked
+ * against each other.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+
+#include "../../jump.h"
+#include "bootloader_config.h"
+#include "crc16.h"
+
+#define CONFIG_BASE   (E2END - BOOTLOADER_EEPROM_SIZE)
+
+int host_test_failures;
+
+static void m_load (const char *path)
+{
+  FILE *f = fopen (path, "rb");
+
+  host_avr_reset ();
+  CHECK (f != NULL);
+  if (f)
+  {
+    CHECK (fread (host_eeprom, 1, E2END + 1, f) == E2END + 1);
+    fclose (f);
+  }
+}
+
+static void m_load_image (void)
+{
+  m_load (HOST_DATA_DIR "/eeprom.bin");
+}
+
+/* The cell the last change of the valid flag went to, or
+ * JUMP_APP_VALID_CELLS if none or more than one changed
+ */
+static uint8_t m_changed_cell (const uint8_t *p_before)
+{
+  uint8_t changed = JUMP_APP_VALID_CELLS;
+  uint8_t cell;
+
+  for (cell = 0; cell < JUMP_APP_VALID_CELLS; cell++)
+  {
+    if (host_eeprom[JUMP_APP_VALID_ADDR + cell] !=
+        p_before[JUMP_APP_VALID_ADDR + cell])
+    {
+      if (changed != JUMP_APP_VALID_CELLS)
+      {
+        return JUMP_APP_VALID_CELLS;
+      }
+      changed = cell;
+    }
+  }
+
+  return changed;
+}
+
+/* Tests */
+
+static void test_tool_image_is_valid (void)
+{
+  bootloader_config_t config;
+
+  m_load_image ();
+
+  CHECK (bootloader_config_read (&config));
+  CHECK (config.version == BOOTLOADER_CONFIG_VERSION);
+  CHECK (config.aci_pins.reqn_pin == 9);
+  CHECK (config.aci_pins.rdyn_pin == 8);
+  CHECK (config.aci_pins.reset_pin == 4);
+  CHECK (config.credit == 2);
+  CHECK (config.pipes[0] == 8 && config.pipes[1] == 9 && config.pipes[2] == 10);
+  CHECK (config.conn_timeout == 180);
+  CHECK (config.conn_interval == 0x0050);
+}
+
+static void test_crc_matches_tool (void)
+{
+  uint16_t crc;
+
+  m_load_image ();
+
+  crc = host_eeprom[CONFIG_BASE + 22] | (host_eeprom[CONFIG_BASE + 23] << 8);
+  CHECK (crc16_compute (&host_eeprom[CONFIG_BASE + 1], 21, NULL) == crc);
+}
+
+static void test_corrupt_block_rejected (void)
+{
+  bootloader_config_t config;
+  uint8_t i;
+
+  /* Every byte from the version to the CRC is covered */
+  for (i = 1; i < sizeof (bootloader_config_t); i++)
+  {
+    m_load_image ();
+    host_eeprom[CONFIG_BASE + i] ^= 0x10;
+    CHECK (!bootloader_config_read (&config));
+  }
+}
+
+static void test_unused_not_covered (void)
+{
+  bootloader_config_t config;
+
+  m_load_image ();
+  host_eeprom[CONFIG_BASE] = 1;
+  CHECK (bootloader_config_read (&config));
+
+  host_eeprom[CONFIG_BASE] = 0;
+  CHECK (bootloader_config_read (&config));
+}
+
+/* The valid flag cells end where the block starts */
+static void test_valid_app_below_config (void)
+{
+  CHECK (JUMP_APP_VALID_ADDR + JUMP_APP_VALID_CELLS == CONFIG_BASE);
+}
+
+static void test_tool_valid_app (void)
+{
+  m_load_image ();
+  CHECK (jump_app_valid () == 0xFF);
+
+  m_load (HOST_DATA_DIR "/eeprom_valid_app.bin");
+  CHECK (jump_app_valid () == 1);
+  jump_app_key_clear ();
+  CHECK (jump_app_valid () == 0);
+}
+
+/* Every change goes to the next cell, round the ring, and the block is
+ * never written
+ */
+static void test_valid_app_rotates (void)
+{
+  uint8_t before[E2END + 1];
+  uint8_t expected = 1;
+  uint16_t i;
+
+  m_load (HOST_DATA_DIR "/eeprom_valid_app.bin");
+
+  for (i = 1; i <= 5 * JUMP_APP_VALID_CELLS + 3; i++)
+  {
+    memcpy (before, host_eeprom, sizeof (before));
+    expected ^= 1;
+    if (expected)
+    {
+      jump_app_key_set ();
+    }
+    else
+    {
+      jump_app_key_clear ();
+    }
+
+    CHECK (jump_app_valid () == expected);
+    CHECK (m_changed_cell (before) == i % JUMP_APP_VALID_CELLS);
+    CHECK (!memcmp (&host_eeprom[CONFIG_BASE], &before[CONFIG_BASE],
+          E2END + 1 - CONFIG_BASE));
+  }
+
+  /* Setting the flag it already has writes nothing */
+  jump_app_key_set ();
+  memcpy (before, host_eeprom, sizeof (before));
+  jump_app_key_set ();
+  CHECK (!memcmp (host_eeprom, before, sizeof (before)));
+}
+
+/* A reset while a cell is written leaves it erased: the flag reads as it
+ * was, or as not valid, never as valid
+ */
+static void test_valid_app_torn_write (void)
+{
+  uint8_t before[E2END + 1];
+  uint8_t cell;
+  uint16_t i;
+  uint16_t j;
+
+  /* Each cell torn by a set, in both laps */
+  for (i = 0; i < 2 * JUMP_APP_VALID_CELLS; i++)
+  {
+    host_avr_reset ();
+    for (j = 0; j < i; j++)
+    {
+      if ((i - j) & 1)
+      {
+        jump_app_key_clear ();
+      }
+      else
+      {
+        jump_app_key_set ();
+      }
+    }
+
+    memcpy (before, host_eeprom, sizeof (before));
+    jump_app_key_set ();
+    cell = m_changed_cell (before);
+    CHECK (cell < JUMP_APP_VALID_CELLS);
+    host_eeprom[JUMP_APP_VALID_ADDR + cell] = 0xFF;
+    CHECK (jump_app_valid () != 1);
+
+    /* The next change is written in full */
+    jump_app_key_set ();
+    CHECK (jump_app_valid () == 1);
+  }
+}
+
+static void test_old_layout_rejected (void)
+{
+  bootloader_config_t config;
+  uint16_t crc;
+
+  /* A version 1 block, even with a matching CRC */
+  m_load_image ();
+  host_eeprom[CONFIG_BASE + 1] = 1;
+  crc = crc16_compute (&host_eeprom[CONFIG_BASE + 1], 21, NULL);
+  host_eeprom[CONFIG_BASE + 22] = (uint8_t) crc;
+  host_eeprom[CONFIG_BASE + 23] = (uint8_t) (crc >> 8);
+
+  CHECK (!bootloader_config_read (&config));
+}
+
+static void test_erased_eeprom_rejected (void)
+{
+  bootloader_config_t config;
+
+  host_avr_reset ();
+  CHECK (!bootloader_config_read (&config));
+}
+
+int main (void)
+{
+  RUN_TEST (test_tool_image_is_valid);
+  RUN_TEST (test_crc_matches_tool);
+  RUN_TEST (test_corrupt_block_rejected);
+  RUN_TEST (test_unused_not_covered);
+  RUN_TEST (test_old_layout_rejected);
+  RUN_TEST (test_erased_eeprom_rejected);
+  RUN_TEST (test_valid_app_below_config);
+  RUN_TEST (test_tool_valid_app);
+  RUN_TEST (test_valid_app_rotates);
+  RUN_TEST (test_valid_app_torn_write);
+
+  return HOST_TEST_RESULT ();
+}
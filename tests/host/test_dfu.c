@@ -0,0 +1,953 @@
+/* Host tests for the DFU state machine in BLE/dfu.c.
+ *
+ * dfu_update() is driven with packets the way ble_update() and uart_dfu.c
+ * hand them over, through a transport that records the responses, and the
+ * resulting flash image is compared against the transmitted one. The image size scales with the flash of the
+ * part the test is built for, so the atmega1284p build crosses the 64 KB
+ * boundary. The outcome of each transfer is checked in the history of
+ * history.c as well. The tests are built with SELF_UPDATE, and a bootloader
+ * image ends in a stand-in of bootcopy_start(), an application in one of
+ * jump_app_start().
+ */
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/eeprom.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+
+#include "crc16.h"
+#include "dfu.h"
+#include "../../bootcopy.h"
+#include "../../history.h"
+
+#define DFU_PACKET_SIZE     20
+
+/* An image reaching halfway into the upper half of flash */
+#define TEST_IMAGE_SIZE     ((FLASHEND + 1UL) / 2 + 0x1234)
+
+int host_test_failures;
+
+static uint8_t      m_image[FLASHEND + 1UL];
+static uint8_t      m_response[3];
+static uint8_t      m_report[20];
+static uint8_t      m_report_len;
+static uint8_t      m_idle_gaps;
+static uint32_t     m_polls;
+static uint32_t     m_packet_reads;
+static jmp_buf      m_bootcopy;
+static uint32_t     m_bootcopy_size;
+static uint8_t      m_closes;
+static uint8_t      m_closes_at_start;
+
+/* Transport and jump stand-ins, the DFU code only needs their side effects */
+
+static bool m_transport_send (const uint8_t *p_data, uint8_t len)
+{
+  if (p_data[0] == OP_CODE_RESPONSE && len == 3)
+  {
+    memcpy (m_response, p_data, 3);
+  }
+  else if (p_data[0] == OP_CODE_RESPONSE && len <= sizeof (m_report))
+  {
+    memcpy (m_report, p_data, len);
+    m_report_len = len;
+  }
+
+  return true;
+}
+
+static void m_transport_close (void)
+{
+  m_closes++;
+}
+
+static void m_transport_reset (void)
+{
+}
+
+static void m_transport_poll (void)
+{
+  m_polls++;
+}
+
+static const dfu_transport_t m_transport = {
+  m_transport_send, m_transport_close, m_transport_reset, m_transport_poll
+};
+
+/* The valid flag in one cell of EEPROM, which is all dfu.c sees of it */
+uint8_t jump_app_valid (void)
+{
+  return eeprom_read_byte ((uint8_t *) JUMP_APP_VALID_ADDR);
+}
+
+void jump_app_key_clear (void)
+{
+  eeprom_update_byte ((uint8_t *) JUMP_APP_VALID_ADDR, 0);
+}
+
+void jump_app_key_set (void)
+{
+  eeprom_update_byte ((uint8_t *) JUMP_APP_VALID_ADDR, 1);
+}
+
+void bootcopy_start (uint32_t size)
+{
+  m_bootcopy_size = size;
+  longjmp (m_bootcopy, 1);
+}
+
+void jump_app_start (void)
+{
+  m_closes_at_start = m_closes;
+  longjmp (m_bootcopy, 2);
+}
+
+/* Helpers */
+
+/* Hand over a packet, counting the flash reads made while handling one on
+ * the DFU Packet
+ */
+static void m_rx (uint8_t channel, const uint8_t *data, uint8_t len)
+{
+  const uint32_t reads = host_spm_stats.reads;
+
+  dfu_update (channel, data, len);
+  if (channel == DFU_CHANNEL_PACKET)
+  {
+    m_packet_reads += host_spm_stats.reads - reads;
+  }
+}
+
+static void m_control_point (uint8_t op_code)
+{
+  m_rx (DFU_CHANNEL_CONTROL, &op_code, 1);
+}
+
+static void m_setup (uint32_t image_size)
+{
+  uint32_t i;
+
+  host_avr_reset ();
+  memset (m_response, 0, sizeof (m_response));
+  m_report_len = 0;
+  jump_app_key_set ();
+  m_idle_gaps = 0;
+  m_polls = 0;
+  m_packet_reads = 0;
+  m_bootcopy_size = 0;
+  m_closes = 0;
+  m_closes_at_start = 0;
+
+  srand (image_size);
+  for (i = 0; i < image_size; i++)
+  {
+    m_image[i] = (uint8_t) rand ();
+  }
+
+  dfu_init (&m_transport);
+}
+
+/* CRC-16-CCITT of the first image_size bytes of the image, as the init
+ * packet carries it
+ */
+static uint16_t m_image_crc (uint32_t image_size)
+{
+  uint16_t crc = 0xFFFF;
+  uint32_t i;
+
+  for (i = 0; i < image_size; i++)
+  {
+    crc = crc16_compute (&m_image[i], 1, &crc);
+  }
+
+  return crc;
+}
+
+/* Idle time between events, as ble_update() spends it */
+static void m_idle (void)
+{
+  uint8_t i;
+
+  for (i = 0; i < m_idle_gaps; i++)
+  {
+    host_cycles += HOST_SPM_BUSY_CYCLES / 2;
+    dfu_background ();
+  }
+}
+
+/* Send START with an image type, and the start packet with image_size in
+ * the field of that type. Returns the response value.
+ */
+static uint8_t m_start_type (uint8_t type, uint32_t image_size)
+{
+  const uint8_t start_dfu[2] = {OP_CODE_START_DFU, type};
+  uint8_t start_packet[12] = {0};
+  const uint8_t field = (type == DFU_IMAGE_BOOTLOADER) ? 4 : 8;
+
+  start_packet[field + 0] = (uint8_t) (image_size >> 0);
+  start_packet[field + 1] = (uint8_t) (image_size >> 8);
+  start_packet[field + 2] = (uint8_t) (image_size >> 16);
+  start_packet[field + 3] = (uint8_t) (image_size >> 24);
+
+  m_rx (DFU_CHANNEL_CONTROL, start_dfu, sizeof (start_dfu));
+  m_rx (DFU_CHANNEL_PACKET, start_packet, sizeof (start_packet));
+  CHECK (m_response[1] == BLE_DFU_START_PROCEDURE);
+  return m_response[2];
+}
+
+/* Run INIT with crc, and open RECEIVE */
+static void m_init (uint16_t crc)
+{
+  const uint8_t init_packet[2] = {(uint8_t) crc, (uint8_t) (crc >> 8)};
+
+  m_control_point (OP_CODE_RECEIVE_INIT);
+  m_rx (DFU_CHANNEL_PACKET, init_packet, sizeof (init_packet));
+  CHECK (m_response[1] == BLE_DFU_INIT_PROCEDURE);
+  m_idle ();
+
+  m_control_point (OP_CODE_RECEIVE_FW);
+}
+
+/* An init packet header for this part and an image of image_size bytes */
+static dfu_init_packet_t m_header (uint32_t image_size)
+{
+  const dfu_init_packet_t header = {
+    .crc = m_image_crc (image_size),
+    .version = DFU_INIT_VERSION,
+    .signature = {SIGNATURE_0, SIGNATURE_1, SIGNATURE_2},
+    .max_address = image_size - 1,
+  };
+
+  return header;
+}
+
+/* Run INIT with the init packet header. Returns the response value. */
+static uint8_t m_init_header (const dfu_init_packet_t *p_header)
+{
+  m_control_point (OP_CODE_RECEIVE_INIT);
+  m_rx (DFU_CHANNEL_PACKET, (const uint8_t *) p_header, sizeof (*p_header));
+  CHECK (m_response[1] == BLE_DFU_INIT_PROCEDURE);
+  return m_response[2];
+}
+
+/* Run START and INIT for an image of image_size bytes, and open RECEIVE,
+ * with m_idle_gaps calls of dfu_background() after every event. START
+ * goes without an image type, as older tools send it. The application is
+ * only given up with RECEIVE.
+ */
+static void m_start (uint32_t image_size)
+{
+  const uint8_t start_packet[12] = {0, 0, 0, 0, 0, 0, 0, 0,
+    (uint8_t) (image_size >> 0), (uint8_t) (image_size >> 8),
+    (uint8_t) (image_size >> 16), (uint8_t) (image_size >> 24)};
+
+  m_control_point (OP_CODE_START_DFU);
+  m_rx (DFU_CHANNEL_PACKET, start_packet, sizeof (start_packet));
+  CHECK (m_response[1] == BLE_DFU_START_PROCEDURE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_SUCCESS);
+  m_idle ();
+
+  m_init (m_image_crc (image_size));
+  CHECK (jump_app_valid () == 0);
+}
+
+/* Send the first size bytes of m_image, in packets of packet_size bytes */
+static void m_send_image (uint32_t size, uint8_t packet_size)
+{
+  uint32_t offset;
+
+  for (offset = 0; offset < size; offset += packet_size)
+  {
+    uint32_t len = size - offset;
+
+    if (len > packet_size)
+    {
+      len = packet_size;
+    }
+
+    m_rx (DFU_CHANNEL_PACKET, &m_image[offset], (uint8_t) len);
+    m_idle ();
+  }
+}
+
+/* Run START/INIT/RECEIVE for image_size bytes of m_image, in packets of
+ * packet_size bytes
+ */
+static void m_receive_packets (uint32_t image_size, uint8_t packet_size)
+{
+  m_start (image_size);
+  m_send_image (image_size, packet_size);
+
+  CHECK (m_response[1] == BLE_DFU_RECEIVE_APP_PROCEDURE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_SUCCESS);
+}
+
+/* m_receive_packets(), then VALIDATE, which must succeed */
+static void m_transfer_packets (uint32_t image_size, uint8_t packet_size)
+{
+  m_receive_packets (image_size, packet_size);
+
+  m_control_point (OP_CODE_VALIDATE);
+  CHECK (m_response[1] == BLE_DFU_VALIDATE_PROCEDURE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_SUCCESS);
+}
+
+static void m_transfer (uint32_t image_size)
+{
+  m_transfer_packets (image_size, DFU_PACKET_SIZE);
+}
+
+static history_record_t m_history (void)
+{
+  history_record_t record;
+
+  CHECK (history_read (&record));
+  return record;
+}
+
+static int m_flash_is_erased (uint32_t from, uint32_t to)
+{
+  while (from < to)
+  {
+    if (host_flash[from++] != 0xFF)
+    {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/* Tests */
+
+static void test_image_written_to_flash (void)
+{
+  const uint32_t size = TEST_IMAGE_SIZE;
+  const uint32_t end = (size + SPM_PAGESIZE - 1) & ~(uint32_t)(SPM_PAGESIZE - 1);
+
+  m_setup (size);
+  m_transfer (size);
+
+  CHECK (memcmp (host_flash, m_image, size) == 0);
+  CHECK (m_flash_is_erased (end, FLASHEND + 1UL));
+  CHECK (host_spm_stats.errors == 0);
+  CHECK (host_spm_stats.writes == end / SPM_PAGESIZE);
+}
+
+static void test_image_ending_on_page_boundary (void)
+{
+  const uint32_t size = TEST_IMAGE_SIZE & ~(uint32_t)(SPM_PAGESIZE - 1);
+
+  m_setup (size);
+
+  /* Something to trample on right after the image */
+  host_flash[size] = 0x5A;
+
+  m_transfer (size);
+
+  CHECK (memcmp (host_flash, m_image, size) == 0);
+  CHECK (host_flash[size] == 0x5A);
+  CHECK (host_spm_stats.errors == 0);
+  CHECK (host_spm_stats.writes == size / SPM_PAGESIZE);
+}
+
+/* Odd sized packets split words of the page buffer across packets */
+static void test_odd_packet_size (void)
+{
+  const uint32_t size = 5 * SPM_PAGESIZE + 7;
+
+  m_setup (size);
+  m_transfer_packets (size, 19);
+
+  CHECK (memcmp (host_flash, m_image, size) == 0);
+  CHECK (m_flash_is_erased (size, FLASHEND + 1UL));
+  CHECK (host_spm_stats.errors == 0);
+  CHECK (host_spm_stats.fills == 6 * SPM_PAGESIZE / 2 - (SPM_PAGESIZE - 8) / 2);
+}
+
+/* Pages erased between events are not erased again when written, and the
+ * SPM unit is never used while busy
+ */
+static void test_background_erase (void)
+{
+  const uint32_t size = 40 * SPM_PAGESIZE + 3;
+  uint64_t stall_lazy;
+
+  m_setup (size);
+  m_transfer (size);
+  stall_lazy = host_spm_stats.stall_cycles;
+
+  m_setup (size);
+  m_idle_gaps = 2;
+  m_transfer (size);
+
+  CHECK (memcmp (host_flash, m_image, size) == 0);
+  CHECK (m_flash_is_erased (size, FLASHEND + 1UL));
+  CHECK (host_spm_stats.errors == 0);
+  CHECK (host_spm_stats.erases == 41);
+  CHECK (host_spm_stats.writes == 41);
+  CHECK (host_spm_stats.stall_cycles < stall_lazy);
+}
+
+/* The background erase stops at the end of the image */
+static void test_background_erase_stops_at_image_end (void)
+{
+  const uint32_t size = 3 * SPM_PAGESIZE + 1;
+  const uint8_t start_packet[12] = {0, 0, 0, 0, 0, 0, 0, 0,
+    (uint8_t) size, (uint8_t) (size >> 8)};
+  uint16_t i;
+
+  m_setup (size);
+  memset (host_flash, 0x5A, 8 * SPM_PAGESIZE);
+
+  m_control_point (OP_CODE_START_DFU);
+  m_rx (DFU_CHANNEL_PACKET, start_packet, sizeof (start_packet));
+  m_control_point (OP_CODE_RECEIVE_FW);
+
+  for (i = 0; i < 100; i++)
+  {
+    host_cycles += HOST_SPM_BUSY_CYCLES;
+    dfu_background ();
+  }
+
+  CHECK (m_flash_is_erased (0, 4 * SPM_PAGESIZE));
+  CHECK (host_flash[4 * SPM_PAGESIZE] == 0x5A);
+  CHECK (host_spm_stats.erases == 4);
+  CHECK (host_spm_stats.errors == 0);
+}
+
+/* The link is polled for every word loaded and on every turn of a wait for
+ * the SPM unit, so a serial line is serviced throughout programming. The
+ * polls while the history is written are left out.
+ */
+static void test_link_polled_while_programming (void)
+{
+  const uint32_t size = 4 * SPM_PAGESIZE + 6;
+
+  m_setup (size);
+  m_start (size);
+  eeprom_busy_wait ();
+  m_polls = 0;
+  m_send_image (size, DFU_PACKET_SIZE);
+
+  CHECK (host_spm_stats.errors == 0);
+  CHECK (m_polls == host_spm_stats.fills +
+      host_spm_stats.stall_cycles / HOST_SPM_POLL_CYCLES);
+}
+
+/* Every written page is read back before VALIDATE succeeds, which reads
+ * the image once more for its CRC
+ */
+static void test_pages_read_back (void)
+{
+  const uint32_t size = 10 * SPM_PAGESIZE + 5;
+
+  m_setup (size);
+  m_transfer (size);
+
+  CHECK (host_spm_stats.errors == 0);
+  CHECK (host_spm_stats.reads == 2 * size);
+}
+
+/* Given the idle time, pages are read back between events, and not while
+ * a packet is handled
+ */
+static void test_read_back_in_idle_time (void)
+{
+  const uint32_t size = 10 * SPM_PAGESIZE + 5;
+
+  m_setup (size);
+  m_idle_gaps = 2;
+  m_transfer (size);
+
+  CHECK (host_spm_stats.errors == 0);
+  CHECK (host_spm_stats.reads == 2 * size);
+  CHECK (m_packet_reads == 0);
+}
+
+/* RECEIVE records the attempt in the history, and the first packet comes
+ * while the last byte of the record is still being written to EEPROM. It
+ * waits for that, as the SPM unit would ignore the page buffer fills.
+ */
+static void test_first_packet_waits_for_eeprom (void)
+{
+  const uint32_t size = SPM_PAGESIZE;
+
+  m_setup (size);
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  m_init (m_image_crc (size));
+  CHECK (host_eeprom_pending ());
+
+  m_send_image (size, DFU_PACKET_SIZE);
+
+  CHECK (host_spm_stats.errors == 0);
+  CHECK (memcmp (host_flash, m_image, size) == 0);
+  CHECK (m_polls > 0);
+}
+
+/* The link is polled while the record of the attempt is written to the
+ * history, which takes a byte at a time some 3.4 ms each
+ */
+static void test_link_polled_while_history_written (void)
+{
+  const uint32_t size = SPM_PAGESIZE;
+
+  m_setup (size);
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  m_polls = 0;
+  m_init (m_image_crc (size));
+
+  CHECK (m_polls >= HOST_EEPROM_BUSY_CYCLES / HOST_SPM_POLL_CYCLES);
+}
+
+/* A byte that does not program fails VALIDATE, and the image can not be
+ * activated
+ */
+static void test_weak_cell_fails_validation (void)
+{
+  const uint32_t size = 10 * SPM_PAGESIZE + 5;
+
+  m_setup (size);
+  host_flash_weak.address = 3 * SPM_PAGESIZE + 17;
+  host_flash_weak.bits = 0x01;
+  m_image[host_flash_weak.address] &= 0xFE;
+
+  m_idle_gaps = 1;
+  m_receive_packets (size, DFU_PACKET_SIZE);
+  m_control_point (OP_CODE_VALIDATE);
+
+  CHECK (m_response[1] == BLE_DFU_VALIDATE_PROCEDURE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_OPER_FAILED);
+  CHECK (host_spm_stats.errors == 0);
+
+  m_control_point (OP_CODE_ACTIVATE_N_RESET);
+  CHECK (jump_app_valid () == 0);
+  CHECK (m_history ().result == HISTORY_RESULT_VERIFY);
+}
+
+/* An image validated short of the size given at START fails, where it
+ * used to be taken as valid without a response
+ */
+static void test_short_image_fails_validation (void)
+{
+  const uint32_t size = 4 * SPM_PAGESIZE;
+
+  m_setup (size);
+  m_start (size);
+  m_send_image (size - DFU_PACKET_SIZE, DFU_PACKET_SIZE);
+  m_control_point (OP_CODE_VALIDATE);
+
+  CHECK (m_response[1] == BLE_DFU_VALIDATE_PROCEDURE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_DATA_SIZE);
+  CHECK (m_history ().result == HISTORY_RESULT_SIZE);
+  CHECK (m_history ().successes == 0);
+
+  m_control_point (OP_CODE_ACTIVATE_N_RESET);
+  CHECK (jump_app_valid () == 0);
+}
+
+/* A packet reaching past the size given at START is refused before any of
+ * it is loaded
+ */
+static void test_data_past_image_size_refused (void)
+{
+  const uint32_t size = 4 * SPM_PAGESIZE + 5;
+
+  m_setup (size);
+  m_start (size);
+  m_send_image (size + 3, DFU_PACKET_SIZE);
+
+  CHECK (m_response[1] == BLE_DFU_RECEIVE_APP_PROCEDURE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_DATA_SIZE);
+  CHECK (m_flash_is_erased (4 * SPM_PAGESIZE, 5 * SPM_PAGESIZE));
+  CHECK (m_history ().result == HISTORY_RESULT_SIZE);
+
+  m_control_point (OP_CODE_VALIDATE);
+  CHECK (m_response[2] != BLE_DFU_RESP_VAL_SUCCESS);
+  m_control_point (OP_CODE_ACTIVATE_N_RESET);
+  CHECK (jump_app_valid () == 0);
+}
+
+/* An application failing the CRC of its init packet fails VALIDATE */
+static void test_application_crc_checked (void)
+{
+  const uint32_t size = 4 * SPM_PAGESIZE + 5;
+
+  m_setup (size);
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  m_init (m_image_crc (size) ^ 0x0100);
+  m_send_image (size, DFU_PACKET_SIZE);
+  m_control_point (OP_CODE_VALIDATE);
+
+  CHECK (m_response[1] == BLE_DFU_VALIDATE_PROCEDURE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_CRC_ERROR);
+  CHECK (m_history ().result == HISTORY_RESULT_CRC);
+
+  m_control_point (OP_CODE_ACTIVATE_N_RESET);
+  CHECK (jump_app_valid () == 0);
+}
+
+/* Each transfer is counted, and the last one described */
+static void test_history_recorded (void)
+{
+  const uint32_t size = 6 * SPM_PAGESIZE + 3;
+  history_record_t record;
+
+  m_setup (size);
+  m_transfer (size);
+  m_control_point (OP_CODE_SYS_RESET);
+  m_transfer (size);
+
+  record = m_history ();
+  CHECK (record.attempts == 2);
+  CHECK (record.successes == 2);
+  CHECK (record.result == HISTORY_RESULT_SUCCESS);
+  CHECK (record.image_size == size);
+  CHECK (jump_app_valid () == 0);
+}
+
+/* 'Reset System' during a transfer records it as aborted */
+static void test_reset_aborts_transfer (void)
+{
+  const uint32_t size = 6 * SPM_PAGESIZE + 3;
+
+  m_setup (size);
+  m_start (size);
+  m_send_image (size / 2, DFU_PACKET_SIZE);
+  m_control_point (OP_CODE_SYS_RESET);
+
+  CHECK (m_history ().attempts == 1);
+  CHECK (m_history ().result == HISTORY_RESULT_ABORTED);
+
+  /* Not once the transfer has been validated */
+  m_transfer (size);
+  m_control_point (OP_CODE_SYS_RESET);
+  CHECK (m_history ().result == HISTORY_RESULT_SUCCESS);
+
+  /* Nor before it has started */
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  m_control_point (OP_CODE_SYS_RESET);
+  CHECK (m_history ().attempts == 2);
+  CHECK (m_history ().result == HISTORY_RESULT_SUCCESS);
+}
+
+/* The history request is answered in any state, with the newest record
+ * from result through bytes_per_s after the response and the application
+ * valid flag
+ */
+static void test_history_reported (void)
+{
+  const uint32_t size = 6 * SPM_PAGESIZE + 3;
+  const history_record_t *p_report;
+  history_record_t record;
+
+  m_setup (size);
+  m_control_point (OP_CODE_HISTORY_REQ);
+  CHECK (m_report_len == 19);
+  CHECK (m_report[1] == BLE_DFU_HISTORY_PROCEDURE);
+  CHECK (m_report[2] == BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (m_report[3] == 1);
+
+  m_receive_packets (size, DFU_PACKET_SIZE);
+  m_control_point (OP_CODE_HISTORY_REQ);
+  CHECK (m_report_len == 19);
+  CHECK (m_report[5] == 1);
+  CHECK (m_report[4] == HISTORY_RESULT_STARTED);
+
+  m_control_point (OP_CODE_VALIDATE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_SUCCESS);
+  m_control_point (OP_CODE_HISTORY_REQ);
+
+  record = m_history ();
+  p_report = (const history_record_t *) &m_report[3];
+  CHECK (m_report[3] == 0);
+  CHECK (memcmp (&p_report->result, &record.result, 15) == 0);
+  CHECK (p_report->result == HISTORY_RESULT_SUCCESS);
+}
+
+/* An application image given with its type is taken as one without */
+static void test_application_type (void)
+{
+  const uint32_t size = 4 * SPM_PAGESIZE + 5;
+
+  m_setup (size);
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  m_init (m_image_crc (size));
+  m_send_image (size, DFU_PACKET_SIZE);
+  m_control_point (OP_CODE_VALIDATE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (memcmp (host_flash, m_image, size) == 0);
+}
+
+/* A valid application is started once the link is closed, without a
+ * watchdog reset
+ */
+static void test_application_started (void)
+{
+  const uint32_t size = 4 * SPM_PAGESIZE + 5;
+  volatile int started = 0;
+
+  m_setup (size);
+  jump_app_key_clear ();
+  m_transfer (size);
+
+  if (setjmp (m_bootcopy) == 0)
+  {
+    m_control_point (OP_CODE_ACTIVATE_N_RESET);
+  }
+  else
+  {
+    started = 1;
+  }
+  CHECK (started);
+  CHECK (m_closes_at_start == 1);
+  CHECK (m_bootcopy_size == 0);
+  CHECK (jump_app_valid () == 1);
+}
+
+/* A softdevice is refused, and nothing is started or erased */
+static void test_softdevice_not_supported (void)
+{
+  m_setup (SPM_PAGESIZE);
+  memset (host_flash, 0, SPM_PAGESIZE);
+
+  CHECK (m_start_type (DFU_IMAGE_SOFTDEVICE, SPM_PAGESIZE) ==
+      BLE_DFU_RESP_VAL_NOT_SUPPORTED);
+  CHECK (jump_app_valid () == 1);
+  m_idle_gaps = 4;
+  m_idle ();
+  CHECK (host_flash[0] == 0);
+
+  /* The next START is taken */
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, SPM_PAGESIZE) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+}
+
+/* An application image must fit below the boot section */
+static void test_application_size_checked (void)
+{
+  m_setup (SPM_PAGESIZE);
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, BOOT_SECTION_START + 1UL) ==
+      BLE_DFU_RESP_VAL_DATA_SIZE);
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, 0) ==
+      BLE_DFU_RESP_VAL_DATA_SIZE);
+  CHECK (jump_app_valid () == 1);
+
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, BOOT_SECTION_START) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+}
+
+/* An image with the header of this part goes through as one without */
+static void test_init_header_accepted (void)
+{
+  const uint32_t size = 4 * SPM_PAGESIZE + 5;
+  dfu_init_packet_t header;
+
+  m_setup (size);
+  header = m_header (size);
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (m_init_header (&header) == BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (jump_app_valid () == 1);
+
+  m_control_point (OP_CODE_RECEIVE_FW);
+  m_send_image (size, DFU_PACKET_SIZE);
+  m_control_point (OP_CODE_VALIDATE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (memcmp (host_flash, m_image, size) == 0);
+}
+
+/* A header for another part, or of another version, is refused: the DFU
+ * goes back to idle with the application, its flash and the history as
+ * they were
+ */
+static void test_init_header_wrong_part (void)
+{
+  const uint32_t size = 4 * SPM_PAGESIZE + 5;
+  dfu_init_packet_t header = m_header (size);
+  history_record_t record;
+
+  m_setup (size);
+  memset (host_flash, 0, 8 * SPM_PAGESIZE);
+  m_idle_gaps = 4;
+
+  header.signature[2] ^= 1;
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (m_init_header (&header) == BLE_DFU_RESP_VAL_NOT_SUPPORTED);
+
+  /* The image that follows is not taken */
+  m_control_point (OP_CODE_RECEIVE_FW);
+  m_send_image (size, DFU_PACKET_SIZE);
+  m_idle ();
+
+  header = m_header (size);
+  header.version = DFU_INIT_VERSION + 1;
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (m_init_header (&header) == BLE_DFU_RESP_VAL_NOT_SUPPORTED);
+  m_idle ();
+
+  CHECK (jump_app_valid () == 1);
+  CHECK (!history_read (&record) || record.attempts == 0);
+  CHECK (host_spm_stats.erases == 0);
+  CHECK (host_spm_stats.writes == 0);
+  CHECK (host_flash[0] == 0);
+}
+
+/* The highest address must be in the room of the image, and the image
+ * within it
+ */
+static void test_init_header_size_checked (void)
+{
+  const uint32_t size = 4 * SPM_PAGESIZE + 5;
+  dfu_init_packet_t header = m_header (size);
+
+  m_setup (size);
+
+  header.max_address = BOOT_SECTION_START;
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (m_init_header (&header) == BLE_DFU_RESP_VAL_DATA_SIZE);
+
+  header.max_address = size - 2;
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (m_init_header (&header) == BLE_DFU_RESP_VAL_DATA_SIZE);
+  CHECK (jump_app_valid () == 1);
+  CHECK (host_spm_stats.erases == 0);
+
+  /* The image may end below its highest address */
+  header.max_address = BOOT_SECTION_START - 1;
+  CHECK (m_start_type (DFU_IMAGE_APPLICATION, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (m_init_header (&header) == BLE_DFU_RESP_VAL_SUCCESS);
+}
+
+/* A bootloader image must fit in the boot section */
+static void test_bootloader_size_checked (void)
+{
+  const uint32_t room = FLASHEND + 1UL - BOOT_SECTION_START;
+
+  m_setup (room);
+  CHECK (m_start_type (DFU_IMAGE_BOOTLOADER, room + 1) ==
+      BLE_DFU_RESP_VAL_DATA_SIZE);
+  CHECK (m_start_type (DFU_IMAGE_BOOTLOADER, 0) ==
+      BLE_DFU_RESP_VAL_DATA_SIZE);
+  CHECK (jump_app_valid () == 1);
+
+  CHECK (m_start_type (DFU_IMAGE_BOOTLOADER, room) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+}
+
+/* A bootloader image is staged at the start of flash, checked against the
+ * CRC of the init packet and handed to bootcopy_start(). The application
+ * it displaced stays invalid.
+ */
+static void test_bootloader_staged_and_copied (void)
+{
+  const uint32_t size = 7 * SPM_PAGESIZE + 9;
+  volatile int copied = 0;
+
+  m_setup (size);
+  CHECK (m_start_type (DFU_IMAGE_BOOTLOADER, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  m_init (crc16_compute (m_image, size, NULL));
+  m_send_image (size, DFU_PACKET_SIZE);
+  m_control_point (OP_CODE_VALIDATE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_SUCCESS);
+  CHECK (memcmp (host_flash, m_image, size) == 0);
+
+  if (setjmp (m_bootcopy) == 0)
+  {
+    m_control_point (OP_CODE_ACTIVATE_N_RESET);
+  }
+  else
+  {
+    copied = 1;
+  }
+  CHECK (copied);
+  CHECK (m_bootcopy_size == size);
+  CHECK (jump_app_valid () == 0);
+}
+
+/* A bootloader image that does not match the CRC of its init packet is
+ * never copied
+ */
+static void test_bootloader_crc_mismatch (void)
+{
+  const uint32_t size = 3 * SPM_PAGESIZE;
+
+  m_setup (size);
+  CHECK (m_start_type (DFU_IMAGE_BOOTLOADER, size) ==
+      BLE_DFU_RESP_VAL_SUCCESS);
+  m_init (crc16_compute (m_image, size, NULL) ^ 1);
+  m_send_image (size, DFU_PACKET_SIZE);
+  m_control_point (OP_CODE_VALIDATE);
+
+  CHECK (m_response[1] == BLE_DFU_VALIDATE_PROCEDURE);
+  CHECK (m_response[2] == BLE_DFU_RESP_VAL_CRC_ERROR);
+  CHECK (m_history ().result == HISTORY_RESULT_CRC);
+
+  m_control_point (OP_CODE_ACTIVATE_N_RESET);
+  CHECK (m_bootcopy_size == 0);
+}
+
+#ifdef RAMPZ
+/* The page directly above 64 KB must not alias page zero */
+static void test_no_wrap_at_64k (void)
+{
+  const uint32_t size = 0x10000UL + SPM_PAGESIZE;
+
+  m_setup (size);
+  m_transfer (size);
+
+  CHECK (memcmp (&host_flash[0], &m_image[0], SPM_PAGESIZE) == 0);
+  CHECK (memcmp (&host_flash[0x10000], &m_image[0x10000], SPM_PAGESIZE) == 0);
+  CHECK (host_spm_stats.errors == 0);
+}
+#endif
+
+int main (void)
+{
+  RUN_TEST (test_image_written_to_flash);
+  RUN_TEST (test_image_ending_on_page_boundary);
+  RUN_TEST (test_odd_packet_size);
+  RUN_TEST (test_background_erase);
+  RUN_TEST (test_background_erase_stops_at_image_end);
+  RUN_TEST (test_link_polled_while_programming);
+  RUN_TEST (test_pages_read_back);
+  RUN_TEST (test_read_back_in_idle_time);
+  RUN_TEST (test_first_packet_waits_for_eeprom);
+  RUN_TEST (test_link_polled_while_history_written);
+  RUN_TEST (test_weak_cell_fails_validation);
+  RUN_TEST (test_short_image_fails_validation);
+  RUN_TEST (test_data_past_image_size_refused);
+  RUN_TEST (test_application_crc_checked);
+  RUN_TEST (test_history_recorded);
+  RUN_TEST (test_reset_aborts_transfer);
+  RUN_TEST (test_history_reported);
+  RUN_TEST (test_application_type);
+  RUN_TEST (test_application_started);
+  RUN_TEST (test_softdevice_not_supported);
+  RUN_TEST (test_application_size_checked);
+  RUN_TEST (test_init_header_accepted);
+  RUN_TEST (test_init_header_wrong_part);
+  RUN_TEST (test_init_header_size_checked);
+  RUN_TEST (test_bootloader_size_checked);
+  RUN_TEST (test_bootloader_staged_and_copied);
+  RUN_TEST (test_bootloader_crc_mismatch);
+#ifdef RAMPZ
+  RUN_TEST (test_no_wrap_at_64k);
+#endif
+
+  return HOST_TEST_RESULT ();
+}
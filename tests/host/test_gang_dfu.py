@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""End to end gang DFU against several simulators at once.
+
+tools/gang_dfu.py programs tests/test_application.hex into BLE and UART
+simulators side by side, and the flash image each simulator leaves behind
+is compared with the HEX file. A unit that comes up late is programmed on
+a retry, and one that never does is reported failed without holding up the
+others.
+
+    test_gang_dfu.py <eeprom.bin> <ble simulator> <uart simulator>
+"""
+
+import csv
+import os
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TOOLS = os.path.join(HERE, '..', '..', 'tools')
+sys.path.insert(0, TOOLS)
+
+import ble_dfu  # noqa: E402
+
+APPLICATION = os.path.join(HERE, '..', 'test_application.hex')
+GANG_DFU = os.path.join(TOOLS, 'gang_dfu.py')
+BAUD = 500000
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print('%s: CHECK failed: %s' % (__file__, what), file=sys.stderr)
+        failures += 1
+
+
+def wait_for(path):
+    for _ in range(500):
+        if os.path.exists(path):
+            break
+        time.sleep(0.01)
+
+
+class Sims:
+    """Simulators started in tmp, each writing its flash to <link>.flash"""
+
+    def __init__(self, tmp, eeprom, ble_sim, uart_sim):
+        self.tmp = tmp
+        self.eeprom = eeprom
+        self.ble_sim = ble_sim
+        self.uart_sim = uart_sim
+        self.procs = []
+
+    def _start(self, command, link):
+        self.procs.append(subprocess.Popen(
+            command + ['--eeprom', self.eeprom, '--flash-out', link + '.flash'],
+            stdout=subprocess.DEVNULL))
+
+    def ble(self, name):
+        link = os.path.join(self.tmp, name)
+        self._start([self.ble_sim, '--socket', link], link)
+        return link
+
+    def uart(self, name):
+        link = os.path.join(self.tmp, name)
+        self._start([self.uart_sim, '--link', link, '--baud', str(BAUD)], link)
+        return link
+
+    def stop(self):
+        for proc in self.procs:
+            try:
+                proc.wait(timeout=60)
+            except subprocess.TimeoutExpired:
+                proc.kill()
+                proc.wait()
+            check(proc.returncode == 0, 'simulator exit status %d' %
+                  proc.returncode)
+
+
+def gang(tmp, links, options=()):
+    """Run gang_dfu.py on the links, returns its exit status and the rows
+    of its report by link
+    """
+    report = os.path.join(tmp, 'report.csv')
+    command = [sys.executable, GANG_DFU, APPLICATION, '--progress', '0',
+               '--report', report] + list(options)
+    for kind, link in links:
+        command += ['--socket' if kind == 'ble' else '--port', link]
+    status = subprocess.call(command, stdout=subprocess.DEVNULL,
+                             stderr=subprocess.DEVNULL)
+    with open(report, newline='') as f:
+        return status, {row['link']: row for row in csv.DictReader(f)}
+
+
+def check_flash(link, image):
+    with open(link + '.flash', 'rb') as f:
+        flash = f.read()
+    check(flash[:len(image)] == image, '%s: image written to flash' % link)
+
+
+def test_many_units(eeprom, ble_sim, uart_sim):
+    """Four BLE and two UART units, programmed at once"""
+    failures_before = failures
+    image = ble_dfu.read_hex(APPLICATION)
+    with tempfile.TemporaryDirectory() as tmp:
+        sims = Sims(tmp, eeprom, ble_sim, uart_sim)
+        links = [('ble', sims.ble('ble%d' % i)) for i in range(4)] + \
+            [('uart', sims.uart('tty%d' % i)) for i in range(2)]
+        for _, link in links:
+            wait_for(link)
+        status, rows = gang(tmp, links, ['--mcu', 'atmega328p'])
+        sims.stop()
+
+        check(status == 0, 'exit status %d' % status)
+        check(len(rows) == len(links), 'a row per unit')
+        for _, link in links:
+            row = rows.get(link, {})
+            check(row.get('result') == 'ok' and row.get('attempts') == '1',
+                  '%s: programmed at the first attempt' % link)
+            check(row.get('bytes') == str(len(image)), '%s: bytes' % link)
+            check_flash(link, image)
+    print('%-48s %s' % ('test_many_units',
+                        'ok' if failures == failures_before else 'FAILED'))
+
+
+def test_retries(eeprom, ble_sim, uart_sim):
+    """A unit that comes up late is programmed again until it answers, one
+    that never does fails, and neither holds up the others
+    """
+    failures_before = failures
+    image = ble_dfu.read_hex(APPLICATION)
+    with tempfile.TemporaryDirectory() as tmp:
+        sims = Sims(tmp, eeprom, ble_sim, uart_sim)
+        early = sims.ble('early')
+        wait_for(early)
+        late = os.path.join(tmp, 'late')
+        missing = os.path.join(tmp, 'missing')
+
+        # The late unit starts while gang_dfu.py is already retrying it
+        starter = threading.Timer(0.5, sims.ble, ('late',))
+        starter.start()
+        try:
+            status, rows = gang(tmp, [('ble', early), ('ble', late),
+                                      ('ble', missing)],
+                                ['--retries', '4', '--retry-delay', '0.3'])
+        finally:
+            starter.join()
+        sims.stop()
+
+        check(status == 1, 'exit status %d' % status)
+        check(rows[early]['result'] == 'ok' and rows[early]['attempts'] == '1',
+              'unit up at the start programmed at once')
+        check(rows[late]['result'] == 'ok' and int(rows[late]['attempts']) > 1,
+              'late unit programmed on a retry')
+        check(rows[missing]['result'] == 'failed' and
+              rows[missing]['attempts'] == '5' and rows[missing]['error'],
+              'missing unit failed after every retry')
+        check_flash(early, image)
+        check_flash(late, image)
+    print('%-48s %s' % ('test_retries',
+                        'ok' if failures == failures_before else 'FAILED'))
+
+
+def main():
+    eeprom, ble_sim, uart_sim = sys.argv[1:4]
+
+    test_many_units(eeprom, ble_sim, uart_sim)
+    test_retries(eeprom, ble_sim, uart_sim)
+
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
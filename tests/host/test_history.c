@@ -0,0 +1,232 @@
+/* Host tests for the DFU history ring in history.c.
+ *
+ * The ring is inspected in host_eeprom directly, so the tests see which
+ * slot every change went to, and can tear or corrupt records the way a
+ * reset during an EEPROM write would.
+ */
+
+#include <string.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+
+#include "../../history.h"
+#include "bootloader_config.h"
+
+int host_test_failures;
+
+/* Helpers */
+
+static uint8_t *m_slot (uint8_t slot)
+{
+  return &host_eeprom[HISTORY_ADDR + slot * sizeof (history_record_t)];
+}
+
+/* The slot the last change was written to, or HISTORY_SLOTS if none */
+static uint8_t m_changed_slot (const uint8_t *p_before)
+{
+  uint8_t slot;
+
+  for (slot = 0; slot < HISTORY_SLOTS; slot++)
+  {
+    if (memcmp (m_slot (slot), &p_before[HISTORY_ADDR +
+          slot * sizeof (history_record_t)], sizeof (history_record_t)))
+    {
+      return slot;
+    }
+  }
+
+  return HISTORY_SLOTS;
+}
+
+static history_record_t m_history (void)
+{
+  history_record_t record;
+
+  CHECK (history_read (&record));
+  return record;
+}
+
+/* Run a DFU of image_size bytes taking cycles CPU cycles */
+static void m_dfu (uint32_t image_size, uint64_t cycles, uint8_t result)
+{
+  history_dfu_start (image_size);
+  host_cycles += cycles;
+  history_dfu_end (result);
+}
+
+/* Tests */
+
+/* The ring ends where the cells of the valid flag start */
+static void test_ring_below_config (void)
+{
+  CHECK (HISTORY_ADDR + HISTORY_SLOTS * sizeof (history_record_t) ==
+      JUMP_APP_VALID_ADDR);
+  CHECK (sizeof (history_record_t) == 18);
+}
+
+/* Until a record is written, there is no history */
+static void test_empty_without_records (void)
+{
+  history_record_t record;
+
+  host_avr_reset ();
+
+  CHECK (!history_read (&record));
+  CHECK (record.attempts == 0);
+  CHECK (record.successes == 0);
+  CHECK (record.result == HISTORY_RESULT_NONE);
+}
+
+/* Every change goes to the next slot, around the ring */
+static void test_changes_rotate_through_slots (void)
+{
+  static uint8_t before[E2END + 1];
+  uint8_t writes[HISTORY_SLOTS] = {0};
+  uint8_t slot;
+  uint16_t i;
+
+  host_avr_reset ();
+
+  for (i = 0; i < 4 * HISTORY_SLOTS; i++)
+  {
+    memcpy (before, host_eeprom, sizeof (before));
+    history_dfu_start (i);
+
+    slot = m_changed_slot (before);
+    CHECK (slot == i % HISTORY_SLOTS);
+    if (slot < HISTORY_SLOTS)
+    {
+      writes[slot]++;
+    }
+    CHECK (m_history ().image_size == i);
+  }
+
+  for (slot = 0; slot < HISTORY_SLOTS; slot++)
+  {
+    CHECK (writes[slot] == 4);
+  }
+
+  /* Nothing above the ring was touched */
+  for (i = JUMP_APP_VALID_ADDR; i <= E2END; i++)
+  {
+    CHECK (host_eeprom[i] == 0xFF);
+  }
+}
+
+/* A record torn by a reset is ignored, the one before it stays newest */
+static void test_torn_record_ignored (void)
+{
+  static uint8_t before[E2END + 1];
+  uint8_t slot;
+
+  host_avr_reset ();
+  m_dfu (1000, 0, HISTORY_RESULT_SUCCESS);
+
+  memcpy (before, host_eeprom, sizeof (before));
+  history_dfu_start (2000);
+  slot = m_changed_slot (before);
+  CHECK (slot < HISTORY_SLOTS);
+
+  /* Only the first bytes made it */
+  memcpy (m_slot (slot) + 5, &before[HISTORY_ADDR +
+      slot * sizeof (history_record_t) + 5], sizeof (history_record_t) - 5);
+
+  CHECK (m_history ().image_size == 1000);
+  CHECK (m_history ().attempts == 1);
+
+  /* The next record goes into the torn slot */
+  memcpy (before, host_eeprom, sizeof (before));
+  history_dfu_start (3000);
+  CHECK (m_changed_slot (before) == slot);
+  CHECK (m_history ().image_size == 3000);
+  CHECK (m_history ().attempts == 2);
+}
+
+/* The sequence number wraps, over many times around the ring */
+static void test_sequence_wraps (void)
+{
+  uint16_t i;
+
+  host_avr_reset ();
+
+  for (i = 0; i < 300; i++)
+  {
+    m_dfu (i, 0, (i % 3) ? HISTORY_RESULT_SUCCESS : HISTORY_RESULT_VERIFY);
+  }
+
+  CHECK (m_history ().attempts == 300);
+  CHECK (m_history ().successes == 200);
+  CHECK (m_history ().image_size == 299);
+  CHECK (m_history ().result == HISTORY_RESULT_SUCCESS);
+}
+
+/* Counters carry over, and the cells of the application valid flag are
+ * left to jump.c
+ */
+static void test_attempts_counted (void)
+{
+  host_avr_reset ();
+  host_eeprom[JUMP_APP_VALID_ADDR] = 1;
+
+  history_dfu_start (1234);
+  CHECK (host_eeprom[JUMP_APP_VALID_ADDR] == 1);
+  CHECK (m_history ().result == HISTORY_RESULT_STARTED);
+  CHECK (m_history ().attempts == 1);
+
+  /* A reset without an end leaves the attempt started */
+  history_dfu_start (1234);
+  CHECK (m_history ().result == HISTORY_RESULT_STARTED);
+  CHECK (m_history ().attempts == 2);
+
+  history_dfu_end (HISTORY_RESULT_SUCCESS);
+  CHECK (m_history ().successes == 1);
+  CHECK (host_eeprom[JUMP_APP_VALID_ADDR] == 1);
+
+  /* Ending again, without a start, changes nothing */
+  history_dfu_end (HISTORY_RESULT_ABORTED);
+  CHECK (m_history ().result == HISTORY_RESULT_SUCCESS);
+  CHECK (m_history ().successes == 1);
+}
+
+/* Duration and throughput come from timer 1, also across its overflows */
+static void test_duration_measured (void)
+{
+  const uint64_t second = F_CPU;
+  history_record_t record;
+  uint8_t i;
+
+  host_avr_reset ();
+  host_cycles = 12345;
+  history_dfu_start (20000);
+
+  /* 10 s in steps shorter than an overflow of the 16 bit count */
+  for (i = 0; i < 40; i++)
+  {
+    host_cycles += second / 4;
+    history_clock ();
+  }
+  history_dfu_end (HISTORY_RESULT_SUCCESS);
+
+  record = m_history ();
+  CHECK (record.duration_ms >= 9999 && record.duration_ms <= 10001);
+  CHECK (record.bytes_per_s >= 1999 && record.bytes_per_s <= 2001);
+  CHECK (TCCR1B == (_BV(CS12) | _BV(CS10)));
+
+  /* Faster than 0xFFFF bytes per second saturates */
+  m_dfu (100000, second / 4, HISTORY_RESULT_SUCCESS);
+  CHECK (m_history ().bytes_per_s == 0xFFFF);
+}
+
+int main (void)
+{
+  RUN_TEST (test_ring_below_config);
+  RUN_TEST (test_empty_without_records);
+  RUN_TEST (test_changes_rotate_through_slots);
+  RUN_TEST (test_torn_record_ignored);
+  RUN_TEST (test_sequence_wraps);
+  RUN_TEST (test_attempts_counted);
+  RUN_TEST (test_duration_measured);
+
+  return HOST_TEST_RESULT ();
+}
@@ -0,0 +1,168 @@
+/* Host tests for the pin tables of BLE/pins_arduino.c.
+ *
+ * The expected layout of each board is written out here as the port and
+ * bit of every Arduino pin, the way the board's pin diagram gives them, so
+ * a slip in the flash tables does not carry over to the check.
+ */
+
+#include <string.h>
+
+#include <avr/io.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+
+#include "pins_arduino.h"
+
+int host_test_failures;
+
+/* Port letter and bit of pins 0, 1, ... */
+#if defined(PINS_ARDUINO_MEGA)
+static const char m_layout[] =
+  "E0E1E4E5G5E3H3H4"    /* 0 - 7 */
+  "H5H6B4B5B6B7J1J0"    /* 8 - 15 */
+  "H1H0D3D2D1D0A0A1"    /* 16 - 23 */
+  "A2A3A4A5A6A7C7C6"    /* 24 - 31 */
+  "C5C4C3C2C1C0D7G2"    /* 32 - 39 */
+  "G1G0L7L6L5L4L3L2"    /* 40 - 47 */
+  "L1L0B3B2B1B0F0F1"    /* 48 - 55, A0 is 54 */
+  "F2F3F4F5F6F7K0K1"    /* 56 - 63 */
+  "K2K3K4K5K6K7";       /* 64 - 69 */
+#elif defined(PINS_ARDUINO_SANGUINO)
+static const char m_layout[] =
+  "B0B1B2B3B4B5B6B7"    /* 0 - 7 */
+  "D0D1D2D3D4D5D6D7"    /* 8 - 15 */
+  "C0C1C2C3C4C5C6C7"    /* 16 - 23 */
+  "A7A6A5A4A3A2A1A0";   /* 24 - 31, A0 is 31 */
+#else
+static const char m_layout[] =
+  "D0D1D2D3D4D5D6D7"    /* 0 - 7 */
+  "B0B1B2B3B4B5"        /* 8 - 13 */
+  "C0C1C2C3C4C5";       /* 14 - 19, A0 is 14 */
+#endif
+
+/* Helpers */
+
+/* DDR of a port, NULL for one the part does not have */
+static volatile uint8_t *m_ddr (char port)
+{
+  switch (port)
+  {
+#ifdef HOST_HAS_PORTA
+    case 'A': return &DDRA;
+#endif
+    case 'B': return &DDRB;
+    case 'C': return &DDRC;
+    case 'D': return &DDRD;
+#ifdef HOST_HAS_PORTE_TO_L
+    case 'E': return &DDRE;
+    case 'F': return &DDRF;
+    case 'G': return &DDRG;
+    case 'H': return &DDRH;
+    case 'J': return &DDRJ;
+    case 'K': return &DDRK;
+    case 'L': return &DDRL;
+#endif
+    default: return NULL;
+  }
+}
+
+/* PORTx of a port, NULL for one the part does not have */
+static volatile uint8_t *m_port (char port)
+{
+  switch (port)
+  {
+#ifdef HOST_HAS_PORTA
+    case 'A': return &PORTA;
+#endif
+    case 'B': return &PORTB;
+    case 'C': return &PORTC;
+    case 'D': return &PORTD;
+#ifdef HOST_HAS_PORTE_TO_L
+    case 'E': return &PORTE;
+    case 'F': return &PORTF;
+    case 'G': return &PORTG;
+    case 'H': return &PORTH;
+    case 'J': return &PORTJ;
+    case 'K': return &PORTK;
+    case 'L': return &PORTL;
+#endif
+    default: return NULL;
+  }
+}
+
+/* Tests */
+
+static void test_layout_size (void)
+{
+  CHECK (strlen (m_layout) == 2 * NUM_DIGITAL_PINS);
+}
+
+/* Every pin has the DDRx, PORTx and bit of the board, and PINx comes
+ * before DDRx as on the part
+ */
+static void test_pins (void)
+{
+  uint8_t n;
+
+  for (n = 0; n < NUM_DIGITAL_PINS && 2 * n < strlen (m_layout); n++)
+  {
+    const char port = m_layout[2 * n];
+    const uint8_t bit = (uint8_t) (m_layout[2 * n + 1] - '0');
+
+    if (pin_to_mode (n) != m_ddr (port) ||
+        pin_to_output (n) != m_port (port) ||
+        pin_to_input (n) != m_ddr (port) - 1 ||
+        pin_to_bit_mask (n) != _BV(bit))
+    {
+      fprintf (stderr, "pin %u is not P%c%u\n", n, port, bit);
+      CHECK (0);
+    }
+  }
+}
+
+static void test_pins_out_of_range (void)
+{
+  static const uint8_t pins[] = {NUM_DIGITAL_PINS, NUM_DIGITAL_PINS + 1, 255};
+  uint8_t i;
+
+  for (i = 0; i < sizeof (pins); i++)
+  {
+    CHECK (pin_to_mode (pins[i]) == NOT_A_PIN);
+    CHECK (pin_to_output (pins[i]) == NOT_A_PIN);
+    CHECK (pin_to_input (pins[i]) == NOT_A_PIN);
+    CHECK (pin_to_bit_mask (pins[i]) == NOT_A_PIN);
+  }
+}
+
+/* The SPI pins are those of the SPI on port B */
+static void test_spi_pins (void)
+{
+#if defined(PINS_ARDUINO_MEGA)
+  static const uint8_t bits[] = {0, 2, 3, 1};
+#elif defined(PINS_ARDUINO_SANGUINO)
+  static const uint8_t bits[] = {4, 5, 6, 7};
+#else
+  static const uint8_t bits[] = {2, 3, 4, 5};
+#endif
+  static const uint8_t pins[] = {
+    PIN_SPI_SS, PIN_SPI_MOSI, PIN_SPI_MISO, PIN_SPI_SCK,
+  };
+  uint8_t i;
+
+  for (i = 0; i < sizeof (pins); i++)
+  {
+    CHECK (pin_to_mode (pins[i]) == &DDRB);
+    CHECK (pin_to_bit_mask (pins[i]) == _BV(bits[i]));
+  }
+}
+
+int main (void)
+{
+  RUN_TEST (test_layout_size);
+  RUN_TEST (test_pins);
+  RUN_TEST (test_pins_out_of_range);
+  RUN_TEST (test_spi_pins);
+
+  return HOST_TEST_RESULT ();
+}
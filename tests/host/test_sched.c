@@ -0,0 +1,129 @@
+/* Host tests for the cooperative scheduler in sched.c.
+ *
+ * Tasks are fakes that count their runs and take a set number of cycles,
+ * which timer 1 of the host model turns into ticks.
+ */
+
+#include <string.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+
+#include "../../sched.h"
+
+int host_test_failures;
+
+static bool     m_ready[SCHED_TASKS_MAX];
+static uint8_t  m_runs[SCHED_TASKS_MAX];
+static uint64_t m_cycles[SCHED_TASKS_MAX];
+
+/* Helpers */
+
+static void m_run (uint8_t task)
+{
+  m_runs[task]++;
+  host_cycles += m_cycles[task];
+}
+
+static bool m_ready_0 (void) { return m_ready[0]; }
+static bool m_ready_1 (void) { return m_ready[1]; }
+static bool m_ready_2 (void) { return m_ready[2]; }
+static void m_run_0 (void) { m_run (0); }
+static void m_run_1 (void) { m_run (1); }
+static void m_run_2 (void) { m_run (2); }
+static void m_run_3 (void) { m_run (3); }
+
+static const sched_task_t m_tasks[] = {
+  {m_ready_0, m_run_0},
+  {m_ready_1, m_run_1},
+  {m_ready_2, m_run_2},
+  {NULL, m_run_3},
+};
+
+static void m_reset (void)
+{
+  host_avr_reset ();
+  memset (m_ready, 0, sizeof (m_ready));
+  memset (m_runs, 0, sizeof (m_runs));
+  memset (m_cycles, 0, sizeof (m_cycles));
+  memset (sched_stats, 0, sizeof (sched_stats[0]) * SCHED_TASKS_MAX);
+}
+
+/* Tests */
+
+/* The first ready task runs, and only that one */
+static void test_first_ready_runs (void)
+{
+  m_reset ();
+  m_ready[1] = true;
+  m_ready[2] = true;
+
+  CHECK (sched_step (m_tasks, 4) == 1);
+  CHECK (m_runs[1] == 1);
+  CHECK (m_runs[0] == 0 && m_runs[2] == 0 && m_runs[3] == 0);
+
+  m_ready[0] = true;
+  CHECK (sched_step (m_tasks, 4) == 0);
+  CHECK (m_runs[0] == 1 && m_runs[1] == 1);
+}
+
+/* A task without a ready check runs when nothing before it is ready */
+static void test_idle_task_fills_gaps (void)
+{
+  m_reset ();
+
+  CHECK (sched_step (m_tasks, 4) == 3);
+  CHECK (m_runs[3] == 1);
+
+  m_ready[2] = true;
+  CHECK (sched_step (m_tasks, 4) == 2);
+  CHECK (m_runs[3] == 1);
+}
+
+/* Without such a task, a step can run nothing */
+static void test_nothing_ready (void)
+{
+  m_reset ();
+
+  CHECK (sched_step (m_tasks, 3) == 3);
+  CHECK (m_runs[0] == 0 && m_runs[1] == 0 && m_runs[2] == 0);
+  CHECK (sched_stats[0].runs == 0);
+}
+
+/* Runs are counted per task, and the time they take in timer 1 ticks */
+static void test_stats_counted (void)
+{
+  uint8_t i;
+
+  m_reset ();
+  m_cycles[0] = 10 * 1024;
+  m_cycles[3] = 100;
+
+  m_ready[0] = true;
+  for (i = 0; i < 5; i++)
+  {
+    sched_step (m_tasks, 4);
+  }
+  m_ready[0] = false;
+  for (i = 0; i < 50; i++)
+  {
+    sched_step (m_tasks, 4);
+  }
+
+  CHECK (sched_stats[0].runs == 5);
+  CHECK (sched_stats[0].ticks == 50);
+  CHECK (sched_stats[3].runs == 50);
+
+  /* Short runs are counted in whole ticks as they cross one */
+  CHECK (sched_stats[3].ticks >= 4 && sched_stats[3].ticks <= 5);
+}
+
+int main (void)
+{
+  RUN_TEST (test_first_ready_runs);
+  RUN_TEST (test_idle_task_fills_gaps);
+  RUN_TEST (test_nothing_ready);
+  RUN_TEST (test_stats_counted);
+
+  return HOST_TEST_RESULT ();
+}
@@ -0,0 +1,96 @@
+/* Host tests for the stack painting in stack.c.
+ *
+ * The stack area is host_ram above HOST_RAM_STATIC; the tests grow a stack
+ * into it by hand, from RAMEND down.
+ */
+
+#include <string.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+
+#include "../../stack.h"
+
+int host_test_failures;
+
+/* Helpers */
+
+/* Push depth bytes of frame below RAMEND, none of them the paint */
+static void m_use (uint16_t depth)
+{
+  memset (&host_ram[RAMEND + 1 - depth], 0, depth);
+}
+
+/* Tests */
+
+/* The area runs from the end of the statics through RAMEND */
+static void test_size (void)
+{
+  CHECK (stack_size () == RAMEND + 1 - RAMSTART - HOST_RAM_STATIC);
+}
+
+/* Painting covers the whole area and nothing below it */
+static void test_paint_covers_area (void)
+{
+  uint16_t i;
+
+  host_avr_reset ();
+  stack_paint ();
+
+  for (i = 0; i < stack_size (); i++)
+  {
+    CHECK (STACK_START[i] == STACK_PAINT);
+  }
+  CHECK (STACK_START[-1] == 0);
+  CHECK (stack_unused () == stack_size ());
+}
+
+/* The margin is what the deepest stack left, later shallower ones do not
+ * give it back
+ */
+static void test_high_water_mark (void)
+{
+  host_avr_reset ();
+  stack_paint ();
+
+  m_use (40);
+  CHECK (stack_unused () == stack_size () - 40);
+
+  m_use (100);
+  m_use (20);
+  CHECK (stack_unused () == stack_size () - 100);
+}
+
+/* A stack byte that holds the paint, at the deepest point, is taken for
+ * margin
+ */
+static void test_paint_inside_frame (void)
+{
+  host_avr_reset ();
+  stack_paint ();
+
+  m_use (64);
+  host_ram[RAMEND + 1 - 64] = STACK_PAINT;
+  CHECK (stack_unused () == stack_size () - 63);
+}
+
+/* A stack that reached the statics leaves no margin */
+static void test_exhausted (void)
+{
+  host_avr_reset ();
+  stack_paint ();
+
+  m_use (stack_size ());
+  CHECK (stack_unused () == 0);
+}
+
+int main (void)
+{
+  RUN_TEST (test_size);
+  RUN_TEST (test_paint_covers_area);
+  RUN_TEST (test_high_water_mark);
+  RUN_TEST (test_paint_inside_frame);
+  RUN_TEST (test_exhausted);
+
+  return HOST_TEST_RESULT ();
+}
@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""STK500 uploads against stk500_sim.
+
+tools/stk500_upload.py writes and verifies tests/test_application.hex on
+main() of optiboot.c, with one command per page and with the multi-page
+extension, and the flash image the simulator leaves behind is compared
+with the HEX file. STK_PROG_MULTI is also driven a page at a time to check
+each page is answered on its own, and both multi-page commands with a count
+of 0 to check they are rejected. Options after the simulator are passed on
+to it.
+
+    test_stk500_upload.py <simulator> [simulator options]
+"""
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', 'tools'))
+
+import ble_dfu  # noqa: E402
+import stk500_upload  # noqa: E402
+
+APPLICATION = os.path.join(HERE, '..', 'test_application.hex')
+BAUD = 115200
+# Flash page of the ATmega328P the simulator runs
+PAGE_SIZE = 128
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print('%s: CHECK failed: %s' % (__file__, what), file=sys.stderr)
+        failures += 1
+
+
+def simulate(sim, sim_options, client):
+    """Run client on a Stk500 to the simulator, returns the flash image and
+    the simulator report
+    """
+    with tempfile.TemporaryDirectory() as tmp:
+        tty = os.path.join(tmp, 'tty')
+        flash = os.path.join(tmp, 'flash.bin')
+        proc = subprocess.Popen(sim + ['--link', tty, '--flash-out', flash,
+                                       '--baud', str(BAUD)] + sim_options,
+                                stdout=subprocess.PIPE, universal_newlines=True)
+        try:
+            for _ in range(500):
+                if os.path.exists(tty):
+                    break
+                time.sleep(0.01)
+            stk = stk500_upload.Stk500(tty, BAUD)
+            try:
+                client(stk)
+            finally:
+                stk.close()
+            report, _ = proc.communicate(timeout=600)
+        finally:
+            if proc.poll() is None:
+                proc.kill()
+                proc.wait()
+        check(proc.returncode == 0, 'simulator exit status %d' % proc.returncode)
+        with open(flash, 'rb') as f:
+            return f.read(), report
+
+
+def run_test(name, sim, mode, pages=16, sim_options=()):
+    failures_before = failures
+    image = ble_dfu.read_hex(APPLICATION)
+
+    def client(stk):
+        _, multi = stk500_upload.upload(stk, image, mode, pages, True)
+        check(multi == (mode == 'multi'), 'flow used')
+
+    flash, report = simulate(sim, list(sim_options), client)
+
+    check(flash[:len(image)] == image, 'image written to flash')
+    check(flash[len(image):] == b'\xff' * (len(flash) - len(image)),
+          'rest of flash erased')
+    check(re.search(r'\b0 overruns', report), 'no overruns')
+    check(re.search(r'\b0 SPM errors', report), 'no SPM errors')
+    check(re.search(r'\b%d page writes' % (-(-len(image) // PAGE_SIZE)),
+                    report), 'one write per page')
+    print('%-48s %s' % (name, 'ok' if failures == failures_before else 'FAILED'))
+    return report
+
+
+def run_lock_step_test(name, sim, pages=4):
+    """Each page of STK_PROG_MULTI is answered on its own once it is written,
+    before the host sends the next one, and CRC_EOP is only answered with
+    STK_INSYNC STK_OK after the last page's STK_OK
+    """
+    failures_before = failures
+    image = ble_dfu.read_hex(APPLICATION)[:pages * PAGE_SIZE]
+
+    def client(stk):
+        stk.sync()
+        stk.command([stk500_upload.STK_ENTER_PROGMODE])
+        stk._write(bytes([stk500_upload.STK_PROG_MULTI, 0, 0, pages]))
+        for i in range(pages):
+            stk._write(image[i * PAGE_SIZE:(i + 1) * PAGE_SIZE])
+            reply = stk._read(1, 1.0)
+            check(reply == bytes([stk500_upload.STK_OK]),
+                  'STK_OK for page %d, got %r' % (i, reply))
+        stk._write(bytes([stk500_upload.CRC_EOP]))
+        reply = stk._read(2, 1.0)
+        check(reply == bytes([stk500_upload.STK_INSYNC, stk500_upload.STK_OK]),
+              'STK_INSYNC STK_OK after the last page, got %r' % reply)
+        stk.command([stk500_upload.STK_LEAVE_PROGMODE])
+
+    flash, report = simulate(sim, [], client)
+
+    check(flash[:len(image)] == image, 'pages written to flash')
+    check(re.search(r'\b%d page writes' % pages, report), 'one write per page')
+    print('%-48s %s' % (name, 'ok' if failures == failures_before else 'FAILED'))
+
+
+def run_count_zero_test(name, sim, command):
+    """A count of 0 is a bad command: no reply, nothing written, and the
+    watchdog resets the part
+    """
+    failures_before = failures
+    reply = []
+
+    def client(stk):
+        stk.sync()
+        stk.command([stk500_upload.STK_ENTER_PROGMODE])
+        stk._write(bytes([command, 0, 0, 0, stk500_upload.CRC_EOP]))
+        try:
+            reply.append(stk._read(1, 1.0))
+        except ble_dfu.DfuError:
+            # The simulator has left at the reset
+            reply.append(b'')
+
+    flash, report = simulate(sim, [], client)
+
+    check(reply == [b''], 'no reply to command 0x%02x of 0 pages' % command)
+    check(flash == b'\xff' * len(flash), 'flash left erased')
+    check(re.search(r'\b0 page erases, 0 page writes', report),
+          'no page erased or written')
+    print('%-48s %s' % (name, 'ok' if failures == failures_before else 'FAILED'))
+
+
+def turnarounds(report):
+    return int(re.search(r'(\d+) turnarounds', report).group(1))
+
+
+def cycles_per_page(report):
+    return int(re.search(r'(\d+) cycles per page', report).group(1))
+
+
+def main():
+    sim = sys.argv[1:]
+
+    classic = run_test('test_classic_page_by_page', sim, 'classic')
+
+    # Pages are received while the previous one is written, each answered
+    # once it is
+    multi = run_test('test_multi_page', sim, 'multi')
+    check(turnarounds(multi) * 10 < turnarounds(classic),
+          'fewer turnarounds than page by page')
+    check(cycles_per_page(multi) < cycles_per_page(classic),
+          'pages written faster than page by page')
+
+    run_lock_step_test('test_prog_multi_stk_ok_per_page', sim)
+    run_test('test_multi_page_single', sim, 'multi', pages=1)
+    run_test('test_multi_page_with_latency', sim, 'multi', pages=255,
+             sim_options=['--latency-us', '16000'])
+    run_count_zero_test('test_prog_multi_count_zero', sim,
+                        stk500_upload.STK_PROG_MULTI)
+    run_count_zero_test('test_read_multi_count_zero', sim,
+                        stk500_upload.STK_READ_MULTI)
+
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
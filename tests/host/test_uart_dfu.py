@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""End to end framed UART DFU against uart_sim.
+
+tools/uart_dfu.py transfers tests/test_application.hex over the pseudo
+terminal of uart_sim, and the flash image the simulator leaves behind is
+compared with the HEX file. Options after the simulator are passed on to
+it.
+
+    test_uart_dfu.py <eeprom.bin> <simulator> [simulator options]
+"""
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..', '..', 'tools'))
+
+import ble_dfu  # noqa: E402
+import uart_dfu  # noqa: E402
+
+APPLICATION = os.path.join(HERE, '..', 'test_application.hex')
+# RAM of the ATmega328P the simulators run
+SIM_RAM_SIZE = 2048
+BAUD = 500000
+
+failures = 0
+
+
+def check(cond, what):
+    global failures
+    if not cond:
+        print('%s: CHECK failed: %s' % (__file__, what), file=sys.stderr)
+        failures += 1
+
+
+def dfu(sim, eeprom, image, prn, window, packet_size, sim_options, noise):
+    """Run one DFU, with noise on the line ahead of it, returns the flash
+    image and the simulator report
+    """
+    with tempfile.TemporaryDirectory() as tmp:
+        tty = os.path.join(tmp, 'tty')
+        flash = os.path.join(tmp, 'flash.bin')
+        proc = subprocess.Popen(sim + ['--link', tty, '--eeprom', eeprom,
+                                       '--flash-out', flash,
+                                       '--baud', str(BAUD)] + sim_options,
+                                stdout=subprocess.PIPE, universal_newlines=True)
+        try:
+            for _ in range(500):
+                if os.path.exists(tty):
+                    break
+                time.sleep(0.01)
+            link = uart_dfu.UartLink(tty, BAUD, window)
+            try:
+                os.write(link.fd, noise)
+                client = uart_dfu.UartDfu(link, prn, packet_size)
+                history = client.history()
+                check(history.attempts == 0 and history.result == 'none',
+                      'no update in the history yet')
+                memory = client.memory()
+                check(memory.static + memory.stack_peak + memory.stack_free ==
+                      SIM_RAM_SIZE, 'RAM use adds up to the RAM of the part')
+                try:
+                    client.spi_bench()
+                    check(False, 'SPI benchmark fails without an nRF8001')
+                except ble_dfu.DfuError:
+                    pass
+                client.run(image)
+            finally:
+                link.close()
+            report, _ = proc.communicate(timeout=60)
+        finally:
+            if proc.poll() is None:
+                proc.kill()
+                proc.wait()
+        check(proc.returncode == 0, 'simulator exit status %d' % proc.returncode)
+        with open(flash, 'rb') as f:
+            return f.read(), report
+
+
+def run_test(name, sim, eeprom, prn=0, window=4096,
+             packet_size=uart_dfu.UART_DFU_PAYLOAD_MAX, sim_options=(),
+             noise=b''):
+    failures_before = failures
+    image = ble_dfu.read_hex(APPLICATION)
+    flash, report = dfu(sim, eeprom, image, prn, window, packet_size,
+                        list(sim_options), noise)
+
+    check(flash[:len(image)] == image, 'image written to flash')
+    check(flash[len(image):] == b'\xff' * (len(flash) - len(image)),
+          'rest of flash erased')
+    check(re.search(r'\b0 SPM errors', report), 'no SPM errors')
+    check(re.search(r'valid_app 1\b', report), 'application marked valid')
+    check(re.search(r'history 1 attempts, 1 successes, result 2, %d bytes' %
+                    len(image), report), 'update recorded in the history')
+    print('%-48s %s' % (name, 'ok' if failures == failures_before else 'FAILED'))
+    return report
+
+
+def main():
+    eeprom, sim = sys.argv[1], sys.argv[2:]
+
+    # The ring takes whatever arrives while a page is programmed
+    report = run_test('test_streamed_while_programming', sim, eeprom)
+    check(re.search(r'\b0 overruns', report), 'no overruns')
+    check(re.search(r'\b0 rejects', report), 'no rejects')
+
+    run_test('test_receipt_notifications', sim, eeprom, prn=10)
+    run_test('test_stop_and_wait', sim, eeprom, window=1, packet_size=20)
+
+    report = run_test('test_lost_frames_sent_again', sim, eeprom,
+                      sim_options=['--corrupt-every', '997'])
+    check(not re.search(r'\b0 rejects', report), 'corrupted frames rejected')
+
+    # Only a whole hello with a good CRC starts the DFU. Taking this one
+    # would make the bootloader expect frame 6 and reject the real hello.
+    bad_hello = bytearray([uart_dfu.UART_DFU_SYNC]) + \
+        uart_dfu.frame(uart_dfu.HELLO, 5)
+    bad_hello[-1] ^= 0xFF
+    run_test('test_noise_before_hello', sim, eeprom,
+             noise=b'\x00\x55' + bytes(bad_hello))
+
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
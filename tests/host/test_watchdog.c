@@ -0,0 +1,146 @@
+/* Host tests for the watchdog phases and the reset log in watchdog.c.
+ *
+ * A reset is simulated by setting MCUSR and calling watchdog_log_reset()
+ * the way main() does, with the phase left behind by the last
+ * watchdog_phase_set().
+ */
+
+#include <string.h>
+
+#include "host_avr.h"
+#include "host_test.h"
+
+#include "../../watchdog.h"
+#include "bootloader_config.h"
+
+int host_test_failures;
+
+/* Helpers */
+
+static void m_reset (uint8_t cause)
+{
+  MCUSR = cause;
+  watchdog_log_reset ();
+  CHECK (MCUSR == 0);
+}
+
+static watchdog_log_t m_log (void)
+{
+  watchdog_log_t log;
+
+  memcpy (&log, &host_eeprom[WATCHDOG_LOG_ADDR], sizeof (log));
+  return log;
+}
+
+static int m_log_is_erased (void)
+{
+  const watchdog_log_t log = m_log ();
+
+  return log.count == 0xFF && log.cause == 0xFF && log.phase == 0xFF;
+}
+
+/* Tests */
+
+/* The log follows the configuration block, within the bootloader area */
+static void test_log_after_config (void)
+{
+  CHECK (WATCHDOG_LOG_ADDR ==
+      E2END - BOOTLOADER_EEPROM_SIZE + sizeof (bootloader_config_t));
+  CHECK (WATCHDOG_LOG_ADDR + sizeof (watchdog_log_t) <= E2END + 1);
+}
+
+static void test_phase_timeouts (void)
+{
+  host_avr_reset ();
+
+  watchdog_phase_set (WATCHDOG_PHASE_IDLE);
+  CHECK (WDTCSR == (_BV(WDP3) | _BV(WDE)));
+  watchdog_phase_set (WATCHDOG_PHASE_BOND);
+  CHECK (WDTCSR == (_BV(WDP2) | _BV(WDP1) | _BV(WDE)));
+  watchdog_phase_set (WATCHDOG_PHASE_DFU);
+  CHECK (WDTCSR == (_BV(WDP3) | _BV(WDP0) | _BV(WDE)));
+  watchdog_phase_set (WATCHDOG_PHASE_ACTIVATE);
+  CHECK (WDTCSR == (_BV(WDP2) | _BV(WDP1) | _BV(WDP0) | _BV(WDE)));
+  watchdog_phase_set (WATCHDOG_PHASE_RESET);
+  CHECK (WDTCSR == _BV(WDE));
+}
+
+/* Power-up, the reset button, and the watchdog ending the bootloader as
+ * intended are not logged
+ */
+static void test_expected_resets_not_logged (void)
+{
+  host_avr_reset ();
+
+  m_reset (_BV(PORF));
+  m_reset (_BV(PORF) | _BV(BORF));
+  m_reset (_BV(EXTRF));
+
+  watchdog_phase_set (WATCHDOG_PHASE_IDLE);
+  m_reset (_BV(WDRF));
+  watchdog_phase_set (WATCHDOG_PHASE_ACTIVATE);
+  m_reset (_BV(WDRF));
+  watchdog_phase_set (WATCHDOG_PHASE_RESET);
+  m_reset (_BV(WDRF));
+
+  CHECK (m_log_is_erased ());
+}
+
+static void test_watchdog_reset_in_transfer_logged (void)
+{
+  watchdog_log_t log;
+
+  host_avr_reset ();
+
+  watchdog_phase_set (WATCHDOG_PHASE_DFU);
+  m_reset (_BV(WDRF));
+  log = m_log ();
+  CHECK (log.count == 1);
+  CHECK (log.cause == _BV(WDRF));
+  CHECK (log.phase == WATCHDOG_PHASE_DFU);
+
+  watchdog_phase_set (WATCHDOG_PHASE_BOND);
+  m_reset (_BV(WDRF) | _BV(EXTRF));
+  log = m_log ();
+  CHECK (log.count == 2);
+  CHECK (log.cause == (_BV(WDRF) | _BV(EXTRF)));
+  CHECK (log.phase == WATCHDOG_PHASE_BOND);
+}
+
+static void test_brown_out_logged (void)
+{
+  watchdog_log_t log;
+
+  host_avr_reset ();
+
+  watchdog_phase_set (WATCHDOG_PHASE_IDLE);
+  m_reset (_BV(BORF));
+  log = m_log ();
+  CHECK (log.count == 1);
+  CHECK (log.cause == _BV(BORF));
+  CHECK (log.phase == WATCHDOG_PHASE_IDLE);
+}
+
+static void test_count_saturates (void)
+{
+  host_avr_reset ();
+  host_eeprom[WATCHDOG_LOG_ADDR] = 0xFD;
+
+  watchdog_phase_set (WATCHDOG_PHASE_DFU);
+  m_reset (_BV(WDRF));
+  CHECK (m_log ().count == 0xFE);
+  m_reset (_BV(WDRF));
+  CHECK (m_log ().count == 0xFE);
+}
+
+int main (void)
+{
+  RUN_TEST (test_log_after_config);
+  RUN_TEST (test_phase_timeouts);
+  RUN_TEST (test_expected_resets_not_logged);
+  RUN_TEST (test_watchdog_reset_in_transfer_logged);
+  RUN_TEST (test_brown_out_logged);
+  RUN_TEST (test_count_saturates);
+
+  return HOST_TEST_RESULT ();
+}
@@ -0,0 +1,847 @@
+/* Host simulator of the bootloader's framed UART DFU.
+ *
+ * uart_dfu.c and dfu.c run unmodified against the AVR stand-ins of
+ * host_avr.c, with a model of the UART attached to UCSR0A and UDR0. The
+ * line is a pseudo terminal, so the DFU client is tools/uart_dfu.py
+ * talking to what it takes for a serial port:
+ *
+ *   make -C tests/host sim
+ *   tests/host/build/atmega328p/uart_sim --link /tmp/uart_sim &
+ *   tools/uart_dfu.py --port /tmp/uart_sim tests/test_application.hex
+ *
+ * The UART is modelled at the configured baud rate: a received byte takes
+ * ten bit times on the line and waits in the two byte receive FIFO, where
+ * the next byte to complete while the FIFO is full is lost as an overrun.
+ * Transmitted bytes occupy the transmitter the same way. Time is the cycle
+ * count of the simulated AVR, SPM operations are charged at their data
+ * sheet duration and other CPU time per access to UCSR0A.
+ *
+ * The simulator waits for the client only while the bootloader has nothing
+ * left to do, so time the client spends thinking is not simulated and the
+ * reported throughput is that of the line and the bootloader alone. It
+ * finds out through dfu_housekeeping(), see __wrap_dfu_housekeeping().
+ *
+ * With --latency-us, a batch of bytes the client writes starts on the line
+ * no earlier than that after the last byte the bootloader sent, the
+ * turnaround of a USB serial adapter and its driver. A batch that finds the
+ * bootloader with nothing left to do counts as a turnaround.
+ *
+ * Like main(), the simulator eats bytes up to the first complete hello
+ * before it starts the DFU. The run ends once the 'D' frame that precedes the
+ * reset into the new application has left the UART.
+ *
+ * Built with STK500_SIM, as stk500_sim, it runs main() of optiboot.c from
+ * reset instead, for tools/stk500_upload.py on the STK500 path:
+ *
+ *   tests/host/build/atmega328p/stk500_sim --link /tmp/stk500_sim &
+ *   tools/stk500_upload.py --port /tmp/stk500_sim tests/test_application.hex
+ *
+ * There it waits for the client whenever the bootloader polls the UART with
+ * nothing to receive, send or write to flash, and the run ends at the reset
+ * by the watchdog: 16 ms after STK_LEAVE_PROGMODE, or on a bad command.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <avr/io.h>
+
+#include "host_avr.h"
+
+#include "ble.h"
+#include "../../history.h"
+#include "../../jump.h"
+#include "../../sched.h"
+#include "../../stack.h"
+#include "../../uart_dfu.h"
+
+/* Cost of one access to UCSR0A, a turn of one of the polling loops */
+#define SIM_POLL_CYCLES       10
+
+/* Wall clock the client may stay silent while the bootloader waits */
+#define SIM_CLIENT_TIMEOUT_MS 10000
+
+#ifdef STK500_SIM
+#define SIM_NAME              "stk500_sim"
+/* As the atmega328 target of the top-level Makefile */
+#define SIM_BAUD              115200
+
+/* Accesses to UCSR0A in a row that make the bootloader idle */
+#define SIM_IDLE_POLLS        3
+
+/* CPU time a loop that the clock does not move in may take, before it is
+ * taken for the bootloader waiting for the watchdog
+ */
+#define SIM_WATCHDOG_TICK_US  100000
+
+int optiboot_main (void);
+#else
+#define SIM_NAME              "uart_sim"
+#define SIM_BAUD              500000
+#endif
+
+typedef struct
+{
+  const char *link_path;
+  const char *eeprom_path;
+  const char *flash_path;
+  uint32_t    baud;
+  uint32_t    latency_us;
+  uint32_t    corrupt_every;
+  uint32_t    time_limit_s;
+} sim_options_t;
+
+/* Frame boundaries on one direction of the line, see uart_dfu.h */
+typedef struct
+{
+  uint8_t  state;
+  uint8_t  type;
+  uint8_t  len;
+  uint8_t  count;
+  uint32_t frames;
+  uint32_t payload_bytes[256];  /* By frame type */
+} sim_framing_t;
+
+#define SIM_FRAME_SYNC     0
+#define SIM_FRAME_TYPE     1
+#define SIM_FRAME_SEQ      2
+#define SIM_FRAME_LEN      3
+#define SIM_FRAME_PAYLOAD  4
+#define SIM_FRAME_CRC      5
+
+static sim_options_t m_options = {
+  .baud = SIM_BAUD,
+  .time_limit_s = 600,
+};
+
+static int           m_master = -1;
+static int           m_slave = -1;
+static sigjmp_buf    m_reset;
+static uint64_t      m_byte_cycles;
+static uint64_t      m_latency_cycles;
+static uint64_t      m_time_limit;
+
+/* Bytes from the client not yet on the line, and the receive FIFO */
+static uint8_t       m_pending[4096];
+static size_t        m_pending_head;
+static size_t        m_pending_tail;
+static uint64_t      m_rx_next;
+static uint8_t       m_fifo[2];
+static uint8_t       m_fifo_count;
+static uint8_t       m_rx_data;
+static uint32_t      m_rx_bytes;
+static uint32_t      m_overruns;
+static uint32_t      m_corrupted;
+static uint32_t      m_turnarounds;
+
+/* The transmitter is busy until m_tx_done, its buffer is free one byte
+ * time earlier. The client gets each byte once it is through, so there
+ * are at most two on the way, in the buffer and in the shift register.
+ */
+static uint64_t      m_tx_done;
+static uint8_t       m_tx_data;
+static bool          m_tx_pending;
+static uint32_t      m_tx_bytes;
+static uint8_t       m_tx_line[2];
+static uint64_t      m_tx_line_done[2];
+static uint8_t       m_tx_line_count;
+
+static sim_framing_t m_rx_framing;
+static sim_framing_t m_tx_framing;
+static bool          m_done;
+static uint64_t      m_first_packet;
+static uint64_t      m_last_packet;
+
+#ifdef STK500_SIM
+/* Clock at the last tick of the watchdog timer, and whether the simulator
+ * waits for the client meanwhile
+ */
+static uint64_t              m_watchdog_cycles;
+static volatile sig_atomic_t m_client_waiting;
+
+/* Accesses to UCSR0A in a row that found the UART idle, and the SPM
+ * instructions issued before them, see m_uart_idle()
+ */
+static uint8_t       m_idle_polls;
+static uint32_t      m_idle_spm;
+
+/* Page writes so far, the first and the last */
+static uint32_t      m_writes;
+static uint64_t      m_first_write;
+static uint64_t      m_last_write;
+#endif
+
+static void m_fail (const char *what)
+{
+  fprintf (stderr, SIM_NAME ": %s\n", what);
+  exit (1);
+}
+
+/* Follow the frames on the line. Returns true when a frame ends. */
+static bool m_framing (sim_framing_t *p_framing, uint8_t ch)
+{
+  switch (p_framing->state)
+  {
+    case SIM_FRAME_SYNC:
+    case SIM_FRAME_TYPE:
+      if (ch == UART_DFU_SYNC)
+      {
+        p_framing->state = SIM_FRAME_TYPE;
+      }
+      else if (p_framing->state == SIM_FRAME_TYPE)
+      {
+        p_framing->type = ch;
+        p_framing->state = SIM_FRAME_SEQ;
+      }
+      break;
+    case SIM_FRAME_SEQ:
+      p_framing->state = SIM_FRAME_LEN;
+      break;
+    case SIM_FRAME_LEN:
+      p_framing->len = ch;
+      p_framing->count = 0;
+      p_framing->state = ch ? SIM_FRAME_PAYLOAD : SIM_FRAME_CRC;
+      break;
+    case SIM_FRAME_PAYLOAD:
+      if (++p_framing->count == p_framing->len)
+      {
+        p_framing->count = 0;
+        p_framing->state = SIM_FRAME_CRC;
+      }
+      break;
+    case SIM_FRAME_CRC:
+      if (++p_framing->count == 2)
+      {
+        p_framing->state = SIM_FRAME_SYNC;
+        p_framing->frames++;
+        p_framing->payload_bytes[p_framing->type] += p_framing->len;
+        return true;
+      }
+      break;
+  }
+
+  return false;
+}
+
+/* Nothing to receive, send or write to flash */
+static bool m_uart_quiet (void)
+{
+  return !m_fifo_count && m_pending_head == m_pending_tail && !m_tx_pending &&
+      host_cycles >= m_tx_done && !host_spm_pending ();
+}
+
+/* Client side */
+
+/* Read what the client has written. Waits for it if block is set. */
+static void m_client_read (bool block)
+{
+  struct pollfd pfd = {.fd = m_master, .events = POLLIN};
+  bool quiet;
+  ssize_t n;
+
+  if (m_pending_head != m_pending_tail)
+  {
+    return;
+  }
+  m_pending_head = m_pending_tail = 0;
+  quiet = m_uart_quiet ();
+
+#ifdef STK500_SIM
+  m_client_waiting = block;
+#endif
+  while (poll (&pfd, 1, block ? SIM_CLIENT_TIMEOUT_MS : 0) < 0)
+  {
+    if (errno != EINTR)
+    {
+      m_fail ("poll failed");
+    }
+  }
+#ifdef STK500_SIM
+  m_client_waiting = false;
+#endif
+  if (!(pfd.revents & POLLIN))
+  {
+    if (block)
+    {
+      m_fail ("client went quiet");
+    }
+    return;
+  }
+
+  n = read (m_master, m_pending, sizeof (m_pending));
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+  {
+    return;
+  }
+  if (n <= 0)
+  {
+    m_fail ("client went away");
+  }
+  m_pending_tail = n;
+
+  /* The adapter passes the bytes on no earlier than a turnaround after the
+   * last reply
+   */
+  if (m_latency_cycles && m_rx_next < m_tx_done + m_latency_cycles)
+  {
+    m_rx_next = m_tx_done + m_latency_cycles;
+  }
+  if (quiet)
+  {
+    m_turnarounds++;
+  }
+}
+
+static void m_client_write (uint8_t ch)
+{
+  while (write (m_master, &ch, 1) != 1)
+  {
+    if (errno != EAGAIN && errno != EINTR)
+    {
+      m_fail ("client went away");
+    }
+  }
+}
+
+/* AVR side */
+
+/* Move the receive side of the line forward to the current time.
+ * m_rx_next is when the next byte starts on the line, it takes a byte time
+ * from there to the FIFO.
+ */
+static void m_uart_update (void)
+{
+  if (host_cycles > m_time_limit)
+  {
+    m_fail ("time limit reached");
+  }
+
+  m_client_read (false);
+
+  if (m_pending_head == m_pending_tail)
+  {
+    /* The line is idle, the next byte starts whenever it arrives */
+    if (m_rx_next < host_cycles)
+    {
+      m_rx_next = host_cycles;
+    }
+    return;
+  }
+
+  while (m_pending_head != m_pending_tail &&
+         m_rx_next + m_byte_cycles <= host_cycles)
+  {
+    uint8_t ch = m_pending[m_pending_head++];
+
+    m_rx_bytes++;
+    if (m_framing (&m_rx_framing, ch) && m_rx_framing.type == UART_DFU_PACKET)
+    {
+      if (!m_first_packet)
+      {
+        m_first_packet = host_cycles;
+      }
+      m_last_packet = host_cycles;
+    }
+
+    if (m_options.corrupt_every && m_rx_bytes % m_options.corrupt_every == 0)
+    {
+      ch ^= 0x10;
+      m_corrupted++;
+    }
+
+    if (m_fifo_count < sizeof (m_fifo))
+    {
+      m_fifo[m_fifo_count++] = ch;
+    }
+    else
+    {
+      m_overruns++;
+    }
+    m_rx_next += m_byte_cycles;
+  }
+}
+
+#ifdef STK500_SIM
+/* WATCHDOG_16MS of optiboot.c, what it sets before it waits for the reset */
+static bool m_watchdog_short (void)
+{
+  return WDTCSR == _BV(WDE);
+}
+
+/* The reset 16 ms on */
+static void m_watchdog_reset (void)
+{
+  host_cycles += (uint64_t) F_CPU * 16 / 1000;
+  siglongjmp (m_reset, 1);
+}
+
+/* On a bad command the bootloader waits for the watchdog in a loop that
+ * touches nothing the model sees. It is found there by a timer of CPU time:
+ * the clock stands still from one tick to the next while the simulator is
+ * not waiting for the client.
+ */
+static void m_watchdog_tick (int signum)
+{
+  if (!m_client_waiting && m_watchdog_short () &&
+      host_cycles == m_watchdog_cycles)
+  {
+    m_watchdog_reset ();
+  }
+  m_watchdog_cycles = host_cycles;
+}
+
+/* The bootloader polls the UART with nothing else to do. Past
+ * STK_LEAVE_PROGMODE the watchdog resets the part 16 ms on, before that it
+ * waits for the client. A poll may also be the last one of a wait for the
+ * SPM unit, or putch() finding the transmitter free, so it takes a few in
+ * a row, without UDR0 accessed or an SPM instruction between.
+ */
+static void m_uart_idle (void)
+{
+  const uint32_t spm = host_spm_stats.fills + host_spm_stats.erases +
+    host_spm_stats.writes;
+
+  if (!m_uart_quiet () || spm != m_idle_spm)
+  {
+    m_idle_polls = 0;
+    m_idle_spm = spm;
+    return;
+  }
+  if (++m_idle_polls < SIM_IDLE_POLLS)
+  {
+    return;
+  }
+
+  if (m_watchdog_short ())
+  {
+    m_watchdog_reset ();
+  }
+  m_client_read (true);
+}
+
+/* Called after every page erase and write */
+static void m_spm (uint32_t address)
+{
+  if (host_spm_stats.writes != m_writes)
+  {
+    m_writes = host_spm_stats.writes;
+    if (!m_first_write)
+    {
+      m_first_write = host_cycles;
+    }
+    m_last_write = host_cycles;
+  }
+}
+#endif
+
+static void m_uart_status (void)
+{
+  host_cycles += SIM_POLL_CYCLES;
+
+  if (m_tx_pending)
+  {
+    /* UDR0 was written since the last access */
+    if (m_tx_line_count == sizeof (m_tx_line))
+    {
+      m_fail ("UDR0 written while not empty");
+    }
+    m_tx_pending = false;
+    m_tx_bytes++;
+    m_tx_done = (m_tx_done > host_cycles ? m_tx_done : host_cycles) + m_byte_cycles;
+    m_tx_line[m_tx_line_count] = m_tx_data;
+    m_tx_line_done[m_tx_line_count++] = m_tx_done;
+  }
+
+  while (m_tx_line_count && m_tx_line_done[0] <= host_cycles)
+  {
+    const uint8_t ch = m_tx_line[0];
+
+    m_tx_line[0] = m_tx_line[1];
+    m_tx_line_done[0] = m_tx_line_done[1];
+    m_tx_line_count--;
+    m_client_write (ch);
+    if (m_framing (&m_tx_framing, ch) && m_tx_framing.type == UART_DFU_DONE)
+    {
+      m_done = true;
+    }
+  }
+
+  m_uart_update ();
+#ifdef STK500_SIM
+  m_uart_idle ();
+#endif
+
+  /* UDRE0 is only reported with the FIFO empty, so an access to UDR0 is
+   * a read exactly when the FIFO holds a byte, see host_io_hooks_t
+   */
+  host_UCSR0A &= _BV(U2X0);
+  if (m_fifo_count)
+  {
+    host_UCSR0A |= _BV(RXC0);
+  }
+  else if (host_cycles + m_byte_cycles >= m_tx_done)
+  {
+    host_UCSR0A |= _BV(UDRE0);
+  }
+  if (host_cycles >= m_tx_done)
+  {
+    host_UCSR0A |= _BV(TXC0);
+
+    if (m_done)
+    {
+      siglongjmp (m_reset, 1);
+    }
+  }
+}
+
+#ifndef STK500_SIM
+/* The scheduler of uart_dfu_run() calls dfu_housekeeping() when no other
+ * task is ready: every received byte has been taken from the ring, and
+ * there is no flash work it could start. Linked with
+ * --wrap=dfu_housekeeping, this is where the simulator waits for the client.
+ */
+void __real_dfu_housekeeping (void);
+void __wrap_dfu_housekeeping (void);
+
+void __wrap_dfu_housekeeping (void)
+{
+  __real_dfu_housekeeping ();
+
+  if (m_uart_quiet () && !m_done)
+  {
+    m_client_read (true);
+  }
+}
+
+/* The simulator has no nRF8001, as a board on which ble_init() was never
+ * called. BLE is not linked.
+ */
+uint8_t ble_spi_bench (uint8_t len, uint8_t count,
+    aci_bench_result_t *p_results, void (*poll) (void))
+{
+  return 0;
+}
+#endif
+
+static volatile uint8_t *m_uart_data (void)
+{
+#ifdef STK500_SIM
+  m_idle_polls = 0;
+#endif
+  if (m_fifo_count)
+  {
+    /* A read, RXC0 has been reported */
+    m_rx_data = m_fifo[0];
+    m_fifo[0] = m_fifo[1];
+    m_fifo_count--;
+    return &m_rx_data;
+  }
+
+  /* A write, UDRE0 has been reported. It goes out on the next access to
+   * UCSR0A.
+   */
+  m_tx_pending = true;
+  return &m_tx_data;
+}
+
+#ifdef STK500_SIM
+/* The bootloader from reset, until the watchdog resets it */
+static void m_avr_run (void)
+{
+  const struct itimerval tick = {
+    .it_interval = {.tv_usec = SIM_WATCHDOG_TICK_US},
+    .it_value = {.tv_usec = SIM_WATCHDOG_TICK_US},
+  };
+  const struct itimerval off = {{0}};
+
+  if (sigsetjmp (m_reset, 1))
+  {
+    setitimer (ITIMER_VIRTUAL, &off, NULL);
+    return;
+  }
+
+  signal (SIGVTALRM, m_watchdog_tick);
+  setitimer (ITIMER_VIRTUAL, &tick, NULL);
+  optiboot_main ();
+}
+#else
+/* The part of main() ahead of the DFU, then the DFU until the reset */
+static void m_avr_run (void)
+{
+  if (sigsetjmp (m_reset, 1))
+  {
+    return;
+  }
+
+  m_client_read (true);
+  while (!(UCSR0A & _BV(RXC0)) || !uart_dfu_hello (UDR0));
+
+  uart_dfu_run ();
+}
+#endif
+
+/* Setup and report */
+
+static void m_load (const char *path, uint8_t *p_dst, size_t size)
+{
+  FILE *f = fopen (path, "rb");
+
+  if (!f || fread (p_dst, 1, size, f) != size)
+  {
+    perror (path);
+    exit (1);
+  }
+  fclose (f);
+}
+
+static void m_store (const char *path, const uint8_t *p_src, size_t size)
+{
+  FILE *f = fopen (path, "wb");
+
+  if (!f || fwrite (p_src, 1, size, f) != size)
+  {
+    perror (path);
+    exit (1);
+  }
+  fclose (f);
+}
+
+static void m_link_open (const char *path)
+{
+  struct termios tio;
+
+  m_master = posix_openpt (O_RDWR | O_NOCTTY);
+  if (m_master < 0 || grantpt (m_master) < 0 || unlockpt (m_master) < 0)
+  {
+    perror ("pty");
+    exit (1);
+  }
+
+  /* Hold the terminal side open in raw mode, so nothing is echoed before
+   * the client has set it up, and the line survives the client reopening it
+   */
+  m_slave = open (ptsname (m_master), O_RDWR | O_NOCTTY);
+  if (m_slave < 0 || tcgetattr (m_slave, &tio) < 0)
+  {
+    perror (ptsname (m_master));
+    exit (1);
+  }
+  cfmakeraw (&tio);
+  tcsetattr (m_slave, TCSANOW, &tio);
+
+  unlink (path);
+  if (symlink (ptsname (m_master), path) < 0)
+  {
+    perror (path);
+    exit (1);
+  }
+}
+
+/* Let the client read the last frames, a hangup of the pseudo terminal
+ * discards what is still queued on the terminal side. Bytes written to the
+ * master reach that queue a little later, so it has to stay empty for a
+ * while before they are all known to be read.
+ */
+static void m_link_drain (void)
+{
+  int queued;
+  int empty = 0;
+  int i;
+
+  for (i = 0; i < 1000 && empty < 20; i++)
+  {
+    if (ioctl (m_slave, FIONREAD, &queued) < 0)
+    {
+      return;
+    }
+    empty = queued ? 0 : empty + 1;
+    usleep (1000);
+  }
+}
+
+#ifdef STK500_SIM
+static void m_report (void)
+{
+  const double seconds = (double) host_cycles / F_CPU;
+
+  printf ("stk500_sim: %.6f s simulated, %llu cycles, %lu baud, "
+      "%lu us latency\n",
+      seconds, (unsigned long long) host_cycles,
+      (unsigned long) m_options.baud, (unsigned long) m_options.latency_us);
+  printf ("stk500_sim: %lu bytes received, %lu sent, %lu overruns, "
+      "%lu corrupted, %lu turnarounds\n",
+      (unsigned long) m_rx_bytes, (unsigned long) m_tx_bytes,
+      (unsigned long) m_overruns, (unsigned long) m_corrupted,
+      (unsigned long) m_turnarounds);
+  printf ("stk500_sim: %lu page erases, %lu page writes, %llu cycles per page, "
+      "%llu SPM stall cycles (%.1f%%), %lu SPM errors, valid_app %u\n",
+      (unsigned long) host_spm_stats.erases,
+      (unsigned long) host_spm_stats.writes,
+      (unsigned long long) (m_writes > 1 ?
+        (m_last_write - m_first_write) / (m_writes - 1) : 0),
+      (unsigned long long) host_spm_stats.stall_cycles,
+      100.0 * host_spm_stats.stall_cycles / host_cycles,
+      (unsigned long) host_spm_stats.errors, jump_app_valid ());
+}
+#else
+static void m_report (void)
+{
+  const double seconds = (double) host_cycles / F_CPU;
+  const double transfer = (double) (m_last_packet - m_first_packet) / F_CPU;
+  /* The tasks of uart_dfu_run() */
+  static const char * const task_names[] = {"frame", "spm", "housekeeping"};
+  history_record_t history;
+  uint8_t i;
+
+  /* Past the reset, the UART must not be polled any more */
+  history_init (NULL);
+  history_read (&history);
+
+  printf ("uart_sim: %.6f s simulated, %llu cycles, %lu baud, "
+      "%lu us latency\n",
+      seconds, (unsigned long long) host_cycles,
+      (unsigned long) m_options.baud, (unsigned long) m_options.latency_us);
+  printf ("uart_sim: %lu frames, %lu packet bytes, %.0f bytes/s\n",
+      (unsigned long) m_rx_framing.frames,
+      (unsigned long) m_rx_framing.payload_bytes[UART_DFU_PACKET],
+      transfer > 0 ? m_rx_framing.payload_bytes[UART_DFU_PACKET] / transfer : 0);
+  printf ("uart_sim: %lu bytes received, %lu sent, %lu overruns, "
+      "%lu corrupted, %lu rejects, %lu turnarounds\n",
+      (unsigned long) m_rx_bytes, (unsigned long) m_tx_bytes,
+      (unsigned long) m_overruns, (unsigned long) m_corrupted,
+      (unsigned long) (m_tx_framing.payload_bytes[UART_DFU_REJECT]),
+      (unsigned long) m_turnarounds);
+  printf ("uart_sim: %lu page writes, %llu SPM stall cycles (%.1f%%), "
+      "%lu SPM errors, valid_app %u\n",
+      (unsigned long) host_spm_stats.writes,
+      (unsigned long long) host_spm_stats.stall_cycles,
+      100.0 * host_spm_stats.stall_cycles / host_cycles,
+      (unsigned long) host_spm_stats.errors, jump_app_valid ());
+  for (i = 0; i < sizeof (task_names) / sizeof (task_names[0]); i++)
+  {
+    printf ("uart_sim: task %s, %lu runs, %lu cycles\n", task_names[i],
+        (unsigned long) sched_stats[i].runs,
+        (unsigned long) sched_stats[i].ticks * 1024);
+  }
+  printf ("uart_sim: history %u attempts, %u successes, result %u, "
+      "%lu bytes in %lu ms\n",
+      history.attempts, history.successes, history.result,
+      (unsigned long) history.image_size, (unsigned long) history.duration_ms);
+}
+#endif
+
+static void m_usage (const char *name)
+{
+  fprintf (stderr,
+      "usage: %s --link PATH [options]\n"
+      "  --link PATH            symbolic link to create to the pseudo terminal\n"
+      "  --eeprom FILE          EEPROM image to start with, erased if not given\n"
+      "  --flash-out FILE       write the flash image here when done\n"
+      "  --baud N               line rate (%lu)\n"
+      "  --latency-us N         turnaround of the client's adapter (%lu)\n"
+      "  --corrupt-every N      flip a bit in every Nth byte received\n"
+      "  --time-limit N         simulated seconds before giving up (%lu)\n",
+      name, (unsigned long) m_options.baud,
+      (unsigned long) m_options.latency_us,
+      (unsigned long) m_options.time_limit_s);
+  exit (2);
+}
+
+static unsigned long m_number (const char *text, unsigned long min,
+    unsigned long max)
+{
+  char *end;
+  const unsigned long value = strtoul (text, &end, 0);
+
+  if (*text == '\0' || *end != '\0' || value < min || value > max)
+  {
+    fprintf (stderr, SIM_NAME ": bad value %s\n", text);
+    exit (2);
+  }
+
+  return value;
+}
+
+static void m_parse (int argc, char **argv)
+{
+  static const struct option options[] = {
+    {"link",          required_argument, NULL, 'l'},
+    {"eeprom",        required_argument, NULL, 'e'},
+    {"flash-out",     required_argument, NULL, 'f'},
+    {"baud",          required_argument, NULL, 'b'},
+    {"latency-us",    required_argument, NULL, 'L'},
+    {"corrupt-every", required_argument, NULL, 'c'},
+    {"time-limit",    required_argument, NULL, 't'},
+    {"help",          no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0},
+  };
+  int opt;
+
+  while ((opt = getopt_long (argc, argv, "", options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 'l': m_options.link_path = optarg; break;
+      case 'e': m_options.eeprom_path = optarg; break;
+      case 'f': m_options.flash_path = optarg; break;
+      case 'b': m_options.baud = m_number (optarg, 1, F_CPU / 8); break;
+      case 'L': m_options.latency_us = m_number (optarg, 0, 1000000); break;
+      case 'c': m_options.corrupt_every = m_number (optarg, 1, 1000000); break;
+      case 't': m_options.time_limit_s = m_number (optarg, 1, 100000); break;
+      default: m_usage (argv[0]);
+    }
+  }
+
+  if (!m_options.link_path || optind != argc)
+  {
+    m_usage (argv[0]);
+  }
+}
+
+int main (int argc, char **argv)
+{
+  m_parse (argc, argv);
+
+  host_avr_reset ();
+  stack_paint ();
+  if (m_options.eeprom_path)
+  {
+    m_load (m_options.eeprom_path, host_eeprom, sizeof (host_eeprom));
+  }
+
+  m_byte_cycles = (uint64_t) F_CPU * 10 / m_options.baud;
+  m_latency_cycles = (uint64_t) F_CPU / 1000000 * m_options.latency_us;
+  m_time_limit = (uint64_t) m_options.time_limit_s * F_CPU;
+  host_UCSR0A = _BV(U2X0);
+  host_io_hooks.uart_status = m_uart_status;
+  host_io_hooks.uart_data = m_uart_data;
+#ifdef STK500_SIM
+  host_io_hooks.spm = m_spm;
+#endif
+
+  m_link_open (m_options.link_path);
+  m_avr_run ();
+  m_link_drain ();
+
+  if (m_options.flash_path)
+  {
+    m_store (m_options.flash_path, host_flash, sizeof (host_flash));
+  }
+
+  m_report ();
+  unlink (m_options.link_path);
+
+  return 0;
+}
@@ -0,0 +1,465 @@
+/* Full system simulator of the bootloader's BLE DFU path.
+ *
+ * Where tests/host/ble_sim.c compiles the BLE sources for the build
+ * machine, this runs the real bootloader, optiboot_atmega328.hex as built
+ * by avr-gcc, on simavr. The nRF8001 model of tests/host/nrf8001_model.c is
+ * attached to the SPI unit and to the REQN and RDYN pins, which are taken
+ * from the configuration in the EEPROM image exactly as main() reads them.
+ *
+ * A DFU client, normally tools/ble_dfu.py, plays the central through
+ * tests/host/sim_link.c, in lockstep with the cycle counter of simavr. No
+ * timing is approximated: SPI transfers, flash writes and every instruction
+ * in between take the cycles the part takes, so the latencies reported are
+ * those of the code as built.
+ *
+ * The run ends when the Disconnected event following the bootloader's own
+ * Disconnect command (Activate & Reset) has been transferred to it. The
+ * application section of flash can then be written out for comparison.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sim_avr.h>
+#include <sim_hex.h>
+#include <avr_eeprom.h>
+#include <avr_ioport.h>
+#include <avr_spi.h>
+
+#include "nrf8001_model.h"
+#include "sim_link.h"
+#include "sim_history.h"
+
+#include "bootloader_config.h"
+#include "../../jump.h"
+
+#define SIM_MCU               "atmega328p"
+#define SIM_FREQUENCY         16000000UL
+#define SIM_FLASH_SIZE        0x8000UL
+#define SIM_EEPROM_SIZE       1024
+
+/* bootloader_config_t, at E2END - BOOTLOADER_EEPROM_SIZE */
+#define SIM_CONFIG_ADDR       (SIM_EEPROM_SIZE - 1 - BOOTLOADER_EEPROM_SIZE)
+
+/* Start of the boot section, BOOTSZ for 2048 words, as in the atmega328
+ * target of the top-level Makefile
+ */
+#define SIM_BOOT_START        0x7000UL
+
+/* SPMCSR in data space, and the bits of it the report counts */
+#define SIM_SPMCSR            0x57
+#define SIM_SPMCSR_SPMEN      0x01
+#define SIM_SPMCSR_PGERS      0x02
+#define SIM_SPMCSR_PGWRT      0x04
+
+typedef struct
+{
+  const char *socket_path;
+  const char *eeprom_path;
+  const char *hex_path;
+  const char *flash_path;
+  sim_link_config_t link;
+  nrf8001_config_t nrf8001;
+} sim_options_t;
+
+typedef struct
+{
+  uint32_t erases;
+  uint32_t writes;
+  uint64_t first_write;
+  uint64_t last_write;
+} sim_spm_stats_t;
+
+static bool     m_avr_run (uint64_t cycles);
+static uint64_t m_avr_cycles (void);
+
+static sim_options_t      m_options = {
+  .link = {
+    .interval_us = 7500,
+    .packets_per_event = 4,
+    .time_limit_s = 600,
+    .cycles_per_us = SIM_FREQUENCY / 1000000UL,
+    .avr_run = m_avr_run,
+    .avr_cycles = m_avr_cycles,
+  },
+  .nrf8001 = {.credits = 2, .rx_buffers = 4, .clock = m_avr_cycles},
+};
+static bootloader_config_t m_config;
+static sim_spm_stats_t    m_spm_stats;
+static avr_t             *m_avr;
+static avr_irq_t         *m_spi_in;
+static avr_irq_t         *m_rdyn;
+static bool               m_reqn_low;
+static bool               m_reset;
+
+/* AVR side */
+
+static uint64_t m_avr_cycles (void)
+{
+  return m_avr->cycle;
+}
+
+/* RDYN follows the model. It is updated whenever the model may have
+ * changed: on REQN, after every SPI byte and after every connection event.
+ */
+static void m_rdyn_update (void)
+{
+  avr_raise_irq (m_rdyn, nrf8001_rdyn_low (m_reqn_low) ? 0 : 1);
+}
+
+static void m_reqn_changed (struct avr_irq_t *irq, uint32_t value, void *param)
+{
+  m_reqn_low = !value;
+  m_rdyn_update ();
+}
+
+/* A byte clocked out by the SPI unit, the reply is clocked in */
+static void m_spi_out (struct avr_irq_t *irq, uint32_t value, void *param)
+{
+  avr_raise_irq (m_spi_in, nrf8001_spi_exchange ((uint8_t) value));
+  m_rdyn_update ();
+
+  if (nrf8001_local_disconnect_done ())
+  {
+    m_reset = true;
+  }
+}
+
+/* Observes writes to SPMCSR next to the flash unit of simavr, which
+ * performs them
+ */
+static void m_spmcsr_write (struct avr_t *avr, avr_io_addr_t addr, uint8_t v,
+    void *param)
+{
+  if ((v & (SIM_SPMCSR_PGERS | SIM_SPMCSR_SPMEN)) ==
+      (SIM_SPMCSR_PGERS | SIM_SPMCSR_SPMEN))
+  {
+    m_spm_stats.erases++;
+  }
+  else if ((v & (SIM_SPMCSR_PGWRT | SIM_SPMCSR_SPMEN)) ==
+           (SIM_SPMCSR_PGWRT | SIM_SPMCSR_SPMEN))
+  {
+    if (m_spm_stats.writes++ == 0)
+    {
+      m_spm_stats.first_write = avr->cycle;
+    }
+    m_spm_stats.last_write = avr->cycle;
+  }
+}
+
+/* Run the bootloader until the clock reaches cycles. Returns false if it
+ * reset instead.
+ */
+static bool m_avr_run (uint64_t cycles)
+{
+  m_rdyn_update ();
+
+  while (!m_reset && m_avr->cycle < cycles)
+  {
+    const int state = avr_run (m_avr);
+
+    if (state == cpu_Done || state == cpu_Crashed)
+    {
+      sim_link_fail ("AVR stopped");
+    }
+  }
+
+  return !m_reset;
+}
+
+/* Arduino pin number to the IRQ of its port bit. Only the atmega328 layout
+ * is needed here: D0-D7 on port D, D8-D13 on port B, A0-A5 on port C.
+ */
+static avr_irq_t *m_pin_irq (uint8_t pin)
+{
+  char port;
+  uint8_t bit;
+
+  if (pin < 8)
+  {
+    port = 'D';
+    bit = pin;
+  }
+  else if (pin < 14)
+  {
+    port = 'B';
+    bit = pin - 8;
+  }
+  else if (pin < 20)
+  {
+    port = 'C';
+    bit = pin - 14;
+  }
+  else
+  {
+    sim_link_fail ("REQN or RDYN is not a supported pin");
+    return NULL;
+  }
+
+  return avr_io_getirq (m_avr, AVR_IOCTL_IOPORT_GETIRQ (port), bit);
+}
+
+/* Setup and report */
+
+static void m_load (const char *path, uint8_t *p_dst, size_t size)
+{
+  FILE *f = fopen (path, "rb");
+
+  if (!f || fread (p_dst, 1, size, f) != size)
+  {
+    perror (path);
+    exit (1);
+  }
+  fclose (f);
+}
+
+static void m_store (const char *path, const uint8_t *p_src, size_t size)
+{
+  FILE *f = fopen (path, "wb");
+
+  if (!f || fwrite (p_src, 1, size, f) != size)
+  {
+    perror (path);
+    exit (1);
+  }
+  fclose (f);
+}
+
+/* The bootloader, placed in flash at the addresses of its HEX file. Its
+ * chunks are the code at SIM_BOOT_START, with SELF_UPDATE=1 the copy routine
+ * of .bootcopy (see bootcopy.h) and the version word in the last two bytes,
+ * and the pages between them stay erased as on the part.
+ */
+static void m_load_hex (const char *path)
+{
+  ihex_chunk_p chunks;
+  const int count = read_ihex_chunks (path, &chunks);
+  int i;
+
+  if (count <= 0)
+  {
+    fprintf (stderr, "ble_simavr: %s: can not read HEX file\n", path);
+    exit (1);
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    if (chunks[i].baseaddr < SIM_BOOT_START ||
+        chunks[i].baseaddr + chunks[i].size > SIM_FLASH_SIZE)
+    {
+      fprintf (stderr, "ble_simavr: %s: data outside the boot section\n", path);
+      exit (1);
+    }
+    memcpy (m_avr->flash + chunks[i].baseaddr, chunks[i].data, chunks[i].size);
+  }
+
+  free_ihex_chunks (chunks);
+}
+
+static void m_eeprom (uint32_t ioctl, uint8_t *p_data)
+{
+  avr_eeprom_desc_t desc = {.ee = p_data, .offset = 0, .size = SIM_EEPROM_SIZE};
+
+  avr_ioctl (m_avr, ioctl, &desc);
+
+  if (ioctl == AVR_IOCTL_EEPROM_GET)
+  {
+    memcpy (p_data, desc.ee, SIM_EEPROM_SIZE);
+  }
+}
+
+/* The application valid flag as jump_app_valid() reads it, from all of the
+ * part's EEPROM
+ */
+static uint8_t m_app_valid (const uint8_t *eeprom)
+{
+  const uint8_t *p_cells = &eeprom[JUMP_APP_VALID_ADDR];
+  const uint8_t lap = p_cells[0] & JUMP_APP_VALID_LAP;
+  uint8_t cell = 1;
+
+  while (cell < JUMP_APP_VALID_CELLS &&
+         (p_cells[cell] & JUMP_APP_VALID_LAP) == lap)
+  {
+    cell++;
+  }
+
+  return p_cells[cell - 1] == 0xFF ? 0xFF :
+    p_cells[cell - 1] & ~JUMP_APP_VALID_LAP;
+}
+
+static void m_report (void)
+{
+  const double seconds = (double) m_avr->cycle / SIM_FREQUENCY;
+  uint8_t eeprom[SIM_EEPROM_SIZE];
+  history_record_t history;
+
+  m_eeprom (AVR_IOCTL_EEPROM_GET, eeprom);
+  sim_history_read (eeprom, &history);
+
+  printf ("ble_simavr: %.6f s simulated, %llu cycles, %lu connection events\n",
+      seconds, (unsigned long long) m_avr->cycle,
+      (unsigned long) sim_link_stats.connection_events);
+  printf ("ble_simavr: %lu packets, %lu bytes, %.0f bytes/s\n",
+      (unsigned long) sim_link_stats.packets,
+      (unsigned long) sim_link_stats.packet_bytes,
+      sim_link_stats.packet_bytes / seconds);
+  printf ("ble_simavr: %lu notifications, %lu pipe errors, "
+      "%lu SPI transfers, %lu SPI bytes\n",
+      (unsigned long) nrf8001_stats.data_sent,
+      (unsigned long) nrf8001_stats.pipe_errors,
+      (unsigned long) nrf8001_stats.spi_transfers,
+      (unsigned long) nrf8001_stats.spi_bytes);
+  printf ("ble_simavr: packet latency %llu/%llu/%llu cycles min/avg/max\n",
+      (unsigned long long) nrf8001_stats.rx_latency_min,
+      (unsigned long long) (nrf8001_stats.data_delivered ?
+        nrf8001_stats.rx_latency_total / nrf8001_stats.data_delivered : 0),
+      (unsigned long long) nrf8001_stats.rx_latency_max);
+  printf ("ble_simavr: %lu page erases, %lu page writes, %llu cycles per page, "
+      "valid_app %u\n",
+      (unsigned long) m_spm_stats.erases,
+      (unsigned long) m_spm_stats.writes,
+      (unsigned long long) (m_spm_stats.writes > 1 ?
+        (m_spm_stats.last_write - m_spm_stats.first_write) /
+        (m_spm_stats.writes - 1) : 0),
+      m_app_valid (eeprom));
+  printf ("ble_simavr: history %u attempts, %u successes, result %u, "
+      "%lu bytes in %lu ms\n",
+      history.attempts, history.successes, history.result,
+      (unsigned long) history.image_size, (unsigned long) history.duration_ms);
+}
+
+static void m_usage (const char *name)
+{
+  fprintf (stderr,
+      "usage: %s --socket PATH --eeprom FILE --hex FILE [options]\n"
+      "  --socket PATH          UNIX socket to accept the client on\n"
+      "  --eeprom FILE          EEPROM image with the bootloader configuration\n"
+      "  --hex FILE             the bootloader, optiboot_atmega328.hex\n"
+      "  --flash-out FILE       write the application section here when done\n"
+      "  --interval-us N        connection interval (%lu)\n"
+      "  --packets-per-event N  writes per connection event (%u)\n"
+      "  --credits N            nRF8001 data credits (%u)\n"
+      "  --rx-buffers N         nRF8001 receive buffers (%u)\n"
+      "  --time-limit N         simulated seconds before giving up (%lu)\n",
+      name, (unsigned long) m_options.link.interval_us,
+      m_options.link.packets_per_event, m_options.nrf8001.credits,
+      m_options.nrf8001.rx_buffers, (unsigned long) m_options.link.time_limit_s);
+  exit (2);
+}
+
+static unsigned long m_number (const char *text, unsigned long max)
+{
+  char *end;
+  const unsigned long value = strtoul (text, &end, 0);
+
+  if (*text == '\0' || *end != '\0' || value == 0 || value > max)
+  {
+    fprintf (stderr, "ble_simavr: bad value %s\n", text);
+    exit (2);
+  }
+
+  return value;
+}
+
+static void m_parse (int argc, char **argv)
+{
+  static const struct option options[] = {
+    {"socket",            required_argument, NULL, 's'},
+    {"eeprom",            required_argument, NULL, 'e'},
+    {"hex",               required_argument, NULL, 'x'},
+    {"flash-out",         required_argument, NULL, 'f'},
+    {"interval-us",       required_argument, NULL, 'i'},
+    {"packets-per-event", required_argument, NULL, 'p'},
+    {"credits",           required_argument, NULL, 'c'},
+    {"rx-buffers",        required_argument, NULL, 'r'},
+    {"time-limit",        required_argument, NULL, 't'},
+    {"help",              no_argument,       NULL, 'h'},
+    {NULL, 0, NULL, 0},
+  };
+  int opt;
+
+  while ((opt = getopt_long (argc, argv, "", options, NULL)) != -1)
+  {
+    switch (opt)
+    {
+      case 's': m_options.socket_path = optarg; break;
+      case 'e': m_options.eeprom_path = optarg; break;
+      case 'x': m_options.hex_path = optarg; break;
+      case 'f': m_options.flash_path = optarg; break;
+      case 'i': m_options.link.interval_us = m_number (optarg, 4000000); break;
+      case 'p': m_options.link.packets_per_event = m_number (optarg, 255); break;
+      case 'c': m_options.nrf8001.credits = m_number (optarg, 255); break;
+      case 'r': m_options.nrf8001.rx_buffers = m_number (optarg, 255); break;
+      case 't': m_options.link.time_limit_s = m_number (optarg, 100000); break;
+      default: m_usage (argv[0]);
+    }
+  }
+
+  if (!m_options.socket_path || !m_options.eeprom_path ||
+      !m_options.hex_path || optind != argc)
+  {
+    m_usage (argv[0]);
+  }
+}
+
+int main (int argc, char **argv)
+{
+  uint8_t eeprom[SIM_EEPROM_SIZE];
+  avr_irq_t *p_reqn;
+
+  m_parse (argc, argv);
+
+  m_avr = avr_make_mcu_by_name (SIM_MCU);
+  if (!m_avr)
+  {
+    sim_link_fail ("simavr does not know " SIM_MCU);
+  }
+  avr_init (m_avr);
+  m_avr->frequency = SIM_FREQUENCY;
+
+  /* BOOTRST is programmed, reset goes to the bootloader */
+  m_load_hex (m_options.hex_path);
+  m_avr->reset_pc = SIM_BOOT_START;
+  m_avr->pc = SIM_BOOT_START;
+
+  m_load (m_options.eeprom_path, eeprom, sizeof (eeprom));
+  m_eeprom (AVR_IOCTL_EEPROM_SET, eeprom);
+
+  /* The same pins the bootloader will use, from the same block */
+  memcpy (&m_config, &eeprom[SIM_CONFIG_ADDR], sizeof (m_config));
+  if (m_config.version != BOOTLOADER_CONFIG_VERSION)
+  {
+    sim_link_fail ("no valid bootloader configuration in EEPROM");
+  }
+
+  m_spi_in = avr_io_getirq (m_avr, AVR_IOCTL_SPI_GETIRQ (0), SPI_IRQ_INPUT);
+  avr_irq_register_notify (
+      avr_io_getirq (m_avr, AVR_IOCTL_SPI_GETIRQ (0), SPI_IRQ_OUTPUT),
+      m_spi_out, NULL);
+
+  p_reqn = m_pin_irq (m_config.aci_pins.reqn_pin);
+  m_rdyn = m_pin_irq (m_config.aci_pins.rdyn_pin);
+  avr_irq_register_notify (p_reqn, m_reqn_changed, NULL);
+  m_reqn_low = false;
+
+  avr_register_io_write (m_avr, SIM_SPMCSR, m_spmcsr_write, NULL);
+
+  nrf8001_init (&m_options.nrf8001);
+
+  sim_link_accept (m_options.socket_path);
+
+  m_options.link.pipes = m_config.pipes;
+  sim_link_session (&m_options.link);
+
+  if (m_options.flash_path)
+  {
+    m_store (m_options.flash_path, m_avr->flash, SIM_BOOT_START);
+  }
+
+  m_report ();
+  sim_link_close ();
+
+  return 0;
+}
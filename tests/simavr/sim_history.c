@@ -0,0 +1,41 @@
+/* The DFU history of history.c, read from the EEPROM contents of a
+ * simulated part. See sim_history.h.
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "sim_history.h"
+
+#include "crc16.h"
+
+/* Copy a slot out of eeprom, returns true if it holds a record */
+static bool m_read (const uint8_t *eeprom, uint8_t slot,
+    history_record_t *p_record)
+{
+  memcpy (p_record, &eeprom[HISTORY_ADDR + slot * sizeof (*p_record)],
+      sizeof (*p_record));
+
+  return crc16_compute ((const uint8_t *) p_record,
+      offsetof (history_record_t, crc), NULL) == p_record->crc;
+}
+
+bool sim_history_read (const uint8_t *eeprom, history_record_t *p_record)
+{
+  history_record_t next;
+  uint8_t slot;
+
+  for (slot = 0; slot < HISTORY_SLOTS; slot++)
+  {
+    if (m_read (eeprom, slot, p_record) &&
+        !(m_read (eeprom, (slot + 1) % HISTORY_SLOTS, &next) &&
+          next.seq == (uint8_t) (p_record->seq + 1)))
+    {
+      return true;
+    }
+  }
+
+  memset (p_record, 0, sizeof (*p_record));
+
+  return false;
+}
@@ -0,0 +1,18 @@
+/* The DFU history of history.c, read from the EEPROM contents of a
+ * simulated part.
+ */
+
+#ifndef SIM_HISTORY_H_
+#define SIM_HISTORY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "../../history.h"
+
+/* Read the newest record out of eeprom, all of the part's EEPROM, the way
+ * history_read() does on the part. Returns false if there is none.
+ */
+bool sim_history_read (const uint8_t *eeprom, history_record_t *p_record);
+
+#endif /* SIM_HISTORY_H_ */
@@ -10,61 +10,71 @@ import encodings
 from intelhex import IntelHex
 PKT_SIZE = 20
 
-class HexToDFUPkts():
-    def __init__(self, hexfile):
-        try:
-            self.app_size_packet = None
-            self.app_crc_packet = 0xFFFF
-            self.data_packets = []
-
-            ih = IntelHex(hexfile)
-            bin_array = ih.tobinarray()
-            fsize = len(bin_array)
-            self.app_size_packet = [(fsize >>  0 & 0xFF),
-                                    (fsize >>  8 & 0xFF),
-                                    (fsize >> 16 & 0xFF),
-                                    (fsize >> 24 & 0xFF)]
-
-            for i in range(0, len(bin_array), PKT_SIZE):
-                data = (bin_array[i:i+PKT_SIZE])
-                self.data_packets.append(data)
-                self.crc16_compute(data)
+# CRC-16-CCITT of the high byte of the CRC and the next byte of data, for
+# every value of the two XORed, as crc16_compute() in BLE/crc16.c gives it
+def _crc16_table():
+    table = []
+    for index in range(256):
+        crc = index << 8
+        for _ in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+            else:
+                crc = (crc << 1) & 0xFFFF
+        table.append(crc)
+    return table
 
-            crc_packet = self.app_crc_packet
-            self.app_crc_packet = [(crc_packet >> 0 & 0xFF),
-                                   (crc_packet >> 8 & 0xFF)]
+CRC16_TABLE = _crc16_table()
 
-        except Exception, e1:
-            print "HexToDFUPkts init Exception %s" % str(e1)
-            sys.exit(0)
+class DFUPackets(object):
+    """The packets of an image, cut from it as they are asked for"""
+    def __init__(self, bin_array):
+        self.bin_array = bin_array
 
-        finally:
-            return True
+    def __len__(self):
+        return (len(self.bin_array) + PKT_SIZE - 1) // PKT_SIZE
 
-    def crc16_compute(self, data_array = []):
-        for i in range(len(data_array)):
-            # print "======================================================================================="
+    def __getitem__(self, index):
+        if isinstance(index, slice):
+            return [self[i] for i in range(*index.indices(len(self)))]
+        if index < 0:
+            index += len(self)
+        if not 0 <= index < len(self):
+            raise IndexError(index)
+        return self.bin_array[index * PKT_SIZE:(index + 1) * PKT_SIZE]
 
-            tempData = (((self.app_crc_packet >> 8) & 0xFF) | (self.app_crc_packet << 8)) & 0xFFFF
-            self.app_crc_packet = tempData
-            # print "app_crc_packet 1 %s" % self.app_crc_packet
+    def __iter__(self):
+        for i in range(len(self)):
+            yield self[i]
 
-            self.app_crc_packet ^= data_array[i]
-            # print "app_crc_packet 2 %s" % self.app_crc_packet
+class HexToDFUPkts():
+    """Size and CRC packets, and the data packets, of a HEX file. An error
+    reading it is raised to the caller.
+    """
+    def __init__(self, hexfile):
+        self.app_size_packet = None
+        self.app_crc_packet = 0xFFFF
 
-            tempData = ((self.app_crc_packet & 0xFF) >> 4) & 0xFF
-            self.app_crc_packet ^= tempData
-            # print "app_crc_packet 3 %s" % self.app_crc_packet
+        ih = IntelHex(hexfile)
+        bin_array = ih.tobinarray()
+        fsize = len(bin_array)
+        self.app_size_packet = [(fsize >>  0 & 0xFF),
+                                (fsize >>  8 & 0xFF),
+                                (fsize >> 16 & 0xFF),
+                                (fsize >> 24 & 0xFF)]
 
-            tempData = ((self.app_crc_packet << 8) << 4) & 0xFFFF
-            self.app_crc_packet ^= tempData
-            # print "app_crc_packet 4 %s" % self.app_crc_packet
+        self.data_packets = DFUPackets(bin_array)
+        self.crc16_compute(bin_array)
 
-            tempData = (((self.app_crc_packet & 0xFF) << 4) << 1) & 0xFFFF
-            self.app_crc_packet ^= tempData
-            # print "app_crc_packet 5 %s" % self.app_crc_packet
+        crc_packet = self.app_crc_packet
+        self.app_crc_packet = [(crc_packet >> 0 & 0xFF),
+                               (crc_packet >> 8 & 0xFF)]
 
-            # print "======================================================================================="
+    def crc16_compute(self, data_array = []):
+        crc = self.app_crc_packet
+        for byte in data_array:
+            crc = ((crc << 8) & 0xFF00) ^ CRC16_TABLE[(crc >> 8) ^ byte]
+        self.app_crc_packet = crc
 
 if __name__ == "__main__":
     print "Main Called"
@@ -0,0 +1,588 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Update the application over BLE DFU from Linux.
+
+Runs the sequence of BLE/dfu.h: Start DFU with the image size, Initialize
+DFU parameters, Receive firmware image, Validate, Activate & Reset. The
+image is streamed as write without response packets, with up to --window
+of them unacknowledged. Packet receipt notifications, requested every
+--prn packets, move the window along.
+
+The peer is the bootloader host simulator, tests/host/ble_sim.c, over a
+UNIX socket. It runs in lockstep with the simulated clock, so the reported
+throughput is reproducible:
+
+    make -C tests/host sim
+    tests/host/build/atmega328p/ble_sim --socket /tmp/ble_sim \\
+        --eeprom tests/host/build/atmega328p/eeprom.bin &
+    tools/ble_dfu.py --socket /tmp/ble_sim tests/test_application.hex
+
+tests/simavr/ble_simavr, the bootloader HEX file running on simavr, takes
+the same options plus --hex.
+
+--history prints what the bootloader records of past updates, see
+history.h, ahead of the update, or on its own without an image. --memory
+likewise prints its RAM use, see stack.h. The stack peak covers everything
+since the bootloader started, a DFU aborted with 'Reset System' included.
+
+--bootloader sends the HEX file of a bootloader built with SELF_UPDATE=1
+instead, which replaces the running one, see bootcopy.h. It is staged in
+application flash, so the application is lost and has to be sent again.
+
+--mcu adds the header of dfu_init_packet_t to the init packet: the
+signature of the part and the highest address of the image. The
+bootloader then refuses an image for another part, or one too big for it,
+before it gives up the application.
+
+The image may also be a packet file from tools/dfu_pack.py, which holds it
+with its start and init packets ready to send. It is memory-mapped and
+sent as it is, with the image type and part it was made for.
+"""
+
+import argparse
+import collections
+import mmap
+import socket
+import struct
+import sys
+
+# BLE/dfu.h
+OP_CODE_START_DFU = 1
+OP_CODE_RECEIVE_INIT = 2
+OP_CODE_RECEIVE_FW = 3
+OP_CODE_VALIDATE = 4
+OP_CODE_ACTIVATE_N_RESET = 5
+OP_CODE_PKT_RCPT_NOTIF_REQ = 8
+OP_CODE_RESPONSE = 16
+OP_CODE_PKT_RCPT_NOTIF = 17
+OP_CODE_HISTORY_REQ = 32
+OP_CODE_MEMORY_REQ = 33
+
+BLE_DFU_RESP_VAL_SUCCESS = 1
+
+DFU_IMAGE_BOOTLOADER = 2
+DFU_IMAGE_APPLICATION = 4
+
+DFU_INIT_VERSION = 1
+
+# avr/io.h, SIGNATURE_0..2 of the parts in the init packet header
+SIGNATURES = {
+    'atmega168': b'\x1e\x94\x06',
+    'atmega328p': b'\x1e\x95\x0f',
+    'atmega644p': b'\x1e\x96\x0a',
+    'atmega1280': b'\x1e\x97\x03',
+    'atmega1284p': b'\x1e\x97\x05',
+}
+
+# bootcopy.h, the end of the boot section that a bootloader image leaves out
+BOOTCOPY_SIZE = 256
+
+# history.h, the record after the response to OP_CODE_HISTORY_REQ
+HISTORY_FORMAT = '<BBHHIIH'
+HISTORY_RESPONSE_SIZE = 3 + struct.calcsize(HISTORY_FORMAT)
+HISTORY_RESULTS = ('none', 'started', 'success', 'verify', 'size', 'aborted',
+                   'crc')
+History = collections.namedtuple('History', 'app_valid result attempts successes '
+                                 'image_size duration_ms bytes_per_s')
+
+# The response to OP_CODE_MEMORY_REQ, bytes of RAM
+MEMORY_FORMAT = '<HHH'
+MEMORY_RESPONSE_SIZE = 3 + struct.calcsize(MEMORY_FORMAT)
+Memory = collections.namedtuple('Memory', 'static stack_peak stack_free')
+
+DFU_PACKET_SIZE = 20
+
+# Packet file of tools/dfu_pack.py: this header, the init packet padded to
+# PACKET_FILE_INIT_MAX bytes, then the image. The start packet follows
+# from the image type and size.
+PACKET_FILE_MAGIC = b'DFUP'
+PACKET_FILE_VERSION = 1
+PACKET_FILE_INIT_MAX = 16
+PACKET_FILE_FORMAT = '<4sBBBxI%ds' % PACKET_FILE_INIT_MAX
+PACKET_FILE_HEADER_SIZE = struct.calcsize(PACKET_FILE_FORMAT)
+
+# Connection events without any progress before the transfer is given up
+STALL_EVENTS = 1000
+
+
+class DfuError(Exception):
+    pass
+
+
+class Disconnected(Exception):
+    pass
+
+
+def read_hex(path):
+    """Flat image from an Intel HEX file, gaps filled with 0xFF"""
+    image = bytearray()
+    base = 0
+    with open(path) as f:
+        for line_number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            if not line.startswith(':'):
+                raise DfuError('%s:%d: not a HEX record' % (path, line_number))
+            record = bytes.fromhex(line[1:])
+            if sum(record) & 0xFF or len(record) != record[0] + 5:
+                raise DfuError('%s:%d: bad record' % (path, line_number))
+            length, address, kind = record[0], (record[1] << 8) | record[2], record[3]
+            data = record[4:4 + length]
+            if kind == 0:
+                address += base
+                if len(image) < address + length:
+                    image.extend(b'\xff' * (address + length - len(image)))
+                image[address:address + length] = data
+            elif kind == 1:
+                break
+            elif kind == 2:
+                base = int.from_bytes(data, 'big') << 4
+            elif kind == 4:
+                base = int.from_bytes(data, 'big') << 16
+    return bytes(image)
+
+
+def bootloader_image(image):
+    """The part of a flat bootloader image that is sent: from the start of
+    its boot section to the version word at the end, .bootcopy included,
+    which the bootloader leaves as it is, see bootcopy.h
+    """
+    start = next((i for i, byte in enumerate(image) if byte != 0xFF), len(image))
+    start &= ~(BOOTCOPY_SIZE - 1)
+    if len(image) - start <= 2 * BOOTCOPY_SIZE:
+        raise DfuError('no bootloader below .bootcopy')
+    return image[start:]
+
+
+def start_packet(image, image_type):
+    """The DFU Packet after Start DFU: softdevice, bootloader and
+    application sizes
+    """
+    if image_type == DFU_IMAGE_BOOTLOADER:
+        return struct.pack('<III', 0, len(image), 0)
+    return struct.pack('<III', 0, 0, len(image))
+
+
+def init_packet(image, mcu=None):
+    """The DFU Packet after Initialize DFU parameters: the CRC of image,
+    then with mcu the header the bootloader checks the image against, see
+    dfu_init_packet_t in BLE/dfu.h
+    """
+    packet = struct.pack('<H', crc16_compute(image))
+    if mcu is not None:
+        packet += struct.pack('<B3sI', DFU_INIT_VERSION, SIGNATURES[mcu],
+                              len(image) - 1)
+    return packet
+
+
+def _crc16_table():
+    """CRC-16-CCITT of the high byte of the CRC and the next byte of data,
+    for every value of the two XORed, run through the shifts of
+    crc16_compute() in BLE/crc16.c
+    """
+    table = []
+    for index in range(256):
+        crc = index << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021 if crc & 0x8000 else crc << 1) & 0xFFFF
+        table.append(crc)
+    return tuple(table)
+
+
+CRC16_TABLE = _crc16_table()
+
+
+def crc16_compute(data, crc=0xFFFF):
+    """CRC-16-CCITT, the same as crc16_compute() in BLE/crc16.c, a byte
+    at a time through CRC16_TABLE
+    """
+    table = CRC16_TABLE
+    for byte in data:
+        crc = ((crc << 8) & 0xFF00) ^ table[(crc >> 8) ^ byte]
+    return crc
+
+
+def packets(image, size):
+    """The image in packets of size bytes, as views into it"""
+    view = memoryview(image)
+    for offset in range(0, len(view), size):
+        yield view[offset:offset + size]
+
+
+def write_packet_file(path, image, image_type, init):
+    """Store image of a DFU_IMAGE_* type with its init packet, for
+    PacketFile
+    """
+    with open(path, 'wb') as f:
+        f.write(struct.pack(PACKET_FILE_FORMAT, PACKET_FILE_MAGIC,
+                            PACKET_FILE_VERSION, image_type, len(init),
+                            len(image), init))
+        f.write(image)
+
+
+def is_packet_file(path):
+    with open(path, 'rb') as f:
+        return f.read(len(PACKET_FILE_MAGIC)) == PACKET_FILE_MAGIC
+
+
+class PacketFile:
+    """A packet file of write_packet_file(), memory-mapped. image is a
+    view of the image in the file, to be sent with image_type and init.
+    """
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self._map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        try:
+            if len(self._map) < PACKET_FILE_HEADER_SIZE:
+                raise DfuError('%s: not a packet file' % path)
+            magic, version, self.image_type, init_len, size, init = \
+                struct.unpack_from(PACKET_FILE_FORMAT, self._map)
+            if magic != PACKET_FILE_MAGIC or version != PACKET_FILE_VERSION:
+                raise DfuError('%s: not a packet file of version %d' %
+                               (path, PACKET_FILE_VERSION))
+            if len(self._map) != PACKET_FILE_HEADER_SIZE + size or \
+                    not 2 <= init_len <= PACKET_FILE_INIT_MAX:
+                raise DfuError('%s: truncated or corrupt' % path)
+        except DfuError:
+            self._map.close()
+            raise
+        self.init = init[:init_len]
+        self.image = memoryview(self._map)[PACKET_FILE_HEADER_SIZE:]
+
+    def close(self):
+        """Unmap the file, or leave that to the last packet still held
+        """
+        self.image.release()
+        try:
+            self._map.close()
+        except BufferError:
+            pass
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+class HexImage:
+    """An Intel HEX file, as the image of a DFU_IMAGE_* type for the part
+    mcu if given, with the attributes of a PacketFile
+    """
+
+    def __init__(self, path, image_type=DFU_IMAGE_APPLICATION, mcu=None):
+        self.image = read_hex(path)
+        if image_type == DFU_IMAGE_BOOTLOADER:
+            self.image = bootloader_image(self.image)
+        self.image_type = image_type
+        self.init = init_packet(self.image, mcu)
+
+    def close(self):
+        pass
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def open_image(path, image_type=DFU_IMAGE_APPLICATION, mcu=None):
+    """A PacketFile, which decides the image type and part itself, or else
+    a HexImage
+    """
+    if is_packet_file(path):
+        return PacketFile(path)
+    return HexImage(path, image_type, mcu)
+
+
+def parse_history(data):
+    """History out of the response to OP_CODE_HISTORY_REQ"""
+    history = History(*struct.unpack_from(HISTORY_FORMAT, data, 3))
+    if history.result < len(HISTORY_RESULTS):
+        history = history._replace(result=HISTORY_RESULTS[history.result])
+    return history
+
+
+def format_history(history):
+    return ('%d attempts, %d successes, application %s; last: %s, %d bytes '
+            'in %.3f s, %d bytes/s' %
+            (history.attempts, history.successes,
+             'valid' if history.app_valid == 1 else 'invalid', history.result,
+             history.image_size, history.duration_ms / 1000.0,
+             history.bytes_per_s))
+
+
+def parse_memory(data):
+    """Memory out of the response to OP_CODE_MEMORY_REQ"""
+    return Memory(*struct.unpack_from(MEMORY_FORMAT, data, 3))
+
+
+def format_memory(memory):
+    return ('%d bytes static, stack peak %d bytes, %d bytes never used' %
+            (memory.static, memory.stack_peak, memory.stack_free))
+
+
+class SimLink:
+    """Central side of the simulator socket protocol, see tests/host/sim_link.h"""
+
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+        self._send(b'O')
+
+    def close(self):
+        self.sock.close()
+
+    def _send(self, kind, data=b''):
+        self.sock.sendall(kind + bytes([len(data)]) + data)
+
+    def _recv_exactly(self, n):
+        data = b''
+        while len(data) < n:
+            chunk = self.sock.recv(n - len(data))
+            if not chunk:
+                raise Disconnected(None)
+            data += chunk
+        return data
+
+    def _recv(self):
+        kind, length = self._recv_exactly(2)
+        return bytes([kind]), self._recv_exactly(length)
+
+    def event(self):
+        """Wait for the next connection event.
+
+        Returns (time_us, budget, notifications). Raises Disconnected, with
+        the time in microseconds, when the peer has dropped the link.
+        """
+        notifications = []
+        while True:
+            kind, data = self._recv()
+            if kind == b'N':
+                notifications.append(data)
+            elif kind == b'E':
+                time_us, budget = struct.unpack('<IB', data)
+                return time_us, budget, notifications
+            elif kind == b'D':
+                raise Disconnected(struct.unpack('<I', data)[0])
+            else:
+                raise DfuError('unexpected message %r' % kind)
+
+    def write_packet(self, data):
+        self._send(b'P', data)
+
+    def write_control_point(self, data):
+        self._send(b'C', data)
+
+    def event_end(self):
+        self._send(b'S')
+
+
+class DfuClient:
+    """DFU procedure over a link, one connection event at a time"""
+
+    def __init__(self, link, prn=10, window=20, packet_size=DFU_PACKET_SIZE,
+                 progress=None):
+        """progress, if given, is called with the image bytes sent so far
+        and the image size after every packet
+        """
+        if prn and window < prn:
+            raise DfuError('the window must hold at least PRN packets')
+        self.link = link
+        self.prn = prn
+        self.window = window
+        self.packet_size = packet_size
+        self.progress = progress
+        self.queue = collections.deque()
+        self.notifications = collections.deque()
+        self.time_us = 0
+        self.events = 0
+        self.packets_acked = 0
+
+    def _pump(self):
+        """Run one connection event, sending what the link accepts"""
+        self.time_us, budget, notifications = self.link.event()
+        self.events += 1
+        for data in notifications:
+            if data[0] == OP_CODE_PKT_RCPT_NOTIF:
+                # Sent on receipt of a packet, with the byte count from
+                # before that packet
+                received = struct.unpack_from('<I', data, 2)[0]
+                self.packets_acked = max(self.packets_acked,
+                                         received // self.packet_size + 1)
+            else:
+                self.notifications.append(data)
+        while budget and self.queue:
+            write, data = self.queue.popleft()
+            write(data)
+            budget -= 1
+        self.link.event_end()
+
+    def _control_point(self, *data):
+        self.queue.append((self.link.write_control_point, bytes(data)))
+
+    def _packet(self, data):
+        self.queue.append((self.link.write_packet, bytes(data)))
+
+    def _response(self, procedure, size=3):
+        """Wait for the response to procedure, check it and return it"""
+        for _ in range(STALL_EVENTS):
+            while self.notifications:
+                data = self.notifications.popleft()
+                if len(data) == size and data[0] == OP_CODE_RESPONSE and data[1] == procedure:
+                    if data[2] != BLE_DFU_RESP_VAL_SUCCESS:
+                        raise DfuError('procedure %d failed with %d' % (procedure, data[2]))
+                    return data
+            self._pump()
+        raise DfuError('no response to procedure %d' % procedure)
+
+    def _stream(self, image):
+        """Send the image, keeping at most window packets unacknowledged"""
+        stream = packets(image, self.packet_size)
+        count = (len(image) + self.packet_size - 1) // self.packet_size
+        sent = 0
+        idle = 0
+        while sent < count:
+            if self.prn and sent - self.packets_acked >= self.window:
+                acked = self.packets_acked
+                self._pump()
+                idle = 0 if self.packets_acked != acked else idle + 1
+                if idle == STALL_EVENTS:
+                    raise DfuError('no receipt notification after %d packets' % acked)
+                continue
+            self._packet(next(stream))
+            sent += 1
+            if self.progress:
+                self.progress(min(sent * self.packet_size, len(image)),
+                              len(image))
+        while self.queue:
+            self._pump()
+
+    def history(self):
+        """The bootloader's record of past updates, a History"""
+        self._control_point(OP_CODE_HISTORY_REQ)
+        return parse_history(self._response(OP_CODE_HISTORY_REQ,
+                                            HISTORY_RESPONSE_SIZE))
+
+    def memory(self):
+        """The bootloader's RAM use since reset, a Memory"""
+        self._control_point(OP_CODE_MEMORY_REQ)
+        return parse_memory(self._response(OP_CODE_MEMORY_REQ,
+                                           MEMORY_RESPONSE_SIZE))
+
+    def run(self, image, image_type=DFU_IMAGE_APPLICATION, mcu=None,
+            init=None):
+        """Transfer, validate and activate image, of a DFU_IMAGE_* type,
+        for the part mcu if given. init is the init packet if it is at hand,
+        as in a PacketFile.
+
+        Returns (events, microseconds) spent on the image data, from
+        Receive firmware image to its response.
+        """
+        self._control_point(OP_CODE_START_DFU, image_type)
+        self._packet(start_packet(image, image_type))
+        self._response(OP_CODE_START_DFU)
+
+        self._control_point(OP_CODE_RECEIVE_INIT)
+        self._packet(init or init_packet(image, mcu))
+        self._response(OP_CODE_RECEIVE_INIT)
+
+        self._control_point(OP_CODE_PKT_RCPT_NOTIF_REQ, self.prn & 0xFF, self.prn >> 8)
+        self._control_point(OP_CODE_RECEIVE_FW)
+        start_events, start_us = self.events, self.time_us
+        self._stream(image)
+        self._response(OP_CODE_RECEIVE_FW)
+        transfer = (self.events - start_events, self.time_us - start_us)
+
+        self._control_point(OP_CODE_VALIDATE)
+        self._response(OP_CODE_VALIDATE)
+
+        self._control_point(OP_CODE_ACTIVATE_N_RESET)
+        try:
+            for _ in range(STALL_EVENTS):
+                self._pump()
+        except Disconnected:
+            return transfer
+        raise DfuError('still connected after Activate & Reset')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('hex', nargs='?',
+                        help='application image, Intel HEX or packet file')
+    parser.add_argument('--bootloader', action='store_true',
+                        help='the image is a bootloader, to replace this one')
+    parser.add_argument('--mcu', choices=sorted(SIGNATURES),
+                        help='part the image is for, checked by the bootloader')
+    parser.add_argument('--socket', required=True,
+                        help='UNIX socket of the bootloader simulator')
+    parser.add_argument('--prn', type=int, default=10,
+                        help='packets per receipt notification, 0 for none (%(default)s)')
+    parser.add_argument('--window', type=int, default=20,
+                        help='unacknowledged packets in flight (%(default)s)')
+    parser.add_argument('--history', action='store_true',
+                        help='print the history of updates first')
+    parser.add_argument('--memory', action='store_true',
+                        help='print the RAM use first')
+    args = parser.parse_args()
+
+    if not 0 <= args.prn <= 0xFFFF:
+        parser.error('--prn must fit in 16 bits')
+    if not args.hex and not args.history and not args.memory:
+        parser.error('an image, --history or --memory is needed')
+
+    image_type = DFU_IMAGE_BOOTLOADER if args.bootloader else DFU_IMAGE_APPLICATION
+    image = None
+    try:
+        if args.hex:
+            image = open_image(args.hex, image_type, args.mcu)
+        link = SimLink(args.socket)
+        try:
+            client = DfuClient(link, args.prn, args.window)
+            if args.history:
+                print('ble_dfu: history: %s' % format_history(client.history()))
+            if args.memory:
+                print('ble_dfu: memory: %s' % format_memory(client.memory()))
+            if image is None:
+                return 0
+            size = len(image.image)
+            events, time_us = client.run(image.image, image.image_type,
+                                         init=image.init)
+        finally:
+            link.close()
+    except (DfuError, Disconnected, OSError) as e:
+        print('ble_dfu: %s' % (e,), file=sys.stderr)
+        return 1
+    finally:
+        if image is not None:
+            image.close()
+
+    print('ble_dfu: %d bytes in %.6f s, %d connection events, %.0f bytes/s' %
+          (size, time_us / 1e6, events, size * 1e6 / time_us))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
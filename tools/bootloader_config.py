@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Generate the EEPROM image holding the bootloader configuration.
+
+The block matches bootloader_config_t in BLE/bootloader_config.h and is
+placed at E2END - BOOTLOADER_EEPROM_SIZE of the selected part. With
+--valid-app, the application valid flag is written to the first of the
+JUMP_APP_VALID_CELLS cells right below the block that it rotates over (see
+jump.h), as the start of a lap. The rest of the EEPROM is left erased. The defaults are the pins of the nRF8001 shield
+on an Arduino Uno, and the pipes of the ble_uart_project_with_dfu_template.
+The SPI pins default to those of the board layout of the part, see
+BLE/pins_arduino.h.
+
+    tools/bootloader_config.py -o tests/eeprom.hex
+    avrdude ... -U eeprom:w:tests/eeprom.hex
+"""
+
+import argparse
+import struct
+import sys
+
+BOOTLOADER_CONFIG_VERSION = 2
+BOOTLOADER_EEPROM_SIZE = 32
+JUMP_APP_VALID_CELLS = 8
+
+# Part name to E2END
+E2END = {
+    'atmega168':  0x1FF,
+    'atmega328p': 0x3FF,
+    'atmega644p': 0x7FF,
+    'atmega1280': 0xFFF,
+    'atmega1284p': 0xFFF,
+}
+
+# aci_pins_t, in order
+PINS = [
+    ('board_name', 0),
+    ('reqn_pin', 9),
+    ('rdyn_pin', 8),
+    ('mosi_pin', 11),
+    ('miso_pin', 12),
+    ('sck_pin', 13),
+    ('spi_clock_divider', 5),
+    ('reset_pin', 4),
+    ('active_pin', 0xFF),
+    ('optional_chip_sel_pin', 0xFF),
+    ('interface_is_interrupt', 0),
+    ('interrupt_number', 1),
+]
+
+# Part name to the Arduino pins of the hardware SPI, as BLE/pins_arduino.h
+# lays out the board: Mega for the ATmega1280, Sanguino for the ATmega644P
+# and ATmega1284P, standard otherwise
+SPI_PINS_MEGA = {'mosi_pin': 51, 'miso_pin': 50, 'sck_pin': 52}
+SPI_PINS_SANGUINO = {'mosi_pin': 5, 'miso_pin': 6, 'sck_pin': 7}
+SPI_PINS = {
+    'atmega644p': SPI_PINS_SANGUINO,
+    'atmega1280': SPI_PINS_MEGA,
+    'atmega1284p': SPI_PINS_SANGUINO,
+}
+
+
+def crc16_compute(data, crc=0xFFFF):
+    """CRC-16-CCITT, the same as crc16_compute() in BLE/crc16.c"""
+    for byte in data:
+        crc = ((crc >> 8) | (crc << 8)) & 0xFFFF
+        crc ^= byte
+        crc ^= (crc & 0xFF) >> 4
+        crc ^= (crc << 12) & 0xFFFF
+        crc ^= ((crc & 0xFF) << 5) & 0xFFFF
+    return crc
+
+
+def config_block(args):
+    """Pack bootloader_config_t, little-endian like the AVR"""
+    body = struct.pack('<B12BB3sHH',
+                       BOOTLOADER_CONFIG_VERSION,
+                       *[getattr(args, name) for name, _ in PINS],
+                       args.credit,
+                       bytes(args.pipes),
+                       args.conn_timeout,
+                       args.conn_interval)
+    crc = struct.pack('<H', crc16_compute(body))
+    # The unused byte that was the application valid flag, left erased
+    return b'\xff' + body + crc
+
+
+def eeprom_image(args):
+    e2end = E2END[args.mcu]
+    image = bytearray(b'\xff' * (e2end + 1))
+    block = config_block(args)
+    base = e2end - BOOTLOADER_EEPROM_SIZE
+    image[base:base + len(block)] = block
+    if args.valid_app is not None:
+        # Cell 0 in lap 0, the other cells still in the erased lap
+        image[base - JUMP_APP_VALID_CELLS] = args.valid_app
+    return image
+
+
+def intel_hex(image, record_size=16):
+    lines = []
+    for address in range(0, len(image), record_size):
+        record = bytes([len(image[address:address + record_size]),
+                        address >> 8, address & 0xFF, 0x00])
+        record += image[address:address + record_size]
+        checksum = (-sum(record)) & 0xFF
+        lines.append(':' + (record + bytes([checksum])).hex().upper())
+    lines.append(':00000001FF')
+    return '\n'.join(lines) + '\n'
+
+
+def byte_value(text):
+    value = int(text, 0)
+    if not 0 <= value <= 0xFF:
+        raise argparse.ArgumentTypeError('%s does not fit in a byte' % text)
+    return value
+
+
+def word_value(text):
+    value = int(text, 0)
+    if not 0 <= value <= 0xFFFF:
+        raise argparse.ArgumentTypeError('%s does not fit in a word' % text)
+    return value
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('-o', '--output', help='output file (default stdout)')
+    parser.add_argument('--format', choices=('hex', 'bin'), default='hex',
+                        help='Intel HEX or raw EEPROM image')
+    parser.add_argument('--mcu', choices=sorted(E2END), default='atmega328p')
+    parser.add_argument('--valid-app', type=int, choices=(0, 1),
+                        help='application valid flag (default erased)')
+    for name, default in PINS:
+        parser.add_argument('--' + name.replace('_', '-'), type=byte_value,
+                            default=None if name in SPI_PINS_MEGA else default)
+    parser.add_argument('--credit', type=byte_value, default=2,
+                        help='ACI data credits of the nRF8001')
+    parser.add_argument('--pipes', type=byte_value, nargs=3,
+                        default=[8, 9, 10],
+                        metavar=('PACKET', 'CP_TX', 'CP_RX'),
+                        help='DFU packet, control point TX and RX pipes')
+    parser.add_argument('--conn-timeout', type=word_value, default=180,
+                        help='advertising timeout in seconds')
+    parser.add_argument('--conn-interval', type=word_value, default=0x0050,
+                        help='advertising interval in 0.625 ms units')
+    args = parser.parse_args()
+    for name, default in PINS:
+        if getattr(args, name) is None:
+            setattr(args, name, SPI_PINS.get(args.mcu, {}).get(name, default))
+
+    image = eeprom_image(args)
+    if args.format == 'hex':
+        data = intel_hex(image).encode('ascii')
+    else:
+        data = bytes(image)
+
+    if args.output:
+        with open(args.output, 'wb') as output:
+            output.write(data)
+    else:
+        sys.stdout.buffer.write(data)
+
+
+if __name__ == '__main__':
+    main()
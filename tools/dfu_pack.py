@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Prepare an image for tools/ble_dfu.py and tools/uart_dfu.py once.
+
+Reads the Intel HEX file, computes the CRC and init packet the DFU sends
+ahead of it, and writes a packet file: a 28 byte header with the image
+type and init packet, then the image as it goes out. The DFU tools map the
+file into memory and send the image from it as packets of their link's
+size, with no parsing or CRC left to do, so the file can be made once and
+sent to any number of units:
+
+    tools/dfu_pack.py --mcu atmega328p -o app.dfu app.hex
+    tools/ble_dfu.py --socket /tmp/ble_sim app.dfu
+
+--bootloader and --mcu are as for tools/ble_dfu.py, and are kept in the
+file.
+"""
+
+import argparse
+import os
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from ble_dfu import (  # noqa: E402
+    DFU_IMAGE_APPLICATION, DFU_IMAGE_BOOTLOADER, SIGNATURES, DfuError,
+    HexImage, write_packet_file)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('hex', help='application image, Intel HEX')
+    parser.add_argument('-o', '--output', required=True, help='packet file')
+    parser.add_argument('--bootloader', action='store_true',
+                        help='the image is a bootloader, to replace the one running')
+    parser.add_argument('--mcu', choices=sorted(SIGNATURES),
+                        help='part the image is for, checked by the bootloader')
+    args = parser.parse_args()
+
+    image_type = DFU_IMAGE_BOOTLOADER if args.bootloader else DFU_IMAGE_APPLICATION
+    try:
+        image = HexImage(args.hex, image_type, args.mcu)
+        write_packet_file(args.output, image.image, image.image_type,
+                          image.init)
+    except (DfuError, OSError) as e:
+        print('dfu_pack: %s' % (e,), file=sys.stderr)
+        return 1
+
+    print('dfu_pack: %d bytes, CRC 0x%04x' %
+          (len(image.image), int.from_bytes(image.init[:2], 'little')))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
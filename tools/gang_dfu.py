@@ -0,0 +1,278 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Program many units at once over BLE DFU and the serial line.
+
+Every unit is given as the link to it: --socket for a bootloader simulator
+of tests/host, as tools/ble_dfu.py takes it, or --port for a serial port,
+as tools/uart_dfu.py takes it. All of them are sent the same image, each
+by a worker of its own, and asyncio keeps the workers going, so a slow or
+failing unit holds up no other. A DFU that fails is run again from the
+start, after --retry-delay seconds, up to --retries times; the bootloader
+stays in charge of the unit until an image has been activated, so a unit
+left half written is recovered that way.
+
+The image is read once, from a HEX file or better a packet file of
+tools/dfu_pack.py, and shared by the workers. Progress is printed every
+--progress seconds, and a summary at the end:
+
+    tools/dfu_pack.py --mcu atmega328p -o app.dfu app.hex
+    tools/gang_dfu.py app.dfu --port /dev/ttyUSB0 --port /dev/ttyUSB1 \\
+        --socket /tmp/ble_sim0 --socket /tmp/ble_sim1
+
+The summary gives the bytes per second of every unit and of the whole
+gang, the share of the run the links were busy, and the time spent beyond
+the longest DFU, which is what running them together cost. --report writes
+the same per unit as CSV. The exit status is 0 if every unit was
+programmed.
+"""
+
+import argparse
+import asyncio
+import concurrent.futures
+import csv
+import os
+import sys
+import termios
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from ble_dfu import (  # noqa: E402
+    DFU_IMAGE_APPLICATION, DFU_IMAGE_BOOTLOADER, SIGNATURES, DfuClient,
+    DfuError, Disconnected, SimLink, open_image)
+from uart_dfu import UART_DFU_PAYLOAD_MAX, UartDfu, UartLink  # noqa: E402
+
+REPORT_COLUMNS = ['link', 'kind', 'result', 'attempts', 'bytes', 'seconds',
+                  'bytes_per_s', 'error']
+
+# What a failed DFU raises, to be tried again
+LINK_ERRORS = (DfuError, Disconnected, OSError, termios.error)
+
+
+class Unit:
+    """A unit on the gang, and how its DFU is going. sent is updated by
+    the worker, the rest by the event loop.
+    """
+
+    def __init__(self, kind, path):
+        self.kind = kind            # 'ble' or 'uart'
+        self.path = path
+        self.state = 'waiting'      # waiting, sending, retrying, ok, failed
+        self.attempts = 0
+        self.sent = 0
+        self.seconds = 0.0          # busy in DFU attempts
+        self.error = ''
+
+    def progress(self, sent, size):
+        self.sent = sent
+
+
+def dfu(unit, image, args):
+    """One DFU of unit, run by its worker. Raises one of LINK_ERRORS if it
+    fails.
+    """
+    unit.sent = 0
+    if unit.kind == 'ble':
+        link = SimLink(unit.path)
+        try:
+            DfuClient(link, args.prn, args.window,
+                      progress=unit.progress).run(image.image, image.image_type,
+                                                  init=image.init)
+        finally:
+            link.close()
+    else:
+        link = UartLink(unit.path, args.baud, args.uart_window)
+        try:
+            UartDfu(link, args.uart_prn, args.packet_size,
+                    progress=unit.progress).run(image.image, image.image_type,
+                                                init=image.init)
+        finally:
+            link.close()
+
+
+async def program(unit, image, args, executor, slots):
+    """Run the DFU of unit until it succeeds or is out of retries"""
+    loop = asyncio.get_running_loop()
+    async with slots:
+        for attempt in range(1, args.retries + 2):
+            unit.attempts = attempt
+            unit.state = 'sending'
+            start = time.monotonic()
+            try:
+                await loop.run_in_executor(executor, dfu, unit, image, args)
+            except LINK_ERRORS as e:
+                unit.seconds += time.monotonic() - start
+                unit.error = str(e) or type(e).__name__
+                print('gang_dfu: %s: attempt %d failed: %s' %
+                      (unit.path, attempt, unit.error), file=sys.stderr)
+                if attempt <= args.retries:
+                    unit.state = 'retrying'
+                    await asyncio.sleep(args.retry_delay)
+                continue
+            unit.seconds += time.monotonic() - start
+            unit.state = 'ok'
+            unit.error = ''
+            return
+        unit.state = 'failed'
+
+
+def format_progress(units, size):
+    parts = []
+    for unit in units:
+        if unit.state == 'sending':
+            parts.append('%s %d%%' % (unit.path, unit.sent * 100 // size))
+        else:
+            parts.append('%s %s' % (unit.path, unit.state))
+    return ', '.join(parts)
+
+
+async def report_progress(units, size, interval):
+    while True:
+        await asyncio.sleep(interval)
+        print('gang_dfu: %s' % format_progress(units, size), file=sys.stderr)
+
+
+async def gang(units, image, args):
+    """Program every unit, returns the seconds it took"""
+    slots = asyncio.Semaphore(args.jobs or len(units))
+    start = time.monotonic()
+    with concurrent.futures.ThreadPoolExecutor(len(units)) as executor:
+        reporter = None
+        if args.progress:
+            reporter = asyncio.ensure_future(
+                report_progress(units, len(image.image), args.progress))
+        try:
+            await asyncio.gather(*(program(unit, image, args, executor, slots)
+                                   for unit in units))
+        finally:
+            if reporter:
+                reporter.cancel()
+    return time.monotonic() - start
+
+
+def report_rows(units, size):
+    for unit in units:
+        ok = unit.state == 'ok'
+        yield {
+            'link': unit.path,
+            'kind': unit.kind,
+            'result': unit.state,
+            'attempts': unit.attempts,
+            'bytes': size if ok else unit.sent,
+            'seconds': '%.3f' % unit.seconds,
+            'bytes_per_s': '%.0f' % (size / unit.seconds) if ok and unit.seconds else '',
+            'error': unit.error,
+        }
+
+
+def format_summary(units, size, wall):
+    lines = ['%-32s %-6s %6s %8s %8s %9s' %
+             ('link', 'result', 'tries', 'bytes', 'seconds', 'bytes/s')]
+    for row in report_rows(units, size):
+        lines.append('%-32s %-6s %6d %8d %8s %9s' %
+                     (row['link'], row['result'], row['attempts'], row['bytes'],
+                      row['seconds'], row['bytes_per_s']))
+    done = [unit for unit in units if unit.state == 'ok']
+    busy = sum(unit.seconds for unit in units)
+    longest = max(unit.seconds for unit in units)
+    lines.append('%d of %d units programmed, %d bytes in %.3f s, %.0f bytes/s '
+                 'in all' % (len(done), len(units), size * len(done), wall,
+                             size * len(done) / wall if wall else 0))
+    lines.append('links busy %.0f%% of the run, %.3f s beyond the longest DFU' %
+                 (100 * busy / (wall * len(units)) if wall else 0,
+                  wall - longest))
+    return '\n'.join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('hex', help='image, Intel HEX or packet file')
+    parser.add_argument('--socket', action='append', default=[],
+                        help='UNIX socket of a bootloader simulator, repeatable')
+    parser.add_argument('--port', action='append', default=[],
+                        help='serial port of a unit, repeatable')
+    parser.add_argument('--bootloader', action='store_true',
+                        help='the HEX file is a bootloader, to replace the one running')
+    parser.add_argument('--mcu', choices=sorted(SIGNATURES),
+                        help='part the HEX file is for, checked by the bootloader')
+    parser.add_argument('--jobs', type=int, default=0,
+                        help='units programmed at a time, 0 for all (%(default)s)')
+    parser.add_argument('--retries', type=int, default=2,
+                        help='times a failed DFU is run again (%(default)s)')
+    parser.add_argument('--retry-delay', type=float, default=1.0,
+                        help='seconds before a failed DFU is run again (%(default)s)')
+    parser.add_argument('--progress', type=float, default=1.0,
+                        help='seconds between progress lines, 0 for none (%(default)s)')
+    parser.add_argument('--report', help='CSV file with a row per unit')
+    parser.add_argument('--prn', type=int, default=10,
+                        help='BLE packets per receipt notification (%(default)s)')
+    parser.add_argument('--window', type=int, default=20,
+                        help='BLE packets in flight (%(default)s)')
+    parser.add_argument('--baud', type=int, default=500000,
+                        help='baud rate of the serial ports (%(default)s)')
+    parser.add_argument('--uart-prn', type=int, default=0,
+                        help='serial packets per receipt notification (%(default)s)')
+    parser.add_argument('--uart-window', type=int, default=4096,
+                        help='serial bytes in flight (%(default)s)')
+    parser.add_argument('--packet-size', type=int, default=UART_DFU_PAYLOAD_MAX,
+                        help='image bytes per serial packet (%(default)s)')
+    args = parser.parse_args()
+
+    units = [Unit('ble', path) for path in args.socket] + \
+        [Unit('uart', path) for path in args.port]
+    if not units:
+        parser.error('at least one --socket or --port is needed')
+    if len(set(unit.path for unit in units)) != len(units):
+        parser.error('every link may only be given once')
+    if not 0 <= args.prn <= 0xFFFF or not 0 <= args.uart_prn <= 0xFFFF:
+        parser.error('--prn and --uart-prn must fit in 16 bits')
+    if not 1 <= args.packet_size <= UART_DFU_PAYLOAD_MAX:
+        parser.error('--packet-size must be 1 to %d' % UART_DFU_PAYLOAD_MAX)
+    if args.jobs < 0 or args.retries < 0 or args.retry_delay < 0 or \
+            args.progress < 0:
+        parser.error('--jobs, --retries, --retry-delay and --progress can not '
+                     'be negative')
+
+    image_type = DFU_IMAGE_BOOTLOADER if args.bootloader else DFU_IMAGE_APPLICATION
+    try:
+        image = open_image(args.hex, image_type, args.mcu)
+    except (DfuError, OSError) as e:
+        print('gang_dfu: %s' % (e,), file=sys.stderr)
+        return 1
+
+    with image:
+        size = len(image.image)
+        wall = asyncio.run(gang(units, image, args))
+
+    for line in format_summary(units, size, wall).splitlines():
+        print('gang_dfu: %s' % line)
+    if args.report:
+        with open(args.report, 'w', newline='') as f:
+            writer = csv.DictWriter(f, REPORT_COLUMNS)
+            writer.writeheader()
+            writer.writerows(report_rows(units, size))
+
+    return 0 if all(unit.state == 'ok' for unit in units) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Report the static RAM of each module from the linker map.
+
+Reads the map file the bootloader build writes (output.map) and sums the
+.data, .bss and .noinit input sections by the object they came from. What
+is left of the part's RAM is all the stack has; stack.h measures how much
+of it is used at run time, see --memory of tools/ble_dfu.py.
+
+    make atmega328
+    tools/memmap.py --mcu atmega328p output.map
+"""
+
+import argparse
+import collections
+import re
+import sys
+
+# Part name to the first and last byte of RAM
+RAM = {
+    'atmega8':    (0x60, 0x45F),
+    'atmega88':   (0x100, 0x4FF),
+    'atmega168':  (0x100, 0x4FF),
+    'atmega328p': (0x100, 0x8FF),
+    'atmega32':   (0x60, 0x85F),
+    'atmega644p': (0x100, 0x10FF),
+    'atmega1280': (0x200, 0x21FF),
+    'atmega1284p': (0x100, 0x40FF),
+    'attiny84':   (0x60, 0x25F),
+}
+
+SECTIONS = ('.data', '.bss', '.noinit')
+
+# An input section: name, then address, size and object, the name on a
+# line of its own when it is long
+INPUT_SECTION = re.compile(r'^ (\S+)\s+0x[0-9a-fA-F]+\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+INPUT_NAME = re.compile(r'^ (\S+)$')
+INPUT_REST = re.compile(r'^\s+0x[0-9a-fA-F]+\s+0x([0-9a-fA-F]+)\s+(\S.*)$')
+OUTPUT_SECTION = re.compile(r'^(\.\S+)')
+
+
+def module_name(path):
+    """The object, or archive member, an input section came from"""
+    member = re.search(r'\(([^)]+)\)$', path)
+    return member.group(1) if member else path
+
+
+def parse_map(lines):
+    """{module: {section: bytes}} of the RAM sections in a linker map"""
+    usage = collections.defaultdict(lambda: dict.fromkeys(SECTIONS, 0))
+    output = None
+    pending = None
+
+    for line in lines:
+        line = line.rstrip('\n')
+        match = OUTPUT_SECTION.match(line)
+        if match:
+            output = match.group(1)
+            pending = None
+            continue
+        if output not in SECTIONS:
+            continue
+
+        match = INPUT_SECTION.match(line)
+        if match:
+            name, size, path = match.groups()
+        elif pending and INPUT_REST.match(line):
+            name = pending
+            size, path = INPUT_REST.match(line).groups()
+        else:
+            match = INPUT_NAME.match(line)
+            pending = match.group(1) if match else None
+            continue
+        pending = None
+
+        if name.startswith('*'):
+            continue
+        size = int(size, 16)
+        if size:
+            usage[module_name(path)][output] += size
+
+    return usage
+
+
+def format_map(usage, ram=None):
+    rows = ['%-24s %6s %6s %6s %6s' % (('module',) + SECTIONS + ('total',))]
+    totals = dict.fromkeys(SECTIONS, 0)
+    for module in sorted(usage, key=lambda m: -sum(usage[m].values())):
+        sizes = usage[module]
+        for section in SECTIONS:
+            totals[section] += sizes[section]
+        rows.append('%-24s %6d %6d %6d %6d' %
+                    ((module,) + tuple(sizes[s] for s in SECTIONS) +
+                     (sum(sizes.values()),)))
+    total = sum(totals.values())
+    rows.append('%-24s %6d %6d %6d %6d' %
+                (('total',) + tuple(totals[s] for s in SECTIONS) + (total,)))
+    if ram:
+        rows.append('%d of %d bytes of RAM static, %d left for the stack' %
+                    (total, ram, ram - total))
+    return '\n'.join(rows)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('map', help='linker map file')
+    parser.add_argument('--mcu', choices=sorted(RAM),
+                        help='part, for the RAM left to the stack')
+    args = parser.parse_args()
+
+    try:
+        with open(args.map) as f:
+            usage = parse_map(f)
+    except OSError as e:
+        print('memmap: %s' % (e,), file=sys.stderr)
+        return 1
+
+    ram = None
+    if args.mcu:
+        start, end = RAM[args.mcu]
+        ram = end + 1 - start
+    print(format_map(usage, ram))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,277 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+
+"""Upload an application over the STK500 protocol of optiboot from Linux.
+
+Runs the commands AVRDUDE uses for optiboot, one STK_LOAD_ADDRESS and
+STK_PROG_PAGE per page and the same again with STK_READ_PAGE to verify, or
+the multi-page extension of stk500.h, which writes --pages pages with one
+command and reads them back the same way. The reply to each command has to
+be waited for, so on a USB serial adapter that holds bytes back for a few
+milliseconds the turnarounds rather than the line rate set the pace of the
+classic flow. With the extension, each page only waits for the reply to
+the page before it, which the bootloader sends once that one is written.
+
+    tools/stk500_upload.py --port /dev/ttyUSB0 app.hex
+
+By default the extension is used if the bootloader announces it, which
+one built with MULTI_PAGE=1 does. The bootloader resets into the
+application at the end.
+"""
+
+import argparse
+import os
+import select
+import sys
+import termios
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from ble_dfu import DfuError, read_hex  # noqa: E402
+from uart_dfu import open_port  # noqa: E402
+
+# stk500.h
+STK_OK, STK_INSYNC, CRC_EOP = 0x10, 0x14, 0x20
+STK_GET_SYNC = 0x30
+STK_GET_PARAMETER = 0x41
+STK_ENTER_PROGMODE, STK_LEAVE_PROGMODE = 0x50, 0x51
+STK_LOAD_ADDRESS = 0x55
+STK_PROG_PAGE = 0x64
+STK_READ_PAGE = 0x74
+STK_READ_SIGN = 0x75
+STK_PROG_MULTI, STK_READ_MULTI = 0x7A, 0x7B
+Parm_STK_SW_MAJOR, Parm_STK_SW_MINOR = 0x81, 0x82
+Parm_STK_MULTI_PAGE = 0xA0
+
+# Flash page size by signature, for bootloaders without the extension
+PAGE_SIZES = {
+    0x1E9406: 128,   # ATmega168
+    0x1E950F: 128,   # ATmega328P
+    0x1E9514: 128,   # ATmega328
+    0x1E9703: 256,   # ATmega1280
+    0x1E9705: 256,   # ATmega1284P
+    0x1E960A: 256,   # ATmega644P
+}
+
+# Seconds to wait for a reply, on top of the time its bytes take on the line
+REPLY_S = 2.0
+SYNC_TRIES = 50
+
+
+class Stk500:
+    """STK500 commands to optiboot on a serial port"""
+
+    def __init__(self, port, baud):
+        self.fd = open_port(port, baud)
+        self.byte_s = 10.0 / baud
+        self.rx = bytearray()
+        self.turnarounds = 0
+
+    def close(self):
+        os.close(self.fd)
+
+    def _write(self, data):
+        while data:
+            n = os.write(self.fd, data)
+            data = data[n:]
+
+    def _read(self, count, timeout):
+        """count bytes, or what has come within timeout seconds"""
+        deadline = time.monotonic() + timeout
+        while len(self.rx) < count:
+            left = deadline - time.monotonic()
+            if left <= 0:
+                break
+            readable, _, _ = select.select([self.fd], [], [], left)
+            if not readable:
+                break
+            data = os.read(self.fd, 4096)
+            if not data:
+                raise DfuError('serial port closed')
+            self.rx += data
+        data = bytes(self.rx[:count])
+        del self.rx[:count]
+        return data
+
+    def command(self, request, reply_size=0):
+        """Send a command, returns what comes between INSYNC and OK"""
+        self._write(bytes(request) + bytes([CRC_EOP]))
+        self.turnarounds += 1
+        timeout = REPLY_S + (len(request) + reply_size) * self.byte_s
+        reply = self._read(reply_size + 2, timeout)
+        if len(reply) < reply_size + 2:
+            raise DfuError('no reply to command 0x%02x' % request[0])
+        if reply[0] != STK_INSYNC or reply[-1] != STK_OK:
+            raise DfuError('command 0x%02x answered with %s' %
+                           (request[0], reply[:4].hex()))
+        return reply[1:-1]
+
+    def _page_written(self, timeout):
+        if self._read(1, timeout) != bytes([STK_OK]):
+            raise DfuError('no reply to a page of STK_PROG_MULTI')
+
+    def prog_multi(self, word, pages):
+        """STK_PROG_MULTI of pages from word, sending each page and the
+        CRC_EOP once no more than one page is unanswered
+        """
+        self._write(bytes([STK_PROG_MULTI, word & 0xFF, word >> 8, len(pages)]))
+        self.turnarounds += 1
+        timeout = REPLY_S + 2 * len(pages[0]) * self.byte_s
+        for i, page in enumerate(pages):
+            if i >= 2:
+                self._page_written(timeout)
+            self._write(page)
+        if len(pages) >= 2:
+            self._page_written(timeout)
+        self._write(bytes([CRC_EOP]))
+        self._page_written(timeout)
+        if self._read(2, timeout) != bytes([STK_INSYNC, STK_OK]):
+            raise DfuError('STK_PROG_MULTI not answered')
+
+    def sync(self):
+        """Get in sync with the bootloader, waiting in main()"""
+        for _ in range(SYNC_TRIES):
+            self._write(bytes([STK_GET_SYNC, CRC_EOP]))
+            if self._read(1, 0.1) == bytes([STK_INSYNC]):
+                break
+        else:
+            raise DfuError('no answer from the bootloader')
+        # main() answers the first sync without an OK, and further tries
+        # may still be under way
+        time.sleep(0.1)
+        self.rx.clear()
+        termios.tcflush(self.fd, termios.TCIFLUSH)
+        self.command([STK_GET_SYNC])
+
+    def parameter(self, which):
+        return self.command([STK_GET_PARAMETER, which], 1)[0]
+
+
+def upload(stk, image, mode, pages, verify, page_size=None):
+    """Write image from address 0, and read it back if verify. Returns the
+    seconds spent writing and verifying, and whether the extension was used.
+    """
+    stk.sync()
+    version = (stk.parameter(Parm_STK_SW_MAJOR), stk.parameter(Parm_STK_SW_MINOR))
+    signature = int.from_bytes(stk.command([STK_READ_SIGN], 3), 'big')
+
+    multi_page = stk.parameter(Parm_STK_MULTI_PAGE) * 2
+    if multi_page == 6:
+        # The generic reply to a parameter the bootloader does not know
+        multi_page = 0
+    if mode == 'multi' and not multi_page:
+        raise DfuError('optiboot %d.%d does not support multi-page commands' %
+                       version)
+    multi = mode == 'multi' or (mode == 'auto' and multi_page != 0)
+    page_size = page_size or multi_page or PAGE_SIZES.get(signature)
+    if not page_size:
+        raise DfuError('page size of signature %06x not known, use --page-size' %
+                       signature)
+    if multi_page and page_size != multi_page:
+        raise DfuError('bootloader pages are %d bytes' % multi_page)
+
+    image = image + b'\xff' * (-len(image) % page_size)
+    stk.command([STK_ENTER_PROGMODE])
+    start = time.monotonic()
+
+    if multi:
+        step = pages * page_size
+        for offset in range(0, len(image), step):
+            chunk = image[offset:offset + step]
+            stk.prog_multi(offset // 2,
+                           [chunk[i:i + page_size]
+                            for i in range(0, len(chunk), page_size)])
+        if verify:
+            for offset in range(0, len(image), step):
+                count = min(step, len(image) - offset)
+                word = offset // 2
+                data = stk.command([STK_READ_MULTI, word & 0xFF, word >> 8,
+                                    count // page_size], count)
+                if data != image[offset:offset + count]:
+                    raise DfuError('verify failed in 0x%04x..0x%04x' %
+                                   (offset, offset + count - 1))
+    else:
+        for offset in range(0, len(image), page_size):
+            word = offset // 2
+            stk.command([STK_LOAD_ADDRESS, word & 0xFF, word >> 8])
+            stk.command(bytes([STK_PROG_PAGE, page_size >> 8, page_size & 0xFF,
+                               ord('F')]) + image[offset:offset + page_size])
+        if verify:
+            for offset in range(0, len(image), page_size):
+                word = offset // 2
+                stk.command([STK_LOAD_ADDRESS, word & 0xFF, word >> 8])
+                data = stk.command([STK_READ_PAGE, page_size >> 8,
+                                    page_size & 0xFF, ord('F')], page_size)
+                if data != image[offset:offset + page_size]:
+                    raise DfuError('verify failed in 0x%04x..0x%04x' %
+                                   (offset, offset + page_size - 1))
+
+    seconds = time.monotonic() - start
+    stk.command([STK_LEAVE_PROGMODE])
+    return seconds, multi
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('hex', help='application image, Intel HEX')
+    parser.add_argument('--port', required=True, help='serial port')
+    parser.add_argument('--baud', type=int, default=115200,
+                        help='baud rate the bootloader was built for (%(default)s)')
+    parser.add_argument('--mode', choices=('auto', 'classic', 'multi'),
+                        default='auto',
+                        help='multi-page commands or one page per command '
+                             '(%(default)s)')
+    parser.add_argument('--pages', type=int, default=16,
+                        help='pages per multi-page command (%(default)s)')
+    parser.add_argument('--page-size', type=int,
+                        help='flash page size in bytes, if the bootloader '
+                             'does not tell')
+    parser.add_argument('--no-verify', action='store_true',
+                        help='do not read the image back')
+    args = parser.parse_args()
+
+    if not 1 <= args.pages <= 255:
+        parser.error('--pages must be 1 to 255')
+
+    try:
+        image = read_hex(args.hex)
+        stk = Stk500(args.port, args.baud)
+        try:
+            seconds, multi = upload(stk, image, args.mode, args.pages,
+                                    not args.no_verify, args.page_size)
+        finally:
+            stk.close()
+    except (DfuError, OSError, termios.error) as e:
+        print('stk500_upload: %s' % (e,), file=sys.stderr)
+        return 1
+
+    print('stk500_upload: %d bytes %s in %.3f s, %.0f bytes/s, %s, '
+          '%d turnarounds' %
+          (len(image), 'written' if args.no_verify else 'written and verified',
+           seconds, len(image) / seconds if seconds else 0,
+           'multi-page' if multi else 'classic', stk.turnarounds))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
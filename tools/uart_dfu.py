@@ -0,0 +1,448 @@
+#!/usr/bin/env python3
+# Copyright (c) 2014, Nordic Semiconductor ASA
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Update the application over the framed UART DFU from Linux.
+
+Runs the same sequence as tools/ble_dfu.py, Start DFU with the image size,
+Initialize DFU parameters, Receive firmware image, Validate, Activate &
+Reset, in the frames of uart_dfu.h. The image goes out in packets of up to
+128 bytes, streamed without waiting for each to be handled: the bootloader
+acknowledges frames as it takes them, and up to --window bytes, at most
+the size of its receive ring, are kept in flight. Lost frames are sent
+again from the first one the bootloader asks for.
+
+The bootloader must be built with the baud rate used here, eg. "make
+atmega328 BAUD_RATE=500000", and be waiting in the bootloader:
+
+    tools/uart_dfu.py --port /dev/ttyUSB0 --baud 500000 app.hex
+
+tests/host/uart_sim.c runs the bootloader's UART DFU on a pseudo terminal
+for trying this without hardware. --history prints what the bootloader
+records of past updates, and --memory its RAM use, --bootloader replaces
+the bootloader and --mcu has the image checked against the part, as
+tools/ble_dfu.py does.
+
+--spi-bench measures the SPI link between the bootloader and the nRF8001
+at each SPI clock the nRF8001 takes, with ACI echoes of --bench-len bytes,
+see BLE/aci_bench.h. It takes the nRF8001 off the air, so it is only
+offered here and not over BLE.
+"""
+
+import argparse
+import collections
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+from ble_dfu import (  # noqa: E402
+    BLE_DFU_RESP_VAL_SUCCESS, DFU_IMAGE_APPLICATION, DFU_IMAGE_BOOTLOADER,
+    HISTORY_RESPONSE_SIZE, MEMORY_RESPONSE_SIZE,
+    OP_CODE_ACTIVATE_N_RESET, OP_CODE_HISTORY_REQ, OP_CODE_MEMORY_REQ,
+    OP_CODE_PKT_RCPT_NOTIF, OP_CODE_PKT_RCPT_NOTIF_REQ, OP_CODE_RECEIVE_FW,
+    OP_CODE_RECEIVE_INIT, OP_CODE_RESPONSE, OP_CODE_START_DFU,
+    OP_CODE_VALIDATE, SIGNATURES, DfuError, crc16_compute, format_history,
+    format_memory, init_packet, open_image, packets, parse_history,
+    parse_memory, start_packet)
+
+# uart_dfu.h
+UART_DFU_SYNC = 0xD5
+UART_DFU_PAYLOAD_MAX = 128
+HELLO, CONTROL, PACKET = b'H', b'C', b'P'
+NOTIFY, ACK, REJECT, DONE = b'N', b'A', b'R', b'D'
+
+# BLE/dfu.h, the SPI benchmark of uart_dfu.h and its result per SPI clock,
+# see BLE/aci_bench.h
+OP_CODE_SPI_BENCH_REQ = 34
+SPI_BENCH_LEN = 29
+SPI_BENCH_COUNT = 16
+SPI_BENCH_HEADER = '<HBB'
+SPI_BENCH_RESULT = '<BBH'
+SpiBench = collections.namedtuple('SpiBench', 'f_cpu length count results')
+SpiClock = collections.namedtuple('SpiClock', 'divider echoes ticks')
+
+# Sync bytes ahead of a hello, main() polls the UART between other work
+HELLO_SYNC_RUN = 8
+
+# Seconds without an acknowledgement before the frames in flight are sent
+# again, and how often in a row before giving up
+RETRY_S = 0.2
+RETRIES = 25
+
+
+def parse_spi_bench(data):
+    """SpiBench out of the response to OP_CODE_SPI_BENCH_REQ"""
+    f_cpu_khz, length, count = struct.unpack_from(SPI_BENCH_HEADER, data, 3)
+    offset = 3 + struct.calcsize(SPI_BENCH_HEADER)
+    results = [SpiClock(*r) for r in
+               struct.iter_unpack(SPI_BENCH_RESULT, data[offset:])]
+    return SpiBench(f_cpu_khz * 1000, length, count, results)
+
+
+def format_spi_bench(bench):
+    """A line per SPI clock: round trip of an echo, and the echoed bytes per
+    second, both ways counted
+    """
+    lines = []
+    for clock in bench.results:
+        seconds = clock.ticks * 1024.0 / bench.f_cpu
+        lines.append('SCK %5.0f kHz: %d/%d echoes of %d bytes, %.0f us per '
+                     'round trip, %.0f bytes/s' %
+                     (bench.f_cpu / clock.divider / 1000.0, clock.echoes,
+                      bench.count, bench.length,
+                      seconds * 1e6 / clock.echoes if clock.echoes else 0,
+                      2 * bench.length * clock.echoes / seconds if seconds else 0))
+    return '\n'.join(lines)
+
+
+def frame(kind, seq, payload=b''):
+    """A frame of uart_dfu.h, without its sync byte"""
+    body = kind + bytes([seq, len(payload)]) + payload
+    return body + struct.pack('<H', crc16_compute(body))
+
+
+def open_port(port, baud):
+    """Open a serial port raw at baud, returns the file descriptor"""
+    speed = getattr(termios, 'B%d' % baud, None)
+    if speed is None:
+        raise DfuError('baud rate %d is not supported by termios' % baud)
+    fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attrs = termios.tcgetattr(fd)
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+class UartLink:
+    """Frames to and from the bootloader on a serial port.
+
+    Frames to the bootloader are delivered in order, frames from it are
+    checked and handed over as they come.
+    """
+
+    def __init__(self, port, baud, window):
+        self.fd = open_port(port, baud)
+        self.window = window
+        self.ring_size = 0
+        self.seq = 0
+        self.in_flight = collections.deque()   # (seq, bytes on the line)
+        self.notifications = collections.deque()
+        self.opened = False
+        self.done = False
+        self.retransmitted = 0
+        self.rx = bytearray()
+        self.rx_seq = None
+        self.rx_lost = 0
+
+    def close(self):
+        os.close(self.fd)
+
+    def _write(self, data):
+        while data:
+            n = os.write(self.fd, data)
+            data = data[n:]
+
+    def _in_flight_bytes(self):
+        return sum(len(data) for _, data in self.in_flight)
+
+    def _acknowledged(self, next_seq):
+        count = (next_seq - self.in_flight[0][0]) & 0xFF if self.in_flight else 0
+        if count <= len(self.in_flight):
+            for _ in range(count):
+                self.in_flight.popleft()
+            return count
+        return 0
+
+    def _handle(self, kind, seq, payload):
+        if self.rx_seq is not None and seq != self.rx_seq:
+            self.rx_lost += (seq - self.rx_seq) & 0xFF
+        self.rx_seq = (seq + 1) & 0xFF
+
+        if kind == ACK and len(payload) == 3:
+            next_seq, self.ring_size = struct.unpack('<BH', payload)
+            self._acknowledged(next_seq)
+        elif kind == REJECT and len(payload) == 1:
+            self._acknowledged(payload[0])
+            self._resend()
+        elif kind == NOTIFY:
+            self.notifications.append(payload)
+        elif kind == DONE:
+            self.done = True
+
+    def _parse(self):
+        """Take complete frames out of what has been received"""
+        while True:
+            start = self.rx.find(UART_DFU_SYNC)
+            if start < 0:
+                self.rx.clear()
+                return
+            del self.rx[:start]
+            while len(self.rx) > 1 and self.rx[1] == UART_DFU_SYNC:
+                del self.rx[0]
+            if len(self.rx) < 4 or len(self.rx) < 6 + self.rx[3]:
+                return
+            length = 6 + self.rx[3]
+            body, crc = bytes(self.rx[1:length - 2]), self.rx[length - 2:length]
+            if struct.unpack('<H', crc)[0] != crc16_compute(body):
+                # Not a frame after all, look for the next sync byte
+                del self.rx[0]
+                continue
+            del self.rx[:length]
+            self._handle(body[:1], body[1], body[3:])
+
+    def pump(self, timeout):
+        """Receive for up to timeout seconds, returns True if anything came"""
+        readable, _, _ = select.select([self.fd], [], [], timeout)
+        if not readable:
+            return False
+        data = os.read(self.fd, 4096)
+        if not data:
+            raise DfuError('serial port closed')
+        self.rx += data
+        self._parse()
+        return True
+
+    def _resend(self):
+        self.retransmitted += len(self.in_flight)
+        for _, data in self.in_flight:
+            self._write(data)
+
+    def _wait(self, condition):
+        """Pump until condition() holds, sending everything in flight again
+        whenever the bootloader stays silent
+        """
+        retries = 0
+        while not condition():
+            if self.pump(RETRY_S):
+                retries = 0
+                continue
+            retries += 1
+            if retries == RETRIES:
+                raise DfuError('no answer from the bootloader')
+            self._resend()
+
+    def send(self, kind, payload=b''):
+        """Queue a frame, once the window has room for it"""
+        data = bytes([UART_DFU_SYNC]) + frame(kind, self.seq, payload)
+        if kind == HELLO:
+            data = bytes([UART_DFU_SYNC] * HELLO_SYNC_RUN) + data
+        limit = min(self.window, self.ring_size)
+        self._wait(lambda: not self.in_flight or
+                   self._in_flight_bytes() + len(data) <= limit)
+        self.in_flight.append((self.seq, data))
+        self.seq = (self.seq + 1) & 0xFF
+        self._write(data)
+
+    def open(self):
+        """Say hello until the bootloader answers, once"""
+        if not self.opened:
+            self.send(HELLO)
+            self.flush()
+            self.opened = True
+
+    def flush(self):
+        """Wait until every frame has been acknowledged"""
+        self._wait(lambda: not self.in_flight)
+
+    def wait_done(self):
+        self._wait(lambda: self.done)
+
+
+class UartDfu:
+    """DFU procedure over a UartLink"""
+
+    def __init__(self, link, prn=0, packet_size=UART_DFU_PAYLOAD_MAX,
+                 progress=None):
+        """progress is as for ble_dfu.DfuClient"""
+        self.link = link
+        self.prn = prn
+        self.packet_size = packet_size
+        self.progress = progress
+        self.receipts = 0
+
+    def _response(self, procedure, size=3):
+        """Wait for the response to procedure, check it and return it. A
+        size of None takes a response of any length.
+        """
+        response = []
+
+        def responded():
+            while self.link.notifications:
+                data = self.link.notifications.popleft()
+                if data[0] == OP_CODE_PKT_RCPT_NOTIF:
+                    self.receipts += 1
+                elif (len(data) == size or (size is None and len(data) >= 3)) and \
+                        data[0] == OP_CODE_RESPONSE and data[1] == procedure:
+                    if data[2] != BLE_DFU_RESP_VAL_SUCCESS:
+                        raise DfuError('procedure %d failed with %d' % (procedure, data[2]))
+                    response.append(data)
+                    return True
+            return False
+        self.link._wait(responded)
+        return response[0]
+
+    def history(self):
+        """The bootloader's record of past updates, a ble_dfu.History"""
+        self.link.open()
+        self.link.send(CONTROL, bytes([OP_CODE_HISTORY_REQ]))
+        return parse_history(self._response(OP_CODE_HISTORY_REQ,
+                                            HISTORY_RESPONSE_SIZE))
+
+    def memory(self):
+        """The bootloader's RAM use since reset, a ble_dfu.Memory"""
+        self.link.open()
+        self.link.send(CONTROL, bytes([OP_CODE_MEMORY_REQ]))
+        return parse_memory(self._response(OP_CODE_MEMORY_REQ,
+                                           MEMORY_RESPONSE_SIZE))
+
+    def spi_bench(self, length=SPI_BENCH_LEN, count=SPI_BENCH_COUNT):
+        """Echoes on the bootloader's SPI link to the nRF8001, a SpiBench.
+        Fails if the bootloader has no nRF8001.
+        """
+        self.link.open()
+        self.link.send(CONTROL, bytes([OP_CODE_SPI_BENCH_REQ, length, count]))
+        return parse_spi_bench(self._response(OP_CODE_SPI_BENCH_REQ, None))
+
+    def run(self, image, image_type=DFU_IMAGE_APPLICATION, mcu=None,
+            init=None):
+        """Transfer, validate and activate image, of a DFU_IMAGE_* type,
+        for the part mcu if given, or with the init packet init. Returns the
+        seconds spent on the image data, from Receive firmware image to its
+        response.
+        """
+        link = self.link
+        link.open()
+
+        link.send(CONTROL, bytes([OP_CODE_START_DFU, image_type]))
+        link.send(PACKET, start_packet(image, image_type))
+        self._response(OP_CODE_START_DFU)
+
+        link.send(CONTROL, bytes([OP_CODE_RECEIVE_INIT]))
+        link.send(PACKET, init or init_packet(image, mcu))
+        self._response(OP_CODE_RECEIVE_INIT)
+
+        link.send(CONTROL, struct.pack('<BH', OP_CODE_PKT_RCPT_NOTIF_REQ, self.prn))
+        link.send(CONTROL, bytes([OP_CODE_RECEIVE_FW]))
+        start = time.monotonic()
+        sent = 0
+        for packet in packets(image, self.packet_size):
+            link.send(PACKET, packet)
+            sent += len(packet)
+            if self.progress:
+                self.progress(sent, len(image))
+        self._response(OP_CODE_RECEIVE_FW)
+        seconds = time.monotonic() - start
+
+        link.send(CONTROL, bytes([OP_CODE_VALIDATE]))
+        self._response(OP_CODE_VALIDATE)
+
+        link.send(CONTROL, bytes([OP_CODE_ACTIVATE_N_RESET]))
+        link.wait_done()
+        return seconds
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('hex', nargs='?',
+                        help='application image, Intel HEX or packet file')
+    parser.add_argument('--bootloader', action='store_true',
+                        help='the image is a bootloader, to replace this one')
+    parser.add_argument('--mcu', choices=sorted(SIGNATURES),
+                        help='part the image is for, checked by the bootloader')
+    parser.add_argument('--port', required=True, help='serial port')
+    parser.add_argument('--baud', type=int, default=500000,
+                        help='baud rate the bootloader was built for (%(default)s)')
+    parser.add_argument('--prn', type=int, default=0,
+                        help='packets per receipt notification, 0 for none (%(default)s)')
+    parser.add_argument('--window', type=int, default=4096,
+                        help='bytes in flight, capped at the bootloader\'s '
+                             'receive ring (%(default)s)')
+    parser.add_argument('--packet-size', type=int, default=UART_DFU_PAYLOAD_MAX,
+                        help='image bytes per packet (%(default)s)')
+    parser.add_argument('--history', action='store_true',
+                        help='print the history of updates first')
+    parser.add_argument('--memory', action='store_true',
+                        help='print the RAM use first')
+    parser.add_argument('--spi-bench', action='store_true',
+                        help='benchmark the SPI link to the nRF8001 first')
+    parser.add_argument('--bench-len', type=int, default=SPI_BENCH_LEN,
+                        help='bytes per echo of --spi-bench (%(default)s)')
+    parser.add_argument('--bench-count', type=int, default=SPI_BENCH_COUNT,
+                        help='echoes per SPI clock of --spi-bench (%(default)s)')
+    args = parser.parse_args()
+
+    if not 0 <= args.prn <= 0xFFFF:
+        parser.error('--prn must fit in 16 bits')
+    if not 1 <= args.packet_size <= UART_DFU_PAYLOAD_MAX:
+        parser.error('--packet-size must be 1 to %d' % UART_DFU_PAYLOAD_MAX)
+    if not 0 <= args.bench_len <= SPI_BENCH_LEN:
+        parser.error('--bench-len must be 0 to %d' % SPI_BENCH_LEN)
+    if not 1 <= args.bench_count <= 0xFF:
+        parser.error('--bench-count must be 1 to 255')
+    if not args.hex and not args.history and not args.memory and \
+            not args.spi_bench:
+        parser.error('an image, --history, --memory or --spi-bench is needed')
+
+    image_type = DFU_IMAGE_BOOTLOADER if args.bootloader else DFU_IMAGE_APPLICATION
+    image = None
+    try:
+        if args.hex:
+            image = open_image(args.hex, image_type, args.mcu)
+        link = UartLink(args.port, args.baud, args.window)
+        try:
+            dfu = UartDfu(link, args.prn, args.packet_size)
+            if args.history:
+                print('uart_dfu: history: %s' % format_history(dfu.history()))
+            if args.memory:
+                print('uart_dfu: memory: %s' % format_memory(dfu.memory()))
+            if args.spi_bench:
+                bench = dfu.spi_bench(args.bench_len, args.bench_count)
+                for line in format_spi_bench(bench).splitlines():
+                    print('uart_dfu: spi: %s' % line)
+            if image is None:
+                return 0
+            size = len(image.image)
+            seconds = dfu.run(image.image, image.image_type, init=image.init)
+        finally:
+            link.close()
+    except (DfuError, OSError, termios.error) as e:
+        print('uart_dfu: %s' % (e,), file=sys.stderr)
+        return 1
+    finally:
+        if image is not None:
+            image.close()
+
+    print('uart_dfu: %d bytes in %.3f s, %.0f bytes/s, %d receipts, '
+          '%d frames sent again' %
+          (size, seconds, size / seconds if seconds else 0,
+           dfu.receipts, link.retransmitted))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,343 @@
+#include "uart_dfu.h"
+
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+
+#include "sched.h"
+#include "uart_defs.h"
+#include "watchdog.h"
+#include "BLE/ble.h"
+#include "BLE/crc16.h"
+#include "BLE/dfu.h"
+
+#if (UART_DFU_RING_SIZE & (UART_DFU_RING_SIZE - 1))
+#error UART_DFU_RING_SIZE must be a power of two
+#endif
+
+/* Receiver states, one per field of a frame */
+#define M_RX_SYNC     0
+#define M_RX_TYPE     1
+#define M_RX_SEQ      2
+#define M_RX_LEN      3
+#define M_RX_PAYLOAD  4
+#define M_RX_CRC_LO   5
+#define M_RX_CRC_HI   6
+
+static void m_poll (void);
+static bool m_send (const uint8_t *p_data, uint8_t len);
+static void m_close (void);
+static void m_reset (void);
+static bool m_frame_ready (void);
+static void m_frame_task (void);
+
+static const dfu_transport_t m_transport = {m_send, m_close, m_reset, m_poll};
+
+/* Frames first, then the flash work of the DFU */
+static const sched_task_t m_tasks[] = {
+  {m_frame_ready, m_frame_task},
+  {dfu_background_ready, dfu_background},
+  {NULL, dfu_housekeeping},
+};
+
+static uint8_t  m_ring[UART_DFU_RING_SIZE];
+static uint16_t m_ring_head;
+static uint16_t m_ring_tail;
+
+static uint8_t  m_rx_state;
+static uint8_t  m_rx_count;
+static uint16_t m_rx_crc;
+static uint8_t  m_rx_seq;
+static uint8_t  m_rejected;
+
+static uint8_t  m_frame_type;
+static uint8_t  m_frame_seq;
+static uint8_t  m_frame_len;
+static uint8_t  m_frame[UART_DFU_PAYLOAD_MAX];
+
+static uint8_t  m_tx_seq;
+
+/* The hello main() is matching: type, seq, len and CRC, and the count of
+ * them taken, plus one for the sync byte
+ */
+static uint8_t  m_hello[5];
+static uint8_t  m_hello_count;
+
+/* Move received bytes from the UART into the ring. A byte that does not
+ * fit is dropped, its frame then fails the CRC.
+ */
+static void m_poll (void)
+{
+  while (UART_SRA & _BV(RXC0))
+  {
+    const uint8_t ch = UART_UDR;
+
+    if ((uint16_t) (m_ring_head - m_ring_tail) < UART_DFU_RING_SIZE)
+    {
+      m_ring[m_ring_head++ & (UART_DFU_RING_SIZE - 1)] = ch;
+    }
+  }
+}
+
+static void m_putch (uint8_t ch)
+{
+  while (!(UART_SRA & _BV(UDRE0)))
+  {
+    m_poll ();
+  }
+  UART_UDR = ch;
+}
+
+static void m_frame_send (uint8_t type, const uint8_t *p_data, uint8_t len)
+{
+  const uint8_t header[4] = {UART_DFU_SYNC, type, m_tx_seq++, len};
+  uint16_t crc;
+  uint8_t i;
+
+  crc = crc16_compute (&header[1], 3, NULL);
+  crc = crc16_compute (p_data, len, &crc);
+
+  for (i = 0; i < 4; i++)
+  {
+    m_putch (header[i]);
+  }
+  for (i = 0; i < len; i++)
+  {
+    m_putch (p_data[i]);
+  }
+  m_putch ((uint8_t) crc);
+  m_putch ((uint8_t) (crc >> 8));
+}
+
+/* Ask for everything from the expected frame on, once per loss */
+static void m_reject (void)
+{
+  if (!m_rejected)
+  {
+    m_rejected = 1;
+    m_frame_send (UART_DFU_REJECT, &m_rx_seq, 1);
+  }
+}
+
+static void m_ack (void)
+{
+  const uint8_t ack[3] = {m_rx_seq,
+    (uint8_t) UART_DFU_RING_SIZE, (uint8_t) (UART_DFU_RING_SIZE >> 8)};
+
+  m_frame_send (UART_DFU_ACK, ack, 3);
+}
+
+/* Take bytes from the ring until a frame with a good CRC is complete */
+static bool m_frame_get (void)
+{
+  uint8_t ch;
+
+  m_poll ();
+
+  while (m_ring_tail != m_ring_head)
+  {
+    ch = m_ring[m_ring_tail++ & (UART_DFU_RING_SIZE - 1)];
+    m_poll ();
+
+    /* A run of sync bytes ahead of a frame is allowed, it gives main() a
+     * better chance to catch one
+     */
+    if (ch == UART_DFU_SYNC && m_rx_state <= M_RX_TYPE)
+    {
+      m_rx_crc = 0xFFFF;
+      m_rx_state = M_RX_TYPE;
+      continue;
+    }
+    if (m_rx_state == M_RX_SYNC)
+    {
+      continue;
+    }
+
+    if (m_rx_state < M_RX_CRC_LO)
+    {
+      m_rx_crc = crc16_compute (&ch, 1, &m_rx_crc);
+    }
+
+    switch (m_rx_state)
+    {
+      case M_RX_TYPE:
+        m_frame_type = ch;
+        m_rx_state = M_RX_SEQ;
+        break;
+      case M_RX_SEQ:
+        m_frame_seq = ch;
+        m_rx_state = M_RX_LEN;
+        break;
+      case M_RX_LEN:
+        m_frame_len = ch;
+        m_rx_count = 0;
+        m_rx_state = ch ? M_RX_PAYLOAD : M_RX_CRC_LO;
+        if (ch > UART_DFU_PAYLOAD_MAX)
+        {
+          m_rx_state = M_RX_SYNC;
+          m_reject ();
+        }
+        break;
+      case M_RX_PAYLOAD:
+        m_frame[m_rx_count++] = ch;
+        if (m_rx_count == m_frame_len)
+        {
+          m_rx_state = M_RX_CRC_LO;
+        }
+        break;
+      case M_RX_CRC_LO:
+        m_rx_crc ^= ch;
+        m_rx_state = M_RX_CRC_HI;
+        break;
+      case M_RX_CRC_HI:
+        m_rx_state = M_RX_SYNC;
+        if (m_rx_crc == ((uint16_t) ch << 8))
+        {
+          return true;
+        }
+        m_reject ();
+        break;
+    }
+  }
+
+  return false;
+}
+
+/* Run the SPI benchmark of BLE/aci_bench.h for {OP_CODE_SPI_BENCH_REQ, len,
+ * count}, and report F_CPU in kHz, len, count and the results after the
+ * response. Without ACI_BENCH, the request is not supported.
+ */
+static void m_spi_bench (void)
+{
+#ifdef ACI_BENCH
+  uint8_t report[7 + ACI_BENCH_CLOCKS * sizeof (aci_bench_result_t)] = {
+    OP_CODE_RESPONSE, BLE_DFU_SPI_BENCH_PROCEDURE, BLE_DFU_RESP_VAL_SUCCESS,
+    (uint8_t) (F_CPU / 1000), (uint8_t) (F_CPU / 1000 >> 8),
+    UART_DFU_BENCH_LEN, UART_DFU_BENCH_COUNT};
+  uint8_t results;
+
+  if (m_frame_len > 1 && m_frame[1] <= ACI_ECHO_DATA_MAX_LEN)
+  {
+    report[5] = m_frame[1];
+  }
+  if (m_frame_len > 2)
+  {
+    report[6] = m_frame[2];
+  }
+
+  results = ble_spi_bench (report[5], report[6],
+      (aci_bench_result_t *) &report[7], m_poll);
+  if (!results)
+  {
+    report[2] = BLE_DFU_RESP_VAL_OPER_FAILED;
+    m_send (report, 3);
+    return;
+  }
+
+  m_send (report, 7 + results * sizeof (aci_bench_result_t));
+#else
+  static const uint8_t not_supported[3] = {OP_CODE_RESPONSE,
+    BLE_DFU_SPI_BENCH_PROCEDURE, BLE_DFU_RESP_VAL_NOT_SUPPORTED};
+
+  m_send (not_supported, 3);
+#endif
+}
+
+/* Hand an in-order frame to the DFU state machine, and acknowledge it */
+static void m_frame_handle (void)
+{
+  if (m_frame_seq != m_rx_seq)
+  {
+    m_reject ();
+    return;
+  }
+
+  m_rx_seq++;
+  m_rejected = 0;
+  wdt_reset ();
+
+  if (m_frame_type == UART_DFU_PACKET)
+  {
+    dfu_update (DFU_CHANNEL_PACKET, m_frame, m_frame_len);
+  }
+  else if (m_frame_type == UART_DFU_CONTROL && m_frame_len &&
+      m_frame[0] == OP_CODE_SPI_BENCH_REQ)
+  {
+    m_spi_bench ();
+  }
+  else if (m_frame_type == UART_DFU_CONTROL && m_frame_len)
+  {
+    dfu_update (DFU_CHANNEL_CONTROL, m_frame, m_frame_len);
+  }
+
+  m_ack ();
+}
+
+static bool m_frame_ready (void)
+{
+  return (UART_SRA & _BV(RXC0)) || m_ring_tail != m_ring_head;
+}
+
+static void m_frame_task (void)
+{
+  if (m_frame_get ())
+  {
+    m_frame_handle ();
+  }
+}
+
+static bool m_send (const uint8_t *p_data, uint8_t len)
+{
+  m_frame_send (UART_DFU_NOTIFY, p_data, len);
+
+  return true;
+}
+
+/* Tell the host, and let the last bit leave the UART before the reset */
+static void m_close (void)
+{
+  m_frame_send (UART_DFU_DONE, NULL, 0);
+
+  UART_SRA = _BV(U2X0) | _BV(TXC0);
+  while (!(UART_SRA & _BV(TXC0)));
+}
+
+/* Nothing to bring up again on a serial line */
+static void m_reset (void)
+{
+}
+
+bool uart_dfu_hello (uint8_t ch)
+{
+  if (ch == UART_DFU_SYNC && m_hello_count <= 1)
+  {
+    m_hello_count = 1;
+    return false;
+  }
+  if (m_hello_count == 0)
+  {
+    return false;
+  }
+
+  m_hello[m_hello_count++ - 1] = ch;
+  if (m_hello_count <= sizeof (m_hello))
+  {
+    return false;
+  }
+
+  m_hello_count = 0;
+  return m_hello[0] == UART_DFU_HELLO && m_hello[2] == 0 &&
+    crc16_compute (m_hello, 3, NULL) == (m_hello[3] | (m_hello[4] << 8));
+}
+
+void uart_dfu_run (void)
+{
+  dfu_init (&m_transport);
+  watchdog_phase_set (WATCHDOG_PHASE_DFU);
+
+  /* main() has taken the hello, it is acknowledged here */
+  m_rx_seq = m_hello[1] + 1;
+  m_ack ();
+
+  sched_run (m_tasks, sizeof (m_tasks) / sizeof (m_tasks[0]));
+}
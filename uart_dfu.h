@@ -0,0 +1,96 @@
+/* DFU over the serial line.
+ *
+ * Runs the DFU state machine of BLE/dfu.c, with the same procedure and
+ * packet receipt notifications as over BLE, on the hardware UART. Packets
+ * travel in frames:
+ *
+ *   0xD5 type seq len payload[len] crc16
+ *
+ * crc16 is the CRC-16-CCITT of BLE/crc16.c over type, seq, len and the
+ * payload, little-endian. Any number of sync bytes may lead a frame, and
+ * none of the types is one.
+ *
+ *   host -> bootloader
+ *     'H'                    open the link, no payload
+ *     'C' data               write to the DFU Control Point
+ *     'P' data               write to the DFU Packet, up to
+ *                            UART_DFU_PAYLOAD_MAX bytes
+ *
+ *   bootloader -> host
+ *     'N' data               notification on the DFU Control Point
+ *     'A' next ring_size     frames up to next have been handled; the size
+ *                            of the receive ring in bytes (u16 LE)
+ *     'R' next               a frame was lost, send again from next
+ *     'D'                    resetting into the new application
+ *
+ * The host numbers its frames from 0 in seq, and the bootloader takes them
+ * strictly in order. A frame with a bad CRC or out of order is dropped and
+ * answered with a single 'R' until the expected frame arrives. The
+ * bootloader numbers its own frames separately.
+ *
+ * Bytes are moved from the UART into a ring of UART_DFU_RING_SIZE bytes
+ * whenever the bootloader waits, including on the SPM unit, so the host
+ * may stream frames while a page is written. It must keep the frames it
+ * has not seen acknowledged within ring_size bytes, headers and CRC
+ * included.
+ *
+ * A control write of {OP_CODE_SPI_BENCH_REQ, len, count} is not passed to
+ * the DFU: it runs the SPI benchmark of BLE/aci_bench.h with count echoes
+ * of len bytes, UART_DFU_BENCH_COUNT of UART_DFU_BENCH_LEN if left out. It
+ * is answered with a response carrying F_CPU in kHz (u16 LE), len, count
+ * and an aci_bench_result_t per SPI clock, or with OPER_FAILED if there is
+ * no nRF8001. The BLE link is down from then on. Built without ACI_BENCH,
+ * the request is answered with NOT_SUPPORTED.
+ *
+ * The line rate is BAUD_RATE, the same as for STK500. Built with
+ * UART_DFU=1 only, and for the hardware UART: there is no framed DFU with
+ * SOFT_UART.
+ */
+
+#ifndef UART_DFU_H_
+#define UART_DFU_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined (UART_DFU) && defined (SOFT_UART)
+#error UART_DFU needs the hardware UART
+#endif
+
+#define UART_DFU_SYNC         0xD5
+#define UART_DFU_PAYLOAD_MAX  128
+
+#define UART_DFU_HELLO        'H'
+#define UART_DFU_CONTROL      'C'
+#define UART_DFU_PACKET       'P'
+#define UART_DFU_NOTIFY       'N'
+#define UART_DFU_ACK          'A'
+#define UART_DFU_REJECT       'R'
+#define UART_DFU_DONE         'D'
+
+/* SPI benchmark defaults */
+#define UART_DFU_BENCH_LEN    29
+#define UART_DFU_BENCH_COUNT  16
+
+/* Receive ring, a power of two */
+#ifndef UART_DFU_RING_SIZE
+#if RAMEND > 0x4FF
+#define UART_DFU_RING_SIZE    512
+#else
+#define UART_DFU_RING_SIZE    256
+#endif
+#endif
+
+/* Take a byte main() received outside of STK500, and return true once the
+ * bytes taken so far end in a hello frame with a good CRC. Anything else,
+ * noise included, returns false.
+ */
+bool uart_dfu_hello (uint8_t ch);
+
+/* Run a DFU on the UART, once uart_dfu_hello() has returned true. Does not
+ * return: the bootloader resets when the DFU ends, or the watchdog expires
+ * when the host goes quiet.
+ */
+void uart_dfu_run (void);
+
+#endif /* UART_DFU_H_ */
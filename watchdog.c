@@ -0,0 +1,78 @@
+#include "watchdog.h"
+
+#include <avr/eeprom.h>
+#include <avr/io.h>
+#include <avr/wdt.h>
+
+/* Parts without WDP3 stop at 2 s */
+#ifdef WDP3
+#define M_TIMEOUT_4S  (_BV(WDP3) | _BV(WDE))
+#define M_TIMEOUT_8S  (_BV(WDP3) | _BV(WDP0) | _BV(WDE))
+#else
+#define M_TIMEOUT_4S  (_BV(WDP2) | _BV(WDP1) | _BV(WDP0) | _BV(WDE))
+#define M_TIMEOUT_8S  M_TIMEOUT_4S
+#endif
+
+/* WDTCSR by phase */
+static const uint8_t m_timeouts[] = {
+  M_TIMEOUT_4S,                                   /* WATCHDOG_PHASE_IDLE */
+  _BV(WDP2) | _BV(WDP1) | _BV(WDE),               /* WATCHDOG_PHASE_BOND */
+  M_TIMEOUT_8S,                                   /* WATCHDOG_PHASE_DFU */
+  _BV(WDP2) | _BV(WDP1) | _BV(WDP0) | _BV(WDE),   /* WATCHDOG_PHASE_ACTIVATE */
+  _BV(WDE),                                       /* WATCHDOG_PHASE_RESET */
+};
+
+/* The current phase, with its complement in the high byte, so that what
+ * the application leaves in RAM is not taken for a phase
+ */
+static uint16_t m_phase __attribute__ ((section (".noinit")));
+
+void watchdog_log_reset (void)
+{
+#ifdef WATCHDOG_LOG
+  const uint8_t cause = MCUSR;
+  uint8_t phase = WATCHDOG_PHASE_UNKNOWN;
+  watchdog_log_t log;
+#endif
+
+  MCUSR = 0;
+
+#ifdef WATCHDOG_LOG
+  if ((uint8_t) (m_phase >> 8) == (uint8_t) ~m_phase)
+  {
+    phase = (uint8_t) m_phase;
+  }
+
+  if (!((cause & _BV(BORF) && !(cause & _BV(PORF))) ||
+        (cause & _BV(WDRF) &&
+         (phase == WATCHDOG_PHASE_BOND || phase == WATCHDOG_PHASE_DFU))))
+  {
+    return;
+  }
+
+  eeprom_read_block (&log, (const void *) WATCHDOG_LOG_ADDR, sizeof (log));
+
+  if (log.count == 0xFF)
+  {
+    log.count = 1;
+  }
+  else if (log.count < 0xFE)
+  {
+    log.count++;
+  }
+  log.cause = cause;
+  log.phase = phase;
+
+  eeprom_update_block (&log, (void *) WATCHDOG_LOG_ADDR, sizeof (log));
+#endif
+}
+
+void watchdog_phase_set (uint8_t phase)
+{
+  m_phase = phase | ((uint16_t) (uint8_t) ~phase << 8);
+
+  /* Restart the count before a shorter timeout applies */
+  wdt_reset ();
+  WDTCSR = _BV(WDCE) | _BV(WDE);
+  WDTCSR = m_timeouts[phase];
+}
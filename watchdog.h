@@ -0,0 +1,47 @@
+/* Watchdog timeouts by phase of the bootloader, and a log of the resets
+ * that should not have happened.
+ *
+ * Every phase gets a timeout that fits the longest quiet spell it has
+ * legitimately, and the phase is kept in .noinit RAM. A watchdog reset
+ * while waiting for a link, or one the bootloader asks for, is how the
+ * bootloader is meant to end. One while restoring
+ * bond data or in the middle of a DFU costs the transfer, so it is logged
+ * in EEPROM, as is a brown-out reset. The log is kept with WATCHDOG_LOG
+ * only.
+ */
+
+#ifndef WATCHDOG_H_
+#define WATCHDOG_H_
+
+#include <stdint.h>
+
+#include "jump.h"
+
+#define WATCHDOG_PHASE_IDLE      0  /* waiting for a link, 4 s */
+#define WATCHDOG_PHASE_BOND      1  /* bond data restore, 1 s per message */
+#define WATCHDOG_PHASE_DFU       2  /* DFU on BLE or UART, 8 s */
+#define WATCHDOG_PHASE_ACTIVATE  3  /* closing the link after a DFU, 2 s */
+#define WATCHDOG_PHASE_RESET     4  /* resetting on purpose, 16 ms */
+#define WATCHDOG_PHASE_UNKNOWN   0xFF
+
+/* The reset log, in the bootloader EEPROM area right after
+ * bootloader_config_t. Erased EEPROM reads as no resets logged.
+ */
+#define WATCHDOG_LOG_ADDR  (E2END - BOOTLOADER_EEPROM_SIZE + 24)
+
+typedef struct
+{
+  uint8_t count;  /* resets logged, 0xFF for none, stops at 0xFE */
+  uint8_t cause;  /* MCUSR of the last one */
+  uint8_t phase;  /* the phase it hit, or WATCHDOG_PHASE_UNKNOWN */
+} watchdog_log_t;
+
+/* Log the cause of the reset if it is one to log, with WATCHDOG_LOG, and
+ * clear MCUSR. Call once, first thing in main().
+ */
+void watchdog_log_reset (void);
+
+/* Enter phase, with its timeout, and reset the watchdog */
+void watchdog_phase_set (uint8_t phase);
+
+#endif /* WATCHDOG_H_ */